@@ -1,5 +1,5 @@
 /*
-   Asynchronous tri-buffer for parallel loading and processing.
+   Asynchronous ring buffer for parallel loading and processing.
 
    Developed by Zhili Zheng<zhilizheng@outlook.com>
 
@@ -17,6 +17,10 @@
 #include <condition_variable>
 #include <tuple>
 #include <chrono>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <memory>
 #include "mem.hpp"
 
 using std::mutex;
@@ -25,105 +29,128 @@ using std::condition_variable;
 using std::tuple;
 using std::tie;
 
-struct BufferStat{
-    uint8_t write_count[3] = {0, 0, 0};
-    uint8_t read_count[3] = {0, 0, 0};
-    uint8_t nextBufferRead = 0;
-    uint8_t nextBufferWrite = 0;
-    bool eof[3] = {false, false, false};
-    bool accessed[3] = {true, true, true};
-};
-
+// The writers fill the slots and one reader takes them in order (the reader may hand its slot
+// to a team of threads). A single writer uses start_write()/end_write(); several writers number
+// their blocks and use start_write(seq)/end_write(seq), block seq goes to slot seq % numSlots and
+// is read after block seq - 1 whichever writer finishes first. The slot sequences are atomic,
+// the mutex is only taken to sleep when the ring is full or empty.
 template <typename T>
 class AsyncBuffer {
 public:
-    AsyncBuffer(uint64_t bufferSize){
+    AsyncBuffer(uint64_t bufferSize, int numSlots = 3) : numSlots(numSlots < 2 ? 2 : numSlots){
         uint64_t bufferRawSize = bufferSize * sizeof(T);
-        int ret1 = posix_memalign((void **) &(buffer[0]), 64, bufferRawSize);
-        int ret2 = posix_memalign((void **) &(buffer[1]), 64, bufferRawSize);
-        int ret3 = posix_memalign((void **) &(buffer[2]), 64, bufferRawSize);
-        if(ret1 != 0 || ret2 != 0 || ret3 != 0){
-            initStatus = false;
-        }else{
-            initStatus = true;
+        buffer.resize(this->numSlots, NULL);
+        eof.reset(new std::atomic<bool>[this->numSlots]);
+        filled.reset(new std::atomic<uint64_t>[this->numSlots]);
+        initStatus = true;
+        for(int i = 0; i < this->numSlots; i++){
+            eof[i] = false;
+            filled[i] = 0;
+            if(posix_memalign((void **) &(buffer[i]), 64, bufferRawSize) != 0){
+                buffer[i] = NULL;
+                initStatus = false;
+            }
         }
-
     }
 
     ~AsyncBuffer(){
-        posix_mem_free(buffer[0]);
-        posix_mem_free(buffer[1]);
-        posix_mem_free(buffer[2]);
+        for(auto buf : buffer){
+            if(buf) posix_mem_free(buf);
+        }
     }
 
+    AsyncBuffer(const AsyncBuffer&) = delete;
+    AsyncBuffer& operator=(const AsyncBuffer&) = delete;
+
     bool init_status(){
         return initStatus;
     }
 
+    int num_slots(){
+        return numSlots;
+    }
+
     T* start_write(){
-        uint8_t curBufferWrite = m_stat.nextBufferWrite;
-        if(m_stat.accessed[curBufferWrite] &&
-                m_stat.write_count[curBufferWrite] == 0 &&
-                m_stat.read_count[curBufferWrite] == 0 &&
-                (!m_stat.eof[curBufferWrite])){
-            m_stat.write_count[curBufferWrite] += 1;
-            m_stat.accessed[curBufferWrite] = false;
-
-            return buffer[curBufferWrite];
-        }else{
-            std::unique_lock<std::mutex> lock(wmut);
-            wcv.wait_for(lock, std::chrono::milliseconds(20000));
-            lock.unlock();
-
-            return start_write();
+        return start_write(writeSeq.load(std::memory_order_relaxed));
+    }
+
+    T* start_write(uint64_t seq){
+        if(seq - readSeq.load(std::memory_order_acquire) >= (uint64_t)numSlots){
+            wait(writeWaits, writeWaitUs, [this, seq](){
+                    return seq - readSeq.load(std::memory_order_acquire) < (uint64_t)numSlots;});
         }
+        return buffer[seq % numSlots];
     }
 
     /*set current buffer to EOF
      * Please don't call this if the stream to read is not end;
     */
     void setEOF(){
-        m_stat.eof[m_stat.nextBufferWrite] = true;
+        eof[writeSeq.load(std::memory_order_relaxed) % numSlots] = true;
     }
 
     void end_write(){
-        uint8_t curBufferWrite = m_stat.nextBufferWrite;
-        m_stat.write_count[curBufferWrite] -= 1;
-        if(!m_stat.eof[curBufferWrite]){
-            m_stat.nextBufferWrite = (curBufferWrite + 1) % 3;
-        }
-        rcv.notify_one();
+        end_write(writeSeq.fetch_add(1, std::memory_order_relaxed));
+    }
+
+    void end_write(uint64_t seq){
+        filled[seq % numSlots].store(seq + 1, std::memory_order_release);
+        notify();
     }
 
     tuple<T*, bool> start_read(){
-        uint8_t curBufferRead = m_stat.nextBufferRead;
-        if(m_stat.write_count[curBufferRead] == 0 && !m_stat.accessed[curBufferRead]){
-            m_stat.read_count[curBufferRead] += 1;
-            return tuple<T*, bool>{buffer[curBufferRead], m_stat.eof[curBufferRead]};
-        }else{
-            std::unique_lock<std::mutex> lock(rmut);
-            rcv.wait_for(lock, std::chrono::milliseconds(5000));
-            lock.unlock();
-            
-            return start_read();
+        uint64_t curRead = readSeq.load(std::memory_order_relaxed);
+        int slot = curRead % numSlots;
+        if(filled[slot].load(std::memory_order_acquire) != curRead + 1){
+            wait(readWaits, readWaitUs, [this, slot, curRead](){
+                    return filled[slot].load(std::memory_order_acquire) == curRead + 1;});
         }
+        return tuple<T*, bool>{buffer[slot], eof[slot]};
     }
 
+    // the EOF slot is kept to be read again
     void end_read(){
-        uint8_t curBufferRead = m_stat.nextBufferRead;
-        m_stat.read_count[curBufferRead] -= 1;
-        if((m_stat.read_count[curBufferRead] == 0) && (!m_stat.eof[curBufferRead])){
-            m_stat.nextBufferRead = (curBufferRead + 1) % 3;
-            m_stat.accessed[curBufferRead] = true;
+        uint64_t curRead = readSeq.load(std::memory_order_relaxed);
+        if(!eof[curRead % numSlots]){
+            readSeq.fetch_add(1, std::memory_order_release);
+            notify();
         }
-        wcv.notify_one();
     }
 
+    // times and microseconds the writer waited for a free slot (compute bound)
+    // and the reader waited for a filled slot (I/O bound)
+    uint64_t producer_waits(){return writeWaits;}
+    uint64_t producer_wait_us(){return writeWaitUs;}
+    uint64_t consumer_waits(){return readWaits;}
+    uint64_t consumer_wait_us(){return readWaitUs;}
+
 private:
-    mutex rmut, wmut;
-    BufferStat m_stat;
-    condition_variable rcv, wcv;
-    T* buffer[3];
+    template<typename Pred>
+    void wait(std::atomic<uint64_t> &count, std::atomic<uint64_t> &time_us, Pred ready){
+        auto start = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mut);
+        cv.wait(lock, ready);
+        count++;
+        time_us += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+    }
+
+    void notify(){
+        // empty lock to pair with the check in wait, so the signal can't be lost
+        { lock_guard<mutex> lock(mut); }
+        cv.notify_all();
+    }
+
+    int numSlots;
+    std::vector<T*> buffer;
+    std::unique_ptr<std::atomic<bool>[]> eof;
+    std::unique_ptr<std::atomic<uint64_t>[]> filled; // sequence + 1 of the block in the slot
+    std::atomic<uint64_t> writeSeq{0};
+    std::atomic<uint64_t> readSeq{0};
+    std::atomic<uint64_t> writeWaits{0}, writeWaitUs{0};
+    std::atomic<uint64_t> readWaits{0}, readWaitUs{0};
+    mutex mut;
+    condition_variable cv;
     bool initStatus;
 };
 #endif //GCTA2_ASYNCBUFFER_H
@@ -0,0 +1,77 @@
+/*
+   Asynchronous writer: formats and writes the blocks of results in a dedicated thread.
+
+   This file is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   A copy of the GNU General Public License is attached along with this program.
+   If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef GCTA2_ASYNCWRITER_H
+#define GCTA2_ASYNCWRITER_H
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <functional>
+
+// The jobs run in the order they were pushed. The queue is touched once per block,
+// push() only waits when maxPending jobs are already waiting (double buffered by default).
+class AsyncWriter {
+public:
+    AsyncWriter(size_t maxPending = 2) : maxPending(maxPending){
+        worker = std::thread([this](){this->run();});
+    }
+
+    ~AsyncWriter(){
+        finish();
+    }
+
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+    void push(std::function<void ()> job){
+        std::unique_lock<std::mutex> lock(mut);
+        notFull.wait(lock, [this](){return jobs.size() < this->maxPending;});
+        jobs.push_back(std::move(job));
+        lock.unlock();
+        notEmpty.notify_one();
+    }
+
+    // run the remaining jobs and stop the thread
+    void finish(){
+        {
+            std::lock_guard<std::mutex> lock(mut);
+            bStop = true;
+        }
+        notEmpty.notify_one();
+        if(worker.joinable()) worker.join();
+    }
+
+private:
+    void run(){
+        while(true){
+            std::function<void ()> job;
+            {
+                std::unique_lock<std::mutex> lock(mut);
+                notEmpty.wait(lock, [this](){return bStop || !jobs.empty();});
+                if(jobs.empty()) return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            notFull.notify_one();
+            job();
+        }
+    }
+
+    size_t maxPending;
+    bool bStop = false;
+    std::deque<std::function<void ()>> jobs;
+    std::mutex mut;
+    std::condition_variable notEmpty, notFull;
+    std::thread worker;
+};
+
+#endif //GCTA2_ASYNCWRITER_H
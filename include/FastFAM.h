@@ -24,11 +24,15 @@
 #include "Geno.h"
 #include "Pheno.h"
 #include "Marker.h" 
+#include "AsyncWriter.hpp"
 #include "Eigen/Dense"
 #include "Eigen/Sparse"
 #include <vector>
 #include <mutex>
 #include <omp.h>
+#include <memory>
+#include <fstream>
+#include <functional>
 
 using Eigen::Map;
 using Eigen::MatrixXd;
@@ -60,6 +64,7 @@ public:
     void calculate_gwa_2df_sandwich(uintptr_t * geno, const vector<uint32_t> &markerIndex);
     void calculate_mixed_2df(uintptr_t *geno, const vector<uint32_t> &markerIndex);
     void calculate_mixed_2df_sandwich(uintptr_t *geno, const vector<uint32_t> &markerIndex);
+    void calculate_mpheno(uintptr_t *geno, const vector<uint32_t> &markerIndex);
     void output_res(const vector<uint8_t> &isValids, const vector<uint32_t> markerIndex);
     void output_res_2df(const vector<uint8_t> &isValids, const vector<uint32_t> markerIndex);
 
@@ -131,9 +136,21 @@ private:
     uint64_t finished_rand_marker = 0;
     Eigen::ConjugateGradient<SpMat, Eigen::Lower|Eigen::Upper> solver;
     void grammar_func(uintptr_t *genobuf, const vector<uint32_t> &markerIndex);
-    vector<double> v_chisq;
     vector<double> v_c_infs;
     vector<uint8_t> bValids;
+
+    // GRAMMAR-Gamma tuning: the tuning SNPs are read once for all the columns of tuneViY,
+    // column k is V^-1 y of a trait with V solved by tuneSolvers[tuneGroup[k]]
+    vector<Eigen::ConjugateGradient<SpMat, Eigen::Lower|Eigen::Upper> *> tuneSolvers;
+    vector<int> tuneGroup;
+    MatrixXd tuneViY;
+    MatrixXd tuneChisq;   // tuning SNPs x columns of tuneViY
+    MatrixXd tuneCinf;    // NaN if the SNP is not valid for the column
+    vector<uint32_t> grammar_markers();
+    void grammar_tune(const vector<uint32_t> &marker_index);
+    double grammar_cinf(int col, const vector<uint32_t> &marker_index, const string &cinf_file);
+    double estimateVg(const SpMat &fam, const VectorXd &pheno, bool &isSig);
+    void constrainVg(double Vpheno, double &VG, double &VR, bool &isSig);
  
 
     //std::mutex chisq_lock;
@@ -184,6 +201,9 @@ private:
 
     std::ofstream osOut;
     FILE * bOut = NULL;
+    std::unique_ptr<AsyncWriter> resWriter;   // formats and writes the result blocks off the compute threads
+    void write_res(std::function<void ()> job);
+    void flush_res(const string &text, const vector<char> &bin);
     vector<char> osBuf;
     uint32_t numMarkerOutput = 0;
 
@@ -219,6 +239,18 @@ private:
     float *Tscore = NULL;
     float *Tse = NULL;
 
+    // multiple phenotypes (--mpheno-all, --pheno-list) tested in one pass of the genotypes
+    int num_traits = 0;
+    vector<string> trait_names;
+    MatrixXd traitZ;              // each column: Vi_y / c_inf for MLM, or the phenotype for linear regression
+    vector<double> traitCinf;     // GRAMMAR-Gamma of each trait, 0 for linear regression
+    vector<double> traitSSy;
+    vector<std::unique_ptr<std::ofstream>> traitOut;
+    void initMultiPheno(const SpMat &fam, bool flag_est_GE, double VG, double VR);
+
+    // genotype panel of the block kernel in calculate_gwa, kept across the blocks
+    MatrixXd gwaPanel;
+
     void initVar();
     bool bPreciseCovar = false; 
 
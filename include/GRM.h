@@ -30,6 +30,22 @@ using std::string;
 using std::vector;
 using std::pair;
 
+// header of the GRM tile file (*.grm.tile) written by --make-grm-tile
+// followed by the rows of the tile, each row as GRM values then N values in float;
+// a diagonal tile only keeps the lower triangle.
+struct GRMTileHeader{
+    char magic[4];          // GTIL
+    uint32_t version;       // 0: original version
+    uint32_t numBlocks;     // number of sample blocks
+    uint32_t tileIndex;     // 1-based index of the tile
+    uint32_t rowStart;      // first row sample (0-based, in kept samples)
+    uint32_t rowEnd;        // last row sample, included
+    uint32_t colStart;
+    uint32_t colEnd;
+    uint32_t numSample;     // total number of kept samples
+    uint32_t numMarker;     // valid markers used
+};
+
 class GRM {
 public:
     GRM(Pheno *pheno, Marker *marker);
@@ -37,6 +53,7 @@ public:
     ~GRM() {
         posix_mem_free(grm);
         posix_mem_free(N);
+        posix_mem_free(grmF);
         posix_mem_free(cmask_buf);
         if(lookup_GRM_table) delete[] lookup_GRM_table;
         if(sub_miss) delete[] sub_miss;
@@ -48,17 +65,26 @@ public:
 
     void calculate_GRM(uintptr_t* genobuf, const vector<uint32_t> &markerIndex);
     void calculate_GRM_blas(uintptr_t* genobuf, const vector<uint32_t> &markerIndex);
+    void calculate_GRM_tile(uintptr_t* genobuf, const vector<uint32_t> &markerIndex);
+    void calculate_GRM_packed(uintptr_t* genobuf, const vector<uint32_t> &markerIndex);
     
     void grm_thread(int grm_index_from, int grm_index_to);
     void N_thread(int grm_index_from, int grm_index_to, const uintptr_t* cmask);
     void deduce_GRM();
+    void deduce_GRM_tile();
     vector<uint32_t> divide_parts(uint32_t from, uint32_t to, uint32_t num_parts);
     vector<uint32_t> divide_parts_mem(uint32_t n_sample, uint32_t num_parts);
+    static vector<pair<uint32_t, uint32_t>> divide_tiles(uint32_t n_sample, uint32_t num_blocks);
+    static void tile_position(uint32_t tile_index, uint32_t &row_block, uint32_t &col_block);
+    static string tile_file_name(string prefix, uint32_t num_blocks, uint32_t tile_index);
 
     static int registerOption(map<string, vector<string>>& options_in);
     static void processMain();
     void processMakeGRM();
     void processMakeGRMX();
+    // truncated PCA of the GRM by randomized block Krylov iterations on the standardized
+    // genotypes, the GRM is never formed; outputs .eigenval, .eigenvec and .pcl
+    static void pca_approx(Pheno *pheno, Marker *marker);
 
     void loop_block(vector<function<void (double *buf, int num_block)>> callbacks
                     = vector<function<void (double *buf, int num_block)>>());
@@ -66,6 +92,7 @@ public:
     void prune_fam(float thresh, bool isSparse = true, float *val = NULL);
     void unify_grm(string mgrm_file, string out_file);
     void subtract_grm(string mgrm_file, string out_file);
+    void merge_tiles(string prefix, uint32_t num_blocks, string out_file);
 
 private:
     Pheno *pheno = NULL;
@@ -140,6 +167,64 @@ private:
 
     GenoBufItem *gbufitems = NULL;
 
+    // tile mode: part_keep_indices holds the row block, tile_col_indices the column block
+    bool bTile = false;
+    bool bTileDiag = false;
+    uint32_t num_tile_blocks = 0;
+    uint32_t cur_tile = 0;
+    pair<uint32_t, uint32_t> tile_col_indices;
+    double *tilePanelRow = NULL;
+    double *tilePanelCol = NULL;
+    uintptr_t *tileSampleMiss = NULL;
+    vector<uint32_t> tileMissBlocks;
+    float get_mtd_weight();
+
+    // bit-packed kernel for hard calls without missing genotypes, --make-grm-alg 1 only
+    // as the per marker scale has to be the same to sum the counts over markers
+    bool bPacked = false;
+    uint32_t packedGenoPtrSize = 0;
+    uintptr_t *packedGeno = NULL;     // 2-bit genotypes of the markers in the buffer
+    uint32_t packedSampleBlocks = 0;  // 64 samples in each block
+    uint64_t *packedRowL = NULL;      // marker major bits, genotype >= 1
+    uint64_t *packedRowH = NULL;      // marker major bits, genotype == 2
+    uint32_t packedRowCT = 0;
+    vector<double> packedMean;        // 2p of the staged rows
+    uint64_t *packedPlaneL = NULL;    // sample major bits, numPackedWords per sample
+    uint64_t *packedPlaneH = NULL;
+    int packedWordCT = 0;
+    const static int numPackedWords = 32;
+    vector<double> packedSum;         // sum of 2p * x of each sample
+    double packedSumSq = 0.0;         // sum of 4p^2
+    void accumulate_GRM_blas(const vector<int> &validIndex);
+
+    // missing genotypes in sample major words, numMissWords words for each sample
+    uint64_t *missPlane = NULL;
+    int missWordCT = 0;
+    const static int numMissWords = 16;
+    void flush_N();
+
+    // --grm-precision, 0: double; 1: single; 2: mixed, float blocks flushed into the double GRM
+    // grmF is the full float GRM in single precision, a panel of mixedPanelCols columns in mixed
+    int grmPrecision = 0;
+    float *grmF = NULL;
+    float *stdGenoF = NULL;
+    uint64_t num_grm_float = 0;
+    uint32_t numFloatMarkers = 0;
+    const static uint32_t numMixedFlush = 1024;  // staged float markers, multiple of nMarkerBlock
+    uint32_t mixedPanelCols = 0;
+    uint32_t numCheckSample = 0;      // samples in the double precision check
+    double *checkGeno = NULL;
+    double *checkGRM = NULL;
+    double *checkDiff = NULL;         // summed float - double differences of the check samples
+    void accumulate_GRM_float(const vector<int> &validIndex);
+    void flush_GRM_float();
+    void init_std_geno();
+    void end_std_geno();
+    static uint64_t pack_half_bits(uint64_t x);
+    void packed_transpose();
+    void packed_flush();
+    void packed_finalize();
+
     //Just for testing
 #ifndef NDEBUG
     FILE * o_geno0;
@@ -0,0 +1,142 @@
+/*
+   GCTA: a tool for Genome-wide Complex Trait Analysis
+
+   Memory mapped reader of the binary GRM (*.grm.bin, *.grm.N.bin).
+   The lower triangle is accessed in place, row i starts at i * (i + 1) / 2.
+   Reader and writer of the binary sparse GRM (*.grm.spb).
+
+   This file is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   A copy of the GNU General Public License is attached along with this program.
+   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GCTA2_GRMREADER_H
+#define GCTA2_GRMREADER_H
+#include <string>
+#include <vector>
+#include <cstdint>
+
+using std::string;
+using std::vector;
+
+// header of the binary sparse GRM (*.grm.spb), followed by the full symmetric matrix
+// in compressed column storage: column pointers (numSample + 1), row indices (nnz) in int64
+// and values (nnz) in double, so that it can be mapped as a SparseMatrix<double, ColMajor, long long>
+struct GRMSparseHeader{
+    char magic[4];          // GSPB
+    uint32_t version;       // 0: original version
+    uint64_t numSample;
+    uint64_t nnz;           // non-zero elements of both triangles
+    uint64_t reserved;
+};
+
+class GRMReader {
+public:
+    // map grm_file.grm.bin of num_sample samples, the N file is mapped when it is first used
+    GRMReader(string grm_file, uint32_t num_sample);
+    ~GRMReader();
+    GRMReader(const GRMReader&) = delete;
+    GRMReader& operator=(const GRMReader&) = delete;
+
+    uint32_t size() const {return num_sample;}
+
+    // lower triangle row i, i + 1 values
+    const float *row(uint32_t i) const {return grm + (uint64_t)i * (i + 1) / 2;}
+    const float *rowN(uint32_t i) {return mapN() + (uint64_t)i * (i + 1) / 2;}
+    float value(uint32_t i, uint32_t j) const {return i >= j ? row(i)[j] : row(j)[i];}
+
+    // whether grm_file.grm.N.bin exists
+    bool hasN() const;
+
+    // hint the kernel to read rows [row_from, row_to] ahead
+    void prefetch(uint32_t row_from, uint32_t row_to, bool isN = false);
+
+    // fill the full square matrix
+    template<typename T>
+    void read(T &mat, bool isN = false);
+
+    // fill the square matrix of the samples in index (0 based, not necessarily sorted)
+    template<typename T>
+    void extract(const vector<int> &index, T &mat, bool isN = false);
+
+private:
+    string grm_file;
+    uint32_t num_sample;
+    uint64_t num_byte;
+    const float *grm = NULL;
+    const float *N = NULL;
+
+    const float *mapN();
+    static const float *map_file(string file_name, uint64_t num_byte);
+};
+
+class GRMSparseReader {
+public:
+    GRMSparseReader(string file_name);
+    ~GRMSparseReader();
+    GRMSparseReader(const GRMSparseReader&) = delete;
+    GRMSparseReader& operator=(const GRMSparseReader&) = delete;
+
+    uint64_t size() const {return header->numSample;}
+    uint64_t nonZeros() const {return header->nnz;}
+    const long long *outer() const {return outer_index;}
+    const long long *inner() const {return inner_index;}
+    const double *values() const {return value;}
+
+    // write the lower triangle elements (id1 >= id2), which are ordered by id1 then id2
+    static void write(string file_name, uint32_t num_sample, const vector<int> &id1,
+            const vector<int> &id2, const vector<float> &val);
+
+private:
+    string file_name;
+    uint64_t num_byte = 0;
+    const GRMSparseHeader *header = NULL;
+    const long long *outer_index = NULL;
+    const long long *inner_index = NULL;
+    const double *value = NULL;
+};
+
+template<typename T>
+void GRMReader::read(T &mat, bool isN){
+    const float *base = isN ? mapN() : grm;
+    prefetch(0, num_sample - 1, isN);
+    mat.resize(num_sample, num_sample);
+    // each row of the triangle goes to the upper part of a column, then mirror
+    #pragma omp parallel for schedule(dynamic, 64)
+    for(uint32_t i = 0; i < num_sample; i++){
+        const float *cur_row = base + (uint64_t)i * (i + 1) / 2;
+        for(uint32_t j = 0; j <= i; j++){
+            mat(j, i) = cur_row[j];
+        }
+    }
+    #pragma omp parallel for schedule(dynamic, 64)
+    for(uint32_t i = 0; i < num_sample; i++){
+        for(uint32_t j = i + 1; j < num_sample; j++){
+            mat(j, i) = mat(i, j);
+        }
+    }
+}
+
+template<typename T>
+void GRMReader::extract(const vector<int> &index, T &mat, bool isN){
+    const float *base = isN ? mapN() : grm;
+    int n = index.size();
+    mat.resize(n, n);
+    #pragma omp parallel for schedule(dynamic, 64)
+    for(int i = 0; i < n; i++){
+        uint64_t ir = index[i];
+        const float *cur_row = base + ir * (ir + 1) / 2;
+        for(int j = 0; j <= i; j++){
+            uint64_t ic = index[j];
+            float val = (ic <= ir) ? cur_row[ic] : base[ic * (ic + 1) / 2 + ir];
+            mat(j, i) = val;
+            mat(i, j) = val;
+        }
+    }
+}
+
+#endif //GCTA2_GRMREADER_H
@@ -131,14 +131,26 @@ public:
     // new loop subset manner
     void preGenoDouble(int numMarkerBuf, bool bMakeGeno, bool bGenoCenter, bool bGenoStd, bool bMakeMiss);
     void getGenoDouble(uintptr_t *buf, int bufIndex, GenoBufItem* gbuf);
+    // write the genotypes into caller supplied buffers of keepSampleCT doubles and
+    //   setGenoItemSize() missing words (only when bMakeMiss), gbuf->geno and gbuf->missing are untouched
+    void getGenoDouble(uintptr_t *buf, int bufIndex, GenoBufItem* gbuf, double *geno, uintptr_t *missing);
     void endGenoDouble();
 
+    // slabs of the calling OpenMP thread for the above, valid within loopDouble
+    double *getGenoSlab();
+    uintptr_t *getMissSlab();
+
     void loopDouble(const vector<uint32_t> &extractIndex, int numMarkerBuf, bool bMakeGeno, bool bGenoCenter, bool bGenoStd, bool bMakeMiss, vector<function<void (uintptr_t *buf, const vector<uint32_t> &exIndex)>> callbacks = vector<function<void (uintptr_t *buf, const vector<uint32_t> &exIndex)>>(), bool showLog = true);
 
     bool getGenoHasInfo();
 
     void setGRMMode(bool grm, bool dominace);
     void setGenoItemSize(uint32_t &genoSize, uint32_t &missSize);
+
+    // hard-call genotypes in 2-bit codes without expanding to double, BED only
+    bool isHardCall();
+    uint32_t getGenoPackedPtrSize();
+    bool getGenoPacked(uintptr_t *buf, int bufIndex, GenoBufItem* gbuf, uintptr_t *packed);
  
 private:
     Pheno* pheno;
@@ -263,21 +275,37 @@ private:
     typedef void (Geno::*PreGenoDoubleFunc)();
     typedef std::unordered_map<string, PreGenoDoubleFunc> PreGenoDoubleFuncs;
 
-    typedef void (Geno::*GetGenoDoubleFunc)(uintptr_t *buf, int idx, GenoBufItem* gbuf);
+    typedef void (Geno::*GetGenoDoubleFunc)(uintptr_t *buf, int idx, GenoBufItem* gbuf, double *geno, uintptr_t *missing);
     typedef std::unordered_map<string, GetGenoDoubleFunc> GetGenoDoubleFuncs;
 
     typedef void (Geno::*EndGenoDoubleFunc)(void);
     typedef std::unordered_map<string, EndGenoDoubleFunc> EndGenoDoubleFuncs;
 
-    typedef void (Geno::*ReadGenoFunc)(const vector<uint32_t> &extractIndex);
+    typedef void (Geno::*ReadGenoFunc)(int readerIndex, int numReader);
     typedef std::unordered_map<string, ReadGenoFunc> ReadGenoFuncs;
 
     PreGenoDoubleFuncs preGenoDoubleFuncs;
     GetGenoDoubleFuncs getGenoDoubleFuncs;
+    GetGenoDoubleFunc getGenoDoubleFunc = NULL; // of the current format, looked up once in preGenoDouble
     EndGenoDoubleFuncs endGenoDoubleFuncs;
     ReadGenoFuncs readGenoFuncs;
     
-    void readGeno(const vector<uint32_t> &extractIndex);
+    void readGeno(int readerIndex, int numReader);
+
+    // a block of the ring: markers [start, start + size) of readRawIndices, all from one file
+    struct ReadBlock{
+        uint32_t start;
+        uint32_t size;
+        int fileIndex;
+        uint8_t isSexXY;
+    };
+    vector<uint32_t> readRawIndices;
+    vector<ReadBlock> readBlocks;
+    int numReadThreads = 1;  // --read-threads, defaults to one per file up to 4 and to --read-ahead - 1
+    bool bDirectIO = false;  // --direct-io, read the genotype around the page cache
+    int ioDepth = 32;        // --io-depth, reads in flight of each reader
+    void initReadBlocks(const vector<uint32_t> &extractIndex);
+    void endReadBlock(uint64_t blockIndex);
 
     bool hasInfo = false;
     AsyncBuffer<uintptr_t>* asyncBuf64 = NULL;
@@ -296,6 +324,8 @@ private:
     int8_t alleModel = 1; // 1: add; 2: Dom; 3: Reces; 4: Het; //currently unused affect a0 a1 a2 na;
 
     int curBufferIndex;
+    int numBufSlots = 3;  // slots of asyncBuf64, --read-ahead
+    int nextBufIndex(int curIndex);
     vector<int> numMarkersReadBlocks;
     vector<uint8_t> isMarkersSexXYs;
     vector<int> fileIndexBuf;
@@ -303,19 +333,19 @@ private:
 
     //BED format;
     void preGenoDouble_bed();
-    void getGenoDouble_bed(uintptr_t *buf, int idx, GenoBufItem* gbuf);
+    void getGenoDouble_bed(uintptr_t *buf, int idx, GenoBufItem* gbuf, double *geno, uintptr_t *missing);
     void endGenoDouble_bed();
-    void readGeno_bed(const vector<uint32_t> &extractIndex);
+    void readGeno_bed(int readerIndex, int numReader);
     //BGEN format;
     void preGenoDouble_bgen();
-    void getGenoDouble_bgen(uintptr_t *buf, int idx, GenoBufItem* gbuf);
+    void getGenoDouble_bgen(uintptr_t *buf, int idx, GenoBufItem* gbuf, double *geno, uintptr_t *missing);
     void endGenoDouble_bgen();
-    void readGeno_bgen(const vector<uint32_t> &extractIndex);
+    void readGeno_bgen(int readerIndex, int numReader);
     //PGEN format;
     void preGenoDouble_pgen();
-    void getGenoDouble_pgen(uintptr_t *buf, int idx, GenoBufItem* gbuf);
+    void getGenoDouble_pgen(uintptr_t *buf, int idx, GenoBufItem* gbuf, double *geno, uintptr_t *missing);
     void endGenoDouble_pgen();
-    void readGeno_pgen(const vector<uint32_t> &extractIndex);
+    void readGeno_pgen(int readerIndex, int numReader);
  
     //BED
     int bedRawGenoBuf1PtrSize; // how many 64bit geno of raw sample save 
@@ -342,6 +372,15 @@ private:
 
     //BGEN
     int bgenRawGenoBuf1PtrSize;
+    const static uint64_t maxBgenReadGap = 64 * 1024;          // skipped bytes still read through
+    const static uint64_t maxBgenReadRun = 64 * 1024 * 1024;   // size of one merged read
+
+    // per thread genotype and missing slabs, 64 byte aligned and reused across the blocks;
+    // each slab is allocated and first touched by its own thread to stay on the local NUMA node
+    vector<double *> genoSlabs;
+    vector<uintptr_t *> missSlabs;
+    void initGenoSlabs();
+    void freeGenoSlabs();
 
     //PGEN
     int pgenGenoBuf1PtrSize;
@@ -0,0 +1,88 @@
+/*
+   GCTA: a tool for Genome-wide Complex Trait Analysis
+
+   Direct reader of the genotype files: reads around the page cache (O_DIRECT),
+   submitted in batches by io_uring.
+
+   This file is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   A copy of the GNU General Public License is attached along with this program.
+   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GCTA2_GENOIO_H
+#define GCTA2_GENOIO_H
+#include <string>
+#include <vector>
+#include <cstdint>
+
+using std::string;
+using std::vector;
+
+// Linux only; on the other systems --direct-io is ignored and the genotypes are read by stdio
+#ifdef __linux__
+#define GCTA_DIRECT_IO
+#endif
+
+#ifdef GCTA_DIRECT_IO
+// Reads byte ranges of one file. The ranges added by add() are read by submit_wait(), with up to
+// queueDepth of them in flight. Falls back to pread without io_uring (old kernel, or blocked in
+// the container), and to the page cache when the file system doesn't support O_DIRECT.
+class GenoDirectReader{
+public:
+    GenoDirectReader(const string &file_name, int queueDepth = 32);
+    ~GenoDirectReader();
+
+    GenoDirectReader(const GenoDirectReader&) = delete;
+    GenoDirectReader& operator=(const GenoDirectReader&) = delete;
+
+    void add(uint64_t pos, uint64_t size, uint8_t *dest);
+    // read all the ranges added, false if any of them can't be read completely
+    bool submit_wait();
+
+    bool is_direct(){return bDirect;}
+    bool is_uring(){return ring_fd >= 0;}
+
+    // offset, size and memory alignment of O_DIRECT reads
+    const static uint64_t alignSize = 4096;
+
+private:
+    struct Request{
+        uint64_t pos;
+        uint64_t size;
+        uint8_t *dest;
+        uint64_t readPos;   // aligned range read for the request
+        uint64_t readSize;
+        uint8_t *buf;       // dest itself, or an aligned bounce buffer
+        bool done;
+    };
+    vector<Request> requests;
+    vector<uint8_t *> bounceBufs;
+    vector<uint64_t> bounceSizes;
+
+    bool readSync(Request &req);
+    bool readUring();
+    void initUring();
+    void closeUring();
+    void drainUring(uint64_t numInflight);
+
+    string file_name;
+    int fd = -1;
+    bool bDirect = false;
+    int queueDepth;
+
+    int ring_fd = -1;
+    void *sq_ring = NULL;
+    void *cq_ring = NULL;
+    void *sqes = NULL;
+    uint64_t sq_ring_size = 0, cq_ring_size = 0, sqes_size = 0;
+    unsigned *sq_head = NULL, *sq_tail = NULL, *sq_mask = NULL, *sq_array = NULL;
+    unsigned *cq_head = NULL, *cq_tail = NULL, *cq_mask = NULL;
+    void *cqes = NULL;
+};
+#endif //GCTA_DIRECT_IO
+
+#endif //GCTA2_GENOIO_H
@@ -6,19 +6,24 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include "StrIndex.hpp"
 
 using std::map;
 using std::string;
 using std::vector;
 using std::unique_ptr;
 
+// .zld: header (256 bytes reserved), marker info (one "chr SNP bp A1 A2" line per marker),
+// block index (numBlock LDInfoStart), then the compressed blocks. Each block holds the LD rows
+// of blockMarker consecutive markers, so the row of any marker is one index lookup and one
+// block decompression away.
 struct LDHeader{
     char magic[3]; // ZLD
-    uint8_t version; //0: orignal version
+    uint8_t version; //0: orignal version; 1: compressed blocks with the block index
     uint8_t valueType; //0: r; 1: r2;
     uint8_t matrixType; // 0: triangular;  1: full
     uint32_t numMarker; 
-    uint8_t compressType; // 0: zfp; 1: SZ
+    uint8_t compressType; // 0: lossless; 1: quantized to the error bound; both zstd
     uint8_t order;  // 0: colMajor; 1: rowMajor;
     uint32_t window;  //number of bp
     uint64_t fileSize; // size of file in bype;
@@ -26,6 +31,9 @@ struct LDHeader{
     uint64_t markerInfoStart;  // the start of marker = 256; 
     //no marker info if LDinfostart==markerInfoStart
     uint64_t LDInfoStart; // the start of LD infomation
+    uint32_t blockMarker; // number of markers in each block
+    uint32_t numBlock;
+    double errorBound; // maximum absolute error of the values if compressType = 1
     // For check the data corrupted or not
     uint32_t headerCRC; // the CRC of above bytes
     uint32_t resourceCRC;  // the CRC from the 256byte to end;
@@ -35,16 +43,74 @@ struct LDBlockInfo{
     uint32_t index;
 };
     
-
+// block index entry. Decompressed, a block is uint32 numRel[numMarker] followed by the values
+// of the rows, numRel of each: LD of the marker with itself and the markers after it in the
+// window. The values are float (lossless) or int32 multiples of 2 * errorBound, and the whole
+// block is shuffled into byte planes before zstd.
 struct LDInfoStart{
-    uint32_t startIndex;  // marker index in the marker info or .gld.esi
+    uint32_t startIndex;  // marker index in the marker info
     uint32_t numMarker; 
-    // marker Index 50 seems resonalbe 30K * 8 * 1024/1024  * 50 = 114MB
-    uint32_t* numRelAfter = NULL; // how many marker relation saved; size = 1
-    uint32_t* numRelBefore = NULL; // how many marker before;
     uint64_t startByte; // the byte of start
     uint64_t compressSize; // compressed size;
     uint64_t decompressSize; // decompressed size;
+    uint32_t blockCRC; // CRC of the compressed bytes
+    uint32_t reserve;
+};
+
+// Random access reader of a .zld file; keeps the last decompressed block, so use one reader
+// per thread.
+class LDReader{
+public:
+    LDReader(const string &file);
+    ~LDReader();
+    uint32_t count() const;
+    bool isR2() const;
+    uint32_t getWindow() const;
+    // "chr SNP bp A1 A2" of the marker
+    const string& getMarkerInfo(uint32_t index) const;
+    const string& getMarkerName(uint32_t index) const;
+    int64_t findMarker(const string &name) const; // -1 if not found
+    // LD of the marker with itself and the numRel - 1 markers after it
+    uint32_t getRow(uint32_t index, vector<float> &values);
+    // check the CRC of the whole file
+    bool verify();
+
+private:
+    void readBlock(uint32_t block);
+    string file;
+    const char *data = NULL;  // the mapped file
+    uint64_t data_bytes = 0;
+    LDHeader header;
+    vector<LDInfoStart> blocks;
+    vector<string> marker_info;
+    vector<string> marker_name;
+    StrIndex marker_index;
+    int64_t cur_block = -1;
+    vector<uint64_t> cur_row_start;
+    vector<float> cur_values;
+};
+
+// Writer of a .zld file, the rows are added in the order of the markers
+class LDWriter{
+public:
+    // marker_info: "chr SNP bp A1 A2" of each marker, tab separated; error_bound 0 for lossless
+    LDWriter(const string &file, const vector<string> &marker_info, bool is_r2, uint32_t window, double error_bound);
+    ~LDWriter();
+    void writeRow(const float *values, uint32_t size);
+    void finish();
+
+private:
+    void writeBlock();
+    string file;
+    FILE *h_ld;
+    LDHeader header;
+    uint32_t marker_info_crc;
+    vector<LDInfoStart> block_index;
+    uint64_t cur_byte;
+    uint32_t data_crc;
+    uint32_t num_row = 0;
+    vector<uint32_t> block_rel;
+    vector<float> block_values;
 };
 
 class LD{
@@ -61,6 +127,7 @@ private:
     static uint32_t num_indi;
     static map<string, string> options;
     static map<string, int> options_i;
+    static map<string, double> options_d;
     static vector<string> processFunctions;
 
     static bool chr_ends;
@@ -68,12 +135,12 @@ private:
     static int cur_buffer;
     static uint64_t cur_buffer_offset[2];
     void calcLD();
+    void finishLD();
     uint32_t ld_window;
     bool is_r2;
     uint32_t cur_process_marker_index;
 
-    FILE *h_ld;
-
+    unique_ptr<LDWriter> writer;
 };
     
     
@@ -83,6 +150,6 @@ private:
 
 
 
-#endif //GCTA_LD_H:w
+#endif //GCTA_LD_H
 
 
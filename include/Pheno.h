@@ -48,6 +48,10 @@ public:
     uint8_t extract_genobit(uint8_t * const buf, int index_in_keep);
     vector<uint32_t>& get_index_keep();
     void get_pheno(vector<string>& ids, vector<double>& pheno);
+    // traits of --mpheno-all or --pheno-list, 0 if only one trait is read
+    int count_mpheno();
+    string get_mpheno_name(int index);
+    void get_mpheno(int index, vector<double>& pheno);
     void save_pheno(string filename);
     void filter_keep_index(vector<uint32_t>& k_index);
     void getMaskBit(uint64_t *maskp);
@@ -91,6 +95,10 @@ private:
     void read_psam(string psam_file);
     void read_checkMPSample(string m_file);
     void update_pheno(vector<string>& indi_marks, vector<double>& phenos);
+    void read_mpheno(vector<string>& pheno_subjects, vector<vector<double>>& phenos);
+    vector<int> mpheno_cols;
+    vector<uint32_t> mpheno_index;       // raw index of the individuals in mphenos
+    vector<vector<double>> mphenos;
     void update_sex(vector<string>& indi_marks, vector<double>& sex);
     void init_mask_block();
     void init_bmask_block();
@@ -0,0 +1,130 @@
+/*
+   GCTA: a tool for Genome-wide Complex Trait Analysis
+
+   Hash index of the string IDs (markers, samples) to join the lists
+
+   This file is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   A copy of the GNU General Public License is attached along with this program.
+   If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef GCTA2_STRINDEX_H
+#define GCTA2_STRINDEX_H
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+// The IDs are interned into one character block and indexed by an open-addressing table of
+// 32-bit slots (linear probing, at most half full): about 20 bytes per ID besides the text,
+// against ~80 bytes of a std::map node plus a std::string. A duplicated ID is chained from
+// its first occurrence in input order. Lookups don't change the index, so a batch of them
+// runs in parallel. The hash and the probing are also used on the tables stored in files
+// (SumstatBin), which index the IDs of a character block by their offsets.
+class StrIndex{
+public:
+    StrIndex(){}
+    explicit StrIndex(const std::vector<std::string> &ids){
+        build(ids);
+    }
+
+    void build(const std::vector<std::string> &ids){
+        numIDs = ids.size();
+        uint64_t numChars = 0;
+        for(const auto &id : ids) numChars += id.size();
+        chars.resize(numChars);
+        offsets.resize(numIDs + 1);
+        offsets[0] = 0;
+        for(uint64_t i = 0; i < numIDs; i++){
+            memcpy(chars.data() + offsets[i], ids[i].data(), ids[i].size());
+            offsets[i + 1] = offsets[i] + ids[i].size();
+        }
+
+        uint64_t numSlots = 16;
+        while(numSlots < 2 * numIDs) numSlots <<= 1;
+        mask = numSlots - 1;
+        slots.assign(numSlots, 0);
+        dupNext.clear();
+        // the tail of each chain, to keep the duplicates in input order
+        std::vector<uint32_t> dupLast;
+        for(uint64_t i = 0; i < numIDs; i++){
+            uint64_t slot = probe(slots.data(), mask, chars.data(), offsets.data(), chars.data() + offsets[i], offsets[i + 1] - offsets[i]);
+            if(!slots[slot]){
+                slots[slot] = i + 1;
+                continue;
+            }
+            if(dupNext.empty()){
+                dupNext.assign(numIDs, 0);
+                dupLast.assign(numIDs, 0);
+            }
+            uint32_t first = slots[slot] - 1;
+            uint32_t last = dupLast[first] ? dupLast[first] - 1 : first;
+            dupNext[last] = i + 1;
+            dupLast[first] = i + 1;
+        }
+    }
+
+    uint64_t size() const{
+        return numIDs;
+    }
+
+    // index of the first ID equal to key, -1 if not found
+    int64_t find(const char *key, uint64_t len) const{
+        if(slots.empty()) return -1;
+        return (int64_t)slots[probe(slots.data(), mask, chars.data(), offsets.data(), key, len)] - 1;
+    }
+
+    int64_t find(const std::string &key) const{
+        return find(key.data(), key.size());
+    }
+
+    // indices of the first IDs equal to the keys, -1 for the keys not found
+    void find(const std::vector<std::string> &keys, std::vector<int64_t> &indices) const{
+        indices.resize(keys.size());
+        #pragma omp parallel for schedule(static, 4096)
+        for(uint64_t i = 0; i < keys.size(); i++){
+            indices[i] = find(keys[i]);
+        }
+    }
+
+    // the next index of the same ID, -1 after the last one
+    int64_t next(uint64_t index) const{
+        return dupNext.empty() ? -1 : (int64_t)dupNext[index] - 1;
+    }
+
+    // FNV-1a, continued from h to hash several pieces as one
+    static uint64_t hash(const char *key, uint64_t len, uint64_t h = 14695981039346656037ULL){
+        for(uint64_t i = 0; i < len; i++){
+            h ^= (unsigned char)key[i];
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    // the slot of key in a table of mask + 1 slots (index + 1, 0 for empty) over the IDs at
+    // offsets of chars: the slot holding it, or the empty slot it goes into
+    static uint64_t probe(const uint32_t *slots, uint64_t mask, const char *chars, const uint64_t *offsets,
+            const char *key, uint64_t len){
+        uint64_t slot = hash(key, len) & mask;
+        while(slots[slot]){
+            uint64_t index = slots[slot] - 1;
+            if(offsets[index + 1] - offsets[index] == len && memcmp(chars + offsets[index], key, len) == 0) break;
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+private:
+
+    std::vector<char> chars;
+    std::vector<uint64_t> offsets;
+    std::vector<uint32_t> slots;     // index + 1, 0 for empty
+    std::vector<uint32_t> dupNext;   // index + 1 of the next duplicate, 0 for none
+    uint64_t mask = 0;
+    uint64_t numIDs = 0;
+};
+
+#endif //GCTA2_STRINDEX_H
@@ -17,16 +17,33 @@
 #ifndef GCTA2_MEM_HPP
 #define GCTA2_MEM_HPP
 
+#include <stdint.h>
+
 #ifdef _WIN32
 #include <malloc.h>
+#include <process.h>
+#include <cstdio>
 #define posix_memalign(p, a, s) ( ((*(p)) = _aligned_malloc((s), (a))), *(p) ? 0 : errno )
 #define posix_mem_free _aligned_free
+#define getpid _getpid
+#define fseeko _fseeki64
+#define ftello _ftelli64
 #else
 #include <cstdio>
 #include <stdlib.h>
+#include <unistd.h>
 #define posix_mem_free free
 #endif
 
+// read only mapping of a whole file, shared with the other processes mapping the same file;
+// returns NULL if the file can't be opened or mapped, num_byte is set to the file size
+void *map_file_read(const char *file_name, uint64_t &num_byte);
+void unmap_file(void *addr, uint64_t num_byte);
+// hint the kernel the range will be read sequentially soon, no-op where not supported
+void advise_sequential(const void *addr, uint64_t num_byte);
+// rename from to to, replacing to if it exists (rename fails on an existing file on Windows)
+int replace_file(const char *from, const char *to);
+
 // These functions are only for test purpose, don't forget to remove calls
 int getVMemKB();
 int getMemKB();
@@ -31,6 +31,7 @@
 #include <numeric>
 #include <algorithm>
 #include <sstream>
+#include "StrIndex.hpp"
 
 std::string getHostName();
 std::string getLocalTime();
@@ -41,6 +42,11 @@ std::string getSSEvar();
 std::string getOSName();
 uint64_t getFileByteSize(FILE * file);
 
+// text of the default std::ostream << (%g, 6 significant digits) without the stream,
+// buf takes at least 32 chars, return the end of the text (not null terminated)
+char *formatDouble(double value, char *buf);
+char *formatUInt(uint64_t value, char *buf);
+
 template <typename T>
 bool hasVectorDuplicate(const std::vector<T> &v){
     std::vector<T> t = v;
@@ -128,6 +134,31 @@ void vector_commonIndex(const std::vector<T>& v1, const std::vector<T>& v2, std:
 	//std::sort(k2.begin(), k2.end());
 }
 
+// the string IDs (markers, samples) are joined through a hash index of v1 instead of sorting
+// both lists; the pairs come in the order of v2
+template <typename P>
+void vector_commonIndex(const std::vector<std::string>& v1, const std::vector<std::string>& v2, std::vector<P>& k1, std::vector<P>& k2){
+	k1.clear();
+	k2.clear();
+	if(v1 == v2){
+		k1.resize(v1.size());
+		std::iota(k1.begin(), k1.end(), 0);
+
+		k2.resize(v2.size());
+		std::iota(k2.begin(), k2.end(), 0);
+		return;
+	}
+	StrIndex v1_index(v1);
+	std::vector<int64_t> found;
+	v1_index.find(v2, found);
+	for(uint64_t v2_ind = 0; v2_ind != v2.size(); v2_ind++){
+		for(int64_t v1_ind = found[v2_ind]; v1_ind != -1; v1_ind = v1_index.next(v1_ind)){
+			k1.push_back(v1_ind);
+			k2.push_back(v2_ind);
+		}
+	}
+}
+
 template <typename T, typename P>
 void vector_commonIndex_sorted1(const std::vector<T>& v1, const std::vector<T>& v2, std::vector<P>& k1, std::vector<P>& k2){
     vector_commonIndex(v1, v2, k1, k2);
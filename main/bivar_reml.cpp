@@ -13,6 +13,7 @@
 #include "gcta.h"
 
 void gcta::fit_bivar_reml(string grm_file, string phen_file, string qcovar_file, string covar_file, string keep_indi_file, string remove_indi_file, string sex_file, int mphen, int mphen2, double grm_cutoff, double adj_grm_fac, int dosage_compen, bool m_grm_flag, bool pred_rand_eff, bool est_fix_eff, int reml_mtd, int MaxIter, vector<double> reml_priors, vector<double> reml_priors_var, vector<int> drop, bool no_lrt, double prevalence, double prevalence2, bool no_constrain, bool ignore_Ce, vector<double> &fixed_rg_val, bool bivar_no_constrain) {
+    if (_reml_matfree || _reml_spectral) LOGGER.e(0, "--reml-matfree and --reml-spectral can't be used with --reml-bivar.");
     _bivar_reml = true;
     _bivar_no_constrain = bivar_no_constrain;
     no_lrt = true;
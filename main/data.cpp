@@ -16,6 +16,8 @@
 #include "gcta.h"
 #include "Logger.h"
 #include "StrFunc.h"
+#include "StrIndex.hpp"
+#include "submods/Pgenlib/PgenReader.h"
 
 gcta::gcta(int autosome_num, double rm_ld_cutoff, string out)
 {
@@ -86,7 +88,7 @@ gcta::gcta() {
 }
 
 gcta::~gcta() {
-
+    free_geno_cache();
 }
 
 void gcta::read_famfile(string famfile) {
@@ -200,10 +202,88 @@ void gcta::init_include()
     }
 }
 
+void gcta::init_geno_bits(int num_snp, int num_indi)
+{
+    _geno_indi = num_indi;
+    _geno_words = (num_indi + 31) / 32;
+    _geno_bits.clear();
+    _geno_bits.resize((uint64_t)num_snp * _geno_words, 0);
+}
+
+void gcta::geno_keep_mask(vector<uintptr_t> &mask) const
+{
+    mask.clear();
+    if (_geno_cache || _keep.size() == _geno_indi) return;
+    vector<uint32_t> keep(_keep.begin(), _keep.end());
+    mask.resize(2 * PgenReader::GetSubsetMaskSize(_geno_indi));
+    PgenReader::SetSampleSubsets(keep, _geno_indi, mask.data(), mask.data() + mask.size() / 2);
+}
+
+void gcta::geno_row(int j, const double *val, const vector<uintptr_t> &mask, vector<uintptr_t> &buf, double *x) const
+{
+    int snp = _include[j];
+    uint32_t num_keep = _keep.size();
+    double a0 = val[0], a2 = val[2];
+    if (_allele1[snp] != _ref_A[snp]) std::swap(a0, a2);
+    alignas(16) const double lookup[32] = GET_TABLE16(a0, val[1], a2, val[3]);
+    if (_geno_cache) {
+        const int8_t *row = _geno_cache + _geno_cache_snp[snp];
+        for (uint32_t i = 0; i < num_keep; i++) {
+            int g = row[_geno_cache_indi[_keep[i]]];
+            x[i] = lookup[(g < 0 ? 3 : g) << 1];
+        }
+        return;
+    }
+    uintptr_t *in = (uintptr_t *)&_geno_bits[(uint64_t)snp * _geno_words];
+    if (!mask.empty()) {
+        buf.resize(PgenReader::GetGenoBufPtrSize(num_keep));
+        PgenReader::ExtractGenoExt(in, mask.data(), _geno_indi, num_keep, buf.data());
+        in = buf.data();
+    }
+    PgenReader::ExtractDoubleExt(in, NULL, num_keep, num_keep, lookup, x, NULL);
+}
+
+void gcta::geno_row(int j, const double *val, double *x) const
+{
+    vector<uintptr_t> mask, buf;
+    geno_keep_mask(mask);
+    geno_row(j, val, mask, buf, x);
+}
+
+void gcta::geno_row(int j, const double *val, float *x) const
+{
+    vector<double> row(_keep.size());
+    geno_row(j, val, row.data());
+    std::copy(row.begin(), row.end(), x);
+}
+
+// BED code (00: homozygote A1, 01: missing, 10: heterozygote, 11: homozygote A2) to the number of A1 alleles
+static const uint64_t bed_a1_code[4] = {2, 3, 1, 0};
+
+// one SNP of the BED file into 2 bits per kept individual, out is zero filled
+static void decode_bed_snp(const unsigned char *bed, int num_indi, const vector<int> &rindi, bool keep_all, uint64_t *out)
+{
+    if (keep_all) {
+        // whole words at a time: ~code flips 00<->11 and 01<->10, then fix 11 -> 10 and 10 -> 11
+        memcpy(out, bed, (num_indi + 3) / 4);
+        for (int w = 0; w < (num_indi + 31) / 32; w++) {
+            uint64_t flip = ~out[w];
+            out[w] = flip ^ ((flip >> 1) & 0x5555555555555555ULL);
+        }
+        return;
+    }
+    for (int i = 0, indi_indx = 0; i < num_indi; i++) {
+        if (!rindi[i]) continue;
+        uint64_t code = bed_a1_code[(bed[i >> 2] >> ((i & 3) << 1)) & 3];
+        out[indi_indx >> 5] |= code << ((indi_indx & 31) << 1);
+        indi_indx++;
+    }
+}
+
 // some code are adopted from PLINK with modifications
 void gcta::read_bedfile(string bedfile)
 {
-    int i = 0, j = 0, k = 0;
+    int j = 0;
 
     // Flag for reading individuals and SNPs
     vector<int> rindi, rsnp;
@@ -213,41 +293,23 @@ void gcta::read_bedfile(string bedfile)
     if (_include.size() == 0) LOGGER.e(0, "no SNP is retained for analysis.");
     if (_keep.size() == 0) LOGGER.e(0, "no individual is retained for analysis.");
 
-    // Read bed file
-    char ch[1];
-    bitset<8> b;
-    _snp_1.resize(_include.size());
-    _snp_2.resize(_include.size());
-    for (i = 0; i < _include.size(); i++) {
-        _snp_1[i].reserve(_keep.size());
-        _snp_2[i].reserve(_keep.size());
-    }
+    // Read bed file, one SNP at a time
+    init_geno_bits(_include.size(), _keep.size());
+    bool keep_all = (_keep.size() == _indi_num);
+    uint64_t num_byte = (_indi_num + 3) / 4;
+    vector<unsigned char> buf(num_byte);
     fstream BIT(bedfile.c_str(), ios::in | ios::binary);
     if (!BIT) LOGGER.e(0, "cannot open the file [" + bedfile + "] to read.");
     LOGGER << "Reading PLINK BED file from [" + bedfile + "] in SNP-major format ..." << endl;
-    for (i = 0; i < 3; i++) BIT.read(ch, 1); // skip the first three bytes
-    int snp_indx = 0, indi_indx = 0;
-    for (j = 0, snp_indx = 0; j < _snp_num; j++) { // Read genotype in SNP-major mode, 00: homozygote AA; 11: homozygote BB; 01: hetezygote; 10: missing
-        if (!rsnp[j]) {
-            for (i = 0; i < _indi_num; i += 4) BIT.read(ch, 1);
-            continue;
-        }
-        for (i = 0, indi_indx = 0; i < _indi_num;) {
-            BIT.read(ch, 1);
-            if (!BIT) LOGGER.e(0, "problem with the BED file ... has the FAM/BIM file been changed?");
-            b = ch[0];
-            k = 0;
-            while (k < 7 && i < _indi_num) { // change code: 11 for AA; 00 for BB;
-                if (!rindi[i]) k += 2;
-                else {
-                    _snp_2[snp_indx][indi_indx] = (!b[k++]);
-                    _snp_1[snp_indx][indi_indx] = (!b[k++]);
-                    indi_indx++;
-                }
-                i++;
-            }
-        }
-        if (snp_indx == _include.size()) break;
+    int snp_indx = 0, pre_snp = -1;
+    for (j = 0, snp_indx = 0; j < _snp_num && snp_indx < _include.size(); j++) {
+        if (!rsnp[j]) continue;
+        // skip the first three bytes and the SNPs not retained
+        if (pre_snp < 0 || pre_snp != j - 1) BIT.seekg(3 + (uint64_t)j * num_byte);
+        BIT.read((char *)buf.data(), num_byte);
+        if (!BIT) LOGGER.e(0, "problem with the BED file ... has the FAM/BIM file been changed?");
+        decode_bed_snp(buf.data(), _indi_num, rindi, keep_all, &_geno_bits[snp_indx * _geno_words]);
+        pre_snp = j;
         snp_indx++;
     }
     BIT.clear();
@@ -616,43 +678,24 @@ void retrieve_snp(map<string,string> snp_chr_map, map<string,int> snp_id_map, ve
     for(i=0; i<nbfiles; i++) stable_sort(rsnp[i].begin(), rsnp[i].end());
 }
 
-void read_single_bedfile(string bedfile, vector<pair<int,int>> rsnp, vector<int> rindi, vector<vector<bool>> &snp1, vector<vector<bool>> &snp2, bool msg_flag)
+void read_single_bedfile(string bedfile, const vector<pair<int,int>> &rsnp, const vector<int> &rindi, vector<uint64_t> &geno_bits, uint64_t geno_words, bool msg_flag)
 {
-    int i = 0, j = 0, k = 0, t1 = 0, t2= 0, nsnp_chr = rsnp.size(), nindi_chr = rindi.size();
+    int t1 = 0, nsnp_chr = rsnp.size(), nindi_chr = rindi.size();
 
     // Read bed file
-    char ch[1];
-    bitset<8> b;
     fstream BIT(bedfile.c_str(), ios::in | ios::binary);
     if(!BIT) LOGGER.e(0, "cannot open the file [" + bedfile + "] to read.");
     if(msg_flag) LOGGER.i(0, "Reading PLINK BED file from [" + bedfile + "] in SNP-major format ...");
 
-    // skip the first three bytes
-    for (i = 0; i < 3; i++) BIT.read(ch, 1); 
-    int snp_indx = 0, indi_indx = 0;
-    // Read genotype in SNP-major mode, 00: homozygote AA; 11: homozygote BB; 01: hetezygote; 10: missing
-    for(j = 0, t1 = 0, snp_indx = 0; t1 < nsnp_chr; j++) { 
-        if(j!=rsnp[t1].first) {
-            for (i = 0; i < nindi_chr; i += 4) BIT.read(ch, 1);
-            continue;
-        }
-        snp_indx = rsnp[t1].second;
-        for (i = 0, indi_indx = 0; i < nindi_chr;) {
-            BIT.read(ch, 1);
-            if (!BIT) LOGGER.e(0, "problem with the BED file ... has the FAM/BIM file been changed?");
-            b = ch[0];
-            k = 0;
-            while (k < 7 && i < nindi_chr) { // change code: 11 for AA; 00 for BB;
-                if (!rindi[i]) k += 2;
-                else {
-                    snp2[snp_indx][indi_indx] = (!b[k++]);
-                    snp1[snp_indx][indi_indx] = (!b[k++]);
-                    indi_indx++;
-                }
-                i++;
-            }
-        }
-        t1++;
+    bool keep_all = (std::count(rindi.begin(), rindi.end(), 1) == nindi_chr);
+    uint64_t num_byte = (nindi_chr + 3) / 4;
+    vector<unsigned char> buf(num_byte);
+    // rsnp is sorted by the position in the file; skip the first three bytes
+    for(t1 = 0; t1 < nsnp_chr; t1++) { 
+        BIT.seekg(3 + (uint64_t)rsnp[t1].first * num_byte);
+        BIT.read((char *)buf.data(), num_byte);
+        if (!BIT) LOGGER.e(0, "problem with the BED file ... has the FAM/BIM file been changed?");
+        decode_bed_snp(buf.data(), nindi_chr, rindi, keep_all, &geno_bits[rsnp[t1].second * geno_words]);
     }
     BIT.clear();
     BIT.close();
@@ -671,12 +714,7 @@ void gcta::read_multi_bedfiles(vector<string> multi_bfiles) {
 
     LOGGER.i(0, "Reading PLINK BED files ...");
     // Initialize the matrix
-    _snp_1.clear(); _snp_2.clear();
-    _snp_1.resize(_include.size()); _snp_2.resize(_include.size());
-    for (i = 0; i < _include.size(); i++) {
-        _snp_1[i].reserve(_keep.size());
-        _snp_2[i].reserve(_keep.size());
-    }
+    init_geno_bits(_include.size(), _keep.size());
 
     // Update the map to retrieve individuals and SNPs
     update_id_chr_map(_snp_name_per_chr, _snp_name_map);
@@ -696,7 +734,7 @@ void gcta::read_multi_bedfiles(vector<string> multi_bfiles) {
             continue;
         }
         bedfile = multi_bfiles[i] + ".bed";
-        read_single_bedfile(bedfile, rsnp[i], rindi_flag, _snp_1, _snp_2, false);
+        read_single_bedfile(bedfile, rsnp[i], rindi_flag, _geno_bits, _geno_words, false);
     }
 
     LOGGER.i(0, "Genotype data for " + to_string(_keep.size()) + " individuals and " + to_string(_include.size()) + " SNPs have been included.");
@@ -1134,6 +1172,177 @@ void gcta::read_imp_dose_beagle(string zdosefile, string kp_indi_file, string rm
     zinf.close();
 }
 
+// PLINK2 sample file: "#FID IID ..." or "#IID ..." header, or no header in the FAM layout
+void gcta::read_psamfile(string psamfile) {
+    ifstream Psam(psamfile.c_str());
+    if (!Psam) LOGGER.e(0, "cannot open the file [" + psamfile + "] to read.");
+    LOGGER << "Reading PLINK2 PSAM file from [" + psamfile + "]." << endl;
+
+    int i = 0, iFID = 0, iIID = 1, iPAT = 2, iMAT = 3, iSEX = 4, iPHENO = 5;
+    string str_buf;
+    vector<string> vs_buf;
+    _fid.clear();
+    _pid.clear();
+    _fa_id.clear();
+    _mo_id.clear();
+    _sex.clear();
+    _pheno.clear();
+    bool head_flag = true;
+    while (getline(Psam, str_buf)) {
+        if (str_buf.empty() || str_buf.substr(0, 2) == "##") continue;
+        int ncol = StrFunc::split_string(str_buf, vs_buf, " \t\n");
+        if (ncol == 0) continue;
+        if (head_flag && vs_buf[0][0] == '#') {
+            iFID = iIID = iPAT = iMAT = iSEX = iPHENO = -1;
+            for (i = 0; i < ncol; i++) {
+                if (vs_buf[i] == "#FID") iFID = i;
+                else if (vs_buf[i] == "IID" || vs_buf[i] == "#IID") iIID = i;
+                else if (vs_buf[i] == "PAT") iPAT = i;
+                else if (vs_buf[i] == "MAT") iMAT = i;
+                else if (vs_buf[i] == "SEX") iSEX = i;
+                else if (iPHENO < 0 && vs_buf[i] == "PHENO1") iPHENO = i;
+            }
+            if (iIID < 0) LOGGER.e(0, "can't find IID or #IID in the header of [" + psamfile + "].");
+            // without FID, the IID is taken as the family ID as well
+            if (iFID < 0) iFID = iIID;
+            head_flag = false;
+            continue;
+        }
+        head_flag = false;
+        if (ncol <= iFID || ncol <= iIID || ncol <= iPAT || ncol <= iMAT || ncol <= iSEX || ncol <= iPHENO) LOGGER.e(0, "invalid line in [" + psamfile + "]: " + str_buf);
+        _fid.push_back(vs_buf[iFID]);
+        _pid.push_back(vs_buf[iIID]);
+        _fa_id.push_back(iPAT < 0 ? "0" : vs_buf[iPAT]);
+        _mo_id.push_back(iMAT < 0 ? "0" : vs_buf[iMAT]);
+        _sex.push_back(iSEX < 0 ? 0 : atoi(vs_buf[iSEX].c_str()));
+        _pheno.push_back(iPHENO < 0 ? -9 : atoi(vs_buf[iPHENO].c_str()));
+    }
+    Psam.close();
+    _indi_num = _fid.size();
+    LOGGER << _indi_num << " individuals to be included from [" + psamfile + "]." << endl;
+
+    // Initialize _keep
+    init_keep();
+}
+
+// PLINK2 variant file: "#CHROM POS ID REF ALT ..." header, or no header in the BIM layout.
+// ALT is taken as A1, the same as the PGEN readers of --pfile in the other analyses
+void gcta::read_pvarfile(string pvarfile) {
+    ifstream Pvar(pvarfile.c_str());
+    if (!Pvar) LOGGER.e(0, "cannot open the file [" + pvarfile + "] to read.");
+    LOGGER << "Reading PLINK2 PVAR file from [" + pvarfile + "]." << endl;
+
+    int i = 0, iChr = 0, iID = 1, iCM = 2, iPOS = 3, iA1 = 4, iA2 = 5;
+    string str_buf;
+    vector<string> vs_buf;
+    _chr.clear();
+    _snp_name.clear();
+    _genet_dst.clear();
+    _bp.clear();
+    _allele1.clear();
+    _allele2.clear();
+    bool head_flag = true;
+    while (getline(Pvar, str_buf)) {
+        if (str_buf.empty() || str_buf.substr(0, 2) == "##") continue;
+        int ncol = StrFunc::split_string(str_buf, vs_buf, " \t\n");
+        if (ncol == 0) continue;
+        if (head_flag && vs_buf[0] == "#CHROM") {
+            iID = iCM = iPOS = iA1 = iA2 = -1;
+            for (i = 1; i < ncol; i++) {
+                if (vs_buf[i] == "ID") iID = i;
+                else if (vs_buf[i] == "CM") iCM = i;
+                else if (vs_buf[i] == "POS") iPOS = i;
+                else if (vs_buf[i] == "ALT") iA1 = i;
+                else if (vs_buf[i] == "REF") iA2 = i;
+            }
+            if (iID < 0 || iPOS < 0 || iA1 < 0 || iA2 < 0) LOGGER.e(0, "can't find all the essential columns (POS, ID, REF and ALT) in [" + pvarfile + "].");
+            head_flag = false;
+            continue;
+        }
+        head_flag = false;
+        if (ncol <= iID || ncol <= iCM || ncol <= iPOS || ncol <= iA1 || ncol <= iA2) LOGGER.e(0, "invalid line in [" + pvarfile + "]: " + str_buf);
+        string chr = vs_buf[iChr];
+        StrFunc::to_upper(chr);
+        if (chr.substr(0, 3) == "CHR") chr = chr.substr(3);
+        // the numeric codes of PLINK for the species of --autosome-num, X is _autosome_num + 1
+        if (chr == "X") _chr.push_back(_autosome_num + 1);
+        else if (chr == "Y") _chr.push_back(_autosome_num + 2);
+        else if (chr == "XY" || chr == "PAR1" || chr == "PAR2") _chr.push_back(_autosome_num + 3);
+        else if (chr == "MT" || chr == "M") _chr.push_back(_autosome_num + 4);
+        else _chr.push_back(atoi(chr.c_str()));
+        _snp_name.push_back(vs_buf[iID]);
+        _genet_dst.push_back(iCM < 0 ? 0.0 : atof(vs_buf[iCM].c_str()));
+        _bp.push_back(atoi(vs_buf[iPOS].c_str()));
+        if (vs_buf[iA1].find(',') != string::npos) LOGGER.e(0, "multi-allelic variant [" + vs_buf[iID] + "] is not supported. Please split it by PLINK2 first.");
+        StrFunc::to_upper(vs_buf[iA1]);
+        StrFunc::to_upper(vs_buf[iA2]);
+        _allele1.push_back(vs_buf[iA1]);
+        _allele2.push_back(vs_buf[iA2]);
+    }
+    Pvar.close();
+    _snp_num = _chr.size();
+    _ref_A = _allele1;
+    _other_A = _allele2;
+    LOGGER << _snp_num << " SNPs to be included from [" + pvarfile + "]." << endl;
+
+    // Initialize _include
+    init_include();
+}
+
+// dosage: the A1 dosages go to _geno_dose (1e6 for missing), as the MACH and BEAGLE dosage data;
+// otherwise the hard calls are packed as the BED genotypes
+void gcta::read_pgenfile(string pgenfile, bool dosage) {
+    int i = 0, j = 0;
+
+    // Flag for reading individuals and SNPs
+    vector<int> rindi, rsnp;
+    get_rindi(rindi);
+    get_rsnp(rsnp);
+
+    if (_include.size() == 0) LOGGER.e(0, "no SNP is retained for analysis.");
+    if (_keep.size() == 0) LOGGER.e(0, "no individual is retained for analysis.");
+
+    vector<uint32_t> kp_indx;
+    for (i = 0; i < _indi_num; i++) {
+        if (rindi[i]) kp_indx.push_back(i);
+    }
+    int num_keep = kp_indx.size();
+    uint32_t raw_sample_ct = _indi_num, raw_snp_ct = _snp_num;
+    PgenReader reader;
+    reader.Load(pgenfile, &raw_sample_ct, &raw_snp_ct, kp_indx);
+    LOGGER << "Reading PLINK2 PGEN file from [" + pgenfile + "] (" << (dosage ? "dosages" : "hard calls") << ") ..." << endl;
+
+    // allele index 1 is ALT, i.e. A1
+    int snp_indx = 0;
+    if (dosage) {
+        _dosage_flag = true;
+        _geno_dose.clear();
+        _geno_dose.resize(num_keep);
+        for (i = 0; i < num_keep; i++) _geno_dose[i].resize(_include.size());
+        vector<double> buf(num_keep);
+        for (j = 0, snp_indx = 0; j < _snp_num; j++) {
+            if (!rsnp[j]) continue;
+            reader.Read(buf, j, 1);
+            for (i = 0; i < num_keep; i++) _geno_dose[i][snp_indx] = std::isnan(buf[i]) ? 1e6 : buf[i];
+            snp_indx++;
+        }
+    } else {
+        init_geno_bits(_include.size(), num_keep);
+        vector<int32_t> buf(num_keep);
+        for (j = 0, snp_indx = 0; j < _snp_num; j++) {
+            if (!rsnp[j]) continue;
+            reader.ReadIntHardcalls(buf, j, 1);
+            for (i = 0; i < num_keep; i++) set_geno_a1(snp_indx, i, buf[i]);
+            snp_indx++;
+        }
+    }
+    reader.Close();
+    LOGGER << "Genotype data for " << _keep.size() << " individuals and " << _include.size() << " SNPs to be included from [" + pgenfile + "]." << endl;
+
+    update_fam(rindi);
+    update_bim(rsnp);
+}
+
 void gcta::save_plink() {
     if (_dosage_flag) dose2bed();
     save_famfile();
@@ -1142,7 +1351,7 @@ void gcta::save_plink() {
 }
 
 void gcta::save_bedfile() {
-    int i = 0, pos = 0, j = 0;
+    int i = 0, j = 0;
     string OutBedFile = _out + ".bed";
     fstream OutBed(OutBedFile.c_str(), ios::out | ios::binary);
     if (!OutBed) LOGGER.e(0, "cannot open the file [" + OutBedFile + "] to write.");
@@ -1167,19 +1376,16 @@ void gcta::save_bedfile() {
     b.set(0);
     ch[0] = (char) b.to_ulong();
     OutBed.write(ch, 1);
+    // number of A1 alleles (3 for missing) back to the BED code
+    const unsigned char a1_bed_code[4] = {3, 2, 0, 1};
+    vector<unsigned char> row((_keep.size() + 3) / 4);
     for (i = 0; i < _include.size(); i++) {
-        pos = 0;
-        b.reset();
+        std::fill(row.begin(), row.end(), 0);
         for (j = 0; j < _keep.size(); j++) {
-            b[pos++] = (!_snp_2[_include[i]][_keep[j]]);
-            b[pos++] = (!_snp_1[_include[i]][_keep[j]]);
-            if (pos > 7 || j == _keep.size() - 1) {
-                ch[0] = (char) b.to_ulong();
-                OutBed.write(ch, 1);
-                pos = 0;
-                b.reset();
-            }
+            int g = geno_a1(_include[i], _keep[j]);
+            row[j >> 2] |= a1_bed_code[g < 0 ? 3 : g] << ((j & 3) << 1);
         }
+        OutBed.write((char *)row.data(), row.size());
     }
     OutBed.close();
 }
@@ -1215,33 +1421,26 @@ void gcta::dose2bed() {
     double d_buf = 0.0;
 
     LOGGER << "Converting dosage data into PLINK binary PED format ... " << endl;
-    _snp_1.resize(_snp_num);
-    _snp_2.resize(_snp_num);
-    for (i = 0; i < _snp_num; i++){
-        _snp_1[i].resize(_indi_num);
-        _snp_2[i].resize(_indi_num);       
-    }  
+    init_geno_bits(_snp_num, _indi_num);
     for (i = 0; i < _include.size(); i++) {  
         for (j = 0; j < _keep.size(); j++) {
            d_buf = _geno_dose[_keep[j]][_include[i]];
-            if (d_buf > 1e5) {
-                _snp_2[_include[i]][_keep[j]] = false;
-                _snp_1[_include[i]][_keep[j]] = true;
-            } else if (d_buf >= 1.5) _snp_1[_include[i]][_keep[j]] = _snp_2[_include[i]][_keep[j]] = true;
-            else if (d_buf > 0.5) {
-                _snp_2[_include[i]][_keep[j]] = true;
-                _snp_1[_include[i]][_keep[j]] = false;
-            } else if (d_buf <= 0.5) _snp_1[_include[i]][_keep[j]] = _snp_2[_include[i]][_keep[j]] = false;
+            if (d_buf > 1e5) set_geno_a1(_include[i], _keep[j], -1);
+            else if (d_buf >= 1.5) set_geno_a1(_include[i], _keep[j], 2);
+            else if (d_buf > 0.5) set_geno_a1(_include[i], _keep[j], 1);
+            else set_geno_a1(_include[i], _keep[j], 0);
         }
     }
 }
 
 void gcta::update_id_map_kp(const vector<string> &id_list, map<string, int> &id_map, vector<int> &keep) {
-    int i = 0;
-    map<string, int> id_map_buf(id_map);
-    for (i = 0; i < id_list.size(); i++) id_map_buf.erase(id_list[i]);
+    // look the IDs up in a hash index of the list rather than copying the whole map
+    StrIndex list_index(id_list);
     map<string, int>::iterator iter;
-    for (iter = id_map_buf.begin(); iter != id_map_buf.end(); iter++) id_map.erase(iter->first);
+    for (iter = id_map.begin(); iter != id_map.end();) {
+        if (list_index.find(iter->first) < 0) iter = id_map.erase(iter);
+        else ++iter;
+    }
 
     keep.clear();
     for (iter = id_map.begin(); iter != id_map.end(); iter++) keep.push_back(iter->second);
@@ -1585,17 +1784,26 @@ void gcta::calcu_mu(bool ssq_flag) {
     _mu.clear();
     _mu.resize(_snp_num);
 
-    #pragma omp parallel for
-    for (int j = 0; j < _include.size(); j++) {
-        if (_chr[_include[j]]<(_autosome_num + 1)) {
-            mu_func(j, auto_fac);
-        }else if (_chr[_include[j]] == (_autosome_num + 1)) {
-            if(no_sex_info){
-                flag_x_problem = true;
+    vector<uintptr_t> mask;
+    if (!_dosage_flag) geno_keep_mask(mask);
+    const double val[4] = {0.0, 1.0, 2.0, 1e6};
+    #pragma omp parallel
+    {
+        vector<double> x(_dosage_flag ? 0 : _keep.size());
+        vector<uintptr_t> buf;
+        #pragma omp for
+        for (int j = 0; j < _include.size(); j++) {
+            if (!_dosage_flag) geno_row(j, val, mask, buf, x.data());
+            if (_chr[_include[j]]<(_autosome_num + 1)) {
+                mu_func(j, auto_fac, x);
+            }else if (_chr[_include[j]] == (_autosome_num + 1)) {
+                if(no_sex_info){
+                    flag_x_problem = true;
+                }
+                mu_func(j, xfac, x);
+            }else{
+                mu_func(j, fac, x);
             }
-            mu_func(j, xfac);
-        }else{
-            mu_func(j, fac);
         }
     }
 
@@ -1617,9 +1825,9 @@ void gcta::calcu_maf()
     }
 }
 
-void gcta::mu_func(int j, vector<double> &fac) {
+void gcta::mu_func(int j, vector<double> &fac, const vector<double> &x) {
     int i = 0;
-    double fcount = 0.0, f_buf = 0.0;
+    double fcount = 0.0;
     if (_dosage_flag) {
         for (i = 0; i < _keep.size(); i++) {
             if (_geno_dose[_keep[i]][_include[j]] < 1e5) {
@@ -1629,10 +1837,8 @@ void gcta::mu_func(int j, vector<double> &fac) {
         }
     } else {
         for (i = 0; i < _keep.size(); i++) {
-            if (!_snp_1[_include[j]][_keep[i]] || _snp_2[_include[j]][_keep[i]]) {
-                f_buf = (_snp_1[_include[j]][_keep[i]] + _snp_2[_include[j]][_keep[i]]);
-                if (_allele2[_include[j]] == _ref_A[_include[j]]) f_buf = 2.0 - f_buf;
-                _mu[_include[j]] += fac[i] * f_buf;
+            if (x[i] < 1e5) {
+                _mu[_include[j]] += fac[i] * x[i];
                 fcount += fac[i];
             }
         }
@@ -1767,9 +1973,9 @@ bool gcta::make_XMat(MatrixXf &X)
 
     X.resize(0,0);
     X.resize(n, m);
-    #pragma omp parallel for private(j)
-    for (i = 0; i < n; i++) {
-        if (_dosage_flag) {
+    if (_dosage_flag) {
+        #pragma omp parallel for private(j)
+        for (i = 0; i < n; i++) {
             for (j = 0; j < m; j++) {
                 if (_geno_dose[_keep[i]][_include[j]] < 1e5) {
                     if (_allele1[_include[j]] == _ref_A[_include[j]]) X(i,j) = _geno_dose[_keep[i]][_include[j]];
@@ -1781,16 +1987,23 @@ bool gcta::make_XMat(MatrixXf &X)
                 }
             }
             _geno_dose[i].clear();
-        } 
-        else {
-            for (j = 0; j < _include.size(); j++) {
-                if (!_snp_1[_include[j]][_keep[i]] || _snp_2[_include[j]][_keep[i]]) {
-                    if (_allele1[_include[j]] == _ref_A[_include[j]]) X(i,j) = _snp_1[_include[j]][_keep[i]] + _snp_2[_include[j]][_keep[i]];
-                    else X(i,j) = 2.0 - (_snp_1[_include[j]][_keep[i]] + _snp_2[_include[j]][_keep[i]]);
-                } 
-                else {
-                    X(i,j) = 1e6;
-                    have_mis = true;
+        }
+    } 
+    else {
+        // one SNP row at a time into the column of X
+        vector<uintptr_t> mask;
+        geno_keep_mask(mask);
+        const double val[4] = {0.0, 1.0, 2.0, 1e6};
+        #pragma omp parallel private(i)
+        {
+            vector<double> x(n);
+            vector<uintptr_t> buf;
+            #pragma omp for
+            for (j = 0; j < m; j++) {
+                geno_row(j, val, mask, buf, x.data());
+                for (i = 0; i < n; i++) {
+                    X(i,j) = x[i];
+                    if (x[i] > 1e5) have_mis = true;
                 }
             }
         }
@@ -1808,9 +2021,9 @@ bool gcta::make_XMat_d(MatrixXf &X)
 
     X.resize(0,0);
     X.resize(n, m);
-    #pragma omp parallel for private(j)
-    for (i = 0; i < n; i++) {
-        if (_dosage_flag) {
+    if (_dosage_flag) {
+        #pragma omp parallel for private(j)
+        for (i = 0; i < n; i++) {
             for (j = 0; j < m; j++) {
                 if (_geno_dose[_keep[i]][_include[j]] < 1e5) {
                     if (_allele1[_include[j]] == _ref_A[_include[j]]) X(i,j) = _geno_dose[_keep[i]][_include[j]];
@@ -1825,19 +2038,23 @@ bool gcta::make_XMat_d(MatrixXf &X)
                 }
             }
             _geno_dose[i].clear();
-        } 
-        else {
-            for (j = 0; j < _include.size(); j++) {
-                if (!_snp_1[_include[j]][_keep[i]] || _snp_2[_include[j]][_keep[i]]) {
-                    if (_allele1[_include[j]] == _ref_A[_include[j]]) X(i,j) = _snp_1[_include[j]][_keep[i]] + _snp_2[_include[j]][_keep[i]];
-                    else X(i,j) = 2.0 - (_snp_1[_include[j]][_keep[i]] + _snp_2[_include[j]][_keep[i]]);
-                    if (X(i,j) < 0.5) X(i,j) = 0.0;
-                    else if (X(i,j) < 1.5) X(i,j) = _mu[_include[j]];
-                    else X(i,j) = (2.0 * _mu[_include[j]] - 2.0);
-                } 
-                else{
-                    X(i,j) = 1e6;
-                    have_mis = true;
+        }
+    } 
+    else {
+        vector<uintptr_t> mask;
+        geno_keep_mask(mask);
+        #pragma omp parallel private(i)
+        {
+            vector<double> x(n);
+            vector<uintptr_t> buf;
+            #pragma omp for
+            for (j = 0; j < m; j++) {
+                double mu = _mu[_include[j]];
+                const double val[4] = {0.0, mu, 2.0 * mu - 2.0, 1e6};
+                geno_row(j, val, mask, buf, x.data());
+                for (i = 0; i < n; i++) {
+                    X(i,j) = x[i];
+                    if (x[i] > 1e5) have_mis = true;
                 }
             }
         }
@@ -1937,35 +2154,20 @@ void gcta::std_XMat_d(MatrixXf &X, eigenVector &sd_SNP, bool miss_with_mu, bool
 
 void gcta::makex_eigenVector(int j, eigenVector &x, bool resize, bool minus_2p)
 {
-    int i = 0;
     if (resize) x.resize(_keep.size());
-    #pragma omp parallel for
-    for (i = 0; i < _keep.size(); i++) {
-        if (!_snp_1[_include[j]][_keep[i]] || _snp_2[_include[j]][_keep[i]]) {
-            if (_allele1[_include[j]] == _ref_A[_include[j]]) x[i] = (_snp_1[_include[j]][_keep[i]] + _snp_2[_include[j]][_keep[i]]);
-            else x[i] = 2.0 - (_snp_1[_include[j]][_keep[i]] + _snp_2[_include[j]][_keep[i]]);
-        }
-        else x[i] = _mu[_include[j]];
-        if (minus_2p) x[i] -= _mu[_include[j]];
-    }
+    double mu = _mu[_include[j]], c = minus_2p ? mu : 0.0;
+    const double val[4] = {-c, 1.0 - c, 2.0 - c, mu - c};
+    geno_row(j, val, x.data());
 }
 
 //change here: returns standardized genotypes
 void gcta::makex_eigenVector_std(int j, eigenVector &x, bool resize, double snp_std)
 {
-    int i = 0;
     if (resize) x.resize(_keep.size());
-    #pragma omp parallel for
-    for (i = 0; i < _keep.size(); i++) {
-        if (!_snp_1[_include[j]][_keep[i]] || _snp_2[_include[j]][_keep[i]]) {
-            if (_allele1[_include[j]] == _ref_A[_include[j]]) x[i] = (_snp_1[_include[j]][_keep[i]] + _snp_2[_include[j]][_keep[i]]);
-            else x[i] = 2.0 - (_snp_1[_include[j]][_keep[i]] + _snp_2[_include[j]][_keep[i]]);
-        }
-        else x[i] = _mu[_include[j]];
-        // change here: subtract mean and divide by std
-        x[i] -= _mu[_include[j]];
-        x[i] /= snp_std;
-    }
+    // change here: subtract mean and divide by std
+    double mu = _mu[_include[j]];
+    const double val[4] = {-mu / snp_std, (1.0 - mu) / snp_std, (2.0 - mu) / snp_std, 0.0};
+    geno_row(j, val, x.data());
 }
 
 
@@ -1998,7 +2200,28 @@ void gcta::save_XMat(bool miss_with_mu, bool std)
     zoutf << "Reference Allele ";
     for (j = 0; j < _include.size(); j++) zoutf << _ref_A[_include[j]] << " ";
     zoutf << endl;
-    for (i = 0; i < _keep.size(); i++) {
+    // the file is written individual by individual: decode the SNP rows into X
+    // for a block of individuals at a time, at most 2^28 values
+    int n = _keep.size(), num_blk = std::max(1, std::min(n, (1 << 28) / std::max(m, 1)));
+    MatrixXf X;
+    vector<uintptr_t> mask;
+    if (!_dosage_flag) geno_keep_mask(mask);
+    const double val[4] = {0.0, 1.0, 2.0, 1e6};
+    for (i = 0; i < n; i++) {
+        if (!_dosage_flag && i % num_blk == 0) {
+            int i0 = i, nb = std::min(num_blk, n - i);
+            X.resize(nb, m);
+            #pragma omp parallel
+            {
+                vector<double> x(n);
+                vector<uintptr_t> buf;
+                #pragma omp for
+                for (int k = 0; k < m; k++) {
+                    geno_row(k, val, mask, buf, x.data());
+                    for (int l = 0; l < nb; l++) X(l,k) = x[i0 + l];
+                }
+            }
+        }
         zoutf << _fid[_keep[i]] << ' ' << _pid[_keep[i]] << ' ';
         if (_dosage_flag) {
             for (j = 0; j < _include.size(); j++) {
@@ -2017,9 +2240,8 @@ void gcta::save_XMat(bool miss_with_mu, bool std)
             }
         } else {
             for (j = 0; j < _include.size(); j++) {
-                if (!_snp_1[_include[j]][_keep[i]] || _snp_2[_include[j]][_keep[i]]) {
-                    if (_allele1[_include[j]] == _ref_A[_include[j]]) x_buf = _snp_1[_include[j]][_keep[i]] + _snp_2[_include[j]][_keep[i]];
-                    else x_buf = 2.0 - (_snp_1[_include[j]][_keep[i]] + _snp_2[_include[j]][_keep[i]]);
+                if (X(i % num_blk, j) < 1e5) {
+                    x_buf = X(i % num_blk, j);
                     if(std) x_buf = (x_buf - _mu[_include[j]]) * sd_SNP(j);
                     zoutf << x_buf << ' ';                    
                 } else {
@@ -2045,16 +2267,18 @@ bool gcta::make_XMat_subset(MatrixXf &X, vector<int> &snp_indx, bool divid_by_st
     int i = 0, j = 0, k = 0, n = _keep.size(), m = snp_indx.size();
 
     X.resize(n, m);
-    #pragma omp parallel for private(j, k)
-    for (i = 0; i < n; i++) {
+    vector<uintptr_t> mask;
+    geno_keep_mask(mask);
+    #pragma omp parallel private(i, k)
+    {
+        vector<double> x(n);
+        vector<uintptr_t> buf;
+        #pragma omp for
         for (j = 0; j < m; j++) {
             k = _include[snp_indx[j]];
-            if (!_snp_1[k][_keep[i]] || _snp_2[k][_keep[i]]) {
-                if (_allele1[k] == _ref_A[k]) X(i,j) = _snp_1[k][_keep[i]] + _snp_2[k][_keep[i]];
-                else X(i,j) = 2.0 - (_snp_1[k][_keep[i]] + _snp_2[k][_keep[i]]);
-                X(i,j) -= _mu[k];
-            } 
-            else X(i,j) = 0.0;
+            const double val[4] = {-_mu[k], 1.0 - _mu[k], 2.0 - _mu[k], 0.0};
+            geno_row(snp_indx[j], val, mask, buf, x.data());
+            for (i = 0; i < n; i++) X(i,j) = x[i];
         }
     }
 
@@ -2080,19 +2304,19 @@ bool gcta::make_XMat_d_subset(MatrixXf &X, vector<int> &snp_indx, bool divid_by_
     int i = 0, j = 0, k = 0, n = _keep.size(), m = snp_indx.size();
 
     X.resize(n, m);
-    #pragma omp parallel for private(j, k)
-    for (i = 0; i < n; i++) {
+    vector<uintptr_t> mask;
+    geno_keep_mask(mask);
+    #pragma omp parallel private(i, k)
+    {
+        vector<double> x(n);
+        vector<uintptr_t> buf;
+        #pragma omp for
         for (j = 0; j < m; j++) {
             k = _include[snp_indx[j]];
-            if (!_snp_1[k][_keep[i]] || _snp_2[k][_keep[i]]) {
-                if (_allele1[k] == _ref_A[k]) X(i,j) = _snp_1[k][_keep[i]] + _snp_2[k][_keep[i]];
-                else X(i,j) = 2.0 - (_snp_1[k][_keep[i]] + _snp_2[k][_keep[i]]);
-                if (X(i,j) < 0.5) X(i,j) = 0.0;
-                else if (X(i,j) < 1.5) X(i,j) = _mu[k];
-                else X(i,j) = (2.0 * _mu[k] - 2.0);
-                X(i,j) -= 0.5 * _mu[k] * _mu[k];
-            } 
-            else X(i,j) = 0.0;
+            double h = 0.5 * _mu[k] * _mu[k];
+            const double val[4] = {-h, _mu[k] - h, 2.0 * _mu[k] - 2.0 - h, 0.0};
+            geno_row(snp_indx[j], val, mask, buf, x.data());
+            for (i = 0; i < n; i++) X(i,j) = x[i];
         }
     }
 
@@ -11,6 +11,7 @@
  */
 
 #include "gcta.h"
+#include "GRMReader.h"
 #include "mem.hpp"
 
 void gcta::set_reml_diag_mul(double value){
@@ -253,8 +254,26 @@ void gcta::fit_reml(string grm_file, string phen_file, string qcovar_file, strin
     vector<string> phen_ID, qcovar_ID, covar_ID, qGE_ID, GE_ID, grm_id, grm_files;
     vector< vector<string> > phen_buf, qcovar, covar, GE, qGE; // save individuals by column
 
+    // the GRM is subset straight from the mapped binary file unless it has to be adjusted as a whole
+    bool grm_map_flag = _grm_bin_flag && !(grm_cutoff > -1.0) && !(adj_grm_fac > -1.0) && !(dosage_compen > -1);
+    // within-family REML reads the non-zero elements of the GRMs into _Asp, the dense _A is never filled
+    bool grm_sparse_flag = within_family && grm_map_flag && !reml_diag_one && !reml_bending && !GE_flag && !qGE_flag && weight_file.empty();
+    if (_reml_matfree) {
+        if (!grm_flag && !m_grm_flag) LOGGER.e(0, "--reml-matfree needs the GRM(s) specified by --grm or --mgrm.");
+        if (!grm_map_flag) LOGGER.e(0, "--reml-matfree reads the binary GRM in place. It can't be used with --grm-cutoff, --grm-adj, --dc or the text GRM.");
+        if (mlmassoc || within_family || reml_bending || reml_diag_one || GE_flag || qGE_flag || _cv_blup) {
+            LOGGER.e(0, "--reml-matfree can't be used with --mlma, --reml-wfam, --reml-bending, --reml-diag-one, --gxe, --qgxe or --cvblup.");
+        }
+    }
+    if (_reml_spectral) {
+        if (!grm_flag) LOGGER.e(0, "--reml-spectral needs a single GRM specified by --grm.");
+        if (_reml_matfree) LOGGER.e(0, "--reml-spectral can't be used with --reml-matfree.");
+        if (within_family || GE_flag || qGE_flag || _cv_blup || !weight_file.empty()) {
+            LOGGER.e(0, "--reml-spectral can't be used with --reml-wfam, --gxe, --qgxe, --cvblup or --reml-res-diag.");
+        }
+    }
     if (grm_flag) {
-        read_grm(grm_file, grm_id, true, false, !(adj_grm_fac > -1.0));
+        read_grm(grm_file, grm_id, true, grm_map_flag, !(adj_grm_fac > -1.0));
         update_id_map_kp(grm_id, _id_map, _keep);
         grm_files.push_back(grm_file);
     } 
@@ -342,13 +361,22 @@ void gcta::fit_reml(string grm_file, string phen_file, string qcovar_file, strin
         for (int i = 0; i < 1 + qE_fac_num + E_fac_num + 1; i++) _r_indx.push_back(i);
         if (!no_lrt) drop_comp(drop);
         _A.resize(_r_indx.size());
+        if (grm_sparse_flag) _Asp.resize(_r_indx.size());
         if (mlmassoc) StrFunc::match(uni_id, grm_id, kp);
         else kp = _keep;
-        (_A[0]) = eigenMatrix::Zero(_n, _n);
+        if (_reml_matfree) {
+            _reml_matfree_grm.push_back(make_shared<GRMReader>(grm_file, grm_id.size()));
+            _reml_matfree_kp.push_back(kp);
+        }
+        else if (grm_sparse_flag) extract_grm_bin_sparse(grm_file, grm_id.size(), kp, _Asp[0]);
+        else if (grm_map_flag) extract_grm_bin(grm_file, grm_id.size(), kp, _A[0]);
+        else {
+            (_A[0]) = eigenMatrix::Zero(_n, _n);
 
-        #pragma omp parallel for
-        for (int i = 0; i < _n; i++) {
-            for (int j = 0; j <= i; j++) (_A[0])(j, i) = (_A[0])(i, j) = _grm(kp[i], kp[j]);
+            #pragma omp parallel for
+            for (int i = 0; i < _n; i++) {
+                for (int j = 0; j <= i; j++) (_A[0])(j, i) = (_A[0])(i, j) = _grm(kp[i], kp[j]);
+            }
         }
         if (_reml_diag_one) {
             double diag_mean = (_A[0]).diagonal().mean();
@@ -370,22 +398,31 @@ void gcta::fit_reml(string grm_file, string phen_file, string qcovar_file, strin
         for (int i = 0; i < (1 + qE_fac_num + E_fac_num) * grm_files.size() + 1; i++) _r_indx.push_back(i);
         if (!no_lrt) drop_comp(drop);
         _A.resize(_r_indx.size());
+        if (grm_sparse_flag) _Asp.resize(_r_indx.size());
         string prev_file = grm_files[0];
         vector<string> prev_grm_id(grm_id);
         LOGGER << "There are " << grm_files.size() << " GRM file names specified in the file [" + grm_file + "]." << endl;
         for (int i = 0; i < grm_files.size(); i++, pos++) {
             LOGGER << "Reading the GRM from the " << i + 1 << "th file ..." << endl;
-            read_grm(grm_files[i], grm_id, true, false, !(adj_grm_fac > -1.0));
+            read_grm(grm_files[i], grm_id, true, grm_map_flag, !(adj_grm_fac > -1.0));
             if (adj_grm_fac>-1.0) adj_grm(adj_grm_fac);
             if (dosage_compen>-1) dc(dosage_compen);
             StrFunc::match(uni_id, grm_id, kp);
-            (_A[pos]) = eigenMatrix::Zero(_n, _n);
+            if (_reml_matfree) {
+                _reml_matfree_grm.push_back(make_shared<GRMReader>(grm_files[i], grm_id.size()));
+                _reml_matfree_kp.push_back(kp);
+            }
+            else if (grm_sparse_flag) extract_grm_bin_sparse(grm_files[i], grm_id.size(), kp, _Asp[pos]);
+            else if (grm_map_flag) extract_grm_bin(grm_files[i], grm_id.size(), kp, _A[pos]);
+            else {
+                (_A[pos]) = eigenMatrix::Zero(_n, _n);
 
-            #pragma omp parallel for
-            for (int j = 0; j < _n; j++) {
-                for (int k = 0; k <= j; k++) {
-                    if (kp[j] >= kp[k]) (_A[pos])(k, j) = (_A[pos])(j, k) = _grm(kp[j], kp[k]);
-                    else (_A[pos])(k, j) = (_A[pos])(j, k) = _grm(kp[k], kp[j]);
+                #pragma omp parallel for
+                for (int j = 0; j < _n; j++) {
+                    for (int k = 0; k <= j; k++) {
+                        if (kp[j] >= kp[k]) (_A[pos])(k, j) = (_A[pos])(j, k) = _grm(kp[j], kp[k]);
+                        else (_A[pos])(k, j) = (_A[pos])(j, k) = _grm(kp[k], kp[j]);
+                    }
                 }
             }
 
@@ -412,8 +449,22 @@ void gcta::fit_reml(string grm_file, string phen_file, string qcovar_file, strin
         _r_indx.push_back(0);
         _A.resize(_r_indx.size());
     }
-    _A[_r_indx.size() - 1] = eigenMatrix::Identity(_n, _n);
-    if(!weight_file.empty()){
+    if (_reml_matfree) {
+        // diagonals of the GRMs for the preconditioner; the residual component is diagonal
+        for (int i = 0; i < _reml_matfree_grm.size(); i++) {
+            _reml_matfree_diag.push_back(eigenVector(_n));
+            for (int j = 0; j < _n; j++) _reml_matfree_diag[i][j] = _reml_matfree_grm[i]->value(_reml_matfree_kp[i][j], _reml_matfree_kp[i][j]);
+        }
+        _reml_matfree_resid = eigenVector::Ones(_n);
+        for (int i = 0; i < weight_ID.size(); i++) {
+            iter = uni_id_map.find(weight_ID[i]);
+            if (iter != uni_id_map.end()) _reml_matfree_resid[iter->second] = weights[i];
+        }
+        LOGGER << "The GRMs are applied in place from the binary files, V^-1 by the conjugate gradients, with " << _reml_matfree_probes << " random probes for the trace and log-determinant (matrix-free REML)." << endl;
+        if (_reml_mtd == 1) LOGGER << "Fisher scoring is not available in the matrix-free REML, AI-REML is used instead." << endl;
+    }
+    else if (!_reml_spectral && !grm_sparse_flag) _A[_r_indx.size() - 1] = eigenMatrix::Identity(_n, _n);
+    if(!weight_file.empty() && !_reml_matfree){
         // contruct weight
         VectorXd v_weight(_n);
         for (int i = 0; i < weight_ID.size(); i++) {
@@ -508,13 +559,22 @@ void gcta::fit_reml(string grm_file, string phen_file, string qcovar_file, strin
 
     LOGGER << _n << " individuals are in common in these files." << endl;
 
-    // within family
-    if (_within_family) detect_family();
+    // within family, iterated on the sparse components unless the Fisher scoring asks for the whole P
+    if (_within_family) {
+        detect_family();
+        _reml_sparse = !mlmassoc && _reml_mtd != 1 && !_cv_blup;
+    }
 
     // bending
     if (reml_bending) bend_A();
     //LOGGER << "Prepare time: " << LOGGER.tp("main") << std::endl;
 
+    if (_reml_spectral) {
+        // the cache holds the GRM as it is in the file
+        bool grm_eig_flag = _grm_bin_flag && !(adj_grm_fac > -1.0) && !(dosage_compen > -1) && !reml_diag_one && !reml_bending;
+        reml_spectral_decomp(grm_eig_flag ? grm_file : "", kp);
+    }
+
     // run REML algorithm
     reml(pred_rand_eff, est_fix_eff, reml_priors, reml_priors_var, prevalence, -2.0, no_constrain, no_lrt, mlmassoc);
 }
@@ -752,7 +812,16 @@ void gcta::reml(bool pred_rand_eff, bool est_fix_eff, vector<double> &reml_prior
     if (pred_rand_eff) {
         u.resize(_n, _r_indx.size());
         for (i = 0; i < _r_indx.size(); i++) {
-            if (_bivar_reml || _within_family)(u.col(i)) = (((_Asp[_r_indx[i]]) * Py) * varcmp[i]);
+            if (_reml_matfree) {
+                eigenMatrix APy;
+                reml_matfree_apply(_r_indx[i], Py, APy);
+                u.col(i) = APy.col(0) * varcmp[i];
+            }
+            else if (_reml_spectral) {
+                if (_r_indx[i] == 0) u.col(i) = (_spec_U * _spec_eval.cwiseProduct(_spec_U.transpose() * Py)) * varcmp[i];
+                else u.col(i) = Py * varcmp[i];
+            }
+            else if (_bivar_reml || _within_family)(u.col(i)) = (((_Asp[_r_indx[i]]) * Py) * varcmp[i]);
             else (u.col(i)) = (((_A[_r_indx[i]]) * Py) * varcmp[i]);
         }
     }
@@ -1059,12 +1128,84 @@ double gcta::reml_iteration(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatr
         }
     }*/
 
+    if (_reml_matfree) return reml_iteration_matfree(Vi_X, Xt_Vi_X_i, Hi, Py, varcmp, prior_var_flag, no_constrain);
+    if (_reml_spectral) return reml_iteration_spectral(Vi_X, Xt_Vi_X_i, Hi, Py, varcmp, prior_var_flag, no_constrain);
+    if (_reml_sparse) return reml_iteration_sparse(Vi_X, Xt_Vi_X_i, Hi, Py, varcmp, prior_var_flag, no_constrain);
+
+    // the dense V^-1 and P
+    eigenMatrix APy;
+    reml_engine engine;
+    engine.evaluate = [&](const eigenVector &vc, int mtd, double &logdet, double &yPy, eigenVector &R, eigenVector &tr_PA) -> bool {
+        eigenVector vc_buf(vc);
+        int iter_buf = 0;
+        if (_bivar_reml) calcu_Vi_bivar(_Vi, vc_buf, logdet, iter_buf); // Calculate Vi, bivariate analysis //very slow
+        else if (_within_family) calcu_Vi_within_family(_Vi, vc_buf, logdet, iter_buf); // within-family REML
+        else if (!calcu_Vi(_Vi, vc_buf, logdet, iter_buf)) return false;
+        logdet += calcu_P(_Vi, Vi_X, Xt_Vi_X_i, _P); // Calculate P  //quick
+
+        Py = _P * _y;
+        yPy = _y.dot(Py);
+        APy.resize(_n, _r_indx.size());
+        #pragma omp parallel for
+        for (int i = 0; i < _r_indx.size(); i++) {
+            if (_bivar_reml || _within_family) (APy.col(i)) = (_Asp[_r_indx[i]]) * Py;
+            else (APy.col(i)) = (_A[_r_indx[i]]) * Py;
+        }
+        R = APy.transpose() * Py;
+        if (mtd != 1) calcu_tr_PA(_P, tr_PA);  // slow
+        return true;
+    };
+    engine.information = [&](int mtd, eigenMatrix &H) {
+        if (mtd == 1) {
+            calcu_H(_P, H);
+            return;
+        }
+        H.resize(_r_indx.size(), _r_indx.size());
+        #pragma omp parallel for
+        for (int i = 0; i < _r_indx.size(); i++) {
+            eigenVector cvec = _P * (APy.col(i));
+            H(i, i) = ((APy.col(i)).transpose() * cvec)(0, 0);
+            for (int j = 0; j < i; j++) H(j, i) = H(i, j) = ((APy.col(j)).transpose() * cvec)(0, 0);
+        }
+    };
+    return reml_iterate(engine, Hi, varcmp, prior_var_flag, no_constrain, reml_bivar_fix_rg);
+}
+
+// the iterations of AI-REML, Fisher scoring or EM-REML, common to all the engines
+double gcta::reml_iterate(reml_engine &engine, eigenMatrix &Hi, eigenVector &varcmp, bool prior_var_flag, bool no_constrain, bool reml_bivar_fix_rg)
+{
     //char *mtd_str[3] = {"AI-REML", "Fisher-scoring REML", "EM-REML"};
     vector<string> mtd_str = {"AI-REML", "Fisher-scoring REML", "EM-REML"};
-    int i = 0, constrain_num = 0, iter = 0, reml_mtd_tmp = _reml_mtd;
-    double logdet = 0.0, logdet_Xt_Vi_X = 0.0, prev_lgL = -1e20, lgL = -1e20, dlogL = 1000.0;
-    eigenVector prev_prev_varcmp(varcmp), prev_varcmp(varcmp), varcomp_init(varcmp);
+    // the engines without tr(PAPA) take AI-REML for the Fisher scoring
+    if (_reml_mtd == 1 && !engine.has_fisher) _reml_mtd = 0;
+    int i = 0, constrain_num = 0, iter = 0, num_comp = _r_indx.size(), reml_mtd_tmp = _reml_mtd;
+    double logdet = 0.0, yPy = 0.0, prev_lgL = -1e20, lgL = -1e20, dlogL = 1000.0;
+    eigenVector prev_prev_varcmp(varcmp), prev_varcmp(varcmp), varcomp_init(varcmp), R(num_comp), tr_PA(num_comp);
     bool converged_flag = false;
+
+    auto invert_H = [&]() -> bool {
+        if (inverse_H(Hi)) return true;
+        if(_reml_force_converge){
+            LOGGER << "Warning: the information matrix is not invertible." << endl;
+            _reml_AI_not_invertible = true;
+        }
+        else LOGGER.e(0, "the information matrix is not invertible.");
+        return false;
+    };
+    // sampling variance-covariance of the estimates at the last evaluation: from the Fisher
+    // information, 2 * tr(PAPA)^-1, or else the inverse of the average information
+    auto se_Hi = [&]() {
+        if (engine.has_fisher) {
+            engine.information(1, Hi);
+            if (invert_H()) Hi = 2 * Hi;
+        }
+        else {
+            engine.information(0, Hi);
+            Hi = 0.5 * Hi;
+            invert_H();
+        }
+    };
+
     for (iter = 0; iter < _reml_max_iter; iter++) {
         if (reml_bivar_fix_rg) update_A(prev_varcmp);
         if (iter == 0) {
@@ -1080,62 +1221,48 @@ double gcta::reml_iteration(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatr
         }
         if (iter == 1) {
             _reml_mtd = reml_mtd_tmp;
-            LOGGER << "Running " << mtd_str[_reml_mtd] << " algorithm ..." << "\nIter.\tlogL\t";
-            for (i = 0; i < _r_indx.size(); i++) LOGGER << _var_name[_r_indx[i]] << "\t";
+            LOGGER << "Running " << mtd_str[_reml_mtd] << " algorithm" << (engine.name.empty() ? "" : " (" + engine.name + ")") << " ..." << "\nIter.\tlogL\t";
+            for (i = 0; i < num_comp; i++) LOGGER << _var_name[_r_indx[i]] << "\t";
             LOGGER << endl;
         }
-        //LOGGER << "Iter " << iter << endl;
-        float time_vi = 0;
-        LOGGER.ts("DBGtime");
-        if (_bivar_reml) calcu_Vi_bivar(_Vi, prev_varcmp, logdet, iter); // Calculate Vi, bivariate analysis //very slow
-        else if (_within_family) calcu_Vi_within_family(_Vi, prev_varcmp, logdet, iter); // within-family REML
-        else {
-            if (!calcu_Vi(_Vi, prev_varcmp, logdet, iter)){ // Calculate Vi
-                LOGGER<<"Warning: V matrix is not positive-definite.\n";
-                varcmp = prev_prev_varcmp;
-                if(!calcu_Vi(_Vi, varcmp, logdet, iter)) LOGGER.e(0, "V matrix is not positive-definite.");
-                calcu_Hi(_P, Hi);
-                Hi = 2 * Hi;
-                break;
-            }
+
+        if (!engine.evaluate(prev_varcmp, _reml_mtd, logdet, yPy, R, tr_PA)) {
+            LOGGER<<"Warning: V matrix is not positive-definite.\n";
+            varcmp = prev_prev_varcmp;
+            if (!engine.evaluate(varcmp, 1, logdet, yPy, R, tr_PA)) LOGGER.e(0, "V matrix is not positive-definite.");
+            se_Hi();
+            break;
         }
-        time_vi = LOGGER.tp("DBGtime");
-        //LOGGER << "calcu_vi_bivar returned" << endl;
-        float time_p = 0;
-        LOGGER.ts("DBGtime");
-        logdet_Xt_Vi_X = calcu_P(_Vi, Vi_X, Xt_Vi_X_i, _P); // Calculate P  //quick
-        time_p = LOGGER.tp("DBGtime");
-        
-        float time_reml = 0;
-        LOGGER.ts("DBGtime");
-        if (_reml_mtd == 0) ai_reml(_P, Hi, Py, prev_varcmp, varcmp, dlogL);
-        else if (_reml_mtd == 1) reml_equation(_P, Hi, Py, varcmp);
-        else if (_reml_mtd == 2) em_reml(_P, Py, prev_varcmp, varcmp);  //slow ++
-        time_reml = LOGGER.tp("DBGtime");
-        lgL = -0.5 * (logdet_Xt_Vi_X + logdet + (_y.transpose() * Py)(0, 0));
 
-        if(_reml_force_converge && _reml_AI_not_invertible) break;
-            /*{
-            if(_reml_mtd != 1){
-                LOGGER<<"Warning: the information matrix is not invertible. Trying to fix the problem using the Fisher-scoring approach."<<endl;
-                _reml_mtd = 1;
-                _reml_AI_not_invertible = false;
-                iter--;
-                continue;
+        if (_reml_mtd == 0) {
+            engine.information(0, Hi);
+            Hi = 0.5 * Hi;
+            if (invert_H()) {
+                eigenVector delta = Hi * (-0.5 * (tr_PA - R));
+                if (dlogL > 1.0) varcmp = prev_varcmp + 0.316 * delta;
+                else varcmp = prev_varcmp + delta;
             }
-            else {
-                LOGGER<<"Warning: the information matrix is not invertible using the Fisher-scoring approach."<<endl;
-                break;
+        }
+        else if (_reml_mtd == 1) {
+            engine.information(1, Hi);
+            if (invert_H()) {
+                varcmp = Hi * R;
+                Hi = 2 * Hi; // for calculation of SE
             }
-        }*/
+        }
+        else {
+            for (i = 0; i < num_comp; i++) varcmp(i) = prev_varcmp(i) - prev_varcmp(i) * prev_varcmp(i) * (tr_PA(i) - R(i)) / _n;
+        }
+        lgL = -0.5 * (logdet + yPy);
+
+        if(_reml_force_converge && _reml_AI_not_invertible) break;
 
         // output log
         if (!no_constrain) constrain_num = constrain_varcmp(varcmp);
         if (_bivar_reml && !_bivar_no_constrain) constrain_rg(varcmp);
         if (iter > 0) {
             LOGGER << iter << "\t" << std::fixed << LOGGER.setprecision(2) << lgL << "\t";
-            for (i = 0; i < _r_indx.size(); i++) LOGGER << LOGGER.setprecision(5) << varcmp[i] << "\t";
-            //LOGGER << time_vi << "\t" << time_p << "\t" << time_reml << "\t";
+            for (i = 0; i < num_comp; i++) LOGGER << LOGGER.setprecision(5) << varcmp[i] << "\t";
             if (constrain_num > 0) LOGGER << "(" << constrain_num << " component(s) constrained)" << endl;
             else LOGGER << endl;
         } else {
@@ -1147,7 +1274,7 @@ double gcta::reml_iteration(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatr
             varcmp = prev_varcmp; 
             break;
         }
-        if (constrain_num * 2 > _r_indx.size()){
+        if (constrain_num * 2 > num_comp){
             if(_reml_allow_constrain_run){
                 LOGGER.w(0, "more than half of the variance components are constrained.");
             }else{
@@ -1159,8 +1286,7 @@ double gcta::reml_iteration(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatr
 
         if((_reml_force_converge || _reml_no_converge) && prev_lgL > lgL){
             varcmp = prev_varcmp;
-            calcu_Hi(_P, Hi);
-            Hi = 2 * Hi;
+            se_Hi();
             break;
         }
 
@@ -1168,16 +1294,14 @@ double gcta::reml_iteration(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatr
         dlogL = lgL - prev_lgL;
         if ((varcmp - prev_varcmp).squaredNorm() / varcmp.squaredNorm() < 1e-8 && (fabs(dlogL) < 1e-4 || (fabs(dlogL) < 1e-2 && dlogL < 0))) {
             converged_flag = true;
-            if (_reml_mtd == 2) {
-                calcu_Hi(_P, Hi);
-                Hi = 2 * Hi;
-            } // for calculation of SE
+            if (_reml_mtd == 2) se_Hi(); // for calculation of SE
             break;
         }
         prev_prev_varcmp = prev_varcmp;
         prev_varcmp = varcmp;
         prev_lgL = lgL;
     }
+    if (engine.finish) engine.finish();
     
     if(_reml_fixed_var) LOGGER << "Warning: the model is evaluated at fixed variance components. The (log-)likelihood might not be maximised." <<endl;
     else {
@@ -1186,7 +1310,7 @@ double gcta::reml_iteration(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatr
             if(_reml_force_converge || _reml_no_converge) LOGGER << "Warning: Log-likelihood not converged. Results are not reliable." <<endl;
             else if(iter == _reml_max_iter){
                 stringstream errmsg;
-                errmsg << "Log-likelihood not converged (stop after " << _reml_max_iter << " iteractions). \nYou can specify the option --reml-maxit to allow for more iterations." << endl;
+                errmsg << "Log-likelihood not converged (stop after " << _reml_max_iter << " iterations). \nYou can specify the option --reml-maxit to allow for more iterations." << endl;
                 if (_reml_max_iter > 1) LOGGER.e(0, errmsg.str());
             }
         }
@@ -1522,11 +1646,11 @@ double gcta::calcu_P(eigenMatrix &Vi, eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i,
     return logdet_Xt_Vi_X;
 }
 
-// input P, calculate PA and Hi
-void gcta::calcu_Hi(eigenMatrix &P, eigenMatrix &Hi)
+// input P, calculate the Fisher information before inversion, H = tr(P * A_i * P * A_j)
+void gcta::calcu_H(eigenMatrix &P, eigenMatrix &H)
 {
     double d_buf = 0.0;
-    //LOGGER << "Before calcu_Hi: " << getVMemKB() << " " << getMemKB() << ", "; 
+    //LOGGER << "Before calcu_H: " << getVMemKB() << " " << getMemKB() << ", "; 
 
     // Calculate PA
     vector<eigenMatrix> PA(_r_indx.size());
@@ -1537,7 +1661,8 @@ void gcta::calcu_Hi(eigenMatrix &P, eigenMatrix &Hi)
     }
 
 
-    // Calculate Hi
+    // Calculate H
+    H.resize(_r_indx.size(), _r_indx.size());
     //double d_bufs[_n];
     double *d_bufs = new double[_n];
     for (int i = 0; i < _r_indx.size(); i++) {
@@ -1551,121 +1676,13 @@ void gcta::calcu_Hi(eigenMatrix &P, eigenMatrix &Hi)
             for(int k = 0; k < _n; k++){
                 d_buf += d_bufs[k];
             }
-            Hi(i, j) = Hi(j, i) = d_buf;
+            H(i, j) = H(j, i) = d_buf;
         }
     }
 
-    if (!inverse_H(Hi)){
-        if(_reml_force_converge){
-            LOGGER << "Warning: the information matrix is not invertible." << endl;
-            _reml_AI_not_invertible = true;
-        }
-        else LOGGER.e(0, "the information matrix is not invertible.");
-    }
     delete[] d_bufs;
 }
 
-// use Fisher-scoring to estimate variance component
-// input P, calculate PA, H, R and varcmp
-
-void gcta::reml_equation(eigenMatrix &P, eigenMatrix &Hi, eigenVector &Py, eigenVector &varcmp)
-{
-    // Calculate Hi
-    calcu_Hi(P, Hi);
-    if(_reml_AI_not_invertible) return;
-
-    // Calculate R
-    Py = P*_y;
-    eigenVector R(_r_indx.size());
-    for (int i = 0; i < _r_indx.size(); i++) {
-        if (_bivar_reml || _within_family) R(i) = (Py.transpose()*(_Asp[_r_indx[i]]) * Py)(0, 0);
-        else R(i) = (Py.transpose()*(_A[_r_indx[i]]) * Py)(0, 0);
-    }
-
-    // Calculate variance component
-    varcmp = Hi*R;
-    Hi = 2 * Hi; // for calculation of SE
-}
-
-// use Fisher-scoring to estimate variance component
-// input P, calculate PA, H, R and varcmp
-
-void gcta::ai_reml(eigenMatrix &P, eigenMatrix &Hi, eigenVector &Py, eigenVector &prev_varcmp, eigenVector &varcmp, double dlogL)
-{
-    Py = P*_y;
-    //eigenVector cvec(_n);
-    eigenMatrix APy(_n, _r_indx.size());
-    //LOGGER << "AI reml 1 start" << endl;
-    #pragma omp parallel for
-    for (int i = 0; i < _r_indx.size(); i++) {
-        if (_bivar_reml || _within_family) (APy.col(i)) = (_Asp[_r_indx[i]]) * Py;
-        else (APy.col(i)) = (_A[_r_indx[i]]) * Py;
-    }
-
-    //LOGGER << "AI reml 2 start" << endl;
-    // Calculate Hi
-    eigenVector R(_r_indx.size());
-    #pragma omp parallel for
-    for (int i = 0; i < _r_indx.size(); i++) {
-        R(i) = (Py.transpose()*(APy.col(i)))(0, 0);
-        eigenVector cvec = P * (APy.col(i));
-        Hi(i, i) = ((APy.col(i)).transpose() * cvec)(0, 0);
-        for (int j = 0; j < i; j++) Hi(j, i) = Hi(i, j) = ((APy.col(j)).transpose() * cvec)(0, 0);
-    }
-    //LOGGER << "AI reml 2 end" << endl;
-    Hi = 0.5 * Hi;
-
-    // Calcualte tr(PA) and dL
-    eigenVector tr_PA;
-    calcu_tr_PA(P, tr_PA);
-    R = -0.5 * (tr_PA - R);
-
-    // Calculate variance component
-    if (!inverse_H(Hi)){
-        if(_reml_force_converge){
-            LOGGER << "Warning: the information matrix is not invertible." << endl;
-            _reml_AI_not_invertible = true;
-            return;
-        }
-        else LOGGER.e(0, "the information matrix is not invertible.");
-    }
-
-    eigenVector delta(_r_indx.size());
-    delta = Hi*R;
-    if (dlogL > 1.0) varcmp = prev_varcmp + 0.316 * delta;
-    else varcmp = prev_varcmp + delta;
-}
-
-// input P, calculate varcmp
-
-void gcta::em_reml(eigenMatrix &P, eigenVector &Py, eigenVector &prev_varcmp, eigenVector &varcmp)
-{
-    // Calculate trace(PA)
-    //LOGGER << "Before em_reml: " << getVMemKB() << " " << getMemKB() << ", "; 
-    eigenVector tr_PA;
-    calcu_tr_PA(P, tr_PA);  // extremely slow
-    //LOGGER << "calcu_tr_PA returned" << endl;
-    // Calculate R
-    Py = P*_y;
-    eigenVector R(_r_indx.size());
-
-    #pragma omp parallel for
-    for (int i = 0; i < _r_indx.size(); i++) {
-        //LOGGER << "EM reml " << i << endl;
-        if (_bivar_reml || _within_family) R(i) = (Py.transpose()*(_Asp[_r_indx[i]]) * Py)(0, 0);
-        else R(i) = (Py.transpose()*(_A[_r_indx[i]]) * Py)(0, 0);
-        // Calculate Variance component;
-        varcmp(i) = prev_varcmp(i) - prev_varcmp(i) * prev_varcmp(i) * (tr_PA(i) -  R(i)) / _n;
-    }
-
-
-    // Calculate variance component
-    //for (i = 0; i < _r_indx.size(); i++) varcmp(i) = (prev_varcmp(i) * _n - prev_varcmp(i) * prev_varcmp(i) * tr_PA(i) + prev_varcmp(i) * prev_varcmp(i) * R(i)) / _n;
-
-    // added by Jian Yang Dec 2014
-    //varcmp = (varcmp.array() - prev_varcmp.array())*2 + prev_varcmp.array();        
-}
-
 // input P, calculate tr(PA)
 void gcta::calcu_tr_PA(eigenMatrix &P, eigenVector &tr_PA) {
     //LOGGER << "Before calcu_tr_PA: " << getVMemKB() << " " << getMemKB() << ", "; 
@@ -1732,13 +1749,17 @@ void gcta::blup_snp_geno() {
         else var_SNP[j] = 1.0 / var_SNP[j];
     }
 
+    vector<uintptr_t> mask, buf;
+    geno_keep_mask(mask);
+    vector<double> xk(_keep.size());
     for (k = 0; k < _include.size(); k++) {
         fcount = 0.0;
+        double mu = _mu[_include[k]];
+        const double val[4] = {-mu, 1.0 - mu, 2.0 - mu, 1e6};
+        geno_row(k, val, mask, buf, xk.data());
         for (i = 0; i < _keep.size(); i++) {
-            if (!_snp_1[_include[k]][_keep[i]] || _snp_2[_include[k]][_keep[i]]) {
-                if (_allele1[_include[k]] == _ref_A[_include[k]]) x = _snp_1[_include[k]][_keep[i]] + _snp_2[_include[k]][_keep[i]];
-                else x = 2.0 - (_snp_1[_include[k]][_keep[i]] + _snp_2[_include[k]][_keep[i]]);
-                x = (x - _mu[_include[k]]);
+            x = xk[i];
+            if (x < 1e5) {
                 for (j = 0; j < col_num; j++) b_SNP(k, j) += x * _varcmp_Py(i, j);
                 fcount += 1.0;
             }
@@ -36,6 +36,10 @@
 #include <omp.h>
 #include "Logger.h"
 #include "Matrix.hpp"
+#include <memory>
+#include <functional>
+
+class GRMReader;
 
 #ifdef SINGLE_PRECISION
 typedef Eigen::SparseMatrix<float, Eigen::ColMajor, long long> eigenSparseMat;
@@ -59,6 +63,16 @@ typedef VectorXd eigenVector;
 typedef DynamicSparseMatrix<double> eigenDynSparseMat;
 #endif
 
+// header of the eigendecomposition cache (--grm-eig-cache), also its key, see grm_eig.cpp
+struct GrmEigHeader {
+    char magic[8];
+    uint64_t n;
+    uint64_t numEig;
+    uint64_t grmSize;
+    uint64_t grmCRC;
+    uint64_t keepHash;
+};
+
 class gcta {
 public:
     gcta(int autosome_num, double rm_ld_cutoff, string out);
@@ -68,6 +82,8 @@ public:
     void read_famfile(string famfile);
     void read_bimfile(string bimfile);
     void read_bedfile(string bedfile);
+    void read_bedfile_cache(string bedfile, string cache_file);
+    void make_geno_cache(string bfile, string cache_file);
     vector<string> read_bfile_list(string bfile_list);
     void read_multi_famfiles(vector<string> multi_bfiles);
     void read_multi_bimfiles(vector<string> multi_bfiles);
@@ -78,6 +94,9 @@ public:
     void read_imp_dose_mach(string dosefile, string kp_indi_file, string rm_indi_file, string blup_indi_file);
     void read_imp_info_beagle(string zinfofile);
     void read_imp_dose_beagle(string zdosefile, string kp_indi_file, string rm_indi_file, string blup_indi_file);
+    void read_psamfile(string psamfile);
+    void read_pvarfile(string pvarfile);
+    void read_pgenfile(string pgenfile, bool dosage);
     void update_ref_A(string ref_A_file);
     void update_impRsq(string zinfofile);
     void update_freq(string freq);
@@ -128,6 +147,9 @@ public:
     void set_reml_diag_mul(double value);
     void set_reml_diagV_adj(int method);
     void set_reml_inv_method(int method);
+    void set_reml_matfree(int num_probes);
+    void set_reml_spectral();
+    void set_grm_eig_cache();
 
     // bivariate REML analysis
     void fit_bivar_reml(string grm_file, string phen_file, string qcovar_file, string covar_file, string keep_indi_file, string remove_indi_file, string sex_file, int mphen, int mphen2, double grm_cutoff, double adj_grm_fac, int dosage_compen, bool m_grm_flag, bool pred_rand_eff, bool est_fix_eff, int reml_mtd, int MaxIter, vector<double> reml_priors, vector<double> reml_priors_var, vector<int> drop, bool no_lrt, double prevalence, double prevalence2, bool no_constrain, bool ignore_Ce, vector<double> &fixed_rg_val, bool bivar_no_constrain);
@@ -200,12 +222,15 @@ public:
     void mtcojo(string mtcojo_bxy_file, string ref_ld_dirt, string w_ld_dirt, double freq_thresh, double gwas_thresh, int clump_wind_size, double clump_r2_thresh, double std_heidi_thresh, double global_heidi_thresh, double ld_fdr_thresh, int nsnp_gsmr, int gsmr_beta_version);
     bool mtcojo_ldsc(vector<vector<bool>> snp_val_flag, eigenMatrix snp_b, eigenMatrix snp_se, eigenMatrix snp_n, int ntrait, vector<string> snp_name, vector<int> snp_remain, string ref_ld_dirt, string w_ld_dirt, vector<string> trait_name, eigenMatrix &ldsc_intercept, eigenMatrix &ldsc_slope);
     int read_mtcojofile(string mtcojolist_file, double gwas_thresh, int nsnp_gsmr);
-    double read_single_metafile_txt(string metafile, map<string, int> id_map, vector<string> &snp_a1, vector<string> &snp_a2, 
+    double read_single_metafile_txt(string metafile, const map<string, int> &id_map, vector<string> &snp_a1, vector<string> &snp_a2, 
                                 eigenVector &snp_freq, eigenVector &snp_b, eigenVector &snp_se, eigenVector &snp_pval, eigenVector &snp_n, vector<bool> &snpflag);
-    double read_single_metafile_gz(string metafile, map<string, int> id_map, vector<string> &snp_a1, vector<string> &snp_a2, 
+    double read_single_metafile_gz(string metafile, const map<string, int> &id_map, vector<string> &snp_a1, vector<string> &snp_a2, 
                                 eigenVector &snp_freq, eigenVector &snp_b, eigenVector &snp_se, eigenVector &snp_pval, eigenVector &snp_n, vector<bool> &snpflag);
     vector<string> read_snp_metafile_txt(string metafile, map<string,int> &gws_snp_name_map, double thresh);
     vector<string> read_snp_metafile_gz(string metafile, map<string,int> &gws_snp_name_map, double thresh);
+    double read_single_metafile_bin(string metafile, const map<string, int> &id_map, vector<string> &snp_a1, vector<string> &snp_a2, 
+                                eigenVector &snp_freq, eigenVector &snp_b, eigenVector &snp_se, eigenVector &snp_pval, eigenVector &snp_n, vector<bool> &snpflag);
+    vector<string> read_snp_metafile_bin(string metafile, map<string,int> &gws_snp_name_map, double thresh);
     
     // Adjusted for PC
     void pc_adjust(string pcadjust_list_file, string eigenvalue_file, double freq_thresh, int wind_size);
@@ -262,7 +287,7 @@ private:
 
     void calcu_mu(bool ssq_flag = false);
     void calcu_maf();
-    void mu_func(int j, vector<double> &fac);
+    void mu_func(int j, vector<double> &fac, const vector<double> &x);
     void check_autosome();
     void check_chrX();
     void check_sex();
@@ -273,7 +298,12 @@ private:
     void read_grm(string grm_file, vector<string> &grm_id, bool out_id_log = true, bool read_id_only = false, bool dont_read_N = false);
     void read_grm_gz(string grm_file, vector<string> &grm_id, bool out_id_log = true, bool read_id_only = false);
     void read_grm_bin(string grm_file, vector<string> &grm_id, bool out_id_log = true, bool read_id_only = false, bool dont_read_N = false);
+    void extract_grm_bin(string grm_file, int num_grm_id, const vector<int> &kp, eigenMatrix &A);
+    void extract_grm_bin_sparse(string grm_file, int num_grm_id, const vector<int> &kp, eigenSparseMat &A);
     void read_grm_filenames(string merge_grm_file, vector<string> &grm_files, bool out_log = true);
+    bool grm_eig_key(string grm_file, const vector<int> &kp, GrmEigHeader &key);
+    bool read_grm_eig(string grm_file, const GrmEigHeader &key, VectorXd &eval, MatrixXd &evec);
+    void write_grm_eig(string grm_file, const GrmEigHeader &key, const VectorXd &eval, const MatrixXd &evec);
     void merge_grm(string merge_grm_file);
     void rm_cor_indi(double grm_cutoff);
     void adj_grm(double adj_grm_fac);
@@ -295,6 +325,21 @@ private:
     void coeff_mat(const vector<string> &vec, eigenMatrix &coeff_mat, string errmsg1, string errmsg2);
     void reml(bool pred_rand_eff, bool est_fix_eff, vector<double> &reml_priors, vector<double> &reml_priors_var, double prevalence, double prevalence2, bool no_constrain, bool no_lrt, bool mlmassoc = false);
     double reml_iteration(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatrix &Hi, eigenVector &Py, eigenVector &varcmp, bool prior_var_flag, bool no_constrain, bool reml_bivar_fix_rg = false);
+    // the numerical part of the REML iterations, driven by reml_iterate:
+    // evaluate: at the variance components vc, logdet = log|V| + log|X^t * V^-1 * X|, y^t * Py,
+    //     R = Py^t * A_i * Py and tr(P * A_i) (not needed by Fisher scoring, mtd 1);
+    //     false if V is not positive definite
+    // information: before inversion, the average information (A_i * Py)^t * P * (A_j * Py) (mtd 0)
+    //     or tr(P * A_i * P * A_j) (mtd 1, only if has_fisher), at the last evaluation
+    // finish: optional, after the last iteration
+    struct reml_engine {
+        string name;
+        bool has_fisher = true;
+        std::function<bool (const eigenVector &vc, int mtd, double &logdet, double &yPy, eigenVector &R, eigenVector &tr_PA)> evaluate;
+        std::function<void (int mtd, eigenMatrix &H)> information;
+        std::function<void ()> finish;
+    };
+    double reml_iterate(reml_engine &engine, eigenMatrix &Hi, eigenVector &varcmp, bool prior_var_flag, bool no_constrain, bool reml_bivar_fix_rg);
     void init_varcomp(vector<double> &reml_priors_var, vector<double> &reml_priors, eigenVector &varcmp);
     bool calcu_Vi(eigenMatrix &Vi, eigenVector &prev_varcmp, double &logdet, int &iter);
     bool inverse_H(eigenMatrix &H);
@@ -305,17 +350,26 @@ private:
     bool comput_inverse_logdet_PLU(eigenMatrix &Vi, double &logdet);
     bool comput_inverse_logdet_LU(eigenMatrix &Vi, double &logdet);
     double calcu_P(eigenMatrix &Vi, eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatrix &P);
-    void calcu_Hi(eigenMatrix &P, eigenMatrix &Hi);
-    void reml_equation(eigenMatrix &P, eigenMatrix &Hi, eigenVector &Py, eigenVector &varcmp);
+    void calcu_H(eigenMatrix &P, eigenMatrix &H);
     double lgL_reduce_mdl(bool no_constrain);
-    void em_reml(eigenMatrix &P, eigenVector &Py, eigenVector &prev_varcmp, eigenVector &varcmp);
-    void ai_reml(eigenMatrix &P, eigenMatrix &Hi, eigenVector &Py, eigenVector &prev_varcmp, eigenVector &varcmp, double dlogL);
     void calcu_tr_PA(eigenMatrix &P, eigenVector &tr_PA);
     void calcu_Vp(double &Vp, double &Vp2, double &VarVp, double &VarVp2, eigenVector &varcmp, eigenMatrix &Hi);
     void calcu_hsq(int i, double Vp, double Vp2, double VarVp, double VarVp2, double &hsq, double &var_hsq, eigenVector &varcmp, eigenMatrix &Hi);
     void calcu_sum_hsq(double Vp, double VarVp, double &sum_hsq, double &var_sum_hsq, eigenVector &varcmp, eigenMatrix &Hi);
     void output_blup_snp(eigenMatrix &b_SNP);
 
+    // matrix-free reml analysis
+    double reml_iteration_matfree(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatrix &Hi, eigenVector &Py, eigenVector &varcmp, bool prior_var_flag, bool no_constrain);
+    void reml_matfree_apply(int comp, const eigenMatrix &X, eigenMatrix &AX);
+    void reml_matfree_V(const eigenVector &varcmp, const eigenMatrix &X, eigenMatrix &VX);
+    int reml_matfree_pcg(const eigenVector &varcmp, const eigenVector &M, const eigenMatrix &B, eigenMatrix &S, vector< vector<double> > *alpha, vector< vector<double> > *beta);
+
+    // spectral reml analysis
+    void reml_spectral_decomp(string grm_file, const vector<int> &kp);
+    double reml_iteration_spectral(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatrix &Hi, eigenVector &Py, eigenVector &varcmp, bool prior_var_flag, bool no_constrain);
+    double reml_iteration_sparse(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatrix &Hi, eigenVector &Py, eigenVector &varcmp, bool prior_var_flag, bool no_constrain);
+    void mlma_calcu_stat_spectral(float *y, unsigned long n, unsigned long m, bool covar_flag, eigenVector &beta, eigenVector &se, eigenVector &pval);
+
     // within-family reml analysis
     void detect_family();
     bool calcu_Vi_within_family(eigenMatrix &Vi, eigenVector &prev_varcmp, double &logdet, int &iter);
@@ -457,20 +511,20 @@ private:
     void ecojo_blup(double lambda);   
 
     // mtCOJO and GSMR
-    void init_meta_snp_map(vector<string> snplist, map<string, int> &snp_name_map, vector<string> &snp_name, vector<int> &remain_snp);
+    void init_meta_snp_map(const vector<string> &snplist, map<string, int> &snp_name_map, vector<string> &snp_name, vector<int> &remain_snp);
     void init_gwas_variable(vector<vector<string>> &snp_a1, vector<vector<string>> &snp_a2, eigenMatrix &snp_freq, eigenMatrix &snp_b, eigenMatrix &snp_se, eigenMatrix &snp_pval, eigenMatrix &n, int npheno, int nsnp);
-    void update_meta_snp_list(vector<string> &snplist, map<string, int> snp_id_map);
-    void update_meta_snp_map(vector<string> snplist, map<string, int> &snp_id_map, vector<string> &snp_id, vector<int> &snp_indx, bool indx_flag);
+    void update_meta_snp_list(vector<string> &snplist, const map<string, int> &snp_id_map);
+    void update_meta_snp_map(const vector<string> &snplist, map<string, int> &snp_id_map, vector<string> &snp_id, vector<int> &snp_indx, bool indx_flag);
     void update_meta_snp(map<string,int> &snp_name_map, vector<string> &snp_name, vector<int> &snp_remain);
-    vector<string> remove_bad_snps(vector<string> snp_name, vector<int> snp_remain, vector<vector<bool>> snp_flag, vector<vector<string>> &snp_a1, vector<vector<string>> &snp_a2, eigenMatrix &snp_freq,  eigenMatrix &snp_b, eigenMatrix snp_se, eigenMatrix snp_pval, eigenMatrix snp_n, map<string,int> plink_snp_name_map, vector<string> snp_ref_a1, vector<string> snp_ref_a2, int ntarget, int ncovar, string outfile_name);
-    vector<string> remove_freq_diff_snps(vector<string> meta_snp_name, vector<int> meta_snp_remain, map<string,int> snp_name_map, vector<double> ref_freq, eigenMatrix meta_freq, vector<vector<bool>> snp_flag, int ntrait, double freq_thresh, string outfile_name);
-    vector<string> remove_mono_snps(map<string,int> snp_name_map, vector<double> ref_snpfreq, string outfile_name);
+    vector<string> remove_bad_snps(const vector<string> &snp_name, const vector<int> &snp_remain, const vector<vector<bool>> &snp_flag, vector<vector<string>> &snp_a1, vector<vector<string>> &snp_a2, eigenMatrix &snp_freq,  eigenMatrix &snp_b, const eigenMatrix &snp_se, const eigenMatrix &snp_pval, const eigenMatrix &snp_n, const map<string,int> &plink_snp_name_map, const vector<string> &snp_ref_a1, const vector<string> &snp_ref_a2, int ntarget, int ncovar, string outfile_name);
+    vector<string> remove_freq_diff_snps(const vector<string> &meta_snp_name, const vector<int> &meta_snp_remain, const map<string,int> &snp_name_map, const vector<double> &ref_freq, const eigenMatrix &meta_freq, const vector<vector<bool>> &snp_flag, int ntrait, double freq_thresh, string outfile_name);
+    vector<string> remove_mono_snps(const map<string,int> &snp_name_map, const vector<double> &ref_snpfreq, string outfile_name);
     vector<string> filter_meta_snp_pval(vector<string> snp_name, vector<int> remain_snp_indx,  eigenMatrix snp_pval, int start_indx, int end_indx, vector<vector<bool>> snp_flag, double pval_thresh);
     vector<double> gsmr_meta(vector<string> &snp_instru, eigenVector bzx, eigenVector bzx_se, eigenVector bzx_pval, eigenVector bzy, eigenVector bzy_se, eigenVector bzy_pval, double rho_pheno, vector<bool> snp_flag, double gwas_thresh, int wind_size, double r2_thresh, double std_heidi_thresh, double global_heidi_thresh, double ld_fdr_thresh, int nsnp_gsmr, string &pleio_snps, string &err_msg);
     vector<string> clumping_meta(eigenVector snp_chival, vector<bool> snp_flag, double pval_thresh, int wind_size, double r2_thresh);
-    void update_mtcojo_snp_rm(vector<string> adjsnps, map<string,int> &snp_id_map, vector<int> &remain_snp_indx);
-    vector<string> read_snp_ldsc(map<string,int> ldsc_snp_name_map, vector<string> snp_name, vector<int> snp_remain, int &ttl_mk_num, string ref_ld_dirt, string w_ld_dirt, vector<double> &ref_ld_vec, vector<double> &w_ld_vec);
-    void reorder_snp_effect(vector<int> snp_remain, eigenMatrix &bhat_z, eigenMatrix &bhat_n, eigenMatrix snp_b, eigenMatrix snp_se, eigenMatrix snp_n, vector<vector<bool>> &snp_flag, vector<vector<bool>> snp_val_flag, vector<int> &nsnp_cm_trait, vector<string> cm_ld_snps, map<string,int> ldsc_snp_name_map, eigenVector &ref_ld, eigenVector &w_ld, vector<double> ref_ld_vec, vector<double> w_ld_vec, int ntrait);
+    void update_mtcojo_snp_rm(const vector<string> &adjsnps, map<string,int> &snp_id_map, vector<int> &remain_snp_indx);
+    vector<string> read_snp_ldsc(const map<string,int> &ldsc_snp_name_map, const vector<string> &snp_name, const vector<int> &snp_remain, int &ttl_mk_num, string ref_ld_dirt, string w_ld_dirt, vector<double> &ref_ld_vec, vector<double> &w_ld_vec);
+    void reorder_snp_effect(const vector<int> &snp_remain, eigenMatrix &bhat_z, eigenMatrix &bhat_n, const eigenMatrix &snp_b, const eigenMatrix &snp_se, const eigenMatrix &snp_n, vector<vector<bool>> &snp_flag, const vector<vector<bool>> &snp_val_flag, vector<int> &nsnp_cm_trait, const vector<string> &cm_ld_snps, const map<string,int> &ldsc_snp_name_map, eigenVector &ref_ld, eigenVector &w_ld, const vector<double> &ref_ld_vec, const vector<double> &w_ld_vec, int ntrait);
     eigenMatrix ldsc_snp_h2(eigenMatrix bhat_z, eigenMatrix bhat_n, eigenVector ref_ld, eigenVector w_ld, vector<vector<bool>> snp_flag, vector<int> nsnp_cm_trait, int n_cm_ld_snps, int ttl_mk_num, vector<string> trait_name, int ntrait);
     eigenMatrix ldsc_snp_rg(eigenMatrix ldsc_var_h2, eigenMatrix bhat_z, eigenMatrix bhat_n, eigenVector ref_ld, eigenVector w_ld, vector<vector<bool>> snp_flag, vector<int> trait_indx1, vector<int> trait_indx2, int n_cm_ld_snps, int ttl_mk_num, vector<string> trait_name);
 
@@ -480,15 +534,10 @@ private:
     // inline functions
     template<typename ElemType>
     void makex(int j, vector<ElemType> &x, bool minus_2p = false) {
-        int i = 0;
         x.resize(_keep.size());
-        for (i = 0; i < _keep.size(); i++) {
-            if (!_snp_1[_include[j]][_keep[i]] || _snp_2[_include[j]][_keep[i]]) {
-                if (_allele1[_include[j]] == _ref_A[_include[j]]) x[i] = (_snp_1[_include[j]][_keep[i]] + _snp_2[_include[j]][_keep[i]]);
-                else x[i] = 2.0 - (_snp_1[_include[j]][_keep[i]] + _snp_2[_include[j]][_keep[i]]);
-            } else x[i] = _mu[_include[j]];
-            if (minus_2p) x[i] -= _mu[_include[j]];
-        }
+        double mu = _mu[_include[j]], c = minus_2p ? mu : 0.0;
+        const double val[4] = {-c, 1.0 - c, 2.0 - c, mu - c};
+        geno_row(j, val, x.data());
     }
 
 private:
@@ -522,9 +571,41 @@ private:
     vector<int> _keep; // initialized in the read_famfile()
     eigenMatrix _varcmp_Py; // BLUP solution to the total genetic effects of individuals
 
-    // bed file
-    vector< vector<bool> > _snp_1;
-    vector< vector<bool> > _snp_2;
+    // bed file, 2 bits per genotype: the number of A1 alleles, 3 for missing; _geno_words per SNP
+    vector<uint64_t> _geno_bits;
+    uint64_t _geno_words = 0;
+    uint32_t _geno_indi = 0;
+    void init_geno_bits(int num_snp, int num_indi);
+    void set_geno_a1(int snp, int indi, int g) {
+        uint64_t &word = _geno_bits[snp * _geno_words + (indi >> 5)];
+        int shift = (indi & 31) << 1;
+        word = (word & ~(3ULL << shift)) | ((uint64_t)(g < 0 ? 3 : g) << shift);
+    }
+
+    // memory mapped genotype cache (--geno-cache), takes the place of _geno_bits once loaded
+    bool read_geno_cache(string bedfile, string cache_file);
+    void free_geno_cache();
+    void *_geno_cache_map = NULL;
+    uint64_t _geno_cache_bytes = 0;
+    const int8_t *_geno_cache = NULL;
+    uint64_t _geno_cache_row = 0;
+    vector<uint64_t> _geno_cache_snp;  // offset of the cache row of each SNP
+    vector<uint32_t> _geno_cache_indi; // cache column of each individual
+
+    // whole row of the j-th included SNP in the kept individuals, decoded by PgenReader from _geno_bits
+    // or read from the genotype cache; val holds the values of 0, 1 and 2 reference alleles and of missing.
+    // mask is filled once by geno_keep_mask(), buf is the scratch of the calling thread
+    void geno_keep_mask(vector<uintptr_t> &mask) const;
+    void geno_row(int j, const double *val, const vector<uintptr_t> &mask, vector<uintptr_t> &buf, double *x) const;
+    void geno_row(int j, const double *val, double *x) const;
+    void geno_row(int j, const double *val, float *x) const;
+
+    // number of allele1 of SNP snp in individual indi, -1 for missing
+    int geno_a1(int snp, int indi) const {
+        if (_geno_cache) return _geno_cache[_geno_cache_snp[snp] + _geno_cache_indi[indi]];
+        int code = (_geno_bits[snp * _geno_words + (indi >> 5)] >> ((indi & 31) << 1)) & 3;
+        return code == 3 ? -1 : code;
+    }
 
     // imputed data
     bool _dosage_flag;
@@ -578,8 +659,29 @@ private:
     bool _reml_fixed_var;
     bool _reml_allow_constrain_run = false;
 
+    // matrix-free reml analysis
+    bool _reml_matfree = false;
+    int _reml_matfree_probes = 0;
+    vector< shared_ptr<GRMReader> > _reml_matfree_grm;
+    vector< vector<int> > _reml_matfree_kp;
+    vector<eigenVector> _reml_matfree_diag;
+    eigenVector _reml_matfree_resid;
+
+    // spectral reml analysis: eigenvalues and eigenvectors of the GRM, U^t * y, U^t * X and
+    // the eigenvalues of V at the final variance components
+    bool _reml_spectral = false;
+    eigenVector _spec_eval;
+    eigenMatrix _spec_U;
+    eigenVector _spec_Uy;
+    eigenMatrix _spec_UX;
+    eigenVector _spec_d;
+
+    // eigendecomposition cache of the binary GRM
+    bool _grm_eig_cache = false;
+
     // within-family reml analysis
     bool _within_family;
+    bool _reml_sparse = false; // within-family REML iterated on the sparse _Asp
     vector<int> _fam_brk_pnt;
 
     // bivariate reml
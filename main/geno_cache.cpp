@@ -0,0 +1,228 @@
+/*
+ * GCTA: a tool for Genome-wide Complex Trait Analysis
+ *
+ * Memory mapped genotype cache of the reference panel: --make-geno-cache decodes the whole
+ * BED file once into one byte per genotype, and the COJO, GSMR, mtCOJO and fastBAT runs map
+ * the cache (--geno-cache) and take the SNPs and individuals they retain.
+ *
+ * This file is distributed under the GNU General Public
+ * License, Version 3.  Please see the file LICENSE for more
+ * details
+ */
+
+#include "gcta.h"
+#include "Logger.h"
+#include "mem.hpp"
+#include <sys/stat.h>
+#include <cstring>
+#include <cstdio>
+#include <unordered_map>
+
+// File layout: header, SNP block ("snp\tA1\n" of each SNP), individual block ("fid:iid\n"),
+// then the genotypes from dataOffset. Each SNP takes a row of rowBytes (64 aligned) in BIM order,
+// so the SNPs of an LD window are next to each other; the values are the number of A1
+// alleles, -1 for missing.
+struct GenoCacheHeader {
+    char magic[8];
+    uint64_t bedSize;
+    int64_t bedMtime;
+    uint64_t numSNP;
+    uint64_t numIndi;
+    uint64_t rowBytes;
+    uint64_t snpBytes;
+    uint64_t indiBytes;
+    uint64_t dataOffset;
+};
+
+static const char geno_cache_magic[8] = {'G', 'C', 'T', 'A', 'G', 'C', 'H', '1'};
+
+void gcta::read_bedfile_cache(string bedfile, string cache_file)
+{
+    if (read_geno_cache(bedfile, cache_file)) return;
+    LOGGER.w(0, "the genotype cache [" + cache_file + "] can't be used, reading the BED file instead. Please make the cache again by --make-geno-cache.");
+    read_bedfile(bedfile);
+}
+
+bool gcta::read_geno_cache(string bedfile, string cache_file)
+{
+    struct stat bed_st;
+    if (stat(bedfile.c_str(), &bed_st) != 0) LOGGER.e(0, "cannot open the file [" + bedfile + "] to read.");
+
+    FILE *in = fopen(cache_file.c_str(), "rb");
+    if (!in) {
+        LOGGER.w(0, "cannot open the genotype cache [" + cache_file + "].");
+        return false;
+    }
+    GenoCacheHeader header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, geno_cache_magic, 8) != 0) {
+        fclose(in);
+        LOGGER.w(0, "[" + cache_file + "] is not a genotype cache.");
+        return false;
+    }
+    if (header.bedSize != (uint64_t)bed_st.st_size || header.bedMtime != (int64_t)bed_st.st_mtime) {
+        fclose(in);
+        LOGGER.w(0, "the genotype cache [" + cache_file + "] was not made from the current [" + bedfile + "].");
+        return false;
+    }
+    string snp_block(header.snpBytes, '\0'), indi_block(header.indiBytes, '\0');
+    if (fread(&snp_block[0], 1, header.snpBytes, in) != header.snpBytes || fread(&indi_block[0], 1, header.indiBytes, in) != header.indiBytes) {
+        fclose(in);
+        LOGGER.w(0, "[" + cache_file + "] is truncated.");
+        return false;
+    }
+    fclose(in);
+
+    // SNP name -> row and A1
+    unordered_map<string, pair<uint64_t, string>> snp_row;
+    snp_row.reserve(header.numSNP);
+    size_t pos = 0;
+    for (uint64_t row = 0; row < header.numSNP; row++) {
+        size_t tab = snp_block.find('\t', pos), end = snp_block.find('\n', pos);
+        if (tab == string::npos || end == string::npos || tab > end) return false;
+        snp_row[snp_block.substr(pos, tab - pos)] = make_pair(row, snp_block.substr(tab + 1, end - tab - 1));
+        pos = end + 1;
+    }
+    unordered_map<string, uint32_t> indi_col;
+    indi_col.reserve(header.numIndi);
+    pos = 0;
+    for (uint32_t col = 0; col < header.numIndi; col++) {
+        size_t end = indi_block.find('\n', pos);
+        if (end == string::npos) return false;
+        indi_col[indi_block.substr(pos, end - pos)] = col;
+        pos = end + 1;
+    }
+
+    // the cache has to hold all the SNPs and individuals retained in this run
+    vector<int> rindi, rsnp;
+    get_rindi(rindi);
+    get_rsnp(rsnp);
+    if (_include.size() == 0) LOGGER.e(0, "no SNP is retained for analysis.");
+    if (_keep.size() == 0) LOGGER.e(0, "no individual is retained for analysis.");
+    vector<uint64_t> cache_snp;
+    vector<uint32_t> cache_indi;
+    cache_snp.reserve(_include.size());
+    cache_indi.reserve(_keep.size());
+    for (int j = 0; j < _snp_num; j++) {
+        if (!rsnp[j]) continue;
+        auto iter = snp_row.find(_snp_name[j]);
+        if (iter == snp_row.end() || iter->second.second != _allele1[j]) {
+            LOGGER.w(0, "the genotype cache [" + cache_file + "] doesn't cover SNP " + _snp_name[j] + " with A1 " + _allele1[j] + ".");
+            return false;
+        }
+        cache_snp.push_back(iter->second.first * header.rowBytes);
+    }
+    for (int i = 0; i < _indi_num; i++) {
+        if (!rindi[i]) continue;
+        auto iter = indi_col.find(_fid[i] + ":" + _pid[i]);
+        if (iter == indi_col.end()) {
+            LOGGER.w(0, "the genotype cache [" + cache_file + "] doesn't cover individual " + _fid[i] + " " + _pid[i] + ".");
+            return false;
+        }
+        cache_indi.push_back(iter->second);
+    }
+
+    uint64_t num_byte = header.dataOffset + header.numSNP * header.rowBytes;
+    uint64_t file_byte;
+    void *addr = map_file_read(cache_file.c_str(), file_byte);
+    if (!addr) LOGGER.e(0, "failed to map the file [" + cache_file + "] into memory.");
+    if (file_byte != num_byte) {
+        unmap_file(addr, file_byte);
+        LOGGER.w(0, "[" + cache_file + "] is truncated.");
+        return false;
+    }
+
+    free_geno_cache();
+    _geno_cache_map = addr;
+    _geno_cache_bytes = num_byte;
+    _geno_cache = (const int8_t *)addr + header.dataOffset;
+    _geno_cache_row = header.rowBytes;
+    _geno_cache_snp = cache_snp;
+    _geno_cache_indi = cache_indi;
+    vector<uint64_t>().swap(_geno_bits);
+    LOGGER << "Genotype data for " << _keep.size() << " individuals and " << _include.size() << " SNPs to be included from the cache [" + cache_file + "]." << endl;
+
+    update_fam(rindi);
+    update_bim(rsnp);
+    return true;
+}
+
+// all the SNPs and individuals of the BED file, whatever --keep or --extract, so that one cache
+// serves the runs on any subset; the BED file is streamed, no genotype is held in memory
+void gcta::make_geno_cache(string bfile, string cache_file)
+{
+    string bedfile = bfile + ".bed";
+    read_famfile(bfile + ".fam");
+    read_bimfile(bfile + ".bim");
+    struct stat bed_st;
+    if (stat(bedfile.c_str(), &bed_st) != 0) LOGGER.e(0, "cannot open the file [" + bedfile + "] to read.");
+    uint64_t num_byte = (_indi_num + 3) / 4;
+    if ((uint64_t)bed_st.st_size != 3 + num_byte * _snp_num) {
+        LOGGER.e(0, "the size of [" + bedfile + "] doesn't match the FAM and BIM files.");
+    }
+
+    string snp_block, indi_block;
+    for (int j = 0; j < _snp_num; j++) snp_block += _snp_name[j] + "\t" + _allele1[j] + "\n";
+    for (int i = 0; i < _indi_num; i++) indi_block += _fid[i] + ":" + _pid[i] + "\n";
+
+    GenoCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, geno_cache_magic, 8);
+    header.bedSize = bed_st.st_size;
+    header.bedMtime = bed_st.st_mtime;
+    header.numSNP = _snp_num;
+    header.numIndi = _indi_num;
+    header.rowBytes = (header.numIndi + 63) / 64 * 64;
+    header.snpBytes = snp_block.size();
+    header.indiBytes = indi_block.size();
+    header.dataOffset = (sizeof(header) + header.snpBytes + header.indiBytes + 4095) / 4096 * 4096;
+
+    FILE *bed = fopen(bedfile.c_str(), "rb");
+    if (!bed) LOGGER.e(0, "cannot open the file [" + bedfile + "] to read.");
+    unsigned char magic[3];
+    if (fread(magic, 1, 3, bed) != 3 || magic[0] != 0x6c || magic[1] != 0x1b || magic[2] != 0x01) {
+        fclose(bed);
+        LOGGER.e(0, "[" + bedfile + "] is not a SNP-major PLINK BED file.");
+    }
+
+    // written aside and renamed, so the concurrent runs never map a half written cache
+    string tmp_file = cache_file + ".tmp" + to_string(getpid());
+    FILE *out = fopen(tmp_file.c_str(), "wb");
+    if (!out) LOGGER.e(0, "cannot open the file [" + tmp_file + "] to write.");
+    LOGGER << "Saving the genotype cache of " << header.numIndi << " individuals and " << header.numSNP << " SNPs to [" + cache_file + "] ..." << endl;
+    vector<char> pad(header.dataOffset - sizeof(header) - header.snpBytes - header.indiBytes, 0);
+    bool status = fwrite(&header, sizeof(header), 1, out) == 1 &&
+        fwrite(snp_block.data(), 1, header.snpBytes, out) == header.snpBytes &&
+        fwrite(indi_block.data(), 1, header.indiBytes, out) == header.indiBytes &&
+        fwrite(pad.data(), 1, pad.size(), out) == pad.size();
+    // PLINK 2-bit codes: 00 homozygous A1, 01 missing, 10 heterozygous, 11 homozygous A2
+    static const int8_t a1_count[4] = {2, -1, 1, 0};
+    vector<unsigned char> buf(num_byte);
+    vector<int8_t> row(header.rowBytes, 0);
+    for (int j = 0; j < _snp_num && status; j++) {
+        if (fread(buf.data(), 1, num_byte, bed) != num_byte) {
+            fclose(bed);
+            fclose(out);
+            remove(tmp_file.c_str());
+            LOGGER.e(0, "problem with the BED file ... has the FAM/BIM file been changed?");
+        }
+        for (int i = 0; i < _indi_num; i++) row[i] = a1_count[(buf[i >> 2] >> ((i & 3) << 1)) & 3];
+        status = fwrite(row.data(), 1, header.rowBytes, out) == header.rowBytes;
+    }
+    fclose(bed);
+    if (fclose(out) != 0 || !status) {
+        remove(tmp_file.c_str());
+        LOGGER.e(0, "failed to write the genotype cache [" + cache_file + "].");
+    }
+    if (replace_file(tmp_file.c_str(), cache_file.c_str()) != 0) {
+        remove(tmp_file.c_str());
+        LOGGER.e(0, "failed to write the genotype cache [" + cache_file + "].");
+    }
+    LOGGER << "The genotype cache has been saved in [" + cache_file + "]." << endl;
+}
+
+void gcta::free_geno_cache()
+{
+    unmap_file(_geno_cache_map, _geno_cache_bytes);
+    _geno_cache_map = NULL;
+    _geno_cache = NULL;
+}
@@ -13,6 +13,7 @@
 #include "gcta.h"
 #include <iterator>
 #include <unordered_set>
+#include "GRMReader.h"
 
 void gcta::enable_grm_bin_flag() {
     _grm_bin_flag = true;
@@ -337,43 +338,74 @@ void gcta::read_grm_gz(string grm_file, vector<string> &grm_id, bool out_id_log,
 
 void gcta::read_grm_bin(string grm_file, vector<string> &grm_id, bool out_id_log, bool read_id_only, bool dont_read_N)
 {
-    int i = 0, j = 0, n = read_grm_id(grm_file, grm_id, out_id_log, read_id_only);
+    int n = read_grm_id(grm_file, grm_id, out_id_log, read_id_only);
 
     if (read_id_only) return;
 
     string grm_binfile = grm_file + ".grm.bin";
-    ifstream A_bin(grm_binfile.c_str(), ios::in | ios::binary);
-    if (!A_bin.is_open()) LOGGER.e(0, "cannot open the file [" + grm_binfile + "] to read.");
-    _grm.resize(n, n);
+    GRMReader grm_map(grm_file, n);
     LOGGER << "Reading the GRM from [" + grm_binfile + "]." << endl;
-    int size = sizeof (float);
-    float f_buf = 0.0;
+    grm_map.read(_grm);
+
+    if(!dont_read_N){
+        LOGGER << "Reading the number of SNPs for the GRM from [" + grm_file + ".grm.N.bin]." << endl;
+        grm_map.read(_grm_N, true);
+    }
+
+    LOGGER << "GRM for " << n << " individuals are included from [" + grm_binfile + "]." << endl;
+}
+
+void gcta::extract_grm_bin(string grm_file, int num_grm_id, const vector<int> &kp, eigenMatrix &A)
+{
+    string grm_binfile = grm_file + ".grm.bin";
+    GRMReader grm_map(grm_file, num_grm_id);
+    LOGGER << "Reading the GRM of " << kp.size() << " individuals from [" + grm_binfile + "]." << endl;
+    grm_map.extract(kp, A);
+}
+
+// the non-zero elements of the GRM rows kept (kp), read from the mapped .grm.bin without forming the dense matrix
+void gcta::extract_grm_bin_sparse(string grm_file, int num_grm_id, const vector<int> &kp, eigenSparseMat &A)
+{
+    string grm_binfile = grm_file + ".grm.bin";
+    GRMReader grm_map(grm_file, num_grm_id);
+    LOGGER << "Reading the non-zero elements of the GRM of " << kp.size() << " individuals from [" + grm_binfile + "]." << endl;
+    int i = 0, j = 0, n = kp.size();
+
+    // lower triangle, row by row
+    vector< vector< pair<int, float> > > low(n);
+    #pragma omp parallel for schedule(dynamic, 64) private(j)
     for (i = 0; i < n; i++) {
+        uint64_t ir = kp[i];
+        const float *cur_row = grm_map.row(ir);
         for (j = 0; j <= i; j++) {
-            if (!(A_bin.read((char*) &f_buf, size))) LOGGER.e(0, "Is the size of the [" + grm_binfile + "] file incorrect?");
-            _grm(j, i) = _grm(i, j) = f_buf;
+            uint64_t ic = kp[j];
+            float val = (ic <= ir) ? cur_row[ic] : grm_map.row(ic)[ir];
+            if (val != 0.0) low[i].push_back(make_pair(j, val));
         }
     }
-    A_bin.close();
 
-    if(!dont_read_N){
-        string grm_Nfile = grm_file + ".grm.N.bin";
-        ifstream N_bin(grm_Nfile.c_str(), ios::in | ios::binary);
-        if (!N_bin.is_open()) LOGGER.e(0, "cannot open the file [" + grm_Nfile + "] to read.");
-        _grm_N.resize(n, n);
-        LOGGER << "Reading the number of SNPs for the GRM from [" + grm_Nfile + "]." << endl;
-        size = sizeof (float);
-        f_buf = 0.0;
-        for (i = 0; i < n; i++) {
-            for (j = 0; j <= i; j++) {
-                if (!(N_bin.read((char*) &f_buf, size))) LOGGER.e(0, "Is the size of the [" + grm_Nfile + "] file incorrect?");
-                _grm_N(j, i) = _grm_N(i, j) = f_buf;
-            }
+    // both triangles; taking the rows in order, the elements of each column are inserted in ascending rows
+    VectorXi col_nnz = VectorXi::Zero(n);
+    uint64_t nnz = 0;
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < low[i].size(); j++) {
+            col_nnz[i]++;
+            if (low[i][j].first != i) col_nnz[low[i][j].first]++;
         }
-        N_bin.close();
     }
-
-    LOGGER << "GRM for " << n << " individuals are included from [" + grm_binfile + "]." << endl;
+    A.resize(n, n);
+    A.reserve(col_nnz);
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < low[i].size(); j++) {
+            int k = low[i][j].first;
+            A.insert(k, i) = low[i][j].second;
+            if (k != i) A.insert(i, k) = low[i][j].second;
+        }
+        nnz += low[i].size();
+        vector< pair<int, float> >().swap(low[i]);
+    }
+    A.makeCompressed();
+    LOGGER << nnz << " non-zero elements in the lower triangle." << endl;
 }
 
 void gcta::rm_cor_indi(double grm_cutoff) {
@@ -673,9 +705,17 @@ void gcta::pca(string grm_file, string keep_indi_file, string remove_indi_file,
     int i = 0, j = 0, n = _keep.size();
     LOGGER << "\nPerforming principal component analysis ..." << endl;
 
-    SelfAdjointEigenSolver<MatrixXd> eigensolver(_grm.cast<double>());
-    MatrixXd evec = (eigensolver.eigenvectors());
-    VectorXd eval = eigensolver.eigenvalues();
+    // the rows of _grm are the individuals of the .grm.id in the order of _keep
+    GrmEigHeader eig_key;
+    bool cache_flag = _grm_eig_cache && _grm_bin_flag && !merge_grm_flag && grm_eig_key(grm_file, _keep, eig_key);
+    MatrixXd evec;
+    VectorXd eval;
+    if (!cache_flag || !read_grm_eig(grm_file, eig_key, eval, evec)) {
+        SelfAdjointEigenSolver<MatrixXd> eigensolver(_grm.cast<double>());
+        evec = eigensolver.eigenvectors();
+        eval = eigensolver.eigenvalues();
+        if (cache_flag) write_grm_eig(grm_file, eig_key, eval, evec);
+    }
 
     string eval_file = _out + ".eigenval";
     ofstream o_eval(eval_file.c_str());
@@ -906,8 +946,8 @@ void gcta::project_loading(string pc_load, int N){
         LOGGER <<  to_string(ind_index+1) + "\r" << flush;
         Matrix<t_val,1,Dynamic> geno(_include.size());
         for(int snp_index=0; snp_index < _include.size(); snp_index++){
-            if (!_snp_1[_include[snp_index]][_keep[ind_index]] || _snp_2[_include[snp_index]][_keep[ind_index]]) {
-                geno(snp_index) = _snp_1[_include[snp_index]][_keep[ind_index]] + _snp_2[_include[snp_index]][_keep[ind_index]];
+            if (geno_a1(_include[snp_index], _keep[ind_index]) >= 0) {
+                geno(snp_index) = geno_a1(_include[snp_index], _keep[ind_index]);
                 if (_allele1[_include[snp_index]] != _ref_A[_include[snp_index]]) geno(snp_index) = 2.0 - geno(snp_index);
                 geno(snp_index) = (geno(snp_index) - mu_adj[snp_index]) / sqrt(mu_adj[snp_index]*(1.0 - 0.5*mu_adj[snp_index]));
             }else{
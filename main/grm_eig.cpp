@@ -0,0 +1,120 @@
+/*
+ * GCTA: a tool for Genome-wide Complex Trait Analysis
+ *
+ * Cache of the eigendecomposition of a binary GRM (--grm-eig-cache), saved as
+ * [prefix].[keep hash].grm.eig next to the GRM and reused by --pca, --reml-spectral and
+ * --mlma --reml-spectral. The GRM rows kept differ between analyses (e.g. --pca keeps all the
+ * individuals, REML only those with a phenotype), so each set of rows has its own file.
+ *
+ * This file is distributed under the GNU General Public
+ * License, Version 3.  Please see the file LICENSE for more
+ * details
+ */
+
+#include "gcta.h"
+#include "mem.hpp"
+#include "StrIndex.hpp"
+#include <zlib.h>
+
+// File layout: header, eigenvalues in ascending order (double[numEig]), then the eigenvectors
+// column by column (double[n * numEig]), rows in the order of the kept individuals.
+// The key (GrmEigHeader) is the CRC32 and size of the .grm.bin, and a hash of the GRM rows
+// kept, in order. It is computed once by grm_eig_key() and passed to both the read and the
+// write, as the CRC reads the whole .grm.bin.
+
+static const char grm_eig_magic[8] = {'G', 'C', 'T', 'A', 'E', 'I', 'G', '1'};
+
+static string grm_eig_file(const string &grm_file, const GrmEigHeader &key)
+{
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)key.keepHash);
+    return grm_file + "." + hash + ".grm.eig";
+}
+
+bool gcta::grm_eig_key(string grm_file, const vector<int> &kp, GrmEigHeader &header)
+{
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, grm_eig_magic, 8);
+    header.n = kp.size();
+
+    string grm_bin = grm_file + ".grm.bin";
+    FILE *in = fopen(grm_bin.c_str(), "rb");
+    if (!in) {
+        LOGGER.w(0, "cannot open [" + grm_bin + "] to key the eigendecomposition cache.");
+        return false;
+    }
+    vector<unsigned char> buf(1 << 24);
+    uLong crc = crc32(0L, Z_NULL, 0);
+    size_t len = 0;
+    while ((len = fread(buf.data(), 1, buf.size(), in)) > 0) {
+        crc = crc32(crc, buf.data(), len);
+        header.grmSize += len;
+    }
+    bool status = !ferror(in);
+    fclose(in);
+    header.grmCRC = crc;
+    if (!status) LOGGER.w(0, "cannot read [" + grm_bin + "] to key the eigendecomposition cache.");
+
+    uint64_t h = StrIndex::hash(NULL, 0);
+    for (int i = 0; i < kp.size(); i++) {
+        uint32_t row = kp[i];
+        char bytes[4] = {(char)row, (char)(row >> 8), (char)(row >> 16), (char)(row >> 24)};
+        h = StrIndex::hash(bytes, 4, h);
+    }
+    header.keepHash = h;
+    return status;
+}
+
+void gcta::set_grm_eig_cache()
+{
+    _grm_eig_cache = true;
+}
+
+bool gcta::read_grm_eig(string grm_file, const GrmEigHeader &key, VectorXd &eval, MatrixXd &evec)
+{
+    string eig_file = grm_eig_file(grm_file, key);
+    FILE *in = fopen(eig_file.c_str(), "rb");
+    if (!in) return false;
+    GrmEigHeader header;
+    bool status = fread(&header, sizeof(header), 1, in) == 1 && memcmp(header.magic, grm_eig_magic, 8) == 0;
+    status = status && header.n == key.n && header.numEig == key.n && header.grmSize == key.grmSize && header.grmCRC == key.grmCRC && header.keepHash == key.keepHash;
+    if (!status) {
+        fclose(in);
+        LOGGER << "The eigendecomposition in [" + eig_file + "] doesn't match the GRM and the individuals of this analysis. It will be recalculated." << endl;
+        return false;
+    }
+    eval.resize(header.numEig);
+    evec.resize(header.n, header.numEig);
+    status = fread(eval.data(), sizeof(double), header.numEig, in) == header.numEig && fread(evec.data(), sizeof(double), header.n * header.numEig, in) == header.n * header.numEig;
+    fclose(in);
+    if (!status) {
+        LOGGER.w(0, "[" + eig_file + "] is truncated. The eigendecomposition will be recalculated.");
+        return false;
+    }
+    LOGGER << "Eigendecomposition of the GRM of " << header.n << " individuals has been read from [" + eig_file + "]." << endl;
+    return true;
+}
+
+void gcta::write_grm_eig(string grm_file, const GrmEigHeader &key, const VectorXd &eval, const MatrixXd &evec)
+{
+    string eig_file = grm_eig_file(grm_file, key);
+    GrmEigHeader header = key;
+    header.numEig = eval.size();
+
+    // written aside and renamed, so a concurrent job never reads a half written cache
+    string tmp_file = eig_file + ".tmp" + to_string(getpid());
+    FILE *out = fopen(tmp_file.c_str(), "wb");
+    bool status = (out != NULL);
+    if (status) {
+        status = fwrite(&header, sizeof(header), 1, out) == 1
+            && fwrite(eval.data(), sizeof(double), eval.size(), out) == eval.size()
+            && fwrite(evec.data(), sizeof(double), evec.size(), out) == evec.size();
+        if (fclose(out) != 0) status = false;
+    }
+    if (!status || replace_file(tmp_file.c_str(), eig_file.c_str()) != 0) {
+        remove(tmp_file.c_str());
+        LOGGER.w(0, "cannot write the eigendecomposition cache [" + eig_file + "].");
+        return;
+    }
+    LOGGER << "Eigendecomposition of the GRM has been saved in [" + eig_file + "]." << endl;
+}
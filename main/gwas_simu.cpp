@@ -207,8 +207,8 @@ void gcta::GWAS_simu(string bfile, int simu_num, string qtl_file, int case_num,
             if (y[0][i] == -9) continue;
             out_emBayesB << _pid[_keep[i]] << " " << g[i] << " " << y[0][i] << endl;
             for (j = 0; j < _include.size(); j++) {
-                if (_snp_1[_include[j]][_keep[i]] && !_snp_2[_include[j]][_keep[i]]) out_emBayesB << _mu[_include[j]] << " ";
-                else out_emBayesB << (double) (_snp_1[_include[j]][_keep[i]] + _snp_2[_include[j]][_keep[i]]) << " ";
+                if (geno_a1(_include[j], _keep[i]) < 0) out_emBayesB << _mu[_include[j]] << " ";
+                else out_emBayesB << (double) geno_a1(_include[j], _keep[i]) << " ";
             }
             out_emBayesB << endl;
         }
@@ -682,8 +682,7 @@ void gcta::simu_geno_unlinked(int N, int M, double maf)
     _genet_dst.resize(M);
     _allele1.resize(M);
     _allele2.resize(M);
-    _snp_1.resize(M);
-    _snp_2.resize(M);
+    init_geno_bits(M, N);
 
 //double p=0.0;
     std::tr1::minstd_rand eng;
@@ -701,8 +700,6 @@ void gcta::simu_geno_unlinked(int N, int M, double maf)
         _genet_dst[j]=0.0;
         _allele1[j]="A";
         _allele2[j]="G";
-        _snp_1[j].resize(N);
-        _snp_2[j].resize(N);
                 std::tr1::uniform_real<double> runiform(maf,1-maf);
         double p = runiform(eng)/1.0e10;
 		
@@ -717,12 +714,7 @@ void gcta::simu_geno_unlinked(int N, int M, double maf)
                         LOGGER<<x<<"\t";
 			
 			
-            if(x==2) _snp_1[j][i]=_snp_2[j][i]=true;
-            else if(x==1){
-                _snp_1[j][i]=false;
-                _snp_2[j][i]=true;
-            }
-            else _snp_1[j][i]=_snp_2[j][i]=false;
+            set_geno_a1(j, i, x);
         }  
 		
                 //debug
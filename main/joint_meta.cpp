@@ -11,6 +11,7 @@
  */
 
 #include "gcta.h"
+#include "sumstat_bin.h"
 
 void gcta::set_diff_freq(double freq_diff){
     _diff_freq = freq_diff;
@@ -18,8 +19,17 @@ void gcta::set_diff_freq(double freq_diff){
 void gcta::read_metafile(string metafile, bool GC, double GC_val) {
     double freq_diff_thresh = _diff_freq;
     LOGGER << "\nReading GWAS summary-level statistics from [" + metafile + "] ..." << endl;
-    ifstream Meta(metafile.c_str());
-    if (!Meta) LOGGER.e(0, "cannot open the file [" + metafile + "] to read.");
+    // the binary store of --make-sumstat-bin, or the text file
+    bool bin_flag = SumstatBin::is_sumstat_bin(metafile);
+    SumstatBin Meta_bin;
+    ifstream Meta;
+    if (bin_flag) {
+        Meta_bin.open(metafile);
+        if (!Meta_bin.has_cojo_cols()) LOGGER.e(0, "format error in the input file [" + metafile + "].");
+    } else {
+        Meta.open(metafile.c_str());
+        if (!Meta) LOGGER.e(0, "cannot open the file [" + metafile + "] to read.");
+    }
 
     int i = 0, count = 0;
     double f_buf = 0.0, b_buf = 0.0, se_buf = 0.0, p_buf = 0.0, N_buf = 0.0, Vp_buf = 0.0, GC_buf = 0.0, chi_buf = 0.0, h_buf = 0.0;
@@ -30,32 +40,51 @@ void gcta::read_metafile(string metafile, bool GC, double GC_val) {
     vector<string> ref_A1_buf, ref_A2_buf, bad_A1, bad_A2, bad_refA;
     vector<double> freq_buf, beta_buf, beta_se_buf, pval_buf, N_o_buf, Vp_v_buf, GC_v_buf;
     map<string, int>::iterator iter;
-    getline(Meta, str_buf); // the header line
-    if (StrFunc::split_string(str_buf, vs_buf) < 7) LOGGER.e(0, "format error in the input file [" + metafile + "].");
+    if (!bin_flag) {
+        getline(Meta, str_buf); // the header line
+        if (StrFunc::split_string(str_buf, vs_buf) < 7) LOGGER.e(0, "format error in the input file [" + metafile + "].");
+    }
     _jma_Vp = 0.0;
     _GC_val = -1;
-    while (Meta) {
-        getline(Meta, str_buf0);
-        stringstream iss(str_buf0);
-        iss >> snp_buf >> A1_buf >> A2_buf;
-        StrFunc::to_upper(A1_buf);
-        StrFunc::to_upper(A2_buf);
-        iss >> str_buf;
-        f_buf = atof(str_buf.c_str());
-        iss >> str_buf;
-        if (str_buf == "NA" || str_buf == ".") continue;
-        b_buf = atof(str_buf.c_str());
-        iss >> str_buf;
-        if (str_buf == "NA" || str_buf == "." || str_buf == "0") continue;
-        se_buf = atof(str_buf.c_str());
-        iss >> str_buf;
-        if (str_buf == "NA" || str_buf == ".") continue;
-        p_buf = atof(str_buf.c_str());
-        iss >> str_buf;
-        if (str_buf == "NA" || str_buf == ".") continue;
-        N_buf = atof(str_buf.c_str());
-        if (N_buf < 10) LOGGER.e(0, "invalid sample size in line:\n\"" + str_buf0 + "\"");
-        if (Meta.eof()) break;
+    uint64_t row = 0;
+    while (bin_flag ? row < Meta_bin.size() : (bool)Meta) {
+        if (bin_flag) {
+            snp_buf = Meta_bin.snp(row);
+            A1_buf = Meta_bin.a1(row);
+            A2_buf = Meta_bin.a2(row);
+            f_buf = Meta_bin.freq(row);
+            if (std::isnan(f_buf)) f_buf = 0.0;
+            b_buf = Meta_bin.b(row);
+            se_buf = Meta_bin.se(row);
+            p_buf = Meta_bin.p(row);
+            N_buf = Meta_bin.n(row);
+            str_buf0 = snp_buf;
+            row++;
+            if (std::isnan(b_buf) || std::isnan(se_buf) || se_buf == 0.0 || std::isnan(p_buf) || std::isnan(N_buf)) continue;
+            if (N_buf < 10) LOGGER.e(0, "invalid sample size of the SNP " + snp_buf + ".");
+        } else {
+            getline(Meta, str_buf0);
+            stringstream iss(str_buf0);
+            iss >> snp_buf >> A1_buf >> A2_buf;
+            StrFunc::to_upper(A1_buf);
+            StrFunc::to_upper(A2_buf);
+            iss >> str_buf;
+            f_buf = atof(str_buf.c_str());
+            iss >> str_buf;
+            if (str_buf == "NA" || str_buf == ".") continue;
+            b_buf = atof(str_buf.c_str());
+            iss >> str_buf;
+            if (str_buf == "NA" || str_buf == "." || str_buf == "0") continue;
+            se_buf = atof(str_buf.c_str());
+            iss >> str_buf;
+            if (str_buf == "NA" || str_buf == ".") continue;
+            p_buf = atof(str_buf.c_str());
+            iss >> str_buf;
+            if (str_buf == "NA" || str_buf == ".") continue;
+            N_buf = atof(str_buf.c_str());
+            if (N_buf < 10) LOGGER.e(0, "invalid sample size in line:\n\"" + str_buf0 + "\"");
+            if (Meta.eof()) break;
+        }
         iter = _snp_name_map.find(snp_buf);
         h_buf = 2.0 * f_buf * (1.0 - f_buf);
         Vp_buf = h_buf * N_buf * se_buf * se_buf + h_buf * b_buf * b_buf * N_buf / (N_buf - 1.0);
@@ -85,7 +114,8 @@ void gcta::read_metafile(string metafile, bool GC, double GC_val) {
         pval_buf.push_back(p_buf);
         N_o_buf.push_back(N_buf);
     }
-    Meta.close();
+    if (bin_flag) Meta_bin.close();
+    else Meta.close();
     LOGGER << "GWAS summary statistics of " << count << " SNPs read from [" + metafile + "]." << endl;
     _jma_Vp = CommFunc::median(Vp_v_buf);
     LOGGER << "Phenotypic variance estimated from summary statistics of all " << count << " SNPs: " << _jma_Vp << " (variance of logit for case-control studies)." << endl;
@@ -22,55 +22,49 @@ void gcta::make_XMat_mkl(float *X, bool grm_d_flag)
     LOGGER << "Recoding genotypes (individual major mode) ..." << endl;
     unsigned long i = 0, j = 0, k = 0, n = _keep.size(), m = _include.size();
 
-    if (!grm_d_flag) {
+    if (!_dosage_flag) {
+        // one SNP row at a time into the column of X
+        vector<uintptr_t> mask;
+        geno_keep_mask(mask);
+        #pragma omp parallel private(i)
+        {
+            vector<double> x(n);
+            vector<uintptr_t> buf;
+            #pragma omp for
+            for (j = 0; j < m; j++) {
+                double mu = _mu[_include[j]];
+                const double add[4] = {0.0, 1.0, 2.0, 1e6}, dom[4] = {0.0, mu, 2.0 * mu - 2.0, 1e6};
+                geno_row(j, grm_d_flag ? dom : add, mask, buf, x.data());
+                for (i = 0; i < n; i++) X[i * m + j] = x[i];
+            }
+        }
+    }
+    else if (!grm_d_flag) {
         #pragma omp parallel for private(j)
         for (i = 0; i < n; i++) {
-            if (_dosage_flag) {
-                for (j = 0; j < m; j++) {
-                    if (_geno_dose[_keep[i]][_include[j]] < 1e5) {
-                        if (_allele1[_include[j]] == _ref_A[_include[j]]) X[i * m + j] = _geno_dose[_keep[i]][_include[j]];
-                        else X[i * m + j] = 2.0 - _geno_dose[_keep[i]][_include[j]];
-                    } else X[i * m + j] = 1e6;
-                }
-                _geno_dose[i].clear();
-            } else {
-                for (j = 0; j < _include.size(); j++) {
-                    if (!_snp_1[_include[j]][_keep[i]] || _snp_2[_include[j]][_keep[i]]) {
-                        if (_allele1[_include[j]] == _ref_A[_include[j]]) X[i * m + j] = _snp_1[_include[j]][_keep[i]] + _snp_2[_include[j]][_keep[i]];
-                        else X[i * m + j] = 2.0 - (_snp_1[_include[j]][_keep[i]] + _snp_2[_include[j]][_keep[i]]);
-                    } else X[i * m + j] = 1e6;
-                }
+            for (j = 0; j < m; j++) {
+                if (_geno_dose[_keep[i]][_include[j]] < 1e5) {
+                    if (_allele1[_include[j]] == _ref_A[_include[j]]) X[i * m + j] = _geno_dose[_keep[i]][_include[j]];
+                    else X[i * m + j] = 2.0 - _geno_dose[_keep[i]][_include[j]];
+                } else X[i * m + j] = 1e6;
             }
+            _geno_dose[i].clear();
         }
     } 
     else {
         #pragma omp parallel for private(j, k)
         for (i = 0; i < n; i++) {
-            if (_dosage_flag) {
-                for (j = 0; j < m; j++) {
-                    if (_geno_dose[_keep[i]][_include[j]] < 1e5) {
-                        k = i * m + j;
-                        if (_allele1[_include[j]] == _ref_A[_include[j]]) X[k] = _geno_dose[_keep[i]][_include[j]];
-                        else X[k] = 2.0 - _geno_dose[_keep[i]][_include[j]];
-                        if (X[k] < 0.5) X[k] = 0.0;
-                        else if (X[k] < 1.5) X[k] = _mu[_include[j]];
-                        else X[k] = (2.0 * _mu[_include[j]] - 2.0);
-                    } else X[k] = 1e6;
-                }
-                _geno_dose[i].clear();
-            } 
-            else {
-                for (j = 0; j < _include.size(); j++) {
-                    if (!_snp_1[_include[j]][_keep[i]] || _snp_2[_include[j]][_keep[i]]) {
-                        k = i * m + j;
-                        if (_allele1[_include[j]] == _ref_A[_include[j]]) X[k] = _snp_1[_include[j]][_keep[i]] + _snp_2[_include[j]][_keep[i]];
-                        else X[k] = 2.0 - (_snp_1[_include[j]][_keep[i]] + _snp_2[_include[j]][_keep[i]]);
-                        if (X[k] < 0.5) X[k] = 0.0;
-                        else if (X[k] < 1.5) X[k] = _mu[_include[j]];
-                        else X[k] = (2.0 * _mu[_include[j]] - 2.0);
-                    } else X[i * m + j] = 1e6;
-                }
+            for (j = 0; j < m; j++) {
+                k = i * m + j;
+                if (_geno_dose[_keep[i]][_include[j]] < 1e5) {
+                    if (_allele1[_include[j]] == _ref_A[_include[j]]) X[k] = _geno_dose[_keep[i]][_include[j]];
+                    else X[k] = 2.0 - _geno_dose[_keep[i]][_include[j]];
+                    if (X[k] < 0.5) X[k] = 0.0;
+                    else if (X[k] < 1.5) X[k] = _mu[_include[j]];
+                    else X[k] = (2.0 * _mu[_include[j]] - 2.0);
+                } else X[k] = 1e6;
             }
+            _geno_dose[i].clear();
         }
     }
 }
@@ -24,6 +24,8 @@ void gcta::mlma(string grm_file, bool m_grm_flag, string subtract_grm_file, stri
     if (m_grm_flag) grm_flag = false;
     bool subtract_grm_flag = (!subtract_grm_file.empty());
     if (subtract_grm_flag && m_grm_flag) LOGGER.e(0, "the --mlma-subtract-grm option cannot be used in combination with the --mgrm option.");
+    if (_reml_matfree) LOGGER.e(0, "--reml-matfree can't be used with --mlma.");
+    if (_reml_spectral && (m_grm_flag || within_family)) LOGGER.e(0, "--reml-spectral needs a single GRM. It can't be used with --mgrm or --reml-wfam.");
     
     // Read data
     int qcovar_num=0, covar_num=0;
@@ -174,7 +176,7 @@ void gcta::mlma(string grm_file, bool m_grm_flag, string subtract_grm_file, stri
             delete[] _grm_mkl;
         }
     }
-    _A[_r_indx.size()-1]=eigenMatrix::Identity(_n, _n);
+    if(!_reml_spectral) _A[_r_indx.size()-1]=eigenMatrix::Identity(_n, _n);
     
     // construct X matrix
     vector<eigenMatrix> E_float;
@@ -197,6 +199,7 @@ void gcta::mlma(string grm_file, bool m_grm_flag, string subtract_grm_file, stri
     // run REML algorithm
     LOGGER << "\nPerforming MLM association analyses" << (subtract_grm_flag?"":" (including the candidate SNP)") << " ..."<<endl;
     unsigned long n=_keep.size(), m=_include.size();
+    if(_reml_spectral) reml_spectral_decomp((grm_flag && !subtract_grm_flag && _grm_bin_flag) ? grm_file : "", kp);
 	reml(false, true, reml_priors, reml_priors_var, -2.0, -2.0, no_constrain, true, true);
     _P.resize(0,0);
     _A.clear();
@@ -221,7 +224,8 @@ void gcta::mlma(string grm_file, bool m_grm_flag, string subtract_grm_file, stri
     
     if (_mu.empty()) calcu_mu();
     eigenVector beta, se, pval;
-    if(no_adj_covar) mlma_calcu_stat_covar(y, _geno_mkl, n, m, beta, se, pval);
+    if(_reml_spectral) mlma_calcu_stat_spectral(y, n, m, no_adj_covar, beta, se, pval);
+    else if(no_adj_covar) mlma_calcu_stat_covar(y, _geno_mkl, n, m, beta, se, pval);
     else mlma_calcu_stat(y, _geno_mkl, n, m, beta, se, pval);
     delete[] y;
     delete[] _geno_mkl;
@@ -355,6 +359,7 @@ void gcta::mlma_loco(string phen_file, string qcovar_file, string covar_file, in
 {
     unsigned long i=0, j=0, k=0, c1=0, c2=0, n=0;
     _reml_max_iter=MaxIter;
+    if (_reml_matfree || _reml_spectral) LOGGER.e(0, "--reml-matfree and --reml-spectral can't be used with --mlma-loco.");
     bool qcovar_flag=(!qcovar_file.empty());
     bool covar_flag=(!covar_file.empty());
     if(!qcovar_flag && !covar_flag) no_adj_covar=false;
@@ -15,6 +15,7 @@
 #include "Logger.h"
 #include "StatFunc.h"
 #include "zlib.h"
+#include "sumstat_bin.h"
 #include <limits>
 #include <cmath>
 #include <iostream>
@@ -207,7 +208,7 @@ void read_metafile_list(string mtcojolist_file, string &target_pheno, string &ta
     meta_list.close();
 }
 
-void gcta::init_meta_snp_map(vector<string> snplist, map<string, int> &snp_name_map, vector<string> &snp_name, vector<int> &remain_snp) {
+void gcta::init_meta_snp_map(const vector<string> &snplist, map<string, int> &snp_name_map, vector<string> &snp_name, vector<int> &remain_snp) {
     int i=0, size=0, nsnp = snplist.size();
 
     snp_name_map.clear(); remain_snp.clear();
@@ -237,7 +238,7 @@ void gcta::init_gwas_variable(vector<vector<string>> &snp_a1, vector<vector<stri
     snp_pval.resize(nsnp, npheno); n.resize(nsnp, npheno);
 }
 
-void gcta::update_meta_snp_list(vector<string> &snplist, map<string, int> snp_id_map) {
+void gcta::update_meta_snp_list(vector<string> &snplist, const map<string, int> &snp_id_map) {
     int i = 0, nsnpbuf = 0;
     vector<string> snpbuf(snplist);
     nsnpbuf = snplist.size();
@@ -249,7 +250,7 @@ void gcta::update_meta_snp_list(vector<string> &snplist, map<string, int> snp_id
     }
 }
 
-void gcta::update_meta_snp_map(vector<string> snplist, map<string, int> &snp_id_map, vector<string> &snp_id, vector<int> &snp_indx, bool indx_flag) {
+void gcta::update_meta_snp_map(const vector<string> &snplist, map<string, int> &snp_id_map, vector<string> &snp_id, vector<int> &snp_indx, bool indx_flag) {
     int i = 0, j = 0, size = 0, nsnp = snplist.size();
     map<string,int> snp_add_map;
     
@@ -304,7 +305,7 @@ void update_mtcojo_snp_kp(const vector<string> adjsnps, map<string,int> &snp_id_
     stable_sort(remain_snp_indx.begin(), remain_snp_indx.end());
 }
 
-void gcta::update_mtcojo_snp_rm(vector<string> adjsnps, map<string,int> &snp_id_map, vector<int> &remain_snp_indx) {
+void gcta::update_mtcojo_snp_rm(const vector<string> &adjsnps, map<string,int> &snp_id_map, vector<int> &remain_snp_indx) {
     
     int i=0, nsnpbuf=adjsnps.size();
     std::map<string,int>::iterator iter;
@@ -318,7 +319,28 @@ void gcta::update_mtcojo_snp_rm(vector<string> adjsnps, map<string,int> &snp_id_
     stable_sort(remain_snp_indx.begin(), remain_snp_indx.end());
 }
 
+vector<string> gcta::read_snp_metafile_bin(string metafile, map<string,int> &gws_snp_name_map, double thresh) {
+    SumstatBin meta_snp(metafile);
+    if (!meta_snp.has_cojo_cols())
+        LOGGER.e(0, "the GWAS summary data file [" + metafile + "] should be made from a file in GCTA-COJO format.");
+
+    uint64_t i = 0, nsnp = meta_snp.size();
+    vector<string> snplist(nsnp);
+    for(i=0; i<nsnp; i++) {
+        snplist[i] = meta_snp.snp(i);
+        // keep significant SNPs
+        double pval_buf = meta_snp.p(i);
+        if(std::isnan(pval_buf)) pval_buf = 1.0;
+        if( pval_buf < thresh && (gws_snp_name_map.find(snplist[i]) == gws_snp_name_map.end()) ) {
+            int size = gws_snp_name_map.size();
+            gws_snp_name_map.insert(pair<string,int>(snplist[i], size));
+        }
+    }
+    return snplist;
+}
+
 vector<string> gcta::read_snp_metafile_txt(string metafile, map<string,int> &gws_snp_name_map, double thresh) {
+    if (SumstatBin::is_sumstat_bin(metafile)) return read_snp_metafile_bin(metafile, gws_snp_name_map, thresh);
     ifstream meta_snp(metafile.c_str());
     if (!meta_snp)
          LOGGER.e(0, "cannot open the file [" + metafile + "] to read.");
@@ -390,18 +412,57 @@ vector<string> gcta::read_snp_metafile_gz(string metafile, map<string,int> &gws_
     return snplist;
 }
 
-double gcta::read_single_metafile_txt(string metafile, map<string, int> id_map,
+// only the SNPs in id_map are looked up through the hash index of the store
+double gcta::read_single_metafile_bin(string metafile, const map<string, int> &id_map,
                          vector<string> &snp_a1, vector<string> &snp_a2,
                          eigenVector &snp_freq, eigenVector &snp_b,
                          eigenVector &snp_se, eigenVector &snp_pval,
                          eigenVector &snp_n, vector<bool> &snp_flag) {
+    SumstatBin meta_raw(metafile);
+    if (!meta_raw.has_cojo_cols())
+        LOGGER.e(0, "the GWAS summary data file [" + metafile + "] should be made from a file in GCTA-COJO format.");
+
+    int snp_indx = 0;
+    map<string, int>::const_iterator iter;
+    double h_buf = 0.0, vp_buf = 0.0, median_vp = 0.0;
+    vector<double> vec_vp_buf;
+    for(iter = id_map.begin(); iter != id_map.end(); iter++) {
+        int64_t row = meta_raw.find(iter->first);
+        if(row < 0) continue;
+        snp_indx = iter->second;
+        snp_a1[snp_indx] = meta_raw.a1(row); snp_a2[snp_indx] = meta_raw.a2(row);
+        snp_freq(snp_indx) = meta_raw.freq(row);
+        snp_b(snp_indx) = meta_raw.b(row);
+        snp_se(snp_indx) = meta_raw.se(row);
+        snp_pval(snp_indx) = meta_raw.p(row);
+        snp_n(snp_indx) = meta_raw.n(row);
+        snp_flag[snp_indx] = true;
+
+        if(!std::isnan(snp_freq(snp_indx)) && !std::isnan(snp_b(snp_indx)) && !std::isnan(snp_se(snp_indx)) && !std::isnan(snp_pval(snp_indx)) && !std::isnan(snp_n(snp_indx))) {
+            h_buf = 2 * snp_freq(snp_indx) * ( 1- snp_freq(snp_indx) );
+            vp_buf = h_buf * snp_b(snp_indx) * snp_b(snp_indx) + h_buf * snp_n(snp_indx) * snp_se(snp_indx) * snp_se(snp_indx);
+            vec_vp_buf.push_back(vp_buf);
+        }
+    }
+    if(vec_vp_buf.size()>0) median_vp = CommFunc::median(vec_vp_buf);
+
+    return median_vp;
+}
+
+double gcta::read_single_metafile_txt(string metafile, const map<string, int> &id_map,
+                         vector<string> &snp_a1, vector<string> &snp_a2,
+                         eigenVector &snp_freq, eigenVector &snp_b,
+                         eigenVector &snp_se, eigenVector &snp_pval,
+                         eigenVector &snp_n, vector<bool> &snp_flag) {
+    if (SumstatBin::is_sumstat_bin(metafile))
+        return read_single_metafile_bin(metafile, id_map, snp_a1, snp_a2, snp_freq, snp_b, snp_se, snp_pval, snp_n, snp_flag);
    
     ifstream meta_raw(metafile.c_str());
     if (!meta_raw)
         LOGGER.e(0, "cannot open the file [" + metafile + "] to read.");
     string strbuf="", valbuf="";
     int line_number=0, snp_indx=0;
-    map<string, int>::iterator iter;
+    map<string, int>::const_iterator iter;
     // Read the summary data
     double pval_thresh = 0.5, h_buf = 0.0, vp_buf = 0.0, median_vp = 0.0;
     bool missing_flag = false;
@@ -453,7 +514,7 @@ double gcta::read_single_metafile_txt(string metafile, map<string, int> id_map,
     return median_vp;
 }
 
-double gcta::read_single_metafile_gz(string metafile, map<string, int> id_map,
+double gcta::read_single_metafile_gz(string metafile, const map<string, int> &id_map,
                          vector<string> &snp_a1, vector<string> &snp_a2,
                          eigenVector &snp_freq, eigenVector &snp_b,
                          eigenVector &snp_se, eigenVector &snp_pval,
@@ -468,7 +529,7 @@ double gcta::read_single_metafile_gz(string metafile, map<string, int> id_map,
     string err_msg = "Failed to read [" + metafile + "]. An error occurs in line ";
 
     int line_number=0, snp_indx=0;
-    map<string, int>::iterator iter;
+    map<string, int>::const_iterator iter;
     // Read the summary data
     double pval_thresh = 0.5, h_buf = 0.0, vp_buf = 0.0, median_vp = 0.0;
     bool missing_flag = false;
@@ -530,15 +591,15 @@ double gcta::read_single_metafile_gz(string metafile, map<string, int> id_map,
     return median_vp;
 }
 
-vector<string> gcta::remove_bad_snps(vector<string> snp_name, vector<int> snp_remain, vector<vector<bool>> snp_flag, vector<vector<string>> &snp_a1, vector<vector<string>> &snp_a2, eigenMatrix &snp_freq,  
-                                    eigenMatrix &snp_b, eigenMatrix snp_se, eigenMatrix snp_pval, eigenMatrix snp_n, map<string,int> plink_snp_name_map, vector<string> snp_ref_a1, vector<string> snp_ref_a2, 
+vector<string> gcta::remove_bad_snps(const vector<string> &snp_name, const vector<int> &snp_remain, const vector<vector<bool>> &snp_flag, vector<vector<string>> &snp_a1, vector<vector<string>> &snp_a2, eigenMatrix &snp_freq,  
+                                    eigenMatrix &snp_b, const eigenMatrix &snp_se, const eigenMatrix &snp_pval, const eigenMatrix &snp_n, const map<string,int> &plink_snp_name_map, const vector<string> &snp_ref_a1, const vector<string> &snp_ref_a2, 
                                     int ntarget, int ncovar, string outfile_name) {
     int i=0, j=0, nsnp = snp_remain.size(), npheno = ntarget+ncovar;
     double snp_freq_bak = 0.0;
     string snp_a1_bak = "", snp_a2_bak = ""; 
     vector<string> badsnps;
     vector<int> bad_indx;
-    map<string,int>::iterator iter;
+    map<string,int>::const_iterator iter;
     vector<vector<bool>> flip_flag(npheno);
 
     for(i=0; i<npheno; i++) {
@@ -622,11 +683,11 @@ vector<string> gcta::remove_bad_snps(vector<string> snp_name, vector<int> snp_re
     return badsnps;
 }
 
-vector<string> gcta::remove_freq_diff_snps(vector<string> meta_snp_name, vector<int> meta_snp_remain, map<string,int> snp_name_map, vector<double> ref_freq, eigenMatrix meta_freq, vector<vector<bool>> snp_flag, int ntrait, double freq_thresh, string outfile_name) {
+vector<string> gcta::remove_freq_diff_snps(const vector<string> &meta_snp_name, const vector<int> &meta_snp_remain, const map<string,int> &snp_name_map, const vector<double> &ref_freq, const eigenMatrix &meta_freq, const vector<vector<bool>> &snp_flag, int ntrait, double freq_thresh, string outfile_name) {
     int i = 0, nsnp = meta_snp_remain.size(), nsnp_ttl = meta_snp_remain.size();
     string snpbuf="";
     vector<string> afsnps;
-    map<string,int>::iterator iter_ref;
+    map<string,int>::const_iterator iter_ref;
 
     for( i=0; i<nsnp; i++ ) {
         int refsnp_index = 0;
@@ -674,10 +735,10 @@ vector<string> gcta::remove_freq_diff_snps(vector<string> meta_snp_name, vector<
     return(afsnps);
 }
 
-vector<string> gcta::remove_mono_snps(map<string,int> snp_name_map, vector<double> ref_snpfreq, string outfile_name) {
+vector<string> gcta::remove_mono_snps(const map<string,int> &snp_name_map, const vector<double> &ref_snpfreq, string outfile_name) {
     int i = 0, n_raresnp = 0;
     vector<string> afsnps;
-    map<string,int>::iterator iter;
+    map<string,int>::const_iterator iter;
 
     for(iter=snp_name_map.begin(); iter!=snp_name_map.end(); iter++) {
         double af = ref_snpfreq[iter->second]/2;
@@ -2040,7 +2101,7 @@ double transform_hsq_L(double P, double K, double hsq) {
     return (hsq * C);
 }
 
-vector<string> gcta::read_snp_ldsc(map<string,int> ldsc_snp_name_map, vector<string> snp_name, vector<int> snp_remain, int &ttl_mk_num, 
+vector<string> gcta::read_snp_ldsc(const map<string,int> &ldsc_snp_name_map, const vector<string> &snp_name, const vector<int> &snp_remain, int &ttl_mk_num, 
                                    string ref_ld_dirt, string w_ld_dirt, vector<double> &ref_ld_vec, vector<double> &w_ld_vec) {
     int i=0, nsnp = snp_remain.size();
     vector<string> ref_ld_snps, w_ld_snps;
@@ -2067,13 +2128,13 @@ vector<string> gcta::read_snp_ldsc(map<string,int> ldsc_snp_name_map, vector<str
     return cm_ld_snps;
 }
 
-void gcta::reorder_snp_effect(vector<int> snp_remain, eigenMatrix &bhat_z, eigenMatrix &bhat_n, eigenMatrix snp_b, eigenMatrix snp_se, eigenMatrix snp_n, 
-                              vector<vector<bool>> &snp_flag, vector<vector<bool>> snp_val_flag, vector<int> &nsnp_cm_trait,
-                              vector<string> cm_ld_snps, map<string,int> ldsc_snp_name_map,
-                              eigenVector &ref_ld, eigenVector &w_ld, vector<double> ref_ld_vec, vector<double> w_ld_vec, int ntrait) {
+void gcta::reorder_snp_effect(const vector<int> &snp_remain, eigenMatrix &bhat_z, eigenMatrix &bhat_n, const eigenMatrix &snp_b, const eigenMatrix &snp_se, const eigenMatrix &snp_n, 
+                              vector<vector<bool>> &snp_flag, const vector<vector<bool>> &snp_val_flag, vector<int> &nsnp_cm_trait,
+                              const vector<string> &cm_ld_snps, const map<string,int> &ldsc_snp_name_map,
+                              eigenVector &ref_ld, eigenVector &w_ld, const vector<double> &ref_ld_vec, const vector<double> &w_ld_vec, int ntrait) {
     // Re-order the variables
     int i = 0, j = 0, n_cm_ld_snps = cm_ld_snps.size(), indxbuf = 0;
-    map<string,int>::iterator iter;
+    map<string,int>::const_iterator iter;
 
     ref_ld.resize(n_cm_ld_snps); ref_ld.setZero(n_cm_ld_snps);
     w_ld.resize(n_cm_ld_snps); w_ld.setZero(n_cm_ld_snps);
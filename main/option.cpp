@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include "gcta.h"
 #include "Logger.h"
+#include "sumstat_bin.h"
 
 void option(int option_num, char* option_str[]);
 
@@ -116,6 +117,9 @@ void option(int option_num, char* option_str[])
     int reml_diagV_adj = 0;
     double reml_diag_mul = 0.01;
     int reml_inv_method = 0;
+    int reml_matfree_probes = 0;
+    bool reml_spectral = false;
+    bool grm_eig_cache = false;
 
     bool cv_blup = false;
     bool HE_reg_bivar_flag = false;
@@ -152,6 +156,9 @@ void option(int option_num, char* option_str[])
     double mbat_svd_gamma = 0.9; //option to remove overly correlated snps in mBAT test
     bool mbat_write_snpset = false; //write snplist _ used in conjunction with mbat_ld_cutoff
     string mbat_sAssoc_file = "", mbat_gAnno_file = "", mbat_snpset_file = "";
+    string geno_cache_file = "", make_geno_cache_file = "";
+    // binary summary statistics
+    string make_sumstat_bin_file = "";
     int mbat_wind = 50000;
     bool mbat_print_all_p = false;
    
@@ -210,6 +217,23 @@ void option(int option_num, char* option_str[])
             bfile_flag = 1;
             bfile = argv[++i];
             LOGGER << "--bfile " << argv[i] << endl;
+        } else if (strcmp(argv[i], "--pfile") == 0) {
+            bfile_flag = 3;
+            bfile = argv[++i];
+            LOGGER << "--pfile " << argv[i] << endl;
+        } else if (strcmp(argv[i], "--bpfile") == 0) {
+            bfile_flag = 4;
+            bfile = argv[++i];
+            LOGGER << "--bpfile " << argv[i] << endl;
+        } else if (strcmp(argv[i], "--make-sumstat-bin") == 0) {
+            make_sumstat_bin_file = argv[++i];
+            LOGGER << "--make-sumstat-bin " << argv[i] << endl;
+        } else if (strcmp(argv[i], "--geno-cache") == 0) {
+            geno_cache_file = argv[++i];
+            LOGGER << "--geno-cache " << argv[i] << endl;
+        } else if (strcmp(argv[i], "--make-geno-cache") == 0) {
+            make_geno_cache_file = argv[++i];
+            LOGGER << "--make-geno-cache " << argv[i] << endl;
         } else if (strcmp(argv[i], "--mbfile") == 0) {
             bfile_flag = 2;
             bfile_list = argv[++i];
@@ -720,6 +744,17 @@ void option(int option_num, char* option_str[])
             MaxIter = atoi(argv[++i]);
             LOGGER << "--reml-maxit " << MaxIter << endl;
             if (MaxIter < 1 || MaxIter > 10000) LOGGER.e(0, "\n --reml-maxit should be within the range from 1 to 10000.\n");
+        } else if (strcmp(argv[i], "--reml-matfree") == 0) {
+            reml_matfree_probes = 50;
+            if (strcmp(argv[i + 1], "gcta") != 0 && strncmp(argv[i + 1], "--", 2) != 0) reml_matfree_probes = atoi(argv[++i]);
+            LOGGER << "--reml-matfree " << reml_matfree_probes << endl;
+            if (reml_matfree_probes < 1 || reml_matfree_probes > 1000) LOGGER.e(0, "\n  --reml-matfree. The number of random probes should be within the range from 1 to 1000.\n");
+        } else if (strcmp(argv[i], "--reml-spectral") == 0) {
+            reml_spectral = true;
+            LOGGER << "--reml-spectral" << endl;
+        } else if (strcmp(argv[i], "--grm-eig-cache") == 0) {
+            grm_eig_cache = true;
+            LOGGER << "--grm-eig-cache" << endl;
         } else if (strcmp(argv[i], "--reml-bendV") == 0) {
             reml_force_inv_fac_flag = true;
             LOGGER << "--reml-bendV " << endl;
@@ -1311,12 +1346,20 @@ void option(int option_num, char* option_str[])
     if(reml_allow_constrain_run) pter_gcta->set_reml_allow_constrain_run();
     if(reml_mtd != 0) pter_gcta->set_reml_mtd(reml_mtd);
     if(reml_inv_method != 0) pter_gcta->set_reml_inv_method(reml_inv_method);
+    if(reml_matfree_probes > 0) pter_gcta->set_reml_matfree(reml_matfree_probes);
+    if(reml_spectral) pter_gcta->set_reml_spectral();
+    if(grm_eig_cache) pter_gcta->set_grm_eig_cache();
     pter_gcta->set_reml_diagV_adj(reml_diagV_adj);
     pter_gcta->set_reml_diag_mul(reml_diag_mul);
     pter_gcta->set_diff_freq(freq_thresh); 
     if (grm_bin_flag || m_grm_bin_flag) pter_gcta->enable_grm_bin_flag();
     //if(simu_unlinked_flag) pter_gcta->simu_geno_unlinked(simu_unlinked_n, simu_unlinked_m, simu_unlinked_maf);
-    if (!RG_fname_file.empty()) {
+    if (!make_sumstat_bin_file.empty()) SumstatBin::make(make_sumstat_bin_file, out + ".sumstat.bin");
+    else if (!make_geno_cache_file.empty()) {
+        if (bfile_flag != 1) LOGGER.e(0, "--make-geno-cache only works with --bfile.");
+        pter_gcta->make_geno_cache(bfile, make_geno_cache_file);
+    }
+    else if (!RG_fname_file.empty()) {
         if (RG_summary_file.empty()) LOGGER.e(0, "please input the summary information for the raw data files by the option --raw-summary.");
         pter_gcta->read_IRG_fnames(RG_summary_file, RG_fname_file, GC_cutoff);
     } 
@@ -1340,13 +1383,15 @@ void option(int option_num, char* option_str[])
             // Read the list, if there are multiple bfiles
             if(bfile_flag==2) multi_bfiles = pter_gcta->read_bfile_list(bfile_list);
             // Start to read the genotypes
-            if(bfile_flag==1) pter_gcta->read_famfile(bfile + ".fam");
+            if(bfile_flag==1 || bfile_flag==4) pter_gcta->read_famfile(bfile + ".fam");
+            else if(bfile_flag==3) pter_gcta->read_psamfile(bfile + ".psam");
             else pter_gcta->read_multi_famfiles(multi_bfiles);
             if (!kp_indi_file.empty()) pter_gcta->keep_indi(kp_indi_file);
             if (!rm_indi_file.empty()) pter_gcta->remove_indi(rm_indi_file);
             if (!update_sex_file.empty()) pter_gcta->update_sex(update_sex_file);
             if (!blup_indi_file.empty()) pter_gcta->read_indi_blup(blup_indi_file);
-            if(bfile_flag==1) pter_gcta->read_bimfile(bfile + ".bim");
+            if(bfile_flag==1 || bfile_flag==4) pter_gcta->read_bimfile(bfile + ".bim");
+            else if(bfile_flag==3) pter_gcta->read_pvarfile(bfile + ".pvar");
             else pter_gcta->read_multi_bimfiles(multi_bfiles);
             if (!extract_snp_file.empty()) pter_gcta->extract_snp(extract_snp_file);
             if (extract_chr_start > 0) pter_gcta->extract_chr(extract_chr_start, extract_chr_end);
@@ -1365,13 +1410,24 @@ void option(int option_num, char* option_str[])
             if (LD) pter_gcta->read_LD_target_SNPs(LD_file);
             if(gsmr_flag) pter_gcta->read_gsmrfile(expo_file_list, outcome_file_list, gwas_thresh, nsnp_gsmr, gsmr_so_alg);
             if(mtcojo_flag) nsnp_read = pter_gcta->read_mtcojofile(mtcojolist_file, gwas_thresh, nsnp_gsmr);
-            if(mtcojo_flag && nsnp_read>0) {
-                if(bfile_flag==1) pter_gcta->read_bedfile(bfile + ".bed");
-                else pter_gcta->read_multi_bedfiles(multi_bfiles);
+            if (!geno_cache_file.empty()) {
+                // only the reference panel analyses read the genotypes through the cache
+                if (bfile_flag != 1) LOGGER.e(0, "--geno-cache only works with --bfile.");
+                if (!(massoc_slct_flag || massoc_joint_flag || !massoc_cond_snplist.empty() || massoc_sblup_flag || gsmr_flag || mtcojo_flag || !sbat_sAssoc_file.empty() || !mbat_sAssoc_file.empty())) {
+                    LOGGER.e(0, "--geno-cache only works with the COJO, GSMR, mtCOJO, fastBAT and mBAT analyses.");
+                }
             }
-            if(!mtcojo_flag){
-                if(bfile_flag==1) pter_gcta->read_bedfile(bfile + ".bed");
-                else pter_gcta->read_multi_bedfiles(multi_bfiles);
+            if((mtcojo_flag && nsnp_read>0) || !mtcojo_flag) {
+                if(bfile_flag==1) {
+                    if(geno_cache_file.empty()) pter_gcta->read_bedfile(bfile + ".bed");
+                    else pter_gcta->read_bedfile_cache(bfile + ".bed", geno_cache_file);
+                }
+                else if(bfile_flag==2) pter_gcta->read_multi_bedfiles(multi_bfiles);
+                else {
+                    // dosages for the analyses that take the imputed dosage data, hard calls for the others
+                    bool pgen_dosage = out_freq_flag || (make_grm_flag && !dominance_flag) || recode || recode_nomiss || recode_std || LD_prune_rsq>-1.0 || ld_score_flag || ld_max_rsq_flag || mlma_flag || mlma_loco_flag || make_bed_flag || fst_flag;
+                    pter_gcta->read_pgenfile(bfile + ".pgen", pgen_dosage);
+                }
             }
 
             if (!update_impRsq_file.empty()) pter_gcta->update_impRsq(update_impRsq_file);
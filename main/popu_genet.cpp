@@ -51,8 +51,8 @@ void gcta::paa(string aa_file)
 	for(i=0; i<_keep.size(); i++){
  		for(k=0; k<_include.size(); k++){
  		    if(aa[_include[k]]==".") continue;
-            if(!_snp_1[_include[k]][_keep[i]] || _snp_2[_include[k]][_keep[i]]){
-                x=_snp_1[_include[k]][_keep[i]]+_snp_2[_include[k]][_keep[i]];
+            if(geno_a1(_include[k], _keep[i]) >= 0){
+                x=geno_a1(_include[k], _keep[i]);
                 if(x<0.1){
                     if(_ref_A[_include[k]]==aa[_include[k]]){
                         if(_mu[_include[k]]>1.0) hom_da_rare[i]+=1.0;
@@ -147,8 +147,8 @@ void gcta::ibc(bool ibc_all)
     for(i=0; i<_keep.size(); i++){
         double x=0.0, sum_w=0.0, sum_h=0.0, Fhat_buf=0.0;
 		for(k=0; k<_include.size(); k++){
-            if(!_snp_1[_include[k]][_keep[i]] || _snp_2[_include[k]][_keep[i]]){
-                x=_snp_1[_include[k]][_keep[i]]+_snp_2[_include[k]][_keep[i]];
+            if(geno_a1(_include[k], _keep[i]) >= 0){
+                x=geno_a1(_include[k], _keep[i]);
                 if(_allele2[_include[k]]==_ref_A[_include[k]]) x=2.0-x;
                 Fhat_buf=(x-_mu[_include[k]])*(x-_mu[_include[k]]);
                 if(ibc_all) Fhat4[i]+=Fhat_buf;
@@ -0,0 +1,275 @@
+/*
+ * GCTA: a tool for Genome-wide Complex Trait Analysis
+ *
+ * Matrix-free REML (--reml-matfree): V = sum(sigma_i * A_i) is never formed. The GRMs are
+ * applied to blocks of vectors straight from the memory mapped binary files, V^-1 by the
+ * preconditioned conjugate gradients, tr(PA) by Hutch++ and log|V| by the Lanczos quadrature
+ * that comes with the same solves.
+ *
+ * This file is distributed under the GNU General Public
+ * License, Version 3.  Please see the file LICENSE for more
+ * details
+ */
+
+#include "gcta.h"
+#include "GRMReader.h"
+#include <random>
+#include <numeric>
+
+// relative residual to stop the conjugate gradients, and the cap of the iterations
+static const double reml_matfree_tol = 1e-6;
+static const int reml_matfree_max_cg = 1000;
+
+void gcta::set_reml_matfree(int num_probes)
+{
+    _reml_matfree = true;
+    _reml_matfree_probes = num_probes;
+}
+
+// AX = A * X of the variance component comp. A GRM is read in place from the mapped lower
+// triangle, row by row in the order of the file: the lower triangle part of each row goes to
+// its own individual, the upper triangle part to a buffer of the thread.
+void gcta::reml_matfree_apply(int comp, const eigenMatrix &X, eigenMatrix &AX)
+{
+    int k = X.cols();
+    if (comp >= _reml_matfree_grm.size()) {
+        AX = _reml_matfree_resid.asDiagonal() * X;
+        return;
+    }
+
+    const GRMReader &grm = *_reml_matfree_grm[comp];
+    const vector<int> &kp = _reml_matfree_kp[comp];
+    vector<int> order(_n);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&kp](int a, int b){ return kp[a] < kp[b]; });
+
+    // an individual per column, so the k values of an individual are contiguous
+    eigenMatrix Xt = X.transpose();
+    int num_thread = omp_get_max_threads();
+    vector<eigenMatrix> Yt(num_thread);
+    #pragma omp parallel
+    {
+        eigenMatrix &Y = Yt[omp_get_thread_num()];
+        Y = eigenMatrix::Zero(k, _n);
+        vector<double> acc(k);
+        #pragma omp for schedule(dynamic, 16)
+        for (int s = 0; s < _n; s++) {
+            int ls = order[s];
+            const float *row = grm.row(kp[ls]);
+            const double *xs = Xt.data() + (uint64_t)ls * k;
+            std::fill(acc.begin(), acc.end(), 0.0);
+            for (int u = 0; u < s; u++) {
+                int lu = order[u];
+                double a = row[kp[lu]];
+                const double *xu = Xt.data() + (uint64_t)lu * k;
+                double *yu = Y.data() + (uint64_t)lu * k;
+                for (int c = 0; c < k; c++) {
+                    acc[c] += a * xu[c];
+                    yu[c] += a * xs[c];
+                }
+            }
+            double a = row[kp[ls]];
+            double *ys = Y.data() + (uint64_t)ls * k;
+            for (int c = 0; c < k; c++) ys[c] += acc[c] + a * xs[c];
+        }
+    }
+
+    #pragma omp parallel for
+    for (int i = 0; i < _n; i++) {
+        for (int t = 1; t < num_thread; t++) Yt[0].col(i) += Yt[t].col(i);
+    }
+    AX = Yt[0].transpose();
+}
+
+void gcta::reml_matfree_V(const eigenVector &varcmp, const eigenMatrix &X, eigenMatrix &VX)
+{
+    eigenMatrix AX;
+    VX = eigenMatrix::Zero(X.rows(), X.cols());
+    for (int i = 0; i < _r_indx.size(); i++) {
+        reml_matfree_apply(_r_indx[i], X, AX);
+        VX += varcmp[i] * AX;
+    }
+}
+
+// S = V^-1 * B by the conjugate gradients preconditioned with M = diag(V); the columns still
+// running share each product with V. alpha and beta of the columns, if asked for, give the
+// Lanczos tridiagonal matrices of M^-1/2 * V * M^-1/2.
+// Return the number of columns that hit a non-positive curvature, i.e. V is not positive definite.
+int gcta::reml_matfree_pcg(const eigenVector &varcmp, const eigenVector &M, const eigenMatrix &B, eigenMatrix &S, vector< vector<double> > *alpha, vector< vector<double> > *beta)
+{
+    int j = 0, k = B.cols(), num_fail = 0;
+    S = eigenMatrix::Zero(_n, k);
+    eigenMatrix R(B), Z = M.cwiseInverse().asDiagonal() * B, P(Z), P_act, Q_act;
+    eigenVector rz(k), b_norm(k);
+    vector<int> active;
+    for (j = 0; j < k; j++) {
+        rz[j] = R.col(j).dot(Z.col(j));
+        b_norm[j] = B.col(j).norm();
+        if (b_norm[j] > 0) active.push_back(j);
+    }
+    if (alpha) alpha->assign(k, vector<double>());
+    if (beta) beta->assign(k, vector<double>());
+
+    int iter = 0;
+    for (iter = 0; iter < reml_matfree_max_cg && !active.empty(); iter++) {
+        P_act.resize(_n, active.size());
+        for (j = 0; j < active.size(); j++) P_act.col(j) = P.col(active[j]);
+        reml_matfree_V(varcmp, P_act, Q_act);
+
+        vector<int> next;
+        for (int a = 0; a < active.size(); a++) {
+            j = active[a];
+            double pq = P.col(j).dot(Q_act.col(a));
+            if (!(pq > 0)) {
+                num_fail++;
+                continue;
+            }
+            double alpha_j = rz[j] / pq;
+            S.col(j) += alpha_j * P.col(j);
+            R.col(j) -= alpha_j * Q_act.col(a);
+            if (alpha) (*alpha)[j].push_back(alpha_j);
+            if (R.col(j).norm() < reml_matfree_tol * b_norm[j]) continue;
+            Z.col(j) = R.col(j).cwiseQuotient(M);
+            double rz_new = R.col(j).dot(Z.col(j));
+            double beta_j = rz_new / rz[j];
+            P.col(j) = Z.col(j) + beta_j * P.col(j);
+            rz[j] = rz_new;
+            if (beta) (*beta)[j].push_back(beta_j);
+            next.push_back(j);
+        }
+        active = next;
+    }
+    if (!active.empty()) LOGGER.w(0, to_string(active.size()) + " of the conjugate gradient solves didn't converge in " + to_string(reml_matfree_max_cg) + " iterations.");
+    return num_fail;
+}
+
+// z^t * log(A) * z / z^t * z by the Lanczos quadrature, the tridiagonal matrix from the
+// coefficients of the conjugate gradients of A * x = z started from 0
+static double lanczos_log_quad(const vector<double> &alpha, const vector<double> &beta)
+{
+    int k = 0, m = alpha.size();
+    if (m == 0) return 0.0;
+    eigenMatrix T = eigenMatrix::Zero(m, m);
+    for (k = 0; k < m; k++) {
+        T(k, k) = 1.0 / alpha[k];
+        if (k > 0) T(k, k) += beta[k - 1] / alpha[k - 1];
+        if (k + 1 < m) T(k, k + 1) = T(k + 1, k) = sqrt(beta[k]) / alpha[k];
+    }
+    SelfAdjointEigenSolver<eigenMatrix> eigensolver(T);
+    double quad = 0.0;
+    for (k = 0; k < m; k++) {
+        double tau = eigensolver.eigenvectors()(0, k), theta = eigensolver.eigenvalues()[k];
+        if (theta > 0) quad += tau * tau * log(theta);
+    }
+    return quad;
+}
+
+double gcta::reml_iteration_matfree(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatrix &Hi, eigenVector &Py, eigenVector &varcmp, bool prior_var_flag, bool no_constrain)
+{
+    int i = 0, j = 0, num_comp = _r_indx.size(), num_probe = _reml_matfree_probes;
+    // columns of the Hutch++ sketch, on top of the probes that also serve the log|V|
+    int num_sketch = num_probe / 3;
+
+    // the same Rademacher probes and sketch in all the iterations, so that the estimated logL
+    // changes smoothly with the variance components
+    std::mt19937 rng(1);
+    std::bernoulli_distribution coin(0.5);
+    eigenMatrix Z(_n, num_probe), G(_n, num_sketch);
+    for (j = 0; j < num_probe; j++) {
+        for (i = 0; i < _n; i++) Z(i, j) = coin(rng) ? 1.0 : -1.0;
+    }
+    for (j = 0; j < num_sketch; j++) {
+        for (i = 0; i < _n; i++) G(i, j) = coin(rng) ? 1.0 : -1.0;
+    }
+
+    eigenMatrix B(_n, 1 + _X_c + num_probe + num_sketch), W(_n, 1 + num_probe + num_sketch), S, AW, APy(_n, num_comp), PZ, PQ, Q, QZ, proj, AI;
+    eigenVector M, M_sqrt;
+
+    // the information matrix comes with the solves of the evaluation: only the average
+    // information, as tr(PAPA) isn't estimated
+    reml_engine engine;
+    engine.name = "matrix-free, " + to_string(num_probe) + " random probes, " + to_string(num_sketch) + " sketch vectors";
+    engine.has_fisher = false;
+    engine.evaluate = [&](const eigenVector &vc, int mtd, double &logdet, double &yPy, eigenVector &R, eigenVector &tr_PA) -> bool {
+        int i = 0, j = 0;
+        // Jacobi preconditioner
+        M = eigenVector::Zero(_n);
+        for (i = 0; i < num_comp; i++) {
+            if (_r_indx[i] < _reml_matfree_grm.size()) M += vc[i] * _reml_matfree_diag[_r_indx[i]];
+            else M += vc[i] * _reml_matfree_resid;
+        }
+        if (M.minCoeff() <= 0) M.setOnes();
+        M_sqrt = M.cwiseSqrt();
+
+        // V^-1 * [y, X, M^1/2 * Z, M^1/2 * G]
+        B.resize(_n, 1 + _X_c + num_probe + num_sketch);
+        B.col(0) = _y;
+        B.middleCols(1, _X_c) = _X;
+        B.middleCols(1 + _X_c, num_probe) = M_sqrt.asDiagonal() * Z;
+        B.rightCols(num_sketch) = M_sqrt.asDiagonal() * G;
+        vector< vector<double> > alpha, beta;
+        if (reml_matfree_pcg(vc, M, B, S, &alpha, &beta) > 0) return false;
+
+        Vi_X = S.middleCols(1, _X_c);
+        Xt_Vi_X_i = _X.transpose() * Vi_X;
+        double logdet_Xt_Vi_X = 0.0;
+        int rank = 0;
+        INVmethod method = (_reml_inv_mtd == 0) ? INV_LLT : static_cast<INVmethod>(_reml_inv_mtd);
+        if(!SquareMatrixInverse(Xt_Vi_X_i, logdet_Xt_Vi_X, rank, method)) LOGGER.e(0, "\n  the X^t * V^-1 * X matrix is not invertible. Please check the covariate(s) and/or the environmental factor(s).");
+
+        // P * b = V^-1 * b - V^-1 * X * (X^t * V^-1 * X)^-1 * X^t * V^-1 * b
+        proj = Vi_X * Xt_Vi_X_i;
+        Py = S.col(0) - proj * (Vi_X.transpose() * _y);
+        yPy = _y.dot(Py);
+        PZ = S.middleCols(1 + _X_c, num_probe) - proj * (Vi_X.transpose() * B.middleCols(1 + _X_c, num_probe));
+
+        // Hutch++: tr(PA) = tr(P~ * A~) with P~ = M^1/2 * P * M^1/2 and A~ = M^-1/2 * A * M^-1/2.
+        // Q spans the sketch P~ * G of the top eigenvectors of P~, shared by all the components;
+        // tr(Q^t * P~ * A~ * Q) is exact and Hutchinson's estimator only sees the rest,
+        // (I - QQ^t) * P~ * A~ * (I - QQ^t), which has a much smaller Frobenius norm.
+        Q = M_sqrt.asDiagonal() * (S.rightCols(num_sketch) - proj * (Vi_X.transpose() * B.rightCols(num_sketch)));
+        if (num_sketch > 0) Q = HouseholderQR<eigenMatrix>(Q).householderQ() * eigenMatrix::Identity(_n, num_sketch);
+        QZ = Q.transpose() * Z;
+
+        // log|V| = log|M| + log|M^-1/2 * V * M^-1/2|, z^t * z = n of the probes
+        double quad = 0.0;
+        for (j = 0; j < num_probe; j++) quad += lanczos_log_quad(alpha[1 + _X_c + j], beta[1 + _X_c + j]);
+        logdet = M.array().log().sum() + _n * quad / num_probe + logdet_Xt_Vi_X;
+
+        // A * [Py, M^-1/2 * Z, M^-1/2 * Q]
+        vector<eigenMatrix> AZ(num_comp);
+        W.col(0) = Py;
+        W.middleCols(1, num_probe) = M_sqrt.cwiseInverse().asDiagonal() * Z;
+        W.rightCols(num_sketch) = M_sqrt.cwiseInverse().asDiagonal() * Q;
+        for (i = 0; i < num_comp; i++) {
+            reml_matfree_apply(_r_indx[i], W, AW);
+            APy.col(i) = AW.col(0);
+            R[i] = Py.dot(AW.col(0));
+            AZ[i] = AW.rightCols(num_probe + num_sketch);
+        }
+
+        // V^-1 * [A_i * Py, M^1/2 * Q] in one more batch
+        B.resize(_n, num_comp + num_sketch);
+        B.leftCols(num_comp) = APy;
+        B.rightCols(num_sketch) = M_sqrt.asDiagonal() * Q;
+        if (reml_matfree_pcg(vc, M, B, S, NULL, NULL) > 0) return false;
+        S -= proj * (Vi_X.transpose() * B);
+
+        // tr(PA) = sum((P * M^1/2 * Q) .* (A * M^-1/2 * Q)) + E[(P * M^1/2 * d)^t * A * M^-1/2 * d], d = (I - QQ^t) * z
+        PQ = S.rightCols(num_sketch);
+        for (i = 0; i < num_comp; i++) {
+            const eigenMatrix &AZ_i = AZ[i];
+            tr_PA[i] = PQ.cwiseProduct(AZ_i.rightCols(num_sketch)).sum();
+            tr_PA[i] += (PZ - PQ * QZ).cwiseProduct(AZ_i.leftCols(num_probe) - AZ_i.rightCols(num_sketch) * QZ).sum() / num_probe;
+        }
+
+        // average information matrix, (A_i * Py)^t * P * (A_j * Py)
+        AI = APy.transpose() * S.leftCols(num_comp);
+        AI = 0.5 * (AI + AI.transpose()).eval();
+        return true;
+    };
+    engine.information = [&](int mtd, eigenMatrix &H) {
+        H = AI;
+    };
+    return reml_iterate(engine, Hi, varcmp, prior_var_flag, no_constrain, false);
+}
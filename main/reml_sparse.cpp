@@ -0,0 +1,139 @@
+/*
+ * GCTA: a tool for Genome-wide Complex Trait Analysis
+ *
+ * Sparse REML for the within-family analysis (--reml-wfam). V = sum(sigma_i * A_i) stays sparse:
+ * it is factorized by a sparse LDL^t whose symbolic analysis is done once per model, and
+ * tr(V^-1 * A_i) is taken from the entries of V^-1 on the pattern of the factor (selected
+ * inversion) rather than from the dense V^-1 and P.
+ *
+ * This file is distributed under the GNU General Public
+ * License, Version 3.  Please see the file LICENSE for more
+ * details
+ */
+
+#include "gcta.h"
+#include <Eigen/SparseCholesky>
+
+// Takahashi recurrence for Z = (L * D * L^t)^-1 on the pattern of the unit lower factor L, from
+// the last column to the first:
+//   Z(i, j) = -sum_k Z(i, k) * L(k, j),  Z(j, j) = 1 / D(j) - sum_k Z(k, j) * L(k, j)
+// with i, k > j in the pattern of column j, which the elimination keeps closed. Zx holds the
+// strictly lower part in the layout of L, Zd the diagonal.
+static void selected_inverse(const eigenSparseMat &L, const eigenVector &D, eigenVector &Zx, eigenVector &Zd)
+{
+    typedef eigenSparseMat::StorageIndex Index;
+    const Index *outer = L.outerIndexPtr(), *inner = L.innerIndexPtr();
+    const eigenSparseMat::Scalar *Lx = L.valuePtr();
+    Index n = L.cols();
+    Zx.setZero(L.nonZeros());
+    Zd.resize(n);
+
+    auto lower = [&](Index r, Index c) -> double {
+        const Index *end = inner + outer[c + 1];
+        const Index *it = std::lower_bound(inner + outer[c], end, r);
+        return (it != end && *it == r) ? Zx[it - inner] : 0.0;
+    };
+
+    for (Index j = n - 1; j >= 0; j--) {
+        Index start = outer[j], end = outer[j + 1];
+        for (Index a = start; a < end; a++) {
+            Index r = inner[a];
+            double z = 0.0;
+            for (Index b = start; b < end; b++) {
+                Index k = inner[b];
+                double z_rk = (r == k) ? Zd[r] : (r > k ? lower(r, k) : lower(k, r));
+                z -= z_rk * Lx[b];
+            }
+            Zx[a] = z;
+        }
+        double z = 1.0 / D[j];
+        for (Index a = start; a < end; a++) z -= Zx[a] * Lx[a];
+        Zd[j] = z;
+    }
+}
+
+double gcta::reml_iteration_sparse(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatrix &Hi, eigenVector &Py, eigenVector &varcmp, bool prior_var_flag, bool no_constrain)
+{
+    int num_comp = _r_indx.size();
+
+    // the pattern of V is the union of the components, whatever the variance components
+    auto make_V = [&](const eigenVector &vc) -> eigenSparseMat {
+        eigenSparseMat V(_n, _n);
+        for (int k = 0; k < num_comp; k++) V = V + (_Asp[_r_indx[k]]) * vc[k];
+        return V;
+    };
+    Eigen::SimplicialLDLT<eigenSparseMat> solver;
+    solver.analyzePattern(make_V(eigenVector::Ones(num_comp)));
+    if (solver.info() != Eigen::Success) LOGGER.e(0, "the symbolic analysis of the sparse V matrix failed.");
+    bool factor_logged = false;
+
+    eigenVector Vi_y, Zx, Zd;
+    eigenMatrix APy(_n, num_comp);
+    INVmethod method = (_reml_inv_mtd == 0) ? INV_LLT : static_cast<INVmethod>(_reml_inv_mtd);
+    // P * B = V^-1 * B - Vi_X * (X^t * V^-1 * X)^-1 * Vi_X^t * B
+    auto apply_P = [&](const eigenMatrix &B) -> eigenMatrix {
+        eigenMatrix Vi_B = solver.solve(B);
+        return Vi_B - Vi_X * (Xt_Vi_X_i * (Vi_X.transpose() * B));
+    };
+    // tr(V^-1 * A) over the non-zeros of A, V^-1 = P^t * Z * P with P the fill-reducing ordering
+    auto trace_Vi = [&](const eigenSparseMat &L, const eigenSparseMat &A) -> double {
+        const auto &perm = solver.permutationP().indices();
+        const eigenSparseMat::StorageIndex *outer = L.outerIndexPtr(), *inner = L.innerIndexPtr();
+        double tr = 0.0;
+        #pragma omp parallel for reduction(+:tr)
+        for (int c = 0; c < A.outerSize(); c++) {
+            for (eigenSparseMat::InnerIterator it(A, c); it; ++it) {
+                eigenSparseMat::StorageIndex r = perm[it.row()], k = perm[it.col()];
+                if (r < k) std::swap(r, k);
+                double z = 0.0;
+                if (r == k) z = Zd[r];
+                else {
+                    const eigenSparseMat::StorageIndex *end = inner + outer[k + 1];
+                    const eigenSparseMat::StorageIndex *pos = std::lower_bound(inner + outer[k], end, r);
+                    if (pos != end && *pos == r) z = Zx[pos - inner];
+                }
+                tr += z * it.value();
+            }
+        }
+        return tr;
+    };
+
+    // Fisher scoring needs the whole P, the SE of EM-REML comes from the average information
+    reml_engine engine;
+    engine.name = "sparse";
+    engine.has_fisher = false;
+    engine.evaluate = [&](const eigenVector &vc, int mtd, double &logdet, double &yPy, eigenVector &R, eigenVector &tr_PA) -> bool {
+        solver.factorize(make_V(vc));
+        if (solver.info() != Eigen::Success || solver.vectorD().minCoeff() <= 0) return false;
+        const eigenSparseMat &L = solver.matrixL().nestedExpression();
+        if (!factor_logged) {
+            LOGGER << "V is factorized as a sparse LDL^t with " << L.nonZeros() << " non-zeros below the diagonal of the factor." << endl;
+            factor_logged = true;
+        }
+        Vi_X = solver.solve(_X);
+        Vi_y = solver.solve(_y);
+        Xt_Vi_X_i = _X.transpose() * Vi_X;
+        double logdet_Xt_Vi_X = 0.0;
+        int rank = 0;
+        if(!SquareMatrixInverse(Xt_Vi_X_i, logdet_Xt_Vi_X, rank, method)) LOGGER.e(0, "\n  the X^t * V^-1 * X matrix is not invertible. Please check the covariate(s) and/or the environmental factor(s).");
+        logdet = solver.vectorD().array().log().sum() + logdet_Xt_Vi_X;
+        Py = Vi_y - Vi_X * (Xt_Vi_X_i * (Vi_X.transpose() * _y));
+        yPy = _y.dot(Py);
+        selected_inverse(L, solver.vectorD(), Zx, Zd);
+        for (int k = 0; k < num_comp; k++) {
+            const eigenSparseMat &A = _Asp[_r_indx[k]];
+            APy.col(k) = A * Py;
+            R[k] = Py.dot(APy.col(k));
+            // tr(PA) = tr(V^-1 * A) - tr((X^t * V^-1 * X)^-1 * Vi_X^t * A * Vi_X)
+            eigenMatrix A_Vi_X = A * Vi_X;
+            eigenMatrix XAX = Vi_X.transpose() * A_Vi_X;
+            tr_PA[k] = trace_Vi(L, A) - Xt_Vi_X_i.cwiseProduct(XAX).sum();
+        }
+        return true;
+    };
+    engine.information = [&](int mtd, eigenMatrix &H) {
+        H = APy.transpose() * apply_P(APy);
+        H = 0.5 * (H + H.transpose()).eval();
+    };
+    return reml_iterate(engine, Hi, varcmp, prior_var_flag, no_constrain, false);
+}
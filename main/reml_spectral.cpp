@@ -0,0 +1,184 @@
+/*
+ * GCTA: a tool for Genome-wide Complex Trait Analysis
+ *
+ * Spectral REML and MLMA (--reml-spectral) for one GRM plus the residual. With A = U * S * U^t,
+ * V = U * (sigma_g * S + sigma_e * I) * U^t, so once y and X are rotated by U^t an iteration
+ * is diagonal algebra, O(n * c^2) for c fixed effects, and the SNPs are tested on the rotated
+ * genotypes a block at a time.
+ *
+ * This file is distributed under the GNU General Public
+ * License, Version 3.  Please see the file LICENSE for more
+ * details
+ */
+
+#include "gcta.h"
+
+void gcta::set_reml_spectral()
+{
+    _reml_spectral = true;
+}
+
+// eigendecomposition of the GRM in _A[0], which is released, and U^t * y, U^t * X. Given
+// the binary GRM and its rows kept (kp), it is read from or saved to the .grm.eig cache.
+void gcta::reml_spectral_decomp(string grm_file, const vector<int> &kp)
+{
+    GrmEigHeader eig_key;
+    bool cache_flag = _grm_eig_cache && !grm_file.empty() && grm_eig_key(grm_file, kp, eig_key);
+    VectorXd eval;
+    MatrixXd evec;
+    if (cache_flag && read_grm_eig(grm_file, eig_key, eval, evec)) {
+        _A[0].resize(0, 0);
+        _spec_eval = eval.cast<eigenVector::Scalar>();
+        _spec_U = evec.cast<eigenMatrix::Scalar>();
+    }
+    else {
+        LOGGER << "Eigendecomposition of the GRM of " << _n << " individuals ..." << endl;
+        SelfAdjointEigenSolver<eigenMatrix> eigensolver(_A[0]);
+        if (eigensolver.info() != Eigen::Success) LOGGER.e(0, "the eigendecomposition of the GRM failed.");
+        _A[0].resize(0, 0);
+        _spec_eval = eigensolver.eigenvalues();
+        _spec_U = eigensolver.eigenvectors();
+        if (cache_flag) write_grm_eig(grm_file, eig_key, _spec_eval.cast<double>(), _spec_U.cast<double>());
+    }
+    _spec_Uy = _spec_U.transpose() * _y;
+    _spec_UX = _spec_U.transpose() * _X;
+    int num_neg = (_spec_eval.array() < 0).count();
+    LOGGER << "Eigenvalues of the GRM range from " << _spec_eval.minCoeff() << " to " << _spec_eval.maxCoeff();
+    if (num_neg > 0) LOGGER << " (" << num_neg << " negative)";
+    LOGGER << "." << endl;
+}
+
+double gcta::reml_iteration_spectral(eigenMatrix &Vi_X, eigenMatrix &Xt_Vi_X_i, eigenMatrix &Hi, eigenVector &Py, eigenVector &varcmp, bool prior_var_flag, bool no_constrain)
+{
+    int i = 0, num_comp = _r_indx.size();
+
+    // the components in the rotated space are diagonal: the eigenvalues of the GRM and the ones
+    // of the residual
+    eigenMatrix S(_n, num_comp);
+    for (i = 0; i < num_comp; i++) {
+        if (_r_indx[i] == 0) S.col(i) = _spec_eval;
+        else S.col(i).setOnes();
+    }
+
+    // everything below is rotated: d = eigenvalues of V, Di_X = D^-1 * U^t * X, Pty = U^t * Py
+    eigenVector d, di, Pty;
+    eigenMatrix Di_X, APy(_n, num_comp);
+    INVmethod method = (_reml_inv_mtd == 0) ? INV_LLT : static_cast<INVmethod>(_reml_inv_mtd);
+    // P * B = D^-1 * B - Di_X * (X^t * V^-1 * X)^-1 * Di_X^t * B
+    auto apply_P = [&](const eigenMatrix &B) -> eigenMatrix {
+        return di.asDiagonal() * B - Di_X * (Xt_Vi_X_i * (Di_X.transpose() * B));
+    };
+
+    reml_engine engine;
+    engine.name = "spectral";
+    engine.evaluate = [&](const eigenVector &vc, int mtd, double &logdet, double &yPy, eigenVector &R, eigenVector &tr_PA) -> bool {
+        d = S * vc;
+        if (d.minCoeff() <= 0) return false;
+        di = d.cwiseInverse();
+        Di_X = di.asDiagonal() * _spec_UX;
+        Xt_Vi_X_i = _spec_UX.transpose() * Di_X;
+        double logdet_Xt_Vi_X = 0.0;
+        int rank = 0;
+        if(!SquareMatrixInverse(Xt_Vi_X_i, logdet_Xt_Vi_X, rank, method)) LOGGER.e(0, "\n  the X^t * V^-1 * X matrix is not invertible. Please check the covariate(s) and/or the environmental factor(s).");
+        logdet = d.array().log().sum() + logdet_Xt_Vi_X;
+        Pty = apply_P(_spec_Uy);
+        yPy = _spec_Uy.dot(Pty);
+        for (int k = 0; k < num_comp; k++) {
+            APy.col(k) = S.col(k).cwiseProduct(Pty);
+            R[k] = Pty.dot(APy.col(k));
+            // tr(PA) = sum(s / d) - tr((X^t * V^-1 * X)^-1 * Di_X^t * S * Di_X)
+            eigenMatrix XSX = Di_X.transpose() * S.col(k).asDiagonal() * Di_X;
+            tr_PA[k] = S.col(k).cwiseProduct(di).sum() - Xt_Vi_X_i.cwiseProduct(XSX).sum();
+        }
+        return true;
+    };
+    engine.information = [&](int mtd, eigenMatrix &H) {
+        if (mtd == 0) {
+            H = APy.transpose() * apply_P(APy);
+            H = 0.5 * (H + H.transpose()).eval();
+            return;
+        }
+        // tr(P * A_i * P * A_j)
+        vector<eigenMatrix> XSX(num_comp), CXSX(num_comp);
+        for (int k = 0; k < num_comp; k++) {
+            XSX[k] = Di_X.transpose() * S.col(k).asDiagonal() * Di_X;
+            CXSX[k] = Xt_Vi_X_i * XSX[k];
+        }
+        H.resize(num_comp, num_comp);
+        for (int k = 0; k < num_comp; k++) {
+            for (int l = 0; l <= k; l++) {
+                eigenVector ss = S.col(k).cwiseProduct(S.col(l));
+                eigenMatrix XSSX = Di_X.transpose() * ss.cwiseProduct(di).asDiagonal() * Di_X;
+                H(k, l) = H(l, k) = ss.cwiseProduct(di).cwiseProduct(di).sum() - 2.0 * Xt_Vi_X_i.cwiseProduct(XSSX).sum() + CXSX[k].cwiseProduct(CXSX[l].transpose()).sum();
+            }
+        }
+    };
+    // back to the original space, at the variance components V was last evaluated at
+    engine.finish = [&]() {
+        _spec_d = d;
+        Py = _spec_U * Pty;
+        Vi_X = _spec_U * Di_X;
+    };
+    return reml_iterate(engine, Hi, varcmp, prior_var_flag, no_constrain, false);
+}
+
+// Association tests on the genotypes rotated by U^t, a GEMM per block of SNPs:
+// x^t * V^-1 * x = sum(x~^2 / d). With the covariates fitted (covar_flag), the effect of the
+// SNP is taken from the Schur complement of X^t * V^-1 * X, the same as the last element of
+// the joint solution in mlma_calcu_stat_covar.
+void gcta::mlma_calcu_stat_spectral(float *y, unsigned long n, unsigned long m, bool covar_flag, eigenVector &beta, eigenVector &se, eigenVector &pval)
+{
+    int max_block_size = 10000;
+    unsigned long i = 0;
+    double chisq = 0.0;
+    MatrixXf Ut = _spec_U.transpose().cast<float>();
+    _spec_U.resize(0, 0);
+    VectorXf di = _spec_d.cwiseInverse().cast<float>();
+    VectorXf Di_y = di.cwiseProduct(Ut * Map<VectorXf>(y, n));
+
+    MatrixXf Di_X, C;
+    VectorXf Xt_Vi_y;
+    if (covar_flag) {
+        eigenMatrix Xt_Vi_X = _spec_UX.transpose() * _spec_d.cwiseInverse().asDiagonal() * _spec_UX;
+        double logdet = 0.0;
+        int rank = 0;
+        INVmethod method = INV_LLT;
+        if(!SquareMatrixInverse(Xt_Vi_X, logdet, rank, method)) LOGGER.e(0, "Xt_Vi_X is not invertible.");
+        C = Xt_Vi_X.cast<float>();
+        Di_X = di.asDiagonal() * _spec_UX.cast<float>();
+        Xt_Vi_y = _spec_UX.cast<float>().transpose() * Di_y;
+    }
+
+    beta.resize(m);
+    se=eigenVector::Zero(m);
+    pval=eigenVector::Constant(m,2);
+    LOGGER<<"\nRunning association tests for "<<m<<" SNPs (on the genotypes rotated by the eigenvectors of the GRM) ..."<<endl;
+    MatrixXf X_block, X_rot, Q, CQ;
+    VectorXf Xt_Vi_x, x_Vi_y;
+    vector<int> indx;
+    for (unsigned long start = 0; start < m; start += max_block_size) {
+        int block_size = min((unsigned long)max_block_size, m - start);
+        indx.resize(block_size);
+        for (int l = 0; l < block_size; l++) indx[l] = start + l;
+        make_XMat_subset(X_block, indx, false);
+        X_rot.noalias() = Ut * X_block;
+        Xt_Vi_x = (X_rot.array().square().colwise() * di.array()).colwise().sum().transpose();
+        x_Vi_y.noalias() = X_rot.transpose() * Di_y;
+        if (covar_flag) {
+            Q.noalias() = Di_X.transpose() * X_rot;
+            CQ.noalias() = C * Q;
+            Xt_Vi_x -= Q.cwiseProduct(CQ).colwise().sum().transpose();
+            x_Vi_y -= CQ.transpose() * Xt_Vi_y;
+        }
+        for (int l = 0; l < block_size; l++) {
+            i = start + l;
+            se[i]=1.0/Xt_Vi_x[l];
+            beta[i]=se[i]*x_Vi_y[l];
+            if(se[i]>1.0e-30){
+                se[i]=sqrt(se[i]);
+                chisq=beta[i]/se[i];
+                pval[i]=StatFunc::pchisq(chisq*chisq, 1);
+            }
+        }
+    }
+}
@@ -22,9 +22,10 @@ void gcta::detect_family()
 
     _Asp.resize(_r_indx.size());
 
+    // the GRMs read sparse from the binary files are already in _Asp
     int pos;
     for(pos = 0; pos < _r_indx.size() - 1; pos++){
-        _Asp[pos] = _A[pos].sparseView();
+        if(_A[pos].size() > 0) _Asp[pos] = _A[pos].sparseView();
     }
 
     pos=_r_indx[_r_indx.size()-1];
@@ -11,29 +11,46 @@
  */
 
 #include "gcta.h"
+#include "sumstat_bin.h"
 #include <set>
 
 void gcta::sbat_read_snpAssoc(string snpAssoc_file, vector<string> &snp_name, vector<int> &snp_chr, vector<int> &snp_bp, vector<double> &snp_pval)
 {
-    ifstream in_snpAssoc(snpAssoc_file.c_str());
-    if (!in_snpAssoc) LOGGER.e(0, "cannot open the file [" + snpAssoc_file + "] to read.");
     LOGGER << "\nReading SNP association results from [" + snpAssoc_file + "]." << endl;
     string str_buf;
     vector<string> vs_buf;
     map<string, int>::iterator iter;
     map<string, int> assoc_snp_map;
     int line = 0;
-    while (getline(in_snpAssoc, str_buf)) {
-        if (StrFunc::split_string(str_buf, vs_buf, " \t") != 2) LOGGER.e(0, "in line \"" + str_buf + "\".");
-        iter = _snp_name_map.find(vs_buf[0]);
-        if (iter == _snp_name_map.end()) continue;
-        if(assoc_snp_map.find(vs_buf[0]) != assoc_snp_map.end()) continue;
-        else assoc_snp_map.insert(pair<string, int>(vs_buf[0], line));
-        snp_name.push_back(vs_buf[0]);
-        snp_pval.push_back(atof(vs_buf[1].c_str()));
-        line++;
+    if (SumstatBin::is_sumstat_bin(snpAssoc_file)) {
+        // the binary store of --make-sumstat-bin, SNPs without p-value skipped
+        SumstatBin in_snpAssoc(snpAssoc_file);
+        for (uint64_t row = 0; row < in_snpAssoc.size(); row++) {
+            str_buf = in_snpAssoc.snp(row);
+            if (std::isnan(in_snpAssoc.p(row))) continue;
+            iter = _snp_name_map.find(str_buf);
+            if (iter == _snp_name_map.end()) continue;
+            if(assoc_snp_map.find(str_buf) != assoc_snp_map.end()) continue;
+            else assoc_snp_map.insert(pair<string, int>(str_buf, line));
+            snp_name.push_back(str_buf);
+            snp_pval.push_back(in_snpAssoc.p(row));
+            line++;
+        }
+    } else {
+        ifstream in_snpAssoc(snpAssoc_file.c_str());
+        if (!in_snpAssoc) LOGGER.e(0, "cannot open the file [" + snpAssoc_file + "] to read.");
+        while (getline(in_snpAssoc, str_buf)) {
+            if (StrFunc::split_string(str_buf, vs_buf, " \t") != 2) LOGGER.e(0, "in line \"" + str_buf + "\".");
+            iter = _snp_name_map.find(vs_buf[0]);
+            if (iter == _snp_name_map.end()) continue;
+            if(assoc_snp_map.find(vs_buf[0]) != assoc_snp_map.end()) continue;
+            else assoc_snp_map.insert(pair<string, int>(vs_buf[0], line));
+            snp_name.push_back(vs_buf[0]);
+            snp_pval.push_back(atof(vs_buf[1].c_str()));
+            line++;
+        }
+        in_snpAssoc.close();
     }
-    in_snpAssoc.close();
     snp_name.erase(unique(snp_name.begin(), snp_name.end()), snp_name.end());
     LOGGER << "Association p-values of " << snp_name.size() << " SNPs have been included." << endl;
 
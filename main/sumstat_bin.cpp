@@ -0,0 +1,232 @@
+/*
+ * GCTA: a tool for Genome-wide Complex Trait Analysis
+ *
+ * Binary store of the GWAS summary statistics: written once by --make-sumstat-bin
+ * and memory mapped by the COJO, GSMR, mtCOJO and fastBAT readers.
+ *
+ * This file is distributed under the GNU General Public
+ * License, Version 3.  Please see the file LICENSE for more
+ * details
+ */
+
+#include "sumstat_bin.h"
+#include "StrFunc.h"
+#include "Logger.h"
+#include "zfstream.h"
+#include "StrIndex.hpp"
+#include "mem.hpp"
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+
+// File layout: header, then the sections at the byte offsets of the header, each 8 aligned.
+// Strings are uint64 offsets[num_snp + 1] plus the characters; the hash index holds row + 1,
+// 0 for empty slots.
+struct SumstatBinHeader {
+    char magic[8];
+    uint64_t numSNP;
+    uint64_t hashSize;
+    uint64_t cojoCols;
+    uint64_t fileSize;
+    uint64_t snpOff, snpChr, a1Off, a1Chr, a2Off, a2Chr;
+    uint64_t freq, b, se, p, n;
+    uint64_t hash;
+};
+
+static const char sumstat_bin_magic[8] = {'G', 'C', 'T', 'A', 'S', 'S', 'B', '1'};
+
+static double sumstat_val(const string &str)
+{
+    if (str == "." || str == "NA" || str == "NAN") return nan("");
+    return atof(str.c_str());
+}
+
+SumstatBin::SumstatBin() : _map(NULL), _map_bytes(0), _num_snp(0), _hash_mask(0), _cojo_cols(false)
+{
+}
+
+SumstatBin::SumstatBin(const string &file) : SumstatBin()
+{
+    open(file);
+}
+
+SumstatBin::~SumstatBin()
+{
+    close();
+}
+
+bool SumstatBin::is_sumstat_bin(const string &file)
+{
+    FILE *in = fopen(file.c_str(), "rb");
+    if (!in) return false;
+    char magic[8];
+    bool status = fread(magic, 1, 8, in) == 8 && memcmp(magic, sumstat_bin_magic, 8) == 0;
+    fclose(in);
+    return status;
+}
+
+void SumstatBin::open(const string &file)
+{
+    close();
+    _file = file;
+    _map = map_file_read(file.c_str(), _map_bytes);
+    if (!_map) LOGGER.e(0, "cannot open the file [" + file + "] to read.");
+    SumstatBinHeader header;
+    if (_map_bytes < sizeof(header) || memcmp(_map, sumstat_bin_magic, 8) != 0) {
+        close();
+        LOGGER.e(0, "[" + file + "] is not a summary statistics file made by --make-sumstat-bin.");
+    }
+    memcpy(&header, _map, sizeof(header));
+    if (_map_bytes != header.fileSize) {
+        close();
+        LOGGER.e(0, "[" + file + "] is truncated. Please make it again by --make-sumstat-bin.");
+    }
+
+    const char *base = (const char *)_map;
+    _num_snp = header.numSNP;
+    _hash_mask = header.hashSize - 1;
+    _cojo_cols = header.cojoCols != 0;
+    _snp_off = (const uint64_t *)(base + header.snpOff);
+    _snp_chr = base + header.snpChr;
+    _a1_off = (const uint64_t *)(base + header.a1Off);
+    _a1_chr = base + header.a1Chr;
+    _a2_off = (const uint64_t *)(base + header.a2Off);
+    _a2_chr = base + header.a2Chr;
+    _freq = (const double *)(base + header.freq);
+    _b = (const double *)(base + header.b);
+    _se = (const double *)(base + header.se);
+    _p = (const double *)(base + header.p);
+    _n = (const double *)(base + header.n);
+    _hash = (const uint32_t *)(base + header.hash);
+}
+
+void SumstatBin::close()
+{
+    unmap_file(_map, _map_bytes);
+    _map = NULL;
+    _map_bytes = 0;
+    _num_snp = 0;
+}
+
+int64_t SumstatBin::find(const string &snp_name) const
+{
+    if (_num_snp == 0) return -1;
+    return (int64_t)_hash[StrIndex::probe(_hash, _hash_mask, _snp_chr, _snp_off, snp_name.data(), snp_name.size())] - 1;
+}
+
+void SumstatBin::make(const string &in_file, const string &out_file)
+{
+    // gzifstream reads the plain text files as well
+    gzifstream in(in_file.c_str());
+    if (!in.is_open()) LOGGER.e(0, "cannot open the file [" + in_file + "] to read.");
+    LOGGER << "Reading GWAS summary statistics from [" + in_file + "] ..." << endl;
+
+    string str_buf, snp_chr, a1_chr, a2_chr;
+    vector<string> vs_buf;
+    vector<uint64_t> snp_off(1, 0), a1_off(1, 0), a2_off(1, 0);
+    vector<double> freq, b, se, p, n;
+    int ncol = 0;
+    uint64_t line = 0;
+    while (getline(in, str_buf)) {
+        line++;
+        int col = StrFunc::split_string(str_buf, vs_buf, " \t\n");
+        if (col == 0) continue;
+        if (ncol == 0) {
+            // the GCTA-COJO format has a header line, the fastBAT "SNP p" format doesn't
+            ncol = col;
+            if (ncol != 8 && ncol != 2) LOGGER.e(0, "[" + in_file + "] should be in the GCTA-COJO format (SNP A1 A2 freq b se p N) or the \"SNP p\" format.");
+            if (ncol == 8) continue;
+        }
+        if (col != ncol) LOGGER.e(0, "line " + to_string(line) + " of [" + in_file + "] has " + to_string(col) + " columns, " + to_string(ncol) + " expected.");
+        snp_chr += vs_buf[0];
+        snp_off.push_back(snp_chr.size());
+        if (ncol == 8) {
+            StrFunc::to_upper(vs_buf[1]);
+            StrFunc::to_upper(vs_buf[2]);
+            a1_chr += vs_buf[1];
+            a2_chr += vs_buf[2];
+            freq.push_back(sumstat_val(vs_buf[3]));
+            b.push_back(sumstat_val(vs_buf[4]));
+            se.push_back(sumstat_val(vs_buf[5]));
+            p.push_back(sumstat_val(vs_buf[6]));
+            n.push_back(sumstat_val(vs_buf[7]));
+        } else {
+            freq.push_back(nan(""));
+            b.push_back(nan(""));
+            se.push_back(nan(""));
+            p.push_back(sumstat_val(vs_buf[1]));
+            n.push_back(nan(""));
+        }
+        a1_off.push_back(a1_chr.size());
+        a2_off.push_back(a2_chr.size());
+    }
+    in.close();
+    uint64_t num_snp = p.size();
+    if (num_snp == 0) LOGGER.e(0, "no SNP is found in [" + in_file + "].");
+    if (num_snp >= UINT32_MAX) LOGGER.e(0, "too many SNPs in [" + in_file + "].");
+
+    // the later line of a duplicated SNP wins, the same as the text readers
+    uint64_t hash_size = 1;
+    while (hash_size < 2 * num_snp) hash_size <<= 1;
+    vector<uint32_t> hash(hash_size, 0);
+    for (uint64_t row = 0; row < num_snp; row++) {
+        hash[StrIndex::probe(hash.data(), hash_size - 1, snp_chr.data(), snp_off.data(), snp_chr.data() + snp_off[row], snp_off[row + 1] - snp_off[row])] = row + 1;
+    }
+
+    SumstatBinHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, sumstat_bin_magic, 8);
+    header.numSNP = num_snp;
+    header.hashSize = hash_size;
+    header.cojoCols = (ncol == 8);
+    uint64_t pos = sizeof(header);
+    auto section = [&pos](uint64_t bytes) { uint64_t start = pos; pos = (pos + bytes + 7) / 8 * 8; return start; };
+    uint64_t off_bytes = (num_snp + 1) * sizeof(uint64_t), val_bytes = num_snp * sizeof(double);
+    header.snpOff = section(off_bytes);
+    header.snpChr = section(snp_chr.size());
+    header.a1Off = section(off_bytes);
+    header.a1Chr = section(a1_chr.size());
+    header.a2Off = section(off_bytes);
+    header.a2Chr = section(a2_chr.size());
+    header.freq = section(val_bytes);
+    header.b = section(val_bytes);
+    header.se = section(val_bytes);
+    header.p = section(val_bytes);
+    header.n = section(val_bytes);
+    header.hash = section(hash_size * sizeof(uint32_t));
+    header.fileSize = pos;
+
+    // written aside and renamed, so the running jobs never map a half written store
+    string tmp_file = out_file + ".tmp" + to_string(getpid());
+    FILE *out = fopen(tmp_file.c_str(), "wb");
+    if (!out) LOGGER.e(0, "cannot open the file [" + tmp_file + "] to write.");
+    bool status = true;
+    auto write_at = [&out, &status](uint64_t at, const void *data, uint64_t bytes) {
+        if (!status || bytes == 0) return;
+        status = fseeko(out, at, SEEK_SET) == 0 && fwrite(data, 1, bytes, out) == bytes;
+    };
+    write_at(0, &header, sizeof(header));
+    write_at(header.snpOff, snp_off.data(), off_bytes);
+    write_at(header.snpChr, snp_chr.data(), snp_chr.size());
+    write_at(header.a1Off, a1_off.data(), off_bytes);
+    write_at(header.a1Chr, a1_chr.data(), a1_chr.size());
+    write_at(header.a2Off, a2_off.data(), off_bytes);
+    write_at(header.a2Chr, a2_chr.data(), a2_chr.size());
+    write_at(header.freq, freq.data(), val_bytes);
+    write_at(header.b, b.data(), val_bytes);
+    write_at(header.se, se.data(), val_bytes);
+    write_at(header.p, p.data(), val_bytes);
+    write_at(header.n, n.data(), val_bytes);
+    write_at(header.hash, hash.data(), hash_size * sizeof(uint32_t));
+    // pad the last section up to the file size
+    uint64_t hash_end = header.hash + hash_size * sizeof(uint32_t);
+    if (header.fileSize > hash_end) {
+        vector<char> pad(header.fileSize - hash_end, 0);
+        write_at(hash_end, pad.data(), pad.size());
+    }
+    if (fclose(out) != 0 || !status || replace_file(tmp_file.c_str(), out_file.c_str()) != 0) {
+        remove(tmp_file.c_str());
+        LOGGER.e(0, "failed to write the file [" + out_file + "].");
+    }
+    LOGGER << "Summary statistics of " << num_snp << " SNPs have been saved in the binary file [" + out_file + "]." << endl;
+}
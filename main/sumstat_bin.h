@@ -0,0 +1,71 @@
+/*
+ * GCTA: a tool for Genome-wide Complex Trait Analysis
+ *
+ * Interface to the binary store of the GWAS summary statistics (--make-sumstat-bin)
+ *
+ * This file is distributed under the GNU General Public
+ * License, Version 3.  Please see the file LICENSE for more
+ * details
+ */
+
+#ifndef _SUMSTAT_BIN_H
+#define _SUMSTAT_BIN_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+using namespace std;
+
+// Column-oriented store of a GCTA-COJO format file (SNP A1 A2 freq b se p N), or of a
+// two-column "SNP p" file of fastBAT. The strings are kept as offsets into character
+// blocks, each statistic is an array of doubles (NaN for missing), and an open-addressing
+// hash index of the SNP names gives the row of a SNP without parsing the whole file.
+// The store is memory mapped, so the jobs sharing a GWAS share the pages.
+class SumstatBin
+{
+public:
+    SumstatBin();
+    SumstatBin(const string &file);
+    ~SumstatBin();
+
+    SumstatBin(const SumstatBin&) = delete;
+    SumstatBin& operator=(const SumstatBin&) = delete;
+
+    static bool is_sumstat_bin(const string &file);
+    static void make(const string &in_file, const string &out_file);
+
+    void open(const string &file);
+    void close();
+
+    uint64_t size() const { return _num_snp; }
+    // false if made from a "SNP p" file
+    bool has_cojo_cols() const { return _cojo_cols; }
+
+    string snp(uint64_t row) const { return get_str(_snp_off, _snp_chr, row); }
+    string a1(uint64_t row) const { return get_str(_a1_off, _a1_chr, row); }
+    string a2(uint64_t row) const { return get_str(_a2_off, _a2_chr, row); }
+    double freq(uint64_t row) const { return _freq[row]; }
+    double b(uint64_t row) const { return _b[row]; }
+    double se(uint64_t row) const { return _se[row]; }
+    double p(uint64_t row) const { return _p[row]; }
+    double n(uint64_t row) const { return _n[row]; }
+
+    // row of the SNP, -1 if not in the store
+    int64_t find(const string &snp_name) const;
+
+private:
+    string get_str(const uint64_t *off, const char *chr, uint64_t row) const { return string(chr + off[row], off[row + 1] - off[row]); }
+
+    string _file;
+    void *_map;
+    uint64_t _map_bytes;
+    uint64_t _num_snp;
+    uint64_t _hash_mask;
+    bool _cojo_cols;
+    const uint64_t *_snp_off, *_a1_off, *_a2_off;
+    const char *_snp_chr, *_a1_chr, *_a2_chr;
+    const double *_freq, *_b, *_se, *_p, *_n;
+    const uint32_t *_hash;
+};
+
+#endif
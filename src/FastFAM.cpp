@@ -42,6 +42,11 @@
 #include <boost/lexical_cast.hpp>
 #include <iomanip>
 #include "Covar.h"
+#include "GRMReader.h"
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
 #include <cstdio>
 #include <random>
 #include <chrono>
@@ -631,6 +636,20 @@ FastFAM::FastFAM(){
         bGrammar = true;
     }
 
+    num_traits = pheno->count_mpheno();
+    if(num_traits > 0){
+        vector<string> multi_incompatible = {"binary", "envir", "inv_file", "save_inv", "model_only", "save_bin", 
+            "save_resi", "regiontest"};
+        for(auto &key : multi_incompatible){
+            if(options.find(key) != options.end()){
+                LOGGER.e(0, "--mpheno-all and --pheno-list only support --fastGWA-mlm and --fastGWA-lr with text output.");
+            }
+        }
+        if(options.find("grmsparse_file") != options.end() && (!bGrammar)){
+            LOGGER.e(0, "--mpheno-all and --pheno-list don't support --fastGWA-mlm-exact.");
+        }
+    }
+
 
     if(options_d["seed"] == 0){
         seed = pheno->getSeed();
@@ -639,8 +658,8 @@ FastFAM::FastFAM(){
         LOGGER << "Using random seed: " << seed << std::endl;
     }
 
-    double VG;
-    double VR;
+    double VG = 0;
+    double VR = 0;
     bool flag_est_GE = true;
     if(options.find("G") != options.end()){
         VG = std::stod(options["G"]);
@@ -723,6 +742,17 @@ FastFAM::FastFAM(){
     phenoVec = Map<VectorXd> (remain_phenos.data(), remain_phenos.size());
     rawPhenoVec = phenoVec;
 
+    // all the traits in the order of the phenoVec
+    if(num_traits > 0){
+        traitZ.resize(num_indi, num_traits);
+        vector<double> trait_phenos;
+        for(int k = 0; k < num_traits; k++){
+            pheno->get_mpheno(k, trait_phenos);
+            traitZ.col(k) = Map<VectorXd>(trait_phenos.data(), trait_phenos.size());
+            trait_names.push_back(pheno->get_mpheno_name(k));
+        }
+    }
+
     // condition the covar
     if(has_covar){
         vector<double> remain_covar;
@@ -793,6 +823,9 @@ FastFAM::FastFAM(){
         covarFlag = true;
         makeIH(concovar);
         if(!bBinary)conditionCovarReg(phenoVec);
+        if(num_traits > 0){
+            traitZ -= concovar * (H * traitZ);
+        }
         if(options.find("save_pheno") != options.end()){
             std::ofstream pheno_w((options["out"] + ".cphen").c_str());
             if(!pheno_w) LOGGER.e(0, "failed to write " + options["out"]+".cphen");
@@ -852,6 +885,11 @@ FastFAM::FastFAM(){
         //goto saveRes;
     }
 
+    if(num_traits > 0){
+        initMultiPheno(fam, flag_est_GE, VG, VR);
+        return;
+    }
+
     // Center
     double phenoVec_mean = phenoVec.mean();
     phenoVec -= VectorXd::Ones(phenoVec.size()) * phenoVec_mean;
@@ -1017,54 +1055,9 @@ FastFAM::FastFAM(){
                         o_optimal_rho.close();
                     }
                 }else{
-                    LOGGER.i(0, "Estimating the genetic variance (Vg) by " + mtdString[options["VgEstMethod"]] + "...");
-                    LOGGER.ts("HE");
-                    if(options["rel_only"] == "yes"){
-                        LOGGER.i(0, "Using related pairs only.");
-                        for(int k = 0; k < fam.outerSize(); ++k){
-                            for(SpMat::InnerIterator it(fam, k); it; ++it){
-                                if(it.row() < it.col()){
-                                    Aij.push_back(it.value());
-                                    Zij.push_back(phenoVec[it.row()] * phenoVec[it.col()]);
-                                }
-                            }
-                        }
-
-                        VG = HEreg(Zij, Aij, fam_flag);
-                    }else{
-                        string vgEstMethod = options["VgEstMethod"];
-                        if(vgEstMethod == "HE"){
-                            VG = HEreg(fam, phenoVec, fam_flag);
-                        }else if(vgEstMethod == "MCREML"){
-                            VG = MCREML(fam, phenoVec, fam_flag);
-                        }else if (vgEstMethod == "REML"){
-                            VG = spREML(fam, phenoVec, fam_flag);
-                        }else{
-                            LOGGER.e(0, "Unknown method to estimate the Vg");
-                        }
-                    }
-                }
-                if(options.find("force_gwa") != options.end()){
-                    if(!fam_flag){
-                        LOGGER.w(0, " Forcing the program to run fastGWA MLM");
-                    }
-                    fam_flag = true;
-                }
-
-                if(fam_flag){
-                    VR = Vpheno - VG;
-                    if(VG < 0 && options.find("force_gwa") == options.end()){
-                        LOGGER.w(0, "Constraining Vg to 0.");
-                        fam_flag = false;
-                    }else if(VG > Vpheno && fam_flag){
-                        if(options.find("no_constrain") != options.end()){
-                            LOGGER.w(0, "Vg is larger than Vp");
-                        }else{
-                            VG = 0.99 * Vpheno;
-                            LOGGER.w(0, "Constraining Vg to 0.99 * Vp: " + to_string(VG) + ".");
-                        }
-                    }
+                    VG = estimateVg(fam, phenoVec, fam_flag);
                 }
+                constrainVg(Vpheno, VG, VR, fam_flag);
                 if(options["VgEstMethod"]=="REML"){
                     LOGGER << "fastGWA-REML runtime: ";
                 }else if(options["VgEstMethod"]=="HE"){
@@ -2118,6 +2111,71 @@ void FastFAM::readFAM(string filename, SpMat& fam, const vector<string> &ids, ve
             return remain_index[pos];});
     remain_index = ordered_remain_index;
 
+    // prefer the binary sparse GRM, the text one is kept for compatibility; a binary GRM
+    // older than the text one or the ID file is stale, e.g. the text GRM was made again
+    string spb_file = filename + ".grm.spb";
+    bool useSpb = false;
+    struct stat spb_st, sp_st, id_st;
+    if(stat(spb_file.c_str(), &spb_st) == 0){
+        useSpb = true;
+        if(stat((filename + ".grm.sp").c_str(), &sp_st) == 0 && sp_st.st_mtime > spb_st.st_mtime){
+            useSpb = false;
+        }
+        if(stat((filename + ".grm.id").c_str(), &id_st) == 0 && id_st.st_mtime > spb_st.st_mtime){
+            useSpb = false;
+        }
+        if(!useSpb){
+            LOGGER.w(0, "[" + spb_file + "] is older than [" + filename + ".grm.sp] or [" + filename
+                    + ".grm.id], reading the text sparse GRM instead. Remove or make the binary GRM again to use it.");
+        }
+    }
+    if(useSpb){
+        LOGGER.i(0, "Reading the binary sparse GRM from [" + spb_file + "]...");
+        GRMSparseReader sp_reader(spb_file);
+        if(sp_reader.size() != sublist.size()){
+            LOGGER.e(0, "the number of samples in [" + spb_file + "] does not match [" + filename + ".grm.id].");
+        }
+        Map<const SpMat> sp_grm(sp_reader.size(), sp_reader.size(), sp_reader.nonZeros(),
+                sp_reader.outer(), sp_reader.inner(), sp_reader.values());
+
+        bool isSame = (ordered_fam_index.size() == sublist.size());
+        for(uint32_t index = 0; isSame && index != ordered_fam_index.size(); index++){
+            if(ordered_fam_index[index] != index) isSame = false;
+        }
+        if(isSame){
+            fam = sp_grm;
+        }else{
+            vector<int64_t> new_index(sublist.size(), -1);
+            for(uint32_t index = 0; index != ordered_fam_index.size(); index++){
+                new_index[ordered_fam_index[index]] = index;
+            }
+            uint32_t num_fam = ordered_fam_index.size();
+            fam.resize(num_fam, num_fam);
+            vector<uint32_t> num_elements(num_fam, 0);
+            for(uint32_t col = 0; col != num_fam; col++){
+                for(Map<const SpMat>::InnerIterator it(sp_grm, ordered_fam_index[col]); it; ++it){
+                    if(new_index[it.row()] != -1) num_elements[col]++;
+                }
+            }
+            fam.reserve(num_elements);
+            vector<std::pair<int64_t, double>> col_items;
+            for(uint32_t col = 0; col != num_fam; col++){
+                col_items.clear();
+                for(Map<const SpMat>::InnerIterator it(sp_grm, ordered_fam_index[col]); it; ++it){
+                    if(new_index[it.row()] != -1) col_items.emplace_back(new_index[it.row()], it.value());
+                }
+                std::sort(col_items.begin(), col_items.end());
+                for(auto &item : col_items){
+                    fam.insertBackUncompressed(item.first, col) = item.second;
+                }
+            }
+            fam.finalize();
+            fam.makeCompressed();
+        }
+        LOGGER.i(0, to_string(fam.nonZeros()) + " non-zero elements of " + to_string(fam.cols()) + " individuals included.");
+        return;
+    }
+
     std::ifstream pair_list((filename + ".grm.sp").c_str());
     if(!pair_list){
         LOGGER.e(0, "can't read [" + filename + ".grm.sp]");
@@ -2133,7 +2191,7 @@ void FastFAM::readFAM(string filename, SpMat& fam, const vector<string> &ids, ve
 
     vector<uint32_t> num_elements(remain_index.size(), 0);
 
-    map<uint32_t, uint32_t> map_index;
+    vector<int64_t> map_index(sublist.size(), -1);
     for(uint32_t index = 0; index != ordered_fam_index.size(); index++){
         map_index[ordered_fam_index[index]] = index;
     }
@@ -2147,8 +2205,8 @@ void FastFAM::readFAM(string filename, SpMat& fam, const vector<string> &ids, ve
 
         uint32_t tmp_id1 = (std::stoi(line_elements[0]));
         uint32_t tmp_id2 = (std::stoi(line_elements[1]));
-        if(map_index.find(tmp_id1) != map_index.end() &&
-                map_index.find(tmp_id2) != map_index.end()){
+        if(tmp_id1 < map_index.size() && tmp_id2 < map_index.size() &&
+                map_index[tmp_id1] != -1 && map_index[tmp_id2] != -1){
             tmp_id1 = map_index[tmp_id1];
             tmp_id2 = map_index[tmp_id2];
 
@@ -2187,65 +2245,111 @@ void FastFAM::readFAM(string filename, SpMat& fam, const vector<string> &ids, ve
 
 }
 
+// estimate Vg of pheno by --VgEstMethod, isSig is false if Vg is not significant
+double FastFAM::estimateVg(const SpMat &fam, const VectorXd &pheno, bool &isSig){
+    std::map<string, string> mtdString;
+    mtdString["REML"] = "fastGWA-REML (grid search)";
+    mtdString["HE"] = "Haseman-Elston regression";
+
+    LOGGER.i(0, "Estimating the genetic variance (Vg) by " + mtdString[options["VgEstMethod"]] + "...");
+    LOGGER.ts("HE");
+    double VG = 0;
+    if(options["rel_only"] == "yes"){
+        LOGGER.i(0, "Using related pairs only.");
+        vector<double> Aij, Zij;
+        for(int k = 0; k < fam.outerSize(); ++k){
+            for(SpMat::InnerIterator it(fam, k); it; ++it){
+                if(it.row() < it.col()){
+                    Aij.push_back(it.value());
+                    Zij.push_back(pheno[it.row()] * pheno[it.col()]);
+                }
+            }
+        }
+
+        VG = HEreg(Zij, Aij, isSig);
+    }else{
+        string vgEstMethod = options["VgEstMethod"];
+        if(vgEstMethod == "HE"){
+            VG = HEreg(fam, pheno, isSig);
+        }else if(vgEstMethod == "MCREML"){
+            VG = MCREML(fam, pheno, isSig);
+        }else if (vgEstMethod == "REML"){
+            VG = spREML(fam, pheno, isSig);
+        }else{
+            LOGGER.e(0, "Unknown method to estimate the Vg");
+        }
+    }
+    return VG;
+}
+
+// --force-gwa and the constraints of Vg to [0, Vp), VR = Vp - VG
+void FastFAM::constrainVg(double Vpheno, double &VG, double &VR, bool &isSig){
+    if(options.find("force_gwa") != options.end()){
+        if(!isSig){
+            LOGGER.w(0, " Forcing the program to run fastGWA MLM");
+        }
+        isSig = true;
+    }
+
+    if(isSig){
+        if(VG < 0 && options.find("force_gwa") == options.end()){
+            LOGGER.w(0, "Constraining Vg to 0.");
+            isSig = false;
+        }else if(VG > Vpheno){
+            if(options.find("no_constrain") != options.end()){
+                LOGGER.w(0, "Vg is larger than Vp");
+            }else{
+                VG = 0.99 * Vpheno;
+                LOGGER.w(0, "Constraining Vg to 0.99 * Vp: " + to_string(VG) + ".");
+            }
+        }
+        VR = Vpheno - VG;
+    }
+}
+
+// V^-1 g of each tuning SNP by each solver in tuneSolvers, the chi-square and the GRAMMAR-Gamma
+// of each column of tuneViY; NaN GRAMMAR-Gamma if the SNP is not valid for the column
 void FastFAM::grammar_func(uintptr_t *genobuf, const vector<uint32_t> &markerIndex){
     int nMarker = markerIndex.size();
+    int num_col = tuneViY.cols();
+    int num_solver = tuneSolvers.size();
     #pragma omp parallel for schedule(dynamic)
     for(int i = 0; i < nMarker; i++){
         int index_cur_marker = num_grammar_markers + i;
         GenoBufItem item;
         item.extractedMarkerIndex = markerIndex[i];
-        geno->getGenoDouble(genobuf, i, &item);
-        bValids[index_cur_marker] = item.valid;
+        double *geno_slab = geno->getGenoSlab();
+        geno->getGenoDouble(genobuf, i, &item, geno_slab, NULL);
+        tuneChisq.row(index_cur_marker).setConstant(std::numeric_limits<double>::quiet_NaN());
+        tuneCinf.row(index_cur_marker).setConstant(std::numeric_limits<double>::quiet_NaN());
         if(item.valid){
-            Map< VectorXd > curGeno(item.geno.data(), num_indi);
+            Map< VectorXd > curGeno(geno_slab, num_indi);
             conditionCovarReg(curGeno);
-            VectorXd Vg = solver.solve(curGeno);
-            double gt_Vg = curGeno.dot(Vg);
-            double g_Vi_y = curGeno.dot(Vi_y);
-            double temp_chisq = g_Vi_y * g_Vi_y / gt_Vg;
-
-            v_chisq[index_cur_marker] = temp_chisq;
-
-            if(temp_chisq < 5){
-                double gt_g = curGeno.dot(curGeno);
-                double tmp_cinf = gt_Vg / gt_g;
-                v_c_infs[index_cur_marker] = tmp_cinf;
-            }else{
-                bValids[index_cur_marker] = false;
+            double gt_g = curGeno.dot(curGeno);
+            for(int s = 0; s < num_solver; s++){
+                VectorXd Vg = tuneSolvers[s]->solve(curGeno);
+                double gt_Vg = curGeno.dot(Vg);
+                for(int k = 0; k < num_col; k++){
+                    if(tuneGroup[k] != s) continue;
+                    double g_Vi_y = curGeno.dot(tuneViY.col(k));
+                    double temp_chisq = g_Vi_y * g_Vi_y / gt_Vg;
+
+                    tuneChisq(index_cur_marker, k) = temp_chisq;
+                    if(temp_chisq < 5){
+                        tuneCinf(index_cur_marker, k) = gt_Vg / gt_g;
+                    }
+                }
             }
         }
     }
     num_grammar_markers += nMarker;
 }
 
-
-void FastFAM::grammar(SpMat& fam, double VG, double VR){
+// random autosomal SNPs to tune GRAMMAR-Gamma, sorted
+vector<uint32_t> FastFAM::grammar_markers(){
     int num_marker_rand = 2000; //1000 -> 2000, longda
-    int soft_cap = 1000; // a soft cap to stop the grammar-gamma approx, longda
-
 
     LOGGER.i(0, "\nTuning parameters using " + to_string(num_marker_rand) + " null SNPs...");
-
-    SpMat eye(fam.rows(), fam.cols());
-    eye.setIdentity();
-
-    fam *= VG;
-    fam += eye * VR;
-
-    //LOGGER.i(0, "Estimating conjugate gradient...");
-    LOGGER.ts("tuning");
-    solver.compute(fam);
-    if(solver.info() != Eigen::Success){
-        LOGGER.e(0, "the V matrix is not invertible.");
-    }
-    //LOGGER << "TCG compute time: " << LOGGER.tp("TCG") << std::endl;
-
-    //LOGGER.i(0, "Solving Vi * y via conjugate gradient...");
-    //LOGGER.ts("vi_y");
-    Vi_y = solver.solve(phenoVec);
-    //LOGGER << "  time: " << LOGGER.tp("vi_y") << std::endl;
-
-
     // get 1000 random SNPs
     auto total_markers_index = marker->get_extract_index_autosome();
     if(total_markers_index.size() < num_marker_rand){
@@ -2275,7 +2379,12 @@ void FastFAM::grammar(SpMat& fam, double VG, double VR){
     num_marker_rand = seq_marker_index.size();
     vector<uint32_t> marker_index(num_marker_rand);
     std::transform(seq_marker_index.begin(), seq_marker_index.end(), marker_index.begin(), [&total_markers_index](size_t pos){return total_markers_index[pos];});
+    return marker_index;
+}
 
+// read the tuning SNPs once for all the columns of tuneViY
+void FastFAM::grammar_tune(const vector<uint32_t> &marker_index){
+    int num_marker_rand = marker_index.size();
     int nMarker = 100;
 
     //get previous threshold
@@ -2294,9 +2403,8 @@ void FastFAM::grammar(SpMat& fam, double VG, double VR){
         }
     }
 
-    v_chisq.resize(num_marker_rand);
-    v_c_infs.resize(num_marker_rand);
-    bValids.resize(num_marker_rand);
+    tuneChisq.resize(num_marker_rand, tuneViY.cols());
+    tuneCinf.resize(num_marker_rand, tuneViY.cols());
     num_grammar_markers = 0;
 
     LOGGER << "  reading genotypes..." << std::endl; 
@@ -2312,24 +2420,30 @@ void FastFAM::grammar(SpMat& fam, double VG, double VR){
     geno->setMAF(preAF);
     geno->setFilterInfo(preInfo);
     geno->setFilterMiss(preMiss);
+}
 
-    
+// mean GRAMMAR-Gamma of column col of the tuning results, saved to cinf_file if not empty
+double FastFAM::grammar_cinf(int col, const vector<uint32_t> &marker_index, const string &cinf_file){
+    int soft_cap = 1000; // a soft cap to stop the grammar-gamma approx, longda
+    int nMarker = 100;
+    int num_marker_rand = marker_index.size();
     double tmp_cinf = 0;
     int n_valid_null = 0;
 
     std::ofstream o_inf;
     bool out_inf = false;
-    if(options.find("c-inf") != options.end()){
-        o_inf.open(options["out"] + ".cinf");
+    if(!cinf_file.empty()){
+        o_inf.open(cinf_file);
         o_inf << "CHR\tSNP\tPOS\tA1\tA2\tcinf\tchisq" << std::endl;
         out_inf = true;
     }
     for(int i=0; i<num_marker_rand; i++){
-        if(bValids[i]){
-            tmp_cinf += v_c_infs[i];
+        double cur_cinf = tuneCinf(i, col);
+        if(!std::isnan(cur_cinf)){
+            tmp_cinf += cur_cinf;
             n_valid_null++;
             if(out_inf){
-                o_inf << marker->getMarkerStrExtract(marker_index[i]) << "\t" << v_c_infs[i] << "\t" << v_chisq[i] << std::endl;
+                o_inf << marker->getMarkerStrExtract(marker_index[i]) << "\t" << cur_cinf << "\t" << tuneChisq(i, col) << std::endl;
             }
            // added by longda.
             if(i >= soft_cap && n_valid_null >= nMarker){
@@ -2347,13 +2461,47 @@ void FastFAM::grammar(SpMat& fam, double VG, double VR){
         LOGGER.e(0, "not enough valid null SNPs (<100). \nYou may check if too variants are removed by a filter, e.g., MAF.");
     }
 
-    c_inf = tmp_cinf / n_valid_null;
-    LOGGER.i(0, "Mean GRAMMAR-Gamma value = " + to_string(c_inf));
+    double cur_c_inf = tmp_cinf / n_valid_null;
+    LOGGER.i(0, "Mean GRAMMAR-Gamma value = " + to_string(cur_c_inf));
+    return cur_c_inf;
+}
+
+
+void FastFAM::grammar(SpMat& fam, double VG, double VR){
+    vector<uint32_t> marker_index = grammar_markers();
+
+    SpMat eye(fam.rows(), fam.cols());
+    eye.setIdentity();
+
+    fam *= VG;
+    fam += eye * VR;
+
+    //LOGGER.i(0, "Estimating conjugate gradient...");
+    LOGGER.ts("tuning");
+    solver.compute(fam);
+    if(solver.info() != Eigen::Success){
+        LOGGER.e(0, "the V matrix is not invertible.");
+    }
+    //LOGGER << "TCG compute time: " << LOGGER.tp("TCG") << std::endl;
+
+    //LOGGER.i(0, "Solving Vi * y via conjugate gradient...");
+    //LOGGER.ts("vi_y");
+    Vi_y = solver.solve(phenoVec);
+    //LOGGER << "  time: " << LOGGER.tp("vi_y") << std::endl;
+
+    tuneSolvers.assign(1, &solver);
+    tuneGroup.assign(1, 0);
+    tuneViY = Vi_y;
+    grammar_tune(marker_index);
+
+    string cinf_file = options.find("c-inf") != options.end() ? options["out"] + ".cinf" : "";
+    c_inf = grammar_cinf(0, marker_index, cinf_file);
     LOGGER << "Tuning of Gamma finished " << LOGGER.tp("tuning") << " seconds." << std::endl;
     Vi_y_cinf = Vi_y.array() / c_inf;
-    v_chisq.resize(0);
-    v_c_infs.resize(0);
-    bValids.resize(0);
+    tuneSolvers.clear();
+    tuneViY.resize(0, 0);
+    tuneChisq.resize(0, 0);
+    tuneCinf.resize(0, 0);
 
     if(Vi_y_cinf.size() != num_indi){
         LOGGER.e(0, "inconsistent sample size - there may be some unknown bugs.");
@@ -2411,50 +2559,75 @@ void FastFAM::calculate_gwa(uintptr_t * genobuf, const vector<uint32_t> &markerI
 
     static double iN = 1.0 /(num_indi - (covarFlag ? covar.cols() : 1.0) - 1.0);
     static double SSy = phenoVec.dot(phenoVec);
+    // samples x markers panel, as wide as the buffer block but capped at 512MB
+    static int num_panel_marker = std::max(64, std::min(1024,
+                (int)((512ULL * 1024 * 1024 / sizeof(double) / std::max(num_indi, 1U)) / 64 * 64)));
 
     int num_marker = markerIndex.size();
     vector<uint8_t> isValids(num_marker);
-
-    #pragma omp parallel for schedule(dynamic)
-    for(int i = 0; i < num_marker; i++){
-        uint32_t cur_marker = markerIndex[i];
-        GenoBufItem item;
-        item.extractedMarkerIndex = cur_marker;
-
-        geno->getGenoDouble(genobuf, i, &item);
-
-        isValids[i] = item.valid;
-        if(!item.valid) {
-            continue;
+    vector<double> xtx(num_marker), xty(num_marker);
+
+    for(int start = 0; start < num_marker; start += num_panel_marker){
+        int cur_num_marker = std::min(num_panel_marker, num_marker - start);
+        if(gwaPanel.cols() < cur_num_marker){
+            gwaPanel.resize(num_indi, cur_num_marker);
+        }
+
+        #pragma omp parallel for schedule(dynamic)
+        for(int i = 0; i < cur_num_marker; i++){
+            int index = start + i;
+            GenoBufItem item;
+            item.extractedMarkerIndex = markerIndex[index];
+            geno->getGenoDouble(genobuf, index, &item, gwaPanel.col(i).data(), NULL);
+
+            isValids[index] = item.valid;
+            af[index] = (float)item.af;
+            countMarkers[index] = item.nValidN;
+            info[index] = item.info;
+            if(!item.valid){
+                gwaPanel.col(i).setZero();
+            }
         }
 
-        Map< VectorXd > xMat(item.geno.data(), num_indi);
-
-        conditionCovarReg(xMat);
-
+        auto G = gwaPanel.leftCols(cur_num_marker);
+        // (I - X(X'X)^-1X') G in two GEMMs
+        if(covarFlag){
+            MatrixXd HG = H * G;
+            G.noalias() -= covar * HG;
+        }
+
+        // x'x and x'y in one pass over each column
+        #pragma omp parallel for schedule(dynamic)
+        for(int i = 0; i < cur_num_marker; i++){
+            int index = start + i;
+            if(!isValids[index]) continue;
+            const double *x = G.col(i).data();
+            const double *y = phenoVec.data();
+            double sxx = 0.0, sxy = 0.0;
+            #pragma omp simd reduction(+:sxx,sxy)
+            for(uint32_t k = 0; k < num_indi; k++){
+                sxx += x[k] * x[k];
+                sxy += x[k] * y[k];
+            }
+            xtx[index] = sxx;
+            xty[index] = sxy;
+        }
+    }
 
-        double xMat_V_x = 1.0 / xMat.dot(xMat);
-        double xMat_V_p = xMat.dot(phenoVec);
+    for(int i = 0; i < num_marker; i++){
+        if(!isValids[i]) continue;
+        double xMat_V_x = 1.0 / xtx[i];
+        double xMat_V_p = xty[i];
 
         double temp_beta =  xMat_V_x * xMat_V_p;
         double sse = (SSy - temp_beta * xMat_V_p) * iN;
         double temp_se = sqrt(sse * xMat_V_x);
 
-
         double temp_z = temp_beta / temp_se;
 
         beta[i] = (float)temp_beta; //* geno->RDev[cur_raw_marker]; 
         se[i] = (float)temp_se;
         p[i] = StatLib::pchisqd1(temp_z * temp_z); 
-
-        af[i] = (float)item.af;
-        countMarkers[i] = item.nValidN;
-        info[i] = item.info; 
-        //}else{
-            //beta[index] = nan;
-            //se[index] = nan;
-            //p[index] = nan;
-        //}
     }
 
     output_res(isValids, markerIndex);
@@ -2477,15 +2650,16 @@ void FastFAM::calculate_gwa_2df(uintptr_t * genobuf, const vector<uint32_t> &mar
         uint32_t cur_marker = markerIndex[i];
         GenoBufItem item;
         item.extractedMarkerIndex = cur_marker;
+        double *geno_slab = geno->getGenoSlab();
 
-        geno->getGenoDouble(genobuf, i, &item);
+        geno->getGenoDouble(genobuf, i, &item, geno_slab, NULL);
 
         isValids[i] = item.valid;
         if(!item.valid) {
             continue;
         }
 
-        Map< VectorXd > xMat(item.geno.data(), num_indi);
+        Map< VectorXd > xMat(geno_slab, num_indi);
 
         conditionCovarReg(xMat);
         VectorXd g_times_envir(num_indi); 
@@ -2575,15 +2749,16 @@ void FastFAM::calculate_gwa_2df_sandwich(uintptr_t * genobuf, const vector<uint3
         uint32_t cur_marker = markerIndex[i];
         GenoBufItem item;
         item.extractedMarkerIndex = cur_marker;
+        double *geno_slab = geno->getGenoSlab();
 
-        geno->getGenoDouble(genobuf, i, &item);
+        geno->getGenoDouble(genobuf, i, &item, geno_slab, NULL);
 
         isValids[i] = item.valid;
         if(!item.valid) {
             continue;
         }
 
-        Map< VectorXd > xMat(item.geno.data(), num_indi);
+        Map< VectorXd > xMat(geno_slab, num_indi);
         conditionCovarReg(xMat);
         VectorXd g_times_envir(num_indi);
         g_times_envir = xMat.cwiseProduct(envirVec_scaled);
@@ -2685,224 +2860,210 @@ void FastFAM::calculate_gwa_2df_sandwich(uintptr_t * genobuf, const vector<uint3
     output_res_2df(isValids, markerIndex);
 }
 
-void FastFAM::output_res_spa(const vector<uint8_t> &isValids, const vector<uint32_t> markerIndex){
-    int numKept = 0;
-    int num_marker = markerIndex.size();
-    if(bSaveBin){
-        int num_write = 1;
-        for(int i = 0; i != num_marker; i++){
-            if(isValids[i]){
-                numKept++;
-                osOut << marker->getMarkerStrExtract(markerIndex[i]) << "\n";
-                if(fwrite(&af[i], sizeof(float), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write allele frequency to [" + sFileName + ".bin].");
-                }
-
-                if(fwrite(&beta[i], sizeof(float), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write beta to [" + sFileName + ".bin].");
-                }
-                if(fwrite(&se[i], sizeof(float), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write se to [" + sFileName + ".bin].");
-                }
-                if(fwrite(&p[i], sizeof(double), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write p to [" + sFileName + ".bin].");
-                }
-                if(fwrite(&padj[i], sizeof(double), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write Padj to [" + sFileName + ".bin].");
-                }
+static inline void appendNum(string &out, double value){
+    char buf[32];
+    out.append(buf, formatDouble(value, buf) - buf);
+}
 
-                if(fwrite(&countMarkers[i], sizeof(uint32_t), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write N to [" + sFileName + ".bin].");
-                }
-                if(hasInfo){
-                    if(fwrite(&info[i], sizeof(float), num_write, bOut) != num_write){
-                        LOGGER.e(0, "can't write INFO score to [" + sFileName + ".bin].");
-                    }
-                }
+static inline void appendNum(string &out, uint32_t value){
+    char buf[32];
+    out.append(buf, formatUInt(value, buf) - buf);
+}
 
+template<typename T>
+static inline void appendBin(vector<char> &out, T value){
+    const char *ptr = reinterpret_cast<const char *>(&value);
+    out.insert(out.end(), ptr, ptr + sizeof(T));
+}
 
-            }
-        }
+// hand the formatting and writing of a block to the writer thread, or run it here without one
+void FastFAM::write_res(std::function<void ()> job){
+    if(resWriter){
+        resWriter->push(std::move(job));
     }else{
-        for(int i = 0; i != num_marker; i++){
-            if(isValids[i]){
-                numKept++;
-                osOut << marker->getMarkerStrExtract(markerIndex[i]) << "\t" << countMarkers[i]
-                    << "\t" << af[i] << "\t" << Tscore[i] << "\t" << Tse[i] << "\t" << p[i] 
-                    << "\t" << beta[i] << "\t" << se[i] << "\t" << padj[i] << "\t" << ((int)rConverge[i]);
-                if(hasInfo){
-                    osOut << "\t" << info[i];
-                }
-                osOut << "\n";
-            }else{
-                if(bOutResAll){
-                    numKept++;
-                osOut << marker->getMarkerStrExtract(markerIndex[i]) << "\t" << countMarkers[i]
-                    << "\t" << af[i] << "\tNA\tNA\tNA\tNA\tNA\tNA\tNA";
-                if(hasInfo){
-                    osOut << "\t" << info[i];
-                }
-                osOut << "\n";
- 
-                }
-            }
-        }
+        job();
     }
+}
 
-    numMarkerOutput += numKept;
+// the text goes to osOut, and the binary records of --save-bin to bOut in one write
+void FastFAM::flush_res(const string &text, const vector<char> &bin){
+    osOut.write(text.data(), text.size());
+    if(!bin.empty() && fwrite(bin.data(), 1, bin.size(), bOut) != bin.size()){
+        LOGGER.e(0, "can't write the results to [" + sFileName + ".bin].");
+    }
 }
- 
 
+template<typename T>
+static vector<T> copyRes(const T *ptr, int num){
+    return ptr ? vector<T>(ptr, ptr + num) : vector<T>();
+}
 
-void FastFAM::output_res(const vector<uint8_t> &isValids, const vector<uint32_t> markerIndex){
-    int numKept = 0;
+void FastFAM::output_res_spa(const vector<uint8_t> &isValids, const vector<uint32_t> markerIndex){
     int num_marker = markerIndex.size();
-    if(bSaveBin){
-        int num_write = 1;
+    for(int i = 0; i != num_marker; i++){
+        if(isValids[i] || (bOutResAll && !bSaveBin)) numMarkerOutput++;
+    }
+    // the buffers are refilled by the next block while this one is written
+    vector<float> c_af = copyRes(af, num_marker), c_beta = copyRes(beta, num_marker), c_se = copyRes(se, num_marker),
+        c_info = copyRes(info, num_marker), c_Tscore = copyRes(Tscore, num_marker), c_Tse = copyRes(Tse, num_marker);
+    vector<double> c_p = copyRes(p, num_marker), c_padj = copyRes(padj, num_marker);
+    vector<uint32_t> c_N = copyRes(countMarkers, num_marker);
+    vector<uint8_t> c_converge = copyRes(rConverge, num_marker);
+
+    write_res([=](){
+        string out;
+        vector<char> bin;
+        out.reserve(num_marker * 128);
         for(int i = 0; i != num_marker; i++){
-            if(isValids[i]){
-                numKept++;
-                osOut << marker->getMarkerStrExtract(markerIndex[i]) << "\n";
-                if(fwrite(&af[i], sizeof(float), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write allele frequency to [" + sFileName + ".bin].");
-                }
-
-                if(fwrite(&beta[i], sizeof(float), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write beta to [" + sFileName + ".bin].");
-                }
-                if(fwrite(&se[i], sizeof(float), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write se to [" + sFileName + ".bin].");
-                }
-                if(fwrite(&p[i], sizeof(double), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write p to [" + sFileName + ".bin].");
-                }
-
-                if(fwrite(&countMarkers[i], sizeof(uint32_t), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write N to [" + sFileName + ".bin].");
+            if(bSaveBin){
+                if(!isValids[i]) continue;
+                out += marker->getMarkerStrExtract(markerIndex[i]);
+                out += '\n';
+                appendBin(bin, c_af[i]);
+                appendBin(bin, c_beta[i]);
+                appendBin(bin, c_se[i]);
+                appendBin(bin, c_p[i]);
+                appendBin(bin, c_padj[i]);
+                appendBin(bin, c_N[i]);
+                if(hasInfo) appendBin(bin, c_info[i]);
+            }else if(isValids[i] || bOutResAll){
+                out += marker->getMarkerStrExtract(markerIndex[i]);
+                out += '\t'; appendNum(out, c_N[i]);
+                out += '\t'; appendNum(out, c_af[i]);
+                if(isValids[i]){
+                    out += '\t'; appendNum(out, c_Tscore[i]);
+                    out += '\t'; appendNum(out, c_Tse[i]);
+                    out += '\t'; appendNum(out, c_p[i]);
+                    out += '\t'; appendNum(out, c_beta[i]);
+                    out += '\t'; appendNum(out, c_se[i]);
+                    out += '\t'; appendNum(out, c_padj[i]);
+                    out += '\t'; appendNum(out, (uint32_t)c_converge[i]);
+                }else{
+                    out += "\tNA\tNA\tNA\tNA\tNA\tNA\tNA";
                 }
                 if(hasInfo){
-                    if(fwrite(&info[i], sizeof(float), num_write, bOut) != num_write){
-                        LOGGER.e(0, "can't write INFO score to [" + sFileName + ".bin].");
-                    }
+                    out += '\t'; appendNum(out, c_info[i]);
                 }
-
-
+                out += '\n';
             }
         }
-    }else{
+        flush_res(out, bin);
+    });
+}
+
+void FastFAM::output_res(const vector<uint8_t> &isValids, const vector<uint32_t> markerIndex){
+    int num_marker = markerIndex.size();
+    for(int i = 0; i != num_marker; i++){
+        if(isValids[i] || (bOutResAll && !bSaveBin)) numMarkerOutput++;
+    }
+    // the buffers are refilled by the next block while this one is written
+    vector<float> c_af = copyRes(af, num_marker), c_beta = copyRes(beta, num_marker), c_se = copyRes(se, num_marker),
+        c_info = copyRes(info, num_marker);
+    vector<double> c_p = copyRes(p, num_marker);
+    vector<uint32_t> c_N = copyRes(countMarkers, num_marker);
+
+    write_res([=](){
+        string out;
+        vector<char> bin;
+        out.reserve(num_marker * 96);
         for(int i = 0; i != num_marker; i++){
-            if(isValids[i]){
-                numKept++;
-                osOut << marker->getMarkerStrExtract(markerIndex[i]) << "\t" << countMarkers[i]
-                    << "\t" << af[i] << "\t" << beta[i] << "\t" << se[i] << "\t" << p[i];
-                if(hasInfo){
-                    osOut << "\t" << info[i];
+            if(bSaveBin){
+                if(!isValids[i]) continue;
+                out += marker->getMarkerStrExtract(markerIndex[i]);
+                out += '\n';
+                appendBin(bin, c_af[i]);
+                appendBin(bin, c_beta[i]);
+                appendBin(bin, c_se[i]);
+                appendBin(bin, c_p[i]);
+                appendBin(bin, c_N[i]);
+                if(hasInfo) appendBin(bin, c_info[i]);
+            }else if(isValids[i] || bOutResAll){
+                out += marker->getMarkerStrExtract(markerIndex[i]);
+                out += '\t'; appendNum(out, c_N[i]);
+                out += '\t'; appendNum(out, c_af[i]);
+                if(isValids[i]){
+                    out += '\t'; appendNum(out, c_beta[i]);
+                    out += '\t'; appendNum(out, c_se[i]);
+                    out += '\t'; appendNum(out, c_p[i]);
+                }else{
+                    out += "\tNA\tNA\tNA";
                 }
-                osOut << "\n";
-            }else{
-                if(bOutResAll){
-                    numKept++;
-                osOut << marker->getMarkerStrExtract(markerIndex[i]) << "\t" << countMarkers[i]
-                    << "\t" << af[i] << "\tNA\tNA\tNA";
                 if(hasInfo){
-                    osOut << "\t" << info[i];
-                }
-                osOut << "\n";
- 
+                    out += '\t'; appendNum(out, c_info[i]);
                 }
+                out += '\n';
             }
         }
-    }
-
-    numMarkerOutput += numKept;
+        flush_res(out, bin);
+    });
 }
 
 
 void FastFAM::output_res_2df(const vector<uint8_t> &isValids, const vector<uint32_t> markerIndex){
-    int numKept = 0;
     int num_marker = markerIndex.size();
-    if(bSaveBin){
-        int num_write = 1;
+    for(int i = 0; i != num_marker; i++){
+        if(isValids[i] || (bOutResAll && !bSaveBin)) numMarkerOutput++;
+    }
+    // the buffers are refilled by the next block while this one is written
+    vector<float> c_af = copyRes(af, num_marker), c_info = copyRes(info, num_marker),
+        c_beta_geno = copyRes(beta_geno, num_marker), c_beta_interaction = copyRes(beta_interaction, num_marker),
+        c_se_geno = copyRes(se_geno, num_marker), c_se_interaction = copyRes(se_interaction, num_marker),
+        c_cov = copyRes(cov_geno_interaction, num_marker), c_score_geno = copyRes(score_geno, num_marker),
+        c_score_interaction = copyRes(score_interaction, num_marker), c_score = copyRes(score, num_marker);
+    vector<double> c_p = copyRes(p, num_marker), c_p_geno = copyRes(p_geno, num_marker),
+        c_p_interaction = copyRes(p_interaction, num_marker);
+    vector<uint32_t> c_N = copyRes(countMarkers, num_marker);
+
+    write_res([=](){
+        string out;
+        vector<char> bin;
+        out.reserve(num_marker * 192);
         for(int i = 0; i != num_marker; i++){
-            if(isValids[i]){
-                numKept++;
-                osOut << marker->getMarkerStrExtract(markerIndex[i]) << "\n";
-                if(fwrite(&af[i], sizeof(float), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write allele frequency to [" + sFileName + ".bin].");
-                }
-
-                if(fwrite(&beta_geno[i], sizeof(float), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write beta_geno to [" + sFileName + ".bin].");
-                }
-                if(fwrite(&beta_interaction[i], sizeof(float), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write beta_interaction to [" + sFileName + ".bin].");
-                }
-                if(fwrite(&se_geno[i], sizeof(float), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write se_geno to [" + sFileName + ".bin].");
-                }
-                if(fwrite(&se_interaction[i], sizeof(float), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write se_interaction to [" + sFileName + ".bin].");
-                }
-                if(fwrite(&cov_geno_interaction[i], sizeof(float), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write cov_geno_interaction to [" + sFileName + ".bin].");
-                }
-                if(fwrite(&score_geno[i], sizeof(float), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write score_geno to [" + sFileName + ".bin].");
-                }
-                if(fwrite(&score_interaction[i], sizeof(float), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write score_interaction to [" + sFileName + ".bin].");
-                }
-                if(fwrite(&score[i], sizeof(float), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write score to [" + sFileName + ".bin].");
-                }
-                if(fwrite(&p_geno[i], sizeof(double), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write p_geno to [" + sFileName + ".bin].");
-                }   
-                if(fwrite(&p_interaction[i], sizeof(double), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write p_interaction to [" + sFileName + ".bin].");
-                }                             
-                if(fwrite(&p[i], sizeof(double), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write p to [" + sFileName + ".bin].");
-                }
-
-                if(fwrite(&countMarkers[i], sizeof(uint32_t), num_write, bOut) != num_write){
-                    LOGGER.e(0, "can't write N to [" + sFileName + ".bin].");
-                }
-                if(hasInfo){
-                    if(fwrite(&info[i], sizeof(float), num_write, bOut) != num_write){
-                        LOGGER.e(0, "can't write INFO score to [" + sFileName + ".bin].");
-                    }
-                }
-
-
-            }
-        }
-    }else{
-        for(int i = 0; i != num_marker; i++){
-            if(isValids[i]){
-                numKept++;
-                osOut << marker->getMarkerStrExtract(markerIndex[i]) << "\t" << countMarkers[i]
-                    << "\t" << af[i] << "\t" << beta_geno[i] << "\t" << beta_interaction[i]  << "\t" << se_geno[i] << "\t" << se_interaction[i] << "\t" << cov_geno_interaction[i] << "\t" << score_geno[i] << "\t" << score_interaction[i] << "\t" << score[i] << "\t" << p_geno[i] << "\t" << p_interaction[i] << "\t" << p[i];
-                if(hasInfo){
-                    osOut << "\t" << info[i];
+            if(bSaveBin){
+                if(!isValids[i]) continue;
+                out += marker->getMarkerStrExtract(markerIndex[i]);
+                out += '\n';
+                appendBin(bin, c_af[i]);
+                appendBin(bin, c_beta_geno[i]);
+                appendBin(bin, c_beta_interaction[i]);
+                appendBin(bin, c_se_geno[i]);
+                appendBin(bin, c_se_interaction[i]);
+                appendBin(bin, c_cov[i]);
+                appendBin(bin, c_score_geno[i]);
+                appendBin(bin, c_score_interaction[i]);
+                appendBin(bin, c_score[i]);
+                appendBin(bin, c_p_geno[i]);
+                appendBin(bin, c_p_interaction[i]);
+                appendBin(bin, c_p[i]);
+                appendBin(bin, c_N[i]);
+                if(hasInfo) appendBin(bin, c_info[i]);
+            }else if(isValids[i] || bOutResAll){
+                out += marker->getMarkerStrExtract(markerIndex[i]);
+                out += '\t'; appendNum(out, c_N[i]);
+                out += '\t'; appendNum(out, c_af[i]);
+                if(isValids[i]){
+                    out += '\t'; appendNum(out, c_beta_geno[i]);
+                    out += '\t'; appendNum(out, c_beta_interaction[i]);
+                    out += '\t'; appendNum(out, c_se_geno[i]);
+                    out += '\t'; appendNum(out, c_se_interaction[i]);
+                    out += '\t'; appendNum(out, c_cov[i]);
+                    out += '\t'; appendNum(out, c_score_geno[i]);
+                    out += '\t'; appendNum(out, c_score_interaction[i]);
+                    out += '\t'; appendNum(out, c_score[i]);
+                    out += '\t'; appendNum(out, c_p_geno[i]);
+                    out += '\t'; appendNum(out, c_p_interaction[i]);
+                    out += '\t'; appendNum(out, c_p[i]);
+                }else{
+                    out += "\tNA\tNA\tNA\tNA\tNA\tNA\tNA\tNA\tNA\tNA\tNA";
                 }
-                osOut << "\n";
-            }else{
-                if(bOutResAll){
-                    numKept++;
-                osOut << marker->getMarkerStrExtract(markerIndex[i]) << "\t" << countMarkers[i]
-                    << "\t" << af[i] << "\tNA\tNA\tNA\tNA\tNA\tNA\tNA\tNA\tNA\tNA\tNA";
                 if(hasInfo){
-                    osOut << "\t" << info[i];
-                }
-                osOut << "\n";
- 
+                    out += '\t'; appendNum(out, c_info[i]);
                 }
+                out += '\n';
             }
         }
-    }
-
-    numMarkerOutput += numKept;
+        flush_res(out, bin);
+    });
 }
  
 
@@ -2917,15 +3078,16 @@ void FastFAM::calculate_fam(uintptr_t *genobuf, const vector<uint32_t> &markerIn
         uint32_t cur_marker = markerIndex[i];
         GenoBufItem item;
         item.extractedMarkerIndex = cur_marker;
+        double *geno_slab = geno->getGenoSlab();
 
-        geno->getGenoDouble(genobuf, i, &item);
+        geno->getGenoDouble(genobuf, i, &item, geno_slab, NULL);
 
         isValids[i] = item.valid;
         if(!item.valid) {
             continue;
         }
  
-        Map< VectorXd > xMat(item.geno.data(), num_indi);
+        Map< VectorXd > xMat(geno_slab, num_indi);
 
         conditionCovarReg(xMat);
 
@@ -2957,14 +3119,15 @@ void FastFAM::calculate_grammar(uintptr_t *genobuf, const vector<uint32_t> &mark
         uint32_t cur_marker = markerIndex[i];
         GenoBufItem item;
         item.extractedMarkerIndex = cur_marker;
-        geno->getGenoDouble(genobuf, i, &item);
+        double *geno_slab = geno->getGenoSlab();
+        geno->getGenoDouble(genobuf, i, &item, geno_slab, NULL);
         
         isValids[i] = item.valid;
         if(!item.valid){
             continue;
         }
         
-        Map< VectorXd > xvec(item.geno.data(), num_indi);
+        Map< VectorXd > xvec(geno_slab, num_indi);
 
         conditionCovarReg(xvec);
 
@@ -2990,6 +3153,174 @@ void FastFAM::calculate_grammar(uintptr_t *genobuf, const vector<uint32_t> &mark
 }
 
 
+void FastFAM::initMultiPheno(const SpMat &fam, bool flag_est_GE, double VG_in, double VR_in){
+    traitCinf.resize(num_traits, 0.0);
+    traitSSy.resize(num_traits, 0.0);
+
+    // null model of each trait, the traits with the same (Vg, Ve) share one V
+    vector<int> mlm_traits;
+    vector<std::pair<double, double>> trait_VGR;
+    for(int k = 0; k < num_traits; k++){
+        LOGGER.i(0, "\nFitting the null model of " + trait_names[k] + " (" + to_string(k + 1) + "/" + to_string(num_traits) + ")...");
+        phenoVec = traitZ.col(k);
+        phenoVec -= VectorXd::Ones(phenoVec.size()) * phenoVec.mean();
+        traitZ.col(k) = phenoVec;
+
+        double Vpheno = phenoVec.array().square().sum() / (phenoVec.size() - 1);
+        if(Vpheno < 1e-5){
+            LOGGER.e(0, "the Vp of " + trait_names[k] + " is below 1e-5. Please check the scaling of the phenotype or the covariates.");
+        }
+
+        bool trait_fam_flag = fam_flag;
+        double VG = VG_in, VR = VR_in;
+        if(trait_fam_flag && flag_est_GE){
+            VG = estimateVg(fam, phenoVec, trait_fam_flag);
+            constrainVg(Vpheno, VG, VR, trait_fam_flag);
+            if(!trait_fam_flag){
+                LOGGER.w(0, "the estimate of Vg is not statistically significant, linear regression will be used for " + trait_names[k] + ".");
+            }
+        }
+
+        if(trait_fam_flag){
+            mlm_traits.push_back(k);
+            trait_VGR.emplace_back(VG, VR);
+        }else{
+            traitSSy[k] = phenoVec.dot(phenoVec);
+        }
+    }
+    int num_mlm = mlm_traits.size();
+
+    if(num_mlm > 0){
+        vector<uint32_t> marker_index = grammar_markers();
+        LOGGER.ts("tuning");
+
+        // the CG solver keeps a reference to its V, so the Vs live until the tuning is done
+        vector<std::pair<double, double>> distinct_VGR;
+        tuneGroup.resize(num_mlm);
+        for(int j = 0; j < num_mlm; j++){
+            auto it = std::find(distinct_VGR.begin(), distinct_VGR.end(), trait_VGR[j]);
+            tuneGroup[j] = it - distinct_VGR.begin();
+            if(it == distinct_VGR.end()) distinct_VGR.push_back(trait_VGR[j]);
+        }
+        int num_V = distinct_VGR.size();
+        LOGGER.i(0, to_string(num_mlm) + " traits by fastGWA-MLM share " + to_string(num_V) + " distinct V matrices.");
+        vector<SpMat> V(num_V);
+        vector<std::unique_ptr<Eigen::ConjugateGradient<SpMat, Eigen::Lower|Eigen::Upper>>> V_solvers(num_V);
+        SpMat eye(fam.rows(), fam.cols());
+        eye.setIdentity();
+        tuneSolvers.resize(num_V);
+        for(int s = 0; s < num_V; s++){
+            V[s] = fam * distinct_VGR[s].first + eye * distinct_VGR[s].second;
+            V_solvers[s].reset(new Eigen::ConjugateGradient<SpMat, Eigen::Lower|Eigen::Upper>());
+            V_solvers[s]->compute(V[s]);
+            if(V_solvers[s]->info() != Eigen::Success){
+                LOGGER.e(0, "the V matrix is not invertible.");
+            }
+            tuneSolvers[s] = V_solvers[s].get();
+        }
+
+        tuneViY.resize(num_indi, num_mlm);
+        for(int j = 0; j < num_mlm; j++){
+            tuneViY.col(j) = tuneSolvers[tuneGroup[j]]->solve(traitZ.col(mlm_traits[j]));
+        }
+        grammar_tune(marker_index);
+
+        for(int j = 0; j < num_mlm; j++){
+            int k = mlm_traits[j];
+            LOGGER.i(0, "GRAMMAR-Gamma of " + trait_names[k] + ":");
+            string cinf_file = options.find("c-inf") != options.end() ? options["out"] + "." + trait_names[k] + ".cinf" : "";
+            traitCinf[k] = grammar_cinf(j, marker_index, cinf_file);
+            traitZ.col(k) = tuneViY.col(j) / traitCinf[k];
+        }
+        LOGGER << "Tuning of Gamma finished " << LOGGER.tp("tuning") << " seconds." << std::endl;
+        tuneSolvers.clear();
+        tuneViY.resize(0, 0);
+        tuneChisq.resize(0, 0);
+        tuneCinf.resize(0, 0);
+    }
+    LOGGER.i(0, "\nNull models fitted: " + to_string(num_mlm) + " traits by fastGWA-MLM, " 
+            + to_string(num_traits - num_mlm) + " traits by linear regression.");
+}
+
+// X^T * traitZ in blocks of markers, each trait is written to its own file
+void FastFAM::calculate_mpheno(uintptr_t *genobuf, const vector<uint32_t> &markerIndex){
+    static double iN = 1.0 /(num_indi - (covarFlag ? covar.cols() : 1.0) - 1.0);
+    const int num_block_marker = 64;
+
+    int num_marker = markerIndex.size();
+    vector<uint8_t> isValids(num_marker);
+    vector<double> xtx(num_marker);
+    MatrixXd X(num_indi, num_block_marker);
+    MatrixXd XtZ(num_block_marker, num_traits);
+
+    for(int start = 0; start < num_marker; start += num_block_marker){
+        int cur_num_marker = std::min(num_block_marker, num_marker - start);
+
+        #pragma omp parallel for schedule(dynamic)
+        for(int i = 0; i < cur_num_marker; i++){
+            int index = start + i;
+            GenoBufItem item;
+            item.extractedMarkerIndex = markerIndex[index];
+            geno->getGenoDouble(genobuf, index, &item, X.col(i).data(), NULL);
+
+            isValids[index] = item.valid;
+            af[index] = (float)item.af;
+            countMarkers[index] = item.nValidN;
+            info[index] = item.info;
+            if(!item.valid){
+                X.col(i).setZero();
+                continue;
+            }
+            conditionCovarReg(X.col(i));
+            xtx[index] = X.col(i).squaredNorm();
+        }
+
+        XtZ.topRows(cur_num_marker).noalias() = X.leftCols(cur_num_marker).transpose() * traitZ;
+
+        #pragma omp parallel for schedule(dynamic)
+        for(int k = 0; k < num_traits; k++){
+            std::ofstream &out = *traitOut[k];
+            for(int i = 0; i < cur_num_marker; i++){
+                int index = start + i;
+                if(!isValids[index]){
+                    if(bOutResAll){
+                        out << marker->getMarkerStrExtract(markerIndex[index]) << "\t" << countMarkers[index]
+                            << "\t" << af[index] << "\tNA\tNA\tNA";
+                        if(hasInfo) out << "\t" << info[index];
+                        out << "\n";
+                    }
+                    continue;
+                }
+                double xtz = XtZ(i, k);
+                double temp_beta, temp_se, temp_p;
+                if(traitCinf[k] > 0){
+                    // GRAMMAR-Gamma, same as calculate_grammar
+                    temp_beta = xtz / xtx[index];
+                    double temp_chisq = temp_beta * xtz * traitCinf[k];
+                    temp_se = sqrt(temp_beta * temp_beta / temp_chisq);
+                    temp_p = StatLib::pchisqd1(temp_chisq);
+                }else{
+                    // linear regression, same as calculate_gwa
+                    double xMat_V_x = 1.0 / xtx[index];
+                    temp_beta = xMat_V_x * xtz;
+                    double sse = (traitSSy[k] - temp_beta * xtz) * iN;
+                    temp_se = sqrt(sse * xMat_V_x);
+                    double temp_z = temp_beta / temp_se;
+                    temp_p = StatLib::pchisqd1(temp_z * temp_z);
+                }
+                out << marker->getMarkerStrExtract(markerIndex[index]) << "\t" << countMarkers[index]
+                    << "\t" << af[index] << "\t" << (float)temp_beta << "\t" << (float)temp_se << "\t" << temp_p;
+                if(hasInfo) out << "\t" << info[index];
+                out << "\n";
+            }
+        }
+    }
+
+    for(int i = 0; i < num_marker; i++){
+        if(isValids[i] || bOutResAll) numMarkerOutput++;
+    }
+}
+
 void FastFAM::calculate_mixed_2df(uintptr_t *genobuf, const vector<uint32_t> &markerIndex){
     //calculate residualized phenotype
     phenoVec = VR_copy * Vi_y;
@@ -3013,7 +3344,32 @@ void FastFAM::processFAM(vector<function<void (uintptr_t *, const vector<uint32_
     int buf_size = 23068672;
     osBuf.resize(buf_size);
     osOut.rdbuf()->pubsetbuf(&osBuf[0], buf_size);
-    if(options.find("save_bin") == options.end()){
+    if(num_traits > 0){
+        // out.fastGWA => out.<trait>.fastGWA
+        string prefix = sFileName.substr(0, sFileName.size() - string(".fastGWA").size());
+#ifndef _WIN32
+        // one output file for each trait
+        struct rlimit file_limit;
+        if(getrlimit(RLIMIT_NOFILE, &file_limit) == 0 && file_limit.rlim_cur < file_limit.rlim_max){
+            file_limit.rlim_cur = file_limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &file_limit);
+        }
+#endif
+        vector<string> header = {"CHR", "SNP", "POS", "A1", "A2", "N", "AF1", "BETA", "SE", "P"};
+        if(hasInfo)header.push_back("INFO");
+        string header_string = boost::algorithm::join(header, "\t");
+        traitOut.resize(num_traits);
+        for(int k = 0; k < num_traits; k++){
+            string trait_file = prefix + "." + trait_names[k] + ".fastGWA";
+            traitOut[k].reset(new std::ofstream(trait_file.c_str()));
+            if(!(*traitOut[k])){
+                LOGGER.e(0, "can't open [" + trait_file + "] to write. Too many phenotypes for the limit of open files? Try to split them by --pheno-list.");
+            }
+            *traitOut[k] << header_string << "\n";
+        }
+        LOGGER << "fastGWA results of " << num_traits << " phenotypes will be saved in text format to [" 
+            << prefix << ".<phenotype>.fastGWA]." << std::endl;
+    }else if(options.find("save_bin") == options.end()){
         bSaveBin = false;
         LOGGER << "fastGWA results will be saved in text format to [" << sFileName << "]." << std::endl;
         osOut.open(sFileName.c_str());
@@ -3104,10 +3460,17 @@ void FastFAM::processFAM(vector<function<void (uintptr_t *, const vector<uint32_
         p_geno = new double[nMarker];
         p_interaction = new double[nMarker];
     }
+    resWriter.reset(new AsyncWriter());
     geno->loopDouble(extractIndex, nMarker, true, bCenter, false, false, callBacks);
+    resWriter->finish();
+    resWriter.reset();
 
     osOut.flush();
     osOut.close();
+    for(auto &out : traitOut){
+        out->close();
+    }
+    traitOut.clear();
     if(bOut){
         fflush(bOut);
         fclose(bOut);
@@ -3521,7 +3884,10 @@ void FastFAM::processMain(){
                         LOGGER.i(0, "\nPerforming fastGWA generalized linear mixed model association analysis...");
                         callBacks.push_back(bind(&FastFAM::calculate_spa, &ffam, _1, _2));
                     }else{
-                        if(options.find("grammar") == options.end()){
+                        if(ffam.num_traits > 0){
+                            LOGGER.i(0, "\nPerforming fastGWA mixed model association analysis of " + to_string(ffam.num_traits) + " phenotypes...");
+                            callBacks.push_back(bind(&FastFAM::calculate_mpheno, &ffam, _1, _2));
+                        }else if(options.find("grammar") == options.end()){
                             LOGGER.i(0, "\nPerforming fastGWA mixed model association analysis (exact test)...");
                             callBacks.push_back(bind(&FastFAM::calculate_fam, &ffam, _1, _2));
                         }else{
@@ -3539,6 +3905,9 @@ void FastFAM::processMain(){
                         LOGGER.i(0, "\nPerforming fastGWA-GE linear regression analysis using model-robust (sandwich) variance estimator...");
                         callBacks.push_back(bind(&FastFAM::calculate_gwa_2df_sandwich, &ffam, _1, _2));
                     }
+                }else if(ffam.num_traits > 0){
+                    LOGGER.i(0, "\nPerforming fastGWA linear regression analysis of " + to_string(ffam.num_traits) + " phenotypes...");
+                    callBacks.push_back(bind(&FastFAM::calculate_mpheno, &ffam, _1, _2));
                 }else{
                     LOGGER.i(0, "\nPerforming fastGWA linear regression analysis...");
                     callBacks.push_back(bind(&FastFAM::calculate_gwa, &ffam, _1, _2));
@@ -3716,12 +4085,10 @@ void FastFAM::getX(uintptr_t *genobuf, const vector<uint32_t> &markerIndex){
         uint32_t cur_marker = markerIndex[i];
         GenoBufItem item;
         item.extractedMarkerIndex = cur_marker;
-        geno->getGenoDouble(genobuf, i, &item);
+        geno->getGenoDouble(genobuf, i, &item, gX.col(index_cur_marker).data(), NULL);
         
         bValids[index_cur_marker] = item.valid;
         if(item.valid){
-            Map< VectorXd > xvec(item.geno.data(), num_indi);
-            gX.col(index_cur_marker) = xvec;
             gAF[index_cur_marker] = item.af;
             gN[index_cur_marker] = item.nValidN;
         }
@@ -4204,10 +4571,11 @@ void FastFAM::binGrammar_func(uintptr_t *genobuf, const vector<uint32_t> &marker
         int index_cur_marker = num_grammar_markers + i;
         GenoBufItem item;
         item.extractedMarkerIndex = markerIndex[i];
-        geno->getGenoDouble(genobuf, i, &item);
+        double *geno_slab = geno->getGenoSlab();
+        geno->getGenoDouble(genobuf, i, &item, geno_slab, NULL);
         bValids[index_cur_marker] = item.valid;
         if(item.valid){
-            Map< VectorXd > curGeno(item.geno.data(), num_indi);
+            Map< VectorXd > curGeno(geno_slab, num_indi);
             if(bPreciseCovar) conditionCovarBinReg(curGeno);
             //VectorXd PY = solverV.solve(Y) - ViX * inv_XtVX_ViX * Y;
             VectorXd PG = solverV.solve(curGeno) - ViX * (inv_XtVX_ViX * curGeno);
@@ -4354,14 +4722,15 @@ void FastFAM::calculate_spa(uintptr_t *genobuf, const vector<uint32_t> &markerIn
         uint32_t cur_marker = markerIndex[i];
         GenoBufItem item;
         item.extractedMarkerIndex = cur_marker;
-        geno->getGenoDouble(genobuf, i, &item);
+        double *geno_slab = geno->getGenoSlab();
+        geno->getGenoDouble(genobuf, i, &item, geno_slab, NULL);
         
         isValids[i] = item.valid;
         if(!item.valid){
             continue;
         }
 
-        Map< VectorXd > xvec(item.geno.data(), num_indi);
+        Map< VectorXd > xvec(geno_slab, num_indi);
         VectorXd xvec2 = xvec;
 
         if(bPreciseCovar) conditionCovarBinReg(xvec);
@@ -18,6 +18,7 @@
 
 #include "cpu_f77blas.h"
 #include "GRM.h"
+#include "GRMReader.h"
 #include "Logger.h"
 #include <iterator>
 #include <algorithm>
@@ -35,8 +36,12 @@
 #include <boost/algorithm/string/join.hpp>
 #include <sstream>
 #include <csignal>
+#include <random>
+#include <Eigen/Dense>
 
 using std::to_string;
+using Eigen::MatrixXd;
+using Eigen::VectorXd;
 
 map<string, string> GRM::options;
 map<string, double> GRM::options_d;
@@ -376,7 +381,7 @@ void GRM::unify_grm(string mgrm_file, string out_file){
 void GRM::prune_fam(float thresh, bool isSparse, float *value){
     LOGGER.i(0, "Pruning the GRM to a sparse matrix with a cutoff of " + to_string(thresh) + "...");
     LOGGER.i(0, "Total number of parts to be processed: " + to_string(index_grm_pairs.size()));
-    FILE *grmFile = fopen((grm_file + ".grm.bin").c_str(), "rb");
+    GRMReader grm_map(grm_file, num_subjects);
 
     std::ofstream o_id((options["out"] + ".grm.id").c_str());
     if(!o_id) LOGGER.e(0, "can't write to [" + options["out"] + ".grm.id]");
@@ -404,22 +409,19 @@ void GRM::prune_fam(float thresh, bool isSparse, float *value){
 
     // Save pair1 par2 GRM
     std::unordered_set<int> keeps_ori(index_keep.begin(), index_keep.end());
-    float *grm_buf = new float[num_byte_buffer];
-    float cur_grm, *cur_grm_pos0;
+    float cur_grm;
+    const float *cur_grm_pos0;
     vector<float> rm_grm;
     vector<int> rm_grm_ID1, rm_grm_ID2;
     float *out_grm_buf = new float[num_byte_buffer];
     float *cur_grm_buf;
     int new_id1 = 0;
     for(int part_index = 0; part_index != index_grm_pairs.size(); part_index++){
-        if(fread(grm_buf, sizeof(float), byte_part_grms[part_index], grmFile) != byte_part_grms[part_index]){
-            LOGGER.e(0, "Failed to read GRM between line " + to_string(index_grm_pairs[part_index].first + 1) + " and "
-                        + to_string(index_grm_pairs[part_index].second + 1));
-        };
+        grm_map.prefetch(index_grm_pairs[part_index].first, index_grm_pairs[part_index].second);
         if(part_index % 50 == 0){
             LOGGER.i(2, "Processing part " + to_string(part_index + 1));
         }
-        cur_grm_pos0 = grm_buf;
+        cur_grm_pos0 = grm_map.row(index_grm_pairs[part_index].first);
         cur_grm_buf = out_grm_buf;
 
         for(int id1 = index_grm_pairs[part_index].first; id1 != index_grm_pairs[part_index].second + 1; id1++){
@@ -469,9 +471,7 @@ void GRM::prune_fam(float thresh, bool isSparse, float *value){
         }
 
     }
-    delete [] grm_buf;
     delete [] out_grm_buf;
-    fclose(grmFile);
     if(!isSparse){
         fclose(o_bk);
     }
@@ -485,29 +485,28 @@ void GRM::prune_fam(float thresh, bool isSparse, float *value){
             o_fam << rm_grm_ID1[index] << "\t" << rm_grm_ID2[index] << "\t" << rm_grm[index] << std::endl;
         }
         o_fam.close();
+        GRMSparseReader::write(options["out"] + ".grm.spb", index_keep.size(), rm_grm_ID1, rm_grm_ID2, rm_grm);
+        LOGGER.i(0, "Binary sparse GRM has been saved to [" + options["out"] + ".grm.spb]");
         LOGGER.i(0, "Success:", "finished generating a sparse GRM");
         return;
     }else{
         LOGGER.i(0, "GRM has been saved to [" + options["out"] + ".grm.bin]");
     }
 
-    FILE *NFile = fopen((grm_file + ".grm.N.bin").c_str(), "rb");
+    if(!grm_map.hasN()){
+        LOGGER.w(0, "There is no [" + grm_file + ".grm.N.bin], stop pruning the GRM N");
+        return;
+    }
     FILE *ONFile = fopen((options["out"] + ".grm.N.bin").c_str(), "wb");
-    float *N_buf = new float[num_byte_buffer];
-    float *cur_N_pos0;
+    const float *cur_N_pos0;
     float *out_N_buf = new float[num_byte_buffer];
     float *cur_N_buf;
     for(int part_index = 0; part_index != index_grm_pairs.size(); part_index++){
-        if(fread(N_buf, sizeof(float), byte_part_grms[part_index], NFile) != byte_part_grms[part_index]){
-            LOGGER.w(0, "Reading GRM N failed between line " + to_string(index_grm_pairs[part_index].first + 1) + " and "
-                        + to_string(index_grm_pairs[part_index].second + 1));
-            LOGGER.i(0, "Stop pruning the GRM N");
-            break;
-        };
+        grm_map.prefetch(index_grm_pairs[part_index].first, index_grm_pairs[part_index].second, true);
         if(part_index % 50 == 0){
             LOGGER.i(2, "Processing part " + to_string(part_index + 1));
         }
-        cur_N_pos0 = N_buf;
+        cur_N_pos0 = grm_map.rowN(index_grm_pairs[part_index].first);
         cur_N_buf = out_N_buf;
 
         for(int id1 = index_grm_pairs[part_index].first; id1 != index_grm_pairs[part_index].second + 1; id1++){
@@ -529,9 +528,7 @@ void GRM::prune_fam(float thresh, bool isSparse, float *value){
 
     }
     delete [] out_N_buf;
-    delete [] N_buf;
     fclose(ONFile);
-    fclose(NFile);
     LOGGER.i(0, "GRM N has been saved to [" + options["out"] + ".grm.N.bin]");
 }
 
@@ -738,6 +735,22 @@ GRM::GRM(Pheno* pheno, Marker* marker) {
     this->part = std::stoi(options["cur_part"]);
     this->num_parts = std::stoi(options["num_parts"]);
 
+    if(options.find("tile_blocks") != options.end()){
+        // square tile of the GRM, row block >= column block
+        bBLAS = true;
+        bTile = true;
+        num_tile_blocks = std::stoi(options["tile_blocks"]);
+        cur_tile = std::stoi(options["cur_tile"]);
+        vector<pair<uint32_t, uint32_t>> blocks = divide_tiles(pheno->count_keep(), num_tile_blocks);
+        if(blocks.size() != num_tile_blocks){
+            LOGGER.e(0, "cannot divide " + to_string(pheno->count_keep()) + " samples into " + to_string(num_tile_blocks) + " blocks.");
+        }
+        uint32_t row_block, col_block;
+        tile_position(cur_tile - 1, row_block, col_block);
+        part_keep_indices = blocks[row_block];
+        tile_col_indices = blocks[col_block];
+        bTileDiag = (row_block == col_block);
+    }else{
     // divide the genotype into equal length
     vector<uint32_t> parts;
     if(options.find("use_blas") != options.end()){
@@ -762,6 +775,7 @@ GRM::GRM(Pheno* pheno, Marker* marker) {
             part_keep_indices = std::make_pair(parts[part - 2] + 1, parts[part - 1]);
         }
     }
+    }
 
     // init the geno buffers
     /*
@@ -804,12 +818,34 @@ GRM::GRM(Pheno* pheno, Marker* marker) {
     if(bBLAS){
         fill_grm = (uint64_t)num_individual * (part_keep_indices.second + 1);
     }
+    if(bTile){
+        // both GRM and N are column major num_individual x number of columns in the tile
+        num_grm = (uint64_t)num_individual * (tile_col_indices.second - tile_col_indices.first + 1);
+        fill_grm = num_grm;
+        fill_N = num_grm;
+    }
+
+    if(options.find("grm_precision") != options.end()){
+        grmPrecision = std::stoi(options["grm_precision"]);
+    }
+    // mixed precision only keeps a float panel, allocated in init_std_geno
+    if(grmPrecision == 1){
+        int ret_grmF = posix_memalign((void **)&grmF, 32, fill_grm * sizeof(float));
+        if(ret_grmF){
+            LOGGER.e(0, "can't allocate enough memory to store the (parted) GRM: " + to_string(fill_grm*sizeof(float) / 1024.0/1024/1024) + "GB required.");
+        }
+        memset(grmF, 0, fill_grm * sizeof(float));
+        num_grm_float = fill_grm;
+    }
 
+    // single precision keeps the GRM in float only
+    if(grmPrecision != 1){
     int ret_grm = posix_memalign((void **)&grm, 32, fill_grm * sizeof(double));
     if(ret_grm){
         LOGGER.e(0, "can't allocate enough memory to store the (parted) GRM: " + to_string(fill_grm*sizeof(double) / 1024.0/1024/1024) + "GB required.");
     }
     memset(grm, 0, fill_grm * sizeof(double));
+    }
 
     int ret_N = posix_memalign((void **)&N, 32, fill_N * sizeof(uint32_t));
     if(ret_N){
@@ -845,7 +881,12 @@ GRM::GRM(Pheno* pheno, Marker* marker) {
     string fstring = bBLAS ? " v2 " : " ";
     string com_string = string("Computing the ") + (isDominance ? "dominance " : "") + "genetic relationship matrix (GRM)" + fstring + "...";
     LOGGER.i(0, com_string);
-    LOGGER.i(0, "Subset " + to_string(part) + "/" + to_string(num_parts) + ", no. subject " + to_string(part_keep_indices.first + 1) + "-" + to_string(part_keep_indices.second + 1));
+    if(bTile){
+        LOGGER.i(0, "Tile " + to_string(cur_tile) + "/" + to_string(num_tile_blocks * (num_tile_blocks + 1) / 2) + ", no. subject " + to_string(part_keep_indices.first + 1) + "-" + to_string(part_keep_indices.second + 1)
+                + " by " + to_string(tile_col_indices.first + 1) + "-" + to_string(tile_col_indices.second + 1));
+    }else{
+        LOGGER.i(0, "Subset " + to_string(part) + "/" + to_string(num_parts) + ", no. subject " + to_string(part_keep_indices.first + 1) + "-" + to_string(part_keep_indices.second + 1));
+    }
     LOGGER.i(1, to_string(num_individual) + " samples, " + to_string(marker->count_extract()) + " markers, " + to_string(num_grm) + " GRM elements");
 
     o_name = options["out"];
@@ -854,7 +895,10 @@ GRM::GRM(Pheno* pheno, Marker* marker) {
         o_name += ".d";
     }
 
-    output_id();
+    // only the diagonal tile saves the IDs of its block, the merge step concatenates them
+    if(!bTile || bTileDiag){
+        output_id();
+    }
 
 #ifndef NDEBUG
     o_geno0 = fopen("./test.bin", "wb");
@@ -933,12 +977,6 @@ uint32_t popcounts(uint64_t dw){
 void GRM::calculate_GRM_blas(uintptr_t *buf, const vector<uint32_t> &markerIndex){
     int num_marker = markerIndex.size();
 
-    static int m = part_keep_indices.second - part_keep_indices.first + 1;
-    static int n = part_keep_indices.second + 1;
-    static int n_sample = n;
-    static int s_n = n - m;
-    static int bytesStdGeno = sizeof(double) * n_sample;
-
    // GenoBufItem items[num_marker];
  
     #pragma omp parallel for
@@ -956,8 +994,31 @@ void GRM::calculate_GRM_blas(uintptr_t *buf, const vector<uint32_t> &markerIndex
         }
     }
 
+    accumulate_GRM_blas(validIndex);
+
+    finished_marker += num_marker;
+}
+
+// add the decoded markers in gbufitems[validIndex] to the GRM and the missing counts
+void GRM::accumulate_GRM_blas(const vector<int> &validIndex){
+    static int m = part_keep_indices.second - part_keep_indices.first + 1;
+    static int n = part_keep_indices.second + 1;
+    static int n_sample = n;
+    static int s_n = n - m;
+    static int bytesStdGeno = sizeof(double) * n_sample;
+
     int curNumValidMarkers = validIndex.size();
+    if(curNumValidMarkers == 0){
+        return;
+    }
 
+    static char notrans='N', trans='T';
+    static double alpha = 1.0, beta = 1.0;
+    static char uplo='L';
+
+    if(grmPrecision != 0){
+        accumulate_GRM_float(validIndex);
+    }else{
     for(int i = 0; i < curNumValidMarkers; i++){
         int curIndex = validIndex[i];
         memcpy(stdGeno + i * n_sample, gbufitems[curIndex].geno.data(), bytesStdGeno);
@@ -967,9 +1028,6 @@ void GRM::calculate_GRM_blas(uintptr_t *buf, const vector<uint32_t> &markerIndex
         */
     }
 
-    static char notrans='N', trans='T';
-    static double alpha = 1.0, beta = 1.0;
-    static char uplo='L';
    // A * At 
     if(part_keep_indices.first == 0){
 #if GCTA_CPU_x86
@@ -991,50 +1049,621 @@ void GRM::calculate_GRM_blas(uintptr_t *buf, const vector<uint32_t> &markerIndex
         dsyrk_(&uplo, &notrans, &m, &curNumValidMarkers, &alpha, stdGeno + part_keep_indices.first, &n_sample, &beta, grm_start, &m); 
 #endif
     }
+    }
 
-    //memset(this->cmask_buf, 0, num_byte_cmask);
+    // only the markers with missing genotypes in samples 0 to n - 1 add to the N counts
+    const int markerPerN = sizeof(uintptr_t) * CHAR_BIT;
+    static int numNSampleBlock = (n + markerPerN - 1) / markerPerN;
+    vector<int> missIndex;
+    for(int i = 0; i < curNumValidMarkers; i++){
+        const uintptr_t *cur_miss = gbufitems[validIndex[i]].missing.data();
+        for(int j = 0; j < numNSampleBlock; j++){
+            if(cur_miss[j]){
+                missIndex.push_back(validIndex[i]);
+                break;
+            }
+        }
+    }
+
+    // transpose to sample major words, 64 markers in each word
+    int numMissMarkers = missIndex.size();
+    for(int baseMarkerIndex = 0; baseMarkerIndex < numMissMarkers; baseMarkerIndex += markerPerN){
+        int lastIndex = std::min(baseMarkerIndex + markerPerN, numMissMarkers);
+        #pragma omp parallel for
+        for(int j = 0; j < numNSampleBlock; j++){
+            uintptr_t sample_miss[markerPerN];
+            for(int k = baseMarkerIndex; k < lastIndex; k++){
+                sample_miss[k - baseMarkerIndex] = revbits(gbufitems[missIndex[k]].missing[j]);
+            }
+            for(int k = lastIndex - baseMarkerIndex; k < markerPerN; k++){
+                sample_miss[k] = 0UL;
+            }
+
+            flip64(sample_miss);
+
+            uint64_t baseMissIndex = (uint64_t)j * markerPerN;
+            for(int k = 0; k < markerPerN; k++){
+                missPlane[(baseMissIndex + k) * numMissWords + missWordCT] = sample_miss[k];
+                sub_miss[baseMissIndex + k] += popcounts(sample_miss[k]); // give sub_miss a little more avoid overflow
+            }
+        }
+        missWordCT++;
+        if(missWordCT == numMissWords){
+            flush_N();
+        }
+    }
+
+    numValidMarkers += curNumValidMarkers;
+
+}
+
+// count the markers missing in both samples of each pair over the staged words,
+// blocked by rows and columns to keep the columns in cache, samples without missing are skipped
+void GRM::flush_N(){
+    if(missWordCT == 0){
+        return;
+    }
+    const int numWords = missWordCT;
+    const uint32_t n = part_keep_indices.second + 1;
+    const uint32_t first = part_keep_indices.first;
+
+    vector<uint32_t> missSamples;
+    for(uint32_t i = 0; i < n; i++){
+        const uint64_t *cur_miss = missPlane + (uint64_t)i * numMissWords;
+        uint64_t any_miss = 0;
+        for(int w = 0; w < numWords; w++){
+            any_miss |= cur_miss[w];
+        }
+        if(any_miss){
+            missSamples.push_back(i);
+        }
+    }
+
+    int rowBegin = std::lower_bound(missSamples.begin(), missSamples.end(), first) - missSamples.begin();
+    int numMissSamples = missSamples.size();
+    const int rowBlockSize = 64;
+    const int colTileSize = 512;
+    int numRowBlocks = (numMissSamples - rowBegin + rowBlockSize - 1) / rowBlockSize;
+
+    #pragma omp parallel for schedule(dynamic)
+    for(int rb = 0; rb < numRowBlocks; rb++){
+        int rowStart = rowBegin + rb * rowBlockSize;
+        int rowEnd = std::min(rowStart + rowBlockSize, numMissSamples);
+        uint32_t lastRow = missSamples[rowEnd - 1];
+        for(int colStart = 0; colStart < numMissSamples && missSamples[colStart] <= lastRow; colStart += colTileSize){
+            int colEnd = std::min(colStart + colTileSize, numMissSamples);
+            for(int r = rowStart; r < rowEnd; r++){
+                uint64_t row = missSamples[r];
+                const uint64_t *p_miss1 = missPlane + row * numMissWords;
+                uint32_t *po_N = N + (row + first + 1) * (row - first) / 2;
+                for(int c = colStart; c < colEnd; c++){
+                    uint32_t col = missSamples[c];
+                    if(col > row) break;
+                    const uint64_t *p_miss2 = missPlane + (uint64_t)col * numMissWords;
+                    uint32_t count = 0;
+                    for(int w = 0; w < numWords; w++){
+                        count += popcount(p_miss1[w] & p_miss2[w]);
+                    }
+                    po_N[col] += count;
+                }
+            }
+        }
+    }
+    missWordCT = 0;
+}
+
+// same as the double path, but the genotypes are staged in float; single precision accumulates
+// into the float GRM by ssyrk / sgemm, mixed precision stages numMixedFlush markers and adds
+// them to the double GRM panel by panel in flush_GRM_float, so no full float GRM is kept.
+// the first samples of the part are also accumulated in double to check the precision
+void GRM::accumulate_GRM_float(const vector<int> &validIndex){
+    int m = part_keep_indices.second - part_keep_indices.first + 1;
+    int n = part_keep_indices.second + 1;
+    int n_sample = n;
+    int s_n = n - m;
+    int curNumValidMarkers = validIndex.size();
+
+    float *stage = stdGenoF + (grmPrecision == 2 ? (uint64_t)numFloatMarkers * n_sample : 0);
+    #pragma omp parallel for
+    for(int i = 0; i < curNumValidMarkers; i++){
+        const double *cur_geno = gbufitems[validIndex[i]].geno.data();
+        float *cur_geno_f = stage + (uint64_t)i * n_sample;
+        for(int j = 0; j < n_sample; j++){
+            cur_geno_f[j] = (float)cur_geno[j];
+        }
+    }
+    for(int i = 0; i < curNumValidMarkers; i++){
+        sd.push_back(gbufitems[validIndex[i]].sd);
+    }
+
+    char notrans='N', trans='T';
+    float alpha = 1.0, beta = 1.0;
+    char uplo='L';
+    if(grmPrecision == 1){
+    if(part_keep_indices.first == 0){
+#if GCTA_CPU_x86
+        ssyrk(&uplo, &notrans, &n, &curNumValidMarkers, &alpha, stdGenoF, &n_sample, &beta, grmF, &m);
+#else
+        ssyrk_(&uplo, &notrans, &n, &curNumValidMarkers, &alpha, stdGenoF, &n_sample, &beta, grmF, &m);
+#endif
+    }else{
+#if GCTA_CPU_x86
+        sgemm(&notrans, &trans, &m, &s_n, &curNumValidMarkers, &alpha, stdGenoF + part_keep_indices.first, &n_sample, stdGenoF, &n_sample, &beta, grmF, &m);
+#else
+        sgemm_(&notrans, &trans, &m, &s_n, &curNumValidMarkers, &alpha, stdGenoF + part_keep_indices.first, &n_sample, stdGenoF, &n_sample, &beta, grmF, &m);
+#endif
+        float * grm_start = grmF + ((uint64_t)s_n) * m;
+#if GCTA_CPU_x86
+        ssyrk(&uplo, &notrans, &m, &curNumValidMarkers, &alpha, stdGenoF + part_keep_indices.first, &n_sample, &beta, grm_start, &m); 
+#else
+        ssyrk_(&uplo, &notrans, &m, &curNumValidMarkers, &alpha, stdGenoF + part_keep_indices.first, &n_sample, &beta, grm_start, &m); 
+#endif
+    }
+    }
+
+    if(numCheckSample){
+        int c = numCheckSample;
+        for(int i = 0; i < curNumValidMarkers; i++){
+            memcpy(checkGeno + (uint64_t)i * c, gbufitems[validIndex[i]].geno.data() + part_keep_indices.first, sizeof(double) * c);
+        }
+        double alpha_d = 1.0, beta_d = 1.0;
+#if GCTA_CPU_x86
+        dsyrk(&uplo, &notrans, &c, &curNumValidMarkers, &alpha_d, checkGeno, &c, &beta_d, checkGRM, &c);
+#else
+        dsyrk_(&uplo, &notrans, &c, &curNumValidMarkers, &alpha_d, checkGeno, &c, &beta_d, checkGRM, &c);
+#endif
+    }
+
+    numFloatMarkers += curNumValidMarkers;
+    // flush before the next block could overflow the staging buffer
+    if(grmPrecision == 2 && numFloatMarkers + nMarkerBlock > numMixedFlush){
+        flush_GRM_float();
+    }
+}
+
+// mixed precision: multiply the staged markers panel by panel in float and add the lower
+// triangle to the double GRM; single precision: the float GRM is already complete.
+// the check samples are compared against the double accumulation in both cases, the signed
+// differences are summed up, so their maximum is the error of the final GRM.
+void GRM::flush_GRM_float(){
+    if(numFloatMarkers == 0){
+        return;
+    }
+    uint64_t m = part_keep_indices.second - part_keep_indices.first + 1;
+    uint32_t first = part_keep_indices.first;
+    uint32_t c = numCheckSample;
+    if(grmPrecision == 2){
+        int n_sample = part_keep_indices.second + 1;
+        int k = numFloatMarkers;
+        char notrans='N', trans='T';
+        float alpha = 1.0, beta = 0.0;
+        for(uint32_t c0 = 0; c0 < (uint32_t)n_sample; c0 += mixedPanelCols){
+            int w = std::min((int)mixedPanelCols, n_sample - (int)c0);
+            // rows above the panel are in the upper triangle, skip them
+            uint32_t r0 = c0 > first ? c0 - first : 0;
+            int mr = m - r0;
+#if GCTA_CPU_x86
+            sgemm(&notrans, &trans, &mr, &w, &k, &alpha, stdGenoF + first + r0, &n_sample, stdGenoF + c0, &n_sample, &beta, grmF, &mr);
+#else
+            sgemm_(&notrans, &trans, &mr, &w, &k, &alpha, stdGenoF + first + r0, &n_sample, stdGenoF + c0, &n_sample, &beta, grmF, &mr);
+#endif
+            #pragma omp parallel for
+            for(int j = 0; j < w; j++){
+                uint32_t col = c0 + j;
+                uint64_t row_start = col > first ? col - first : 0;
+                double *po_grm = grm + (uint64_t)col * m;
+                const float *po_panel = grmF + (uint64_t)j * mr - r0;
+                for(uint64_t i = row_start; i < m; i++){
+                    po_grm[i] += po_panel[i];
+                }
+                if(col >= first && col < first + c){
+                    uint32_t jc = col - first;
+                    double *po_diff = checkDiff + (uint64_t)jc * c;
+                    const double *po_check = checkGRM + (uint64_t)jc * c;
+                    for(uint32_t i = jc; i < c; i++){
+                        po_diff[i] += (double)po_panel[i] - po_check[i];
+                    }
+                }
+            }
+        }
+    }else if(c){
+        for(uint32_t j = 0; j < c; j++){
+            const float *po_grmF = grmF + (first + j) * m;
+            const double *po_check = checkGRM + (uint64_t)j * c;
+            double *po_diff = checkDiff + (uint64_t)j * c;
+            for(uint32_t i = j; i < c; i++){
+                po_diff[i] += (double)po_grmF[i] - po_check[i];
+            }
+        }
+    }
+    if(c){
+        memset(checkGRM, 0, sizeof(double) * c * c);
+    }
+    numFloatMarkers = 0;
+}
+
+void GRM::init_std_geno(){
+    uint64_t numMissPtr = (uint64_t)(part_keep_indices.second + 64) / 64 * 64 * numMissWords;
+    if(posix_memalign((void **)&missPlane, 32, sizeof(uint64_t) * numMissPtr)){
+        LOGGER.e(0, "can't allocate enough memory for the missing genotype buffer.");
+    }
+
+    if(grmPrecision == 0){
+        this->num_byte_geno = sizeof(double) * nMarkerBlock * (part_keep_indices.second + 1);
+        int ret = posix_memalign((void **)&stdGeno, 32, num_byte_geno);
+        if(ret != 0){
+            LOGGER.e(0, "can't allocate enough memory for the genotype buffer.");
+        }
+        return;
+    }
+
+    uint64_t m = part_keep_indices.second - part_keep_indices.first + 1;
+    uint64_t n_sample = part_keep_indices.second + 1;
+    LOGGER.i(0, string("GRM is accumulated in ") + (grmPrecision == 1 ? "single precision." : "single precision and flushed to double precision every " + to_string(numMixedFlush) + " SNPs."));
+    uint32_t numStage = grmPrecision == 2 ? numMixedFlush : nMarkerBlock;
+    this->num_byte_geno = sizeof(float) * numStage * n_sample;
+    int ret = posix_memalign((void **)&stdGenoF, 32, num_byte_geno);
+    if(ret != 0){
+        LOGGER.e(0, "can't allocate enough memory for the genotype buffer.");
+    }
+    if(grmPrecision == 2){
+        // the float panel is about the size of the staging buffer
+        mixedPanelCols = (uint32_t)std::min(n_sample, std::max((uint64_t)64, numStage * n_sample / m));
+        if(posix_memalign((void **)&grmF, 32, sizeof(float) * m * mixedPanelCols)){
+            LOGGER.e(0, "can't allocate enough memory for the float GRM panel.");
+        }
+    }
+    numCheckSample = std::min((uint32_t)m, (uint32_t)64);
+    checkGeno = new double[(uint64_t)nMarkerBlock * numCheckSample];
+    checkGRM = new double[(uint64_t)numCheckSample * numCheckSample]();
+    checkDiff = new double[(uint64_t)numCheckSample * numCheckSample]();
+}
+
+void GRM::end_std_geno(){
+    flush_N();
+    posix_mem_free(missPlane);
+
+    if(grmPrecision == 0){
+        posix_mem_free(stdGeno);
+        return;
+    }
+    flush_GRM_float();
+    posix_mem_free(stdGenoF);
+    stdGenoF = NULL;
+    if(grmPrecision == 2){
+        posix_mem_free(grmF);
+        grmF = NULL;
+    }
+
+    // largest absolute difference of the float GRM to the double one, divided by the
+    // number of markers to be on the scale of the output GRM
+    uint32_t c = numCheckSample;
+    double max_diff = 0.0;
+    for(uint32_t j = 0; j < c; j++){
+        for(uint32_t i = j; i < c; i++){
+            max_diff = std::max(max_diff, std::abs(checkDiff[(uint64_t)j * c + i]));
+        }
+    }
+    delete[] checkGeno;
+    delete[] checkGRM;
+    delete[] checkDiff;
+    checkGeno = checkGRM = checkDiff = NULL;
+    if(numValidMarkers){
+        double diff = max_diff / numValidMarkers;
+        std::ostringstream ss;
+        ss << "Precision check on the first " << c << " samples: max absolute difference to the double precision GRM " << std::setprecision(3) << diff << ".";
+        LOGGER.i(0, ss.str());
+        if(diff > 1e-4){
+            LOGGER.w(0, "the difference is larger than 1e-4, consider --grm-precision mixed or double.");
+        }
+    }
+}
+
+// hard-call markers without missing genotypes go to the bit-packed kernel, the others to BLAS
+void GRM::calculate_GRM_packed(uintptr_t *buf, const vector<uint32_t> &markerIndex){
+    int num_marker = markerIndex.size();
+    vector<uint8_t> isPacked(num_marker);
+
+    #pragma omp parallel for
+    for(int i = 0; i < num_marker; i++){
+        GenoBufItem &item = gbufitems[i];
+        item.extractedMarkerIndex = markerIndex[i];
+        if(geno->getGenoPacked(buf, i, &item, packedGeno + (uint64_t)i * packedGenoPtrSize)){
+            isPacked[i] = 1;
+        }else{
+            isPacked[i] = 0;
+            geno->getGenoDouble(buf, i, &item);
+        }
+    }
+
+    vector<int> packedIndex, validIndex;
+    packedIndex.reserve(num_marker);
+    validIndex.reserve(num_marker);
+    for(int i = 0; i < num_marker; i++){
+        if(gbufitems[i].valid){
+            if(isPacked[i]){
+                packedIndex.push_back(i);
+            }else{
+                validIndex.push_back(i);
+            }
+        }
+    }
+
+    // split 2-bit codes into bit rows: L for genotype >= 1, H for genotype == 2
+    int numPacked = packedIndex.size();
+    #pragma omp parallel for
+    for(int i = 0; i < numPacked; i++){
+        const uintptr_t *cur_geno = packedGeno + (uint64_t)packedIndex[i] * packedGenoPtrSize;
+        uint64_t *rowL = packedRowL + (uint64_t)(packedRowCT + i) * packedSampleBlocks;
+        uint64_t *rowH = packedRowH + (uint64_t)(packedRowCT + i) * packedSampleBlocks;
+        for(uint32_t b = 0; b < packedSampleBlocks; b++){
+            uint64_t lo1 = cur_geno[2 * b] & 0x5555555555555555ULL;
+            uint64_t hi1 = (cur_geno[2 * b] >> 1) & 0x5555555555555555ULL;
+            uint64_t lo2 = cur_geno[2 * b + 1] & 0x5555555555555555ULL;
+            uint64_t hi2 = (cur_geno[2 * b + 1] >> 1) & 0x5555555555555555ULL;
+            rowL[b] = pack_half_bits(lo1 ^ hi1) | (pack_half_bits(lo2 ^ hi2) << 32);
+            rowH[b] = pack_half_bits(hi1 & ~lo1) | (pack_half_bits(hi2 & ~lo2) << 32);
+        }
+    }
+    for(int i = 0; i < numPacked; i++){
+        const GenoBufItem &item = gbufitems[packedIndex[i]];
+        packedMean[packedRowCT + i] = item.mean;
+        sd.push_back(item.sd);
+    }
+    packedRowCT += numPacked;
+    numValidMarkers += numPacked;
+
+    while(packedRowCT >= 64){
+        packed_transpose();
+    }
+
+    accumulate_GRM_blas(validIndex);
+
+    finished_marker += num_marker;
+}
+
+// keep the bits in even positions and pack them into the lower 32 bits
+uint64_t GRM::pack_half_bits(uint64_t x){
+    x = (x | (x >> 1)) & 0x3333333333333333ULL;
+    x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x >> 4)) & 0x00FF00FF00FF00FFULL;
+    x = (x | (x >> 8)) & 0x0000FFFF0000FFFFULL;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+    return x;
+}
+
+// transpose the first 64 staged bit rows into one word of the sample major planes
+void GRM::packed_transpose(){
+    uint32_t numRow = packedRowCT < 64 ? packedRowCT : 64;
+    if(numRow == 0){
+        return;
+    }
+    if(numRow < 64){
+        memset(packedRowL + (uint64_t)numRow * packedSampleBlocks, 0, sizeof(uint64_t) * (64 - numRow) * packedSampleBlocks);
+        memset(packedRowH + (uint64_t)numRow * packedSampleBlocks, 0, sizeof(uint64_t) * (64 - numRow) * packedSampleBlocks);
+        std::fill(packedMean.begin() + numRow, packedMean.begin() + 64, 0.0);
+    }
+
+    // lookup of the sum of 2p over 8 markers; marker k locates in bit 63 - k after flip64
+    vector<double> sumTable(8 * 256);
+    for(int i = 0; i < 8; i++){
+        double *cur_table = sumTable.data() + i * 256;
+        cur_table[0] = 0.0;
+        for(int v = 1; v < 256; v++){
+            int low_bit = 0;
+            while(!((v >> low_bit) & 1)) low_bit++;
+            cur_table[v] = cur_table[v & (v - 1)] + packedMean[63 - (8 * i + low_bit)];
+        }
+    }
+
+    #pragma omp parallel for
+    for(uint32_t b = 0; b < packedSampleBlocks; b++){
+        uintptr_t tL[64], tH[64];
+        for(int k = 0; k < 64; k++){
+            tL[k] = revbits(packedRowL[(uint64_t)k * packedSampleBlocks + b]);
+            tH[k] = revbits(packedRowH[(uint64_t)k * packedSampleBlocks + b]);
+        }
+        flip64(tL);
+        flip64(tH);
+        for(int k = 0; k < 64; k++){
+            uint64_t sampleIndex = (uint64_t)b * 64 + k;
+            packedPlaneL[sampleIndex * numPackedWords + packedWordCT] = tL[k];
+            packedPlaneH[sampleIndex * numPackedWords + packedWordCT] = tH[k];
+            double sum = 0.0;
+            for(int i = 0; i < 8; i++){
+                const double *cur_table = sumTable.data() + i * 256;
+                sum += cur_table[(tL[k] >> (8 * i)) & 0xFF] + cur_table[(tH[k] >> (8 * i)) & 0xFF];
+            }
+            packedSum[sampleIndex] += sum;
+        }
+    }
+
+    for(uint32_t k = 0; k < numRow; k++){
+        packedSumSq += packedMean[k] * packedMean[k];
+    }
+
+    // move the remaining rows to the front
+    uint32_t remain = packedRowCT - numRow;
+    if(remain){
+        memmove(packedRowL, packedRowL + (uint64_t)64 * packedSampleBlocks, sizeof(uint64_t) * remain * packedSampleBlocks);
+        memmove(packedRowH, packedRowH + (uint64_t)64 * packedSampleBlocks, sizeof(uint64_t) * remain * packedSampleBlocks);
+        memmove(packedMean.data(), packedMean.data() + 64, sizeof(double) * remain);
+    }
+    packedRowCT = remain;
+
+    packedWordCT++;
+    if(packedWordCT == numPackedWords){
+        packed_flush();
+    }
+}
+
+// sum of x_i * x_j over numWords words by popcount, x = L + H;
+// the x86 builds are -msse2 only, so take the popcnt instruction by dispatch where the CPU has it
+#if defined(__linux__) && GCTA_CPU_x86
+__attribute__((target("default")))
+#endif
+static uint32_t packed_count(const uint64_t *pL1, const uint64_t *pH1, const uint64_t *pL2, const uint64_t *pH2, int numWords){
+    uint32_t count = 0;
+    for(int w = 0; w < numWords; w++){
+        count += popcount(pL1[w] & pL2[w]) + popcount(pL1[w] & pH2[w])
+            + popcount(pH1[w] & pL2[w]) + popcount(pH1[w] & pH2[w]);
+    }
+    return count;
+}
+#if defined(__linux__) && GCTA_CPU_x86
+__attribute__((target("popcnt")))
+static uint32_t packed_count(const uint64_t *pL1, const uint64_t *pH1, const uint64_t *pL2, const uint64_t *pH2, int numWords){
+    uint32_t count = 0;
+    for(int w = 0; w < numWords; w++){
+        count += popcount(pL1[w] & pL2[w]) + popcount(pL1[w] & pH2[w])
+            + popcount(pH1[w] & pL2[w]) + popcount(pH1[w] & pH2[w]);
+    }
+    return count;
+}
+#endif
+
+void GRM::packed_flush(){
+    if(packedWordCT == 0){
+        return;
+    }
+    const uint64_t m = part_keep_indices.second - part_keep_indices.first + 1;
+    const int numWords = packedWordCT;
+    const int n = part_keep_indices.second + 1;
+
+    #pragma omp parallel for schedule(dynamic)
+    for(int col = 0; col < n; col++){
+        const uint64_t *pL2 = packedPlaneL + (uint64_t)col * numPackedWords;
+        const uint64_t *pH2 = packedPlaneH + (uint64_t)col * numPackedWords;
+        double *po_grm = grm + (uint64_t)col * m;
+        int row_start = col > (int)part_keep_indices.first ? col : part_keep_indices.first;
+        for(int row = row_start; row < n; row++){
+            const uint64_t *pL1 = packedPlaneL + (uint64_t)row * numPackedWords;
+            const uint64_t *pH1 = packedPlaneH + (uint64_t)row * numPackedWords;
+            po_grm[row - part_keep_indices.first] += packed_count(pL1, pH1, pL2, pH2, numWords);
+        }
+    }
+    packedWordCT = 0;
+}
+
+// flush the staged markers and centre the popcount sums:
+// sum (x_i - 2p)(x_j - 2p) = sum x_i x_j - sum 2p x_i - sum 2p x_j + sum 4p^2
+void GRM::packed_finalize(){
+    packed_transpose();
+    packed_flush();
+
+    const uint64_t m = part_keep_indices.second - part_keep_indices.first + 1;
+    const int n = part_keep_indices.second + 1;
+    #pragma omp parallel for
+    for(int col = 0; col < n; col++){
+        double *po_grm = grm + (uint64_t)col * m;
+        double col_adj = packedSumSq - packedSum[col];
+        int row_start = col > (int)part_keep_indices.first ? col : part_keep_indices.first;
+        for(int row = row_start; row < n; row++){
+            po_grm[row - part_keep_indices.first] += col_adj - packedSum[row];
+        }
+    }
+}
 
-    //LOGGER << "count N" << std::endl;
+// one tile of the GRM: rows in part_keep_indices, columns in tile_col_indices
+// only the genotypes of samples in the tile are staged, thus the memory is bound to the tile size
+void GRM::calculate_GRM_tile(uintptr_t *buf, const vector<uint32_t> &markerIndex){
+    int num_marker = markerIndex.size();
+
+    int m = part_keep_indices.second - part_keep_indices.first + 1;
+    int c = tile_col_indices.second - tile_col_indices.first + 1;
+
+    #pragma omp parallel for
+    for(int i = 0; i < num_marker; i++){
+        GenoBufItem &item = gbufitems[i];
+        item.extractedMarkerIndex = markerIndex[i];
+        geno->getGenoDouble(buf, i, &item);
+    }
+
+    vector<int> validIndex;
+    validIndex.reserve(num_marker);
+    for(int i = 0; i < num_marker; i++){
+        if(gbufitems[i].valid){
+            validIndex.push_back(i);
+        }
+    }
+
+    int curNumValidMarkers = validIndex.size();
+
+    for(int i = 0; i < curNumValidMarkers; i++){
+        int curIndex = validIndex[i];
+        const double *curGeno = gbufitems[curIndex].geno.data();
+        memcpy(tilePanelRow + (uint64_t)i * m, curGeno + part_keep_indices.first, sizeof(double) * m);
+        if(!bTileDiag){
+            memcpy(tilePanelCol + (uint64_t)i * c, curGeno + tile_col_indices.first, sizeof(double) * c);
+        }
+        sd.push_back(gbufitems[curIndex].sd);
+    }
+
+    char notrans='N', trans='T';
+    double alpha = 1.0, beta = 1.0;
+    char uplo='L';
+    if(bTileDiag){
+#if GCTA_CPU_x86
+        dsyrk(&uplo, &notrans, &m, &curNumValidMarkers, &alpha, tilePanelRow, &m, &beta, grm, &m);
+#else
+        dsyrk_(&uplo, &notrans, &m, &curNumValidMarkers, &alpha, tilePanelRow, &m, &beta, grm, &m);
+#endif
+    }else{
+#if GCTA_CPU_x86
+        dgemm(&notrans, &trans, &m, &c, &curNumValidMarkers, &alpha, tilePanelRow, &m, tilePanelCol, &c, &beta, grm, &m);
+#else
+        dgemm_(&notrans, &trans, &m, &c, &curNumValidMarkers, &alpha, tilePanelRow, &m, tilePanelCol, &c, &beta, grm, &m);
+#endif
+    }
+
+    // count missing, only the sample blocks covered by the tile are transposed
     const int markerPerN = sizeof(uintptr_t) * CHAR_BIT;
     int numNblock = (curNumValidMarkers + markerPerN - 1) / markerPerN;
-    static int numNSampleBlock = (n + markerPerN - 1) / markerPerN;
-    //LOGGER << "marker block: " << numNblock << ", sample block:" << numNSampleBlock << ", MarkerPerN: " << markerPerN << std::endl;
-    //LOGGER << ", n: " << n << std::endl;
-    uintptr_t *sample_miss = new uintptr_t[numNSampleBlock * markerPerN]; // don't need to set to 0
+    int numMissBlocks = tileMissBlocks.size();
     for(int i = 0; i < numNblock; i++){
         int lastIndex = markerPerN * (i + 1);
         int lastValidIndex = lastIndex > curNumValidMarkers ? curNumValidMarkers : lastIndex;
 
         int baseMarkerIndex = markerPerN * i;
         #pragma omp parallel for
-        for(int j = 0; j < numNSampleBlock; j++){
+        for(int bj = 0; bj < numMissBlocks; bj++){
+            int j = tileMissBlocks[bj];
             int baseMissIndex = j * markerPerN;
             for(int k = baseMarkerIndex; k < lastValidIndex; k++){
                 int curMarkerIndex = validIndex[k];
-                sample_miss[baseMissIndex + k - baseMarkerIndex] = revbits(gbufitems[curMarkerIndex].missing[j]);
+                tileSampleMiss[baseMissIndex + k - baseMarkerIndex] = revbits(gbufitems[curMarkerIndex].missing[j]);
             }
             for(int k = lastValidIndex; k < lastIndex; k++){
-                sample_miss[baseMissIndex + k - baseMarkerIndex] = 0UL;
+                tileSampleMiss[baseMissIndex + k - baseMarkerIndex] = 0UL;
             }
-            
-            flip64(&sample_miss[baseMissIndex]);
+
+            flip64(&tileSampleMiss[baseMissIndex]);
 
             for(int k = baseMissIndex; k < baseMissIndex + markerPerN; k++){
-                sub_miss[k] += popcounts(sample_miss[k]); // give sub_miss a little more avoid overflow
+                sub_miss[k] += popcounts(tileSampleMiss[k]);
             }
         }
-        #pragma omp parallel for
-        for(int index = 0; index < index_grm_pairs.size(); index++){
-            auto index_pair = index_grm_pairs[index];
-            N_thread(index_pair.first, index_pair.second, sample_miss);
+
+        #pragma omp parallel for schedule(dynamic)
+        for(int j = 0; j < c; j++){
+            uintptr_t cmask2 = tileSampleMiss[tile_col_indices.first + j];
+            if(cmask2){
+                uint32_t *po_N = N + (uint64_t)j * m;
+                const uintptr_t *p_cmask1 = tileSampleMiss + part_keep_indices.first;
+                int start = bTileDiag ? j : 0;
+                for(int k = start; k < m; k++){
+                    uintptr_t cmask = p_cmask1[k] & cmask2;
+                    if(cmask){
+                        po_N[k] += popcounts(cmask);
+                    }
+                }
+            }
         }
     }
-    delete[] sample_miss;
 
     finished_marker += num_marker;
 
     numValidMarkers += curNumValidMarkers;
-
 }
 
     /*
@@ -1353,6 +1982,28 @@ bool write_GRM(float *grm, float *N, FILE *grm_out, FILE *N_out, uint32_t row_in
 }
 
 
+float GRM::get_mtd_weight(){
+    float mtd_weight = 1.0;
+    if(options_b["isMtd"]){
+        float weight = 0;
+        if(!isDominance){
+            for(int i = 0; i < numValidMarkers; i++){
+                //float af = geno->AFA1[i];
+                //float sd = 2.0 * af * (1.0 - af); 
+                weight += sd[i];
+            }
+        }else{
+            for(int i = 0; i < numValidMarkers; i++){
+                //float af = geno->AFA1[i];
+                //float sd = 2.0 * af * (1.0 - af); 
+                weight += sd[i] * sd[i];
+            }
+        }
+        mtd_weight = 1.0 / (weight / numValidMarkers);
+    }
+    return mtd_weight;
+}
+
 void GRM::deduce_GRM(){
     LOGGER.i(0, "The GRM computation is completed.");
     float thresh = -99;
@@ -1389,24 +2040,7 @@ void GRM::deduce_GRM(){
         }
     }
 
-    float mtd_weight = 1.0;
-    if(options_b["isMtd"]){
-        float weight = 0;
-        if(!isDominance){
-            for(int i = 0; i < numValidMarkers; i++){
-                //float af = geno->AFA1[i];
-                //float sd = 2.0 * af * (1.0 - af); 
-                weight += sd[i];
-            }
-        }else{
-            for(int i = 0; i < numValidMarkers; i++){
-                //float af = geno->AFA1[i];
-                //float sd = 2.0 * af * (1.0 - af); 
-                weight += sd[i] * sd[i];
-            }
-        }
-        mtd_weight = 1.0 / (weight / numValidMarkers);
-    }
+    float mtd_weight = get_mtd_weight();
 
  
     /* X chr adjustment
@@ -1421,7 +2055,13 @@ void GRM::deduce_GRM(){
     float *w_grm = new float[num_sample];
     float *w_N = new float[num_sample];
 
+    // the binary sparse GRM keeps the whole matrix, thus not in the part mode
+    bool isSparseBin = isSparse && part_keep_indices.first == 0 && part_keep_indices.second + 1 == num_sample;
+    vector<int> sp_id1, sp_id2;
+    vector<float> sp_grm;
+
     double *po_grm = grm;
+    float *po_grmF = grmF;
     uint32_t *po_N = N;
 
     uint64_t m = part_keep_indices.second - part_keep_indices.first + 1;
@@ -1443,7 +2083,8 @@ void GRM::deduce_GRM(){
                 w_N[pair2] = (float)sub_N;
 
                 if(sub_N){
-                    w_grm[pair2] = (float)((*(po_grm + (uint64_t)pair2 * m))/sub_N) * mtd_weight;
+                    double cur_grm = po_grm ? *(po_grm + (uint64_t)pair2 * m) : *(po_grmF + (uint64_t)pair2 * m);
+                    w_grm[pair2] = (float)(cur_grm/sub_N) * mtd_weight;
                 }else{
                     w_grm[pair2] = 0.0;
                 }
@@ -1453,8 +2094,18 @@ void GRM::deduce_GRM(){
             //fwrite(w_grm, sizeof(float), pair1 + 1, grm_out);
             //fwrite(w_N, sizeof(float), pair1 + 1, N_out);
             write_GRM(w_grm, w_N, grm_out, N_out, pair1, thresh);
+            if(isSparseBin){
+                for(int pair2 = 0; pair2 != pair1 + 1; pair2++){
+                    if(w_grm[pair2] >= thresh){
+                        sp_id1.push_back(pair1);
+                        sp_id2.push_back(pair2);
+                        sp_grm.push_back(w_grm[pair2]);
+                    }
+                }
+            }
             po_N = po_N + pair1 + 1;
-            po_grm = po_grm + 1;
+            if(po_grm) po_grm = po_grm + 1;
+            if(po_grmF) po_grmF = po_grmF + 1;
         }
     }
     /* // don't need special case
@@ -1515,11 +2166,76 @@ void GRM::deduce_GRM(){
         LOGGER.i(0, "Number of SNPs in each pair of individuals has been saved in the file [" + o_name + ".grm.N.bin]");
     }else{
         LOGGER.i(0, "GRM has been saved in the file [" + o_name + ".grm.sp]");
+        if(isSparseBin){
+            GRMSparseReader::write(o_name + ".grm.spb", num_sample, sp_id1, sp_id2, sp_grm);
+            LOGGER.i(0, "Binary sparse GRM has been saved in the file [" + o_name + ".grm.spb]");
+        }
     }
 
 }
 
 
+void GRM::deduce_GRM_tile(){
+    LOGGER.i(0, "The GRM computation is completed.");
+    LOGGER.i(0, "Saving GRM tile...");
+#ifndef NDEBUG
+    fclose(o_geno0);
+    fclose(o_mask0);
+#endif
+
+    string tile_name = o_name + ".grm.tile";
+    FILE *tile_out = fopen(tile_name.c_str(), "wb");
+    if(!tile_out){
+        LOGGER.e(0, "can't open " + tile_name + " to write");
+    }
+
+    GRMTileHeader header;
+    memcpy(header.magic, "GTIL", 4);
+    header.version = 0;
+    header.numBlocks = num_tile_blocks;
+    header.tileIndex = cur_tile;
+    header.rowStart = part_keep_indices.first;
+    header.rowEnd = part_keep_indices.second;
+    header.colStart = tile_col_indices.first;
+    header.colEnd = tile_col_indices.second;
+    header.numSample = index_keep.size();
+    header.numMarker = numValidMarkers;
+    if(fwrite(&header, sizeof(header), 1, tile_out) != 1){
+        LOGGER.e(0, "can't write to " + tile_name);
+    }
+
+    float mtd_weight = get_mtd_weight();
+
+    uint64_t m = part_keep_indices.second - part_keep_indices.first + 1;
+    uint32_t c = tile_col_indices.second - tile_col_indices.first + 1;
+    float *w_grm = new float[c];
+    float *w_N = new float[c];
+
+    for(uint32_t i = 0; i < m; i++){
+        uint32_t row_index = part_keep_indices.first + i;
+        uint32_t sub_miss1 = numValidMarkers - sub_miss[row_index];
+        uint32_t num_col = bTileDiag ? (i + 1) : c;
+        for(uint32_t j = 0; j < num_col; j++){
+            uint32_t sub_N = N[j * m + i] + sub_miss1 - sub_miss[tile_col_indices.first + j];
+            w_N[j] = (float)sub_N;
+            if(sub_N){
+                w_grm[j] = (float)(grm[j * m + i] / sub_N) * mtd_weight;
+            }else{
+                w_grm[j] = 0.0;
+            }
+        }
+        if(fwrite(w_grm, sizeof(float), num_col, tile_out) != num_col ||
+                fwrite(w_N, sizeof(float), num_col, tile_out) != num_col){
+            LOGGER.e(0, "can't write to " + tile_name);
+        }
+    }
+
+    fclose(tile_out);
+    delete[] w_grm;
+    delete[] w_N;
+    LOGGER.i(0, "GRM tile has been saved in the file [" + tile_name + "]");
+}
+
 void GRM::N_thread(int grm_index_from, int grm_index_to, const uintptr_t* cur_cmask){
     uint64_t startPos = ((uint64_t)grm_index_from + 1 + part_keep_indices.first) * (grm_index_from - part_keep_indices.first) / 2;
 
@@ -1693,6 +2409,143 @@ vector<uint32_t> GRM::divide_parts(uint32_t from, uint32_t to, uint32_t num_part
     return parts;
 }
 
+// divide the samples into num_blocks nearly equal blocks, pair of first and last index (included)
+vector<pair<uint32_t, uint32_t>> GRM::divide_tiles(uint32_t n_sample, uint32_t num_blocks){
+    vector<pair<uint32_t, uint32_t>> blocks;
+    if(num_blocks == 0 || num_blocks > n_sample){
+        return blocks;
+    }
+    blocks.reserve(num_blocks);
+    uint32_t base_size = n_sample / num_blocks;
+    uint32_t remain_size = n_sample % num_blocks;
+    uint32_t start = 0;
+    for(uint32_t i = 0; i < num_blocks; i++){
+        uint32_t cur_size = base_size + (i < remain_size ? 1 : 0);
+        blocks.push_back(std::make_pair(start, start + cur_size - 1));
+        start += cur_size;
+    }
+    return blocks;
+}
+
+// tiles are numbered by rows of the lower triangle: (0,0), (1,0), (1,1), (2,0)...
+void GRM::tile_position(uint32_t tile_index, uint32_t &row_block, uint32_t &col_block){
+    uint32_t row = (uint32_t)((sqrt(8.0 * tile_index + 1.0) - 1.0) / 2.0);
+    while((uint64_t)row * (row + 1) / 2 > tile_index) row--;
+    while((uint64_t)(row + 1) * (row + 2) / 2 <= tile_index) row++;
+    row_block = row;
+    col_block = tile_index - row * (row + 1) / 2;
+}
+
+string GRM::tile_file_name(string prefix, uint32_t num_blocks, uint32_t tile_index){
+    std::string s_tiles = std::to_string(num_blocks * (num_blocks + 1) / 2);
+    std::string c_tile = std::to_string(tile_index);
+    return prefix + ".tile_" + std::to_string(num_blocks) + "_" + std::string(s_tiles.length() - c_tile.length(), '0') + c_tile;
+}
+
+void GRM::merge_tiles(string prefix, uint32_t num_blocks, string out_file){
+    uint32_t num_tiles = num_blocks * (num_blocks + 1) / 2;
+    LOGGER.i(0, "Merging " + to_string(num_tiles) + " GRM tiles of [" + prefix + "]...");
+
+    vector<string> err_files;
+    for(uint32_t t = 1; t <= num_tiles; t++){
+        string cur_name = tile_file_name(prefix, num_blocks, t);
+        if(!checkFileReadable(cur_name + ".grm.tile")){
+            err_files.push_back(cur_name + ".grm.tile");
+        }
+        uint32_t row_block, col_block;
+        tile_position(t - 1, row_block, col_block);
+        if(row_block == col_block && !checkFileReadable(cur_name + ".grm.id")){
+            err_files.push_back(cur_name + ".grm.id");
+        }
+    }
+    if(err_files.size() != 0){
+        LOGGER.e(0, "can't read the GRM tiles: " + boost::algorithm::join(err_files, ", ") + ".");
+    }
+
+    // concatenate the IDs from the diagonal tiles
+    string o_grm_id = out_file + ".grm.id";
+    std::ofstream grm_id(o_grm_id.c_str());
+    if (!grm_id) { LOGGER.e(0, "cannot open the file [" + o_grm_id + "] to write"); }
+    uint32_t num_ids = 0;
+    for(uint32_t b = 0; b < num_blocks; b++){
+        string cur_file = tile_file_name(prefix, num_blocks, b * (b + 1) / 2 + b + 1) + ".grm.id";
+        vector<string> cur_ids = Pheno::read_sublist(cur_file);
+        num_ids += cur_ids.size();
+        std::copy(cur_ids.begin(), cur_ids.end(), std::ostream_iterator<string>(grm_id, "\n"));
+    }
+    grm_id.close();
+
+    vector<pair<uint32_t, uint32_t>> blocks = divide_tiles(num_ids, num_blocks);
+    if(blocks.size() != num_blocks){
+        LOGGER.e(0, "the IDs in the GRM tiles can't be divided into " + to_string(num_blocks) + " blocks.");
+    }
+
+    string grm_name = out_file + ".grm.bin";
+    string N_name = out_file + ".grm.N.bin";
+    FILE *grm_out = fopen(grm_name.c_str(), "wb");
+    FILE *N_out = fopen(N_name.c_str(), "wb");
+    if((!grm_out) || (!N_out)){
+        LOGGER.e(0, "can't open " + out_file + ".grm.bin or .grm.N.bin to write");
+    }
+
+    uint32_t num_marker = 0;
+    float *w_grm = new float[num_ids];
+    float *w_N = new float[num_ids];
+    for(uint32_t rb = 0; rb < num_blocks; rb++){
+        // open all the tiles in the row block, then write the rows sequentially
+        vector<FILE *> tiles(rb + 1);
+        for(uint32_t cb = 0; cb <= rb; cb++){
+            uint32_t tile_index = rb * (rb + 1) / 2 + cb + 1;
+            string cur_file = tile_file_name(prefix, num_blocks, tile_index) + ".grm.tile";
+            FILE *cur_tile = fopen(cur_file.c_str(), "rb");
+            if(!cur_tile){
+                LOGGER.e(0, "can't open " + cur_file + " to read");
+            }
+            GRMTileHeader header;
+            if(fread(&header, sizeof(header), 1, cur_tile) != 1 || memcmp(header.magic, "GTIL", 4) != 0 || header.version != 0){
+                LOGGER.e(0, "invalid GRM tile file [" + cur_file + "].");
+            }
+            if(header.numBlocks != num_blocks || header.tileIndex != tile_index || header.numSample != num_ids
+                    || header.rowStart != blocks[rb].first || header.rowEnd != blocks[rb].second
+                    || header.colStart != blocks[cb].first || header.colEnd != blocks[cb].second){
+                LOGGER.e(0, "the GRM tile [" + cur_file + "] doesn't match the other tiles or the IDs.");
+            }
+            if(rb == 0){
+                num_marker = header.numMarker;
+            }else if(header.numMarker != num_marker){
+                LOGGER.e(0, "the GRM tile [" + cur_file + "] was computed from a different number of SNPs (" 
+                        + to_string(header.numMarker) + " vs " + to_string(num_marker) + ").");
+            }
+            tiles[cb] = cur_tile;
+        }
+
+        for(uint32_t row_index = blocks[rb].first; row_index <= blocks[rb].second; row_index++){
+            for(uint32_t cb = 0; cb <= rb; cb++){
+                uint32_t col_start = blocks[cb].first;
+                uint32_t num_col = (cb == rb) ? (row_index - col_start + 1) : (blocks[cb].second - col_start + 1);
+                if(fread(w_grm + col_start, sizeof(float), num_col, tiles[cb]) != num_col ||
+                        fread(w_N + col_start, sizeof(float), num_col, tiles[cb]) != num_col){
+                    LOGGER.e(0, "the GRM tile " + to_string(rb * (rb + 1) / 2 + cb + 1) + " is truncated.");
+                }
+            }
+            write_GRM(w_grm, w_N, grm_out, N_out, row_index);
+        }
+
+        for(auto cur_tile : tiles){
+            fclose(cur_tile);
+        }
+    }
+
+    fclose(grm_out);
+    fclose(N_out);
+    delete[] w_grm;
+    delete[] w_N;
+    LOGGER.i(0, to_string(num_ids) + " samples, " + to_string(num_marker) + " SNPs in the merged GRM.");
+    LOGGER.i(0, "IDs for the GRM file have been saved in the file [" + o_grm_id + "]");
+    LOGGER.i(0, "GRM has been saved in the file [" + grm_name + "]");
+    LOGGER.i(0, "Number of SNPs in each pair of individuals has been saved in the file [" + N_name + "]");
+}
+
 int GRM::registerOption(map<string, vector<string>>& options_in) {
     int return_value = 0;
     options["out"] = options_in["out"][0];
@@ -1782,6 +2635,68 @@ int GRM::registerOption(map<string, vector<string>>& options_in) {
     options["num_parts"] = std::to_string(num_parts);
     options["cur_part"] = std::to_string(cur_part);
 
+    string op_grm_tile = "--make-grm-tile";
+    if(options_in.find(op_grm_tile) != options_in.end()){
+        if(bool_part_grm || bool_part_grm_d || bool_part_grm_xchr){
+            LOGGER.e(0, op_grm_tile + " can't be specified together with --make-grm-part, --make-grm-d-part or --make-grm-xchr-part.");
+        }
+        if(options_in.find("--make-grm-d") != options_in.end() || options_in.find("--make-grm-xchr") != options_in.end()){
+            LOGGER.e(0, op_grm_tile + " only supports the additive GRM of autosomes currently.");
+        }
+        if(options_in.find("--sparse-cutoff") != options_in.end()){
+            LOGGER.e(0, op_grm_tile + " can't be specified together with --sparse-cutoff, use it on the merged GRM instead.");
+        }
+        int num_blocks = 0, cur_tile = 0;
+        if(options_in[op_grm_tile].size() == 2){
+            try{
+                num_blocks = std::stoi(options_in[op_grm_tile][0]);
+                cur_tile = std::stoi(options_in[op_grm_tile][1]);
+            }catch(std::invalid_argument&){
+                LOGGER.e(0, op_grm_tile + " can only deal with integer value.");
+            }
+        }else{
+            LOGGER.e(0, op_grm_tile + " takes two arguments: the number of sample blocks and the tile number to be calculated currently");
+        }
+        if(num_blocks <= 0 || cur_tile <= 0){
+            LOGGER.e(0, op_grm_tile + " arguments should be >= 1");
+        }
+        int num_tiles = num_blocks * (num_blocks + 1) / 2;
+        if(cur_tile > num_tiles){
+            LOGGER.e(0, op_grm_tile + " the tile number can't be larger than " + to_string(num_tiles) + " for " + to_string(num_blocks) + " sample blocks");
+        }
+        options["tile_blocks"] = std::to_string(num_blocks);
+        options["cur_tile"] = std::to_string(cur_tile);
+        options["out"] = tile_file_name(options["out"], num_blocks, cur_tile);
+        options_in["out"][0] = options["out"];
+        options_in.erase(op_grm_tile);
+
+        std::map<string, vector<string>> t_option;
+        t_option["--autosome"] = {};
+        Marker::registerOption(t_option);
+        processFunctions.push_back("make_grm");
+        return_value++;
+    }
+
+    string op_merge_tile = "--merge-grm-tiles";
+    if(options_in.find(op_merge_tile) != options_in.end()){
+        if(options_in[op_merge_tile].size() == 2){
+            options["tile_prefix"] = options_in[op_merge_tile][0];
+            try{
+                options_d["merge_tile_blocks"] = std::stoi(options_in[op_merge_tile][1]);
+            }catch(std::invalid_argument&){
+                LOGGER.e(0, op_merge_tile + " the number of sample blocks should be an integer.");
+            }
+            if(options_d["merge_tile_blocks"] <= 0){
+                LOGGER.e(0, op_merge_tile + " the number of sample blocks should be >= 1");
+            }
+        }else{
+            LOGGER.e(0, op_merge_tile + " takes two arguments: the prefix of the tiles and the number of sample blocks");
+        }
+        processFunctions.push_back("merge_tiles");
+        options_in.erase(op_merge_tile);
+        return_value++;
+    }
+
     if(options_in.find("--grm-singleton") != options_in.end()){
         options_in["--make-grm"] = {};
     }
@@ -1817,6 +2732,25 @@ int GRM::registerOption(map<string, vector<string>>& options_in) {
         return_value++;
     }
 
+    string op_grm_precision = "--grm-precision";
+    if(options_in.find(op_grm_precision) != options_in.end()){
+        vector<string> precisions = {"double", "single", "mixed"};
+        if(options_in[op_grm_precision].size() != 1){
+            LOGGER.e(0, op_grm_precision + " takes one argument: double, single or mixed.");
+        }
+        string precision = options_in[op_grm_precision][0];
+        boost::to_lower(precision);
+        auto it_precision = std::find(precisions.begin(), precisions.end(), precision);
+        if(it_precision == precisions.end()){
+            LOGGER.e(0, op_grm_precision + " can only be double, single or mixed.");
+        }
+        if(options.find("tile_blocks") != options.end() && precision != "double"){
+            LOGGER.e(0, op_grm_precision + " " + precision + " is not supported with --make-grm-tile.");
+        }
+        options["grm_precision"] = to_string(it_precision - precisions.begin());
+        options_in.erase(op_grm_precision);
+    }
+
     options_b["isMtd"] = false;
     string op_grm_mtd = "--make-grm-alg";
     if(options_in.find(op_grm_mtd) != options_in.end()){
@@ -1862,6 +2796,45 @@ int GRM::registerOption(map<string, vector<string>>& options_in) {
         return_value++;
     }
 
+    string op_pca_approx = "--pca-approx";
+    if(options_in.find(op_pca_approx) != options_in.end()){
+        options_d["pca_approx"] = 20;
+        options_d["pca_iter"] = 5;
+        try{
+            if(options_in[op_pca_approx].size() == 1){
+                options_d["pca_approx"] = std::stoi(options_in[op_pca_approx][0]);
+            }else if(options_in[op_pca_approx].size() > 1){
+                LOGGER.e(0, op_pca_approx + " takes at most one argument: the number of PCs.");
+            }
+            if(options_in.find("--pca-iter") != options_in.end()){
+                if(options_in["--pca-iter"].size() != 1){
+                    LOGGER.e(0, "--pca-iter takes one argument: the number of Krylov iterations.");
+                }
+                options_d["pca_iter"] = std::stoi(options_in["--pca-iter"][0]);
+                options_in.erase("--pca-iter");
+            }
+            options_d["pca_seed"] = 0;
+            if(options_in.find("--seed") != options_in.end() && options_in["--seed"].size() >= 1){
+                options_d["pca_seed"] = std::stod(options_in["--seed"][0]);
+            }
+        }catch(std::logic_error&){
+            LOGGER.e(0, op_pca_approx + ", --pca-iter and --seed can only deal with integer value.");
+        }
+        if(options_d["pca_approx"] < 1){
+            LOGGER.e(0, op_pca_approx + " the number of PCs should be >= 1.");
+        }
+        if(options_d["pca_iter"] < 1){
+            LOGGER.e(0, "--pca-iter the number of iterations should be >= 1.");
+        }
+        processFunctions.push_back("pca_approx");
+        options_in.erase(op_pca_approx);
+
+        std::map<string, vector<string>> t_option;
+        t_option["--autosome"] = {};
+        Marker::registerOption(t_option);
+        return_value++;
+    }
+
     if(options_in.find("--make-grm") != options_in.end()){
         isDominance = false;
         if(options.find("grm_file") == options.end()){
@@ -1975,18 +2948,62 @@ void GRM::processMakeGRM(){
         gbufitems[i].missing.resize(missPtrSize);
     }
     */
-    this->num_byte_geno = sizeof(double) * nMarkerBlock * (part_keep_indices.second + 1);
-    int ret = posix_memalign((void **)&stdGeno, 32, num_byte_geno);
-    if(ret != 0){
-        LOGGER.e(0, "can't allocate enough memory for the genotype buffer.");
-    }
-    
     vector<function<void (uintptr_t *, const vector<uint32_t> &)>> callBacks;
-    if(options.find("use_blas") != options.end()){
-        callBacks.push_back(bind(&GRM::calculate_GRM_blas, this, _1, _2));
+    if(bTile){
+        uint32_t m = part_keep_indices.second - part_keep_indices.first + 1;
+        uint32_t c = tile_col_indices.second - tile_col_indices.first + 1;
+        int ret1 = posix_memalign((void **)&tilePanelRow, 32, sizeof(double) * nMarkerBlock * m);
+        int ret2 = 0;
+        if(!bTileDiag){
+            ret2 = posix_memalign((void **)&tilePanelCol, 32, sizeof(double) * nMarkerBlock * c);
+        }
+        if(ret1 != 0 || ret2 != 0){
+            LOGGER.e(0, "can't allocate enough memory for the genotype buffer.");
+        }
+
+        // 64 samples in each block of missing
+        const uint32_t markerPerN = sizeof(uintptr_t) * CHAR_BIT;
+        uint32_t numNSampleBlock = (part_keep_indices.second + markerPerN) / markerPerN;
+        tileSampleMiss = new uintptr_t[(uint64_t)numNSampleBlock * markerPerN];
+        for(uint32_t j = tile_col_indices.first / markerPerN; j <= tile_col_indices.second / markerPerN; j++){
+            tileMissBlocks.push_back(j);
+        }
+        for(uint32_t j = part_keep_indices.first / markerPerN; j <= part_keep_indices.second / markerPerN; j++){
+            if(j > tileMissBlocks.back()){
+                tileMissBlocks.push_back(j);
+            }
+        }
+
+        callBacks.push_back(bind(&GRM::calculate_GRM_tile, this, _1, _2));
     }else{
-        //callBacks.push_back(bind(&GRM::calculate_GRM, &grm, _1, _2));
-        LOGGER.e(0, "the original version has been deleted. Please use GCTA >= 1.92.4");
+        init_std_geno();
+
+        // the single precision mode has no double GRM to add the counts
+        bPacked = isMtd && (!isDominance) && geno->isHardCall() && grmPrecision != 1;
+        if(bPacked){
+            LOGGER.i(0, "Hard-call genotypes without missing values are processed by the bit-packed kernel.");
+            uint32_t n_sample = part_keep_indices.second + 1;
+            packedGenoPtrSize = geno->getGenoPackedPtrSize();
+            packedSampleBlocks = (n_sample + 63) / 64;
+            uint64_t numRowPtr = (uint64_t)(nMarkerBlock + 64) * packedSampleBlocks;
+            uint64_t numPlanePtr = (uint64_t)packedSampleBlocks * 64 * numPackedWords;
+            int ret1 = posix_memalign((void **)&packedGeno, 32, sizeof(uintptr_t) * nMarkerBlock * packedGenoPtrSize);
+            int ret2 = posix_memalign((void **)&packedRowL, 32, sizeof(uint64_t) * numRowPtr);
+            int ret3 = posix_memalign((void **)&packedRowH, 32, sizeof(uint64_t) * numRowPtr);
+            int ret4 = posix_memalign((void **)&packedPlaneL, 32, sizeof(uint64_t) * numPlanePtr);
+            int ret5 = posix_memalign((void **)&packedPlaneH, 32, sizeof(uint64_t) * numPlanePtr);
+            if(ret1 || ret2 || ret3 || ret4 || ret5){
+                LOGGER.e(0, "can't allocate enough memory for the packed genotype buffer.");
+            }
+            packedMean.resize(nMarkerBlock + 64);
+            packedSum.resize((uint64_t)packedSampleBlocks * 64, 0.0);
+            callBacks.push_back(bind(&GRM::calculate_GRM_packed, this, _1, _2));
+        }else if(options.find("use_blas") != options.end()){
+            callBacks.push_back(bind(&GRM::calculate_GRM_blas, this, _1, _2));
+        }else{
+            //callBacks.push_back(bind(&GRM::calculate_GRM, &grm, _1, _2));
+            LOGGER.e(0, "the original version has been deleted. Please use GCTA >= 1.92.4");
+        }
     }
     geno->setGRMMode(true, isDominance);
     bool isSTD = true;
@@ -1996,9 +3013,24 @@ void GRM::processMakeGRM(){
     LOGGER << "Computing GRM..." << std::endl;
     geno->loopDouble(processIndex, nMarkerBlock, true, true, isSTD, true, callBacks);
     LOGGER << "  Used " << numValidMarkers << " valid SNPs."<< std::endl;
-    deduce_GRM();
     delete[] gbufitems;
-    posix_mem_free(stdGeno);
+    if(bTile){
+        deduce_GRM_tile();
+        posix_mem_free(tilePanelRow);
+        if(tilePanelCol) posix_mem_free(tilePanelCol);
+        delete[] tileSampleMiss;
+    }else{
+        if(bPacked){
+            packed_finalize();
+            posix_mem_free(packedGeno);
+            posix_mem_free(packedRowL);
+            posix_mem_free(packedRowH);
+            posix_mem_free(packedPlaneL);
+            posix_mem_free(packedPlaneH);
+        }
+        end_std_geno();
+        deduce_GRM();
+    }
     geno->setGRMMode(false, false);
 }
 
@@ -2013,11 +3045,7 @@ void GRM::processMakeGRMX(){
         gbufitems[i].missing.resize(missPtrSize);
     }
     */
-    this->num_byte_geno = sizeof(double) * nMarkerBlock * (part_keep_indices.second + 1);
-    int ret = posix_memalign((void **)&stdGeno, 32, num_byte_geno);
-    if(ret != 0){
-        LOGGER.e(0, "can't allocate enough memory for the genotype buffer.");
-    }
+    init_std_geno();
     
     vector<function<void (uintptr_t *, const vector<uint32_t> &)>> callBacks;
     if(options.find("use_blas") != options.end()){
@@ -2034,13 +3062,199 @@ void GRM::processMakeGRMX(){
     LOGGER << "Computing GRM..." << std::endl;
     geno->loopDouble(processIndex, nMarkerBlock, true, true, isSTD, true, callBacks);
     LOGGER << numValidMarkers << " valid SNPs are included."<< std::endl;
+    end_std_geno();
     deduce_GRM();
     delete[] gbufitems;
-    posix_mem_free(stdGeno);
     geno->setGRMMode(false, false);
 
 }
 
+// Randomized block Krylov PCA (Musco & Musco 2015) of the GRM A = Z Z' / m, Z the standardized
+// genotypes. Each product A X is one pass over the genotypes, decoding 128 markers at a time
+// into Z_b and adding Z_b (Z_b' X); the basis [A W, A^2 W, ..., A^q W] of a Gaussian W with
+// K + 10 columns takes q passes, the Rayleigh-Ritz step and the SNP loadings one pass each.
+void GRM::pca_approx(Pheno *pheno, Marker *marker){
+    int num_pc = (int)options_d["pca_approx"];
+    int num_iter = (int)options_d["pca_iter"];
+    string out = options["out"];
+
+    uint32_t n = pheno->count_keep();
+    if(num_pc >= n){
+        LOGGER.e(0, "can't compute " + to_string(num_pc) + " PCs from " + to_string(n) + " samples.");
+    }
+    int block_size = std::min(num_pc + 10, (int)n);
+    int num_block = std::min(num_iter, (int)(n / block_size));
+    int num_col = block_size * num_block;
+
+    Geno geno(pheno, marker);
+    geno.setGRMMode(true, false);
+    vector<uint32_t> processIndex = marker->get_extract_index_autosome();
+
+    const int numMarkerBuf = 128;
+    vector<GenoBufItem> items(numMarkerBuf);
+    MatrixXd Zb(n, numMarkerBuf);
+    vector<int> validIndex;
+    validIndex.reserve(numMarkerBuf);
+
+    // decode a block into the columns of Zb, the valid markers are moved to the front
+    auto decode = [&](uintptr_t *buf, const vector<uint32_t> &markerIndex){
+        int num_marker = markerIndex.size();
+        #pragma omp parallel for
+        for(int i = 0; i < num_marker; i++){
+            items[i].extractedMarkerIndex = markerIndex[i];
+            geno.getGenoDouble(buf, i, &items[i], Zb.col(i).data(), NULL);
+        }
+        validIndex.clear();
+        for(int i = 0; i < num_marker; i++){
+            if(items[i].valid){
+                int j = validIndex.size();
+                if(j != i) Zb.col(j) = Zb.col(i);
+                validIndex.push_back(i);
+            }
+        }
+    };
+
+    // dst = Z Z' src / m
+    const MatrixXd *src = NULL;
+    MatrixXd dst;
+    uint32_t numValidMarkers = 0;
+    vector<function<void (uintptr_t *, const vector<uint32_t> &)>> multiplyCallBacks;
+    multiplyCallBacks.push_back([&](uintptr_t *buf, const vector<uint32_t> &markerIndex){
+        decode(buf, markerIndex);
+        int num_valid = validIndex.size();
+        if(num_valid == 0) return;
+        MatrixXd ZtX = Zb.leftCols(num_valid).transpose() * (*src);
+        dst.noalias() += Zb.leftCols(num_valid) * ZtX;
+        numValidMarkers += num_valid;
+    });
+    auto multiply = [&](const MatrixXd &x){
+        src = &x;
+        dst.setZero(n, x.cols());
+        numValidMarkers = 0;
+        geno.loopDouble(processIndex, numMarkerBuf, true, true, true, false, multiplyCallBacks);
+        if(numValidMarkers == 0){
+            LOGGER.e(0, "no valid SNP is left to compute the PCs.");
+        }
+        dst /= numValidMarkers;
+    };
+
+    // orthogonalize the block against the first num_filled columns of the basis (twice for
+    // the rounding), then orthonormalize within the block
+    auto orth = [](const MatrixXd &basis, int num_filled, MatrixXd &block){
+        for(int k = 0; k < 2 && num_filled > 0; k++){
+            MatrixXd proj = basis.leftCols(num_filled).transpose() * block;
+            block.noalias() -= basis.leftCols(num_filled) * proj;
+        }
+        Eigen::HouseholderQR<MatrixXd> qr(block);
+        block = qr.householderQ() * MatrixXd::Identity(block.rows(), block.cols());
+    };
+
+    uint32_t seed = options_d["pca_seed"] == 0 ? pheno->getSeed() : (uint32_t)options_d["pca_seed"];
+    std::mt19937 generator(seed);
+    std::normal_distribution<double> rnorm(0.0, 1.0);
+    MatrixXd omega(n, block_size);
+    for(int j = 0; j < block_size; j++){
+        for(uint32_t i = 0; i < n; i++) omega(i, j) = rnorm(generator);
+    }
+
+    LOGGER.i(0, "Computing the first " + to_string(num_pc) + " PCs by randomized block Krylov iterations (block size " + to_string(block_size)
+            + ", " + to_string(num_block) + " iterations, random seed " + to_string(seed) + ")...");
+    MatrixXd basis(n, num_col);
+    for(int iter = 0; iter < num_block; iter++){
+        LOGGER.i(0, "Krylov iteration " + to_string(iter + 1) + "/" + to_string(num_block) + "...");
+        if(iter == 0){
+            multiply(omega);
+            omega.resize(0, 0);
+        }else{
+            multiply(basis.middleCols((iter - 1) * block_size, block_size));
+        }
+        orth(basis, iter * block_size, dst);
+        basis.middleCols(iter * block_size, block_size) = dst;
+    }
+    LOGGER << "  Used " << numValidMarkers << " valid SNPs." << std::endl;
+
+    // Rayleigh-Ritz on the orthonormalized basis
+    LOGGER.i(0, "Rayleigh-Ritz projection on " + to_string(num_col) + " basis vectors...");
+    {
+        Eigen::HouseholderQR<MatrixXd> qr(basis);
+        basis = qr.householderQ() * MatrixXd::Identity(n, num_col);
+    }
+    multiply(basis);
+    MatrixXd proj = basis.transpose() * dst;
+    proj = 0.5 * (proj + proj.transpose());
+    Eigen::SelfAdjointEigenSolver<MatrixXd> eigensolver(proj);
+    MatrixXd W(num_col, num_pc);
+    VectorXd eval(num_pc);
+    for(int j = 0; j < num_pc; j++){
+        eval(j) = eigensolver.eigenvalues()(num_col - 1 - j);
+        W.col(j) = eigensolver.eigenvectors().col(num_col - 1 - j);
+    }
+    if(eval(num_pc - 1) < 1e-10){
+        LOGGER.e(0, "the GRM has less than " + to_string(num_pc) + " positive eigenvalues, please specify fewer PCs.");
+    }
+    MatrixXd evec = basis * W;
+    // A u - lambda u, with A u = (A Q) w
+    MatrixXd resid = dst * W - evec * eval.asDiagonal();
+    double max_resid = 0.0;
+    for(int j = 0; j < num_pc; j++){
+        max_resid = std::max(max_resid, resid.col(j).norm() / eval(j));
+    }
+    basis.resize(0, 0);
+    dst.resize(0, 0);
+    std::ostringstream ss_resid;
+    ss_resid << "Maximum relative residual ||Au - lambda u|| / lambda of the PCs: " << std::scientific << std::setprecision(3) << max_resid;
+    LOGGER.i(1, ss_resid.str());
+
+    string eval_file = out + ".eigenval";
+    std::ofstream o_eval(eval_file.c_str());
+    if(!o_eval) LOGGER.e(0, "cannot open the file [" + eval_file + "] to write.");
+    for(int j = 0; j < num_pc; j++) o_eval << eval(j) << "\n";
+    o_eval.close();
+    LOGGER.i(0, "The first " + to_string(num_pc) + " eigenvalues have been saved in [" + eval_file + "].");
+
+    string evec_file = out + ".eigenvec";
+    std::ofstream o_evec(evec_file.c_str());
+    if(!o_evec) LOGGER.e(0, "cannot open the file [" + evec_file + "] to write.");
+    vector<string> ids = pheno->get_id(0, n - 1, " ");
+    for(uint32_t i = 0; i < n; i++){
+        o_evec << ids[i];
+        for(int j = 0; j < num_pc; j++) o_evec << " " << evec(i, j);
+        o_evec << "\n";
+    }
+    o_evec.close();
+    LOGGER.i(0, "The first " + to_string(num_pc) + " eigenvectors of " + to_string(n) + " individuals have been saved in [" + evec_file + "].");
+
+    // SNP loadings in the format of --pc-loading: (u' z) / (lambda * m)
+    string pcl_file = out + ".pcl";
+    std::ofstream o_pcl(pcl_file.c_str());
+    if(!o_pcl) LOGGER.e(0, "cannot open the file [" + pcl_file + "] to write.");
+    o_pcl << "SNP\tA1\tA2\tmu";
+    for(int j = 0; j < num_pc; j++) o_pcl << "\tpc" << j + 1 << "_loading";
+    o_pcl << "\n";
+    MatrixXd scaled_evec = evec * (eval * (double)numValidMarkers).cwiseInverse().asDiagonal();
+    vector<function<void (uintptr_t *, const vector<uint32_t> &)>> loadingCallBacks;
+    loadingCallBacks.push_back([&](uintptr_t *buf, const vector<uint32_t> &markerIndex){
+        decode(buf, markerIndex);
+        int num_valid = validIndex.size();
+        if(num_valid == 0) return;
+        MatrixXd loading = Zb.leftCols(num_valid).transpose() * scaled_evec;
+        vector<string> fields;
+        for(int k = 0; k < num_valid; k++){
+            int i = validIndex[k];
+            // chr, SNP, bp, A1 (the counted allele), A2
+            boost::split(fields, marker->getMarkerStrExtract(markerIndex[i]), boost::is_any_of("\t"));
+            o_pcl << fields[1] << "\t" << fields[3] << "\t" << fields[4] << "\t" << 2.0 * items[i].af;
+            for(int j = 0; j < num_pc; j++) o_pcl << "\t" << loading(k, j);
+            o_pcl << "\n";
+        }
+    });
+    LOGGER.i(0, "Calculating PC loadings of SNPs...");
+    geno.loopDouble(processIndex, numMarkerBuf, true, true, true, false, loadingCallBacks);
+    o_pcl.close();
+    LOGGER.i(0, "PC loadings of " + to_string(numValidMarkers) + " SNPs have been saved in [" + pcl_file + "].");
+    geno.setGRMMode(false, false);
+}
+
 void GRM::processMain() {
     vector<function<void (uint64_t *, int)>> callBacks;
     for(auto &process_function : processFunctions){
@@ -2053,6 +3267,14 @@ void GRM::processMain() {
             return;
         }
 
+        if(process_function == "pca_approx"){
+            LOGGER.i(0, "Note: PCs are computed using the SNPs on the autosomes.");
+            Pheno pheno;
+            Marker marker;
+            pca_approx(&pheno, &marker);
+            return;
+        }
+
         if(process_function == "make_grmx"){
             LOGGER.i(0, "Note: this function takes X chromosome as non-PAR region.");
 
@@ -2094,6 +3316,10 @@ void GRM::processMain() {
             GRM grm;
             grm.subtract_grm(options["mgrm"], options["out"]);
         }
+        if(process_function == "merge_tiles"){
+            GRM grm;
+            grm.merge_tiles(options["tile_prefix"], (uint32_t)options_d["merge_tile_blocks"], options["out"]);
+        }
     }
 
 }
@@ -0,0 +1,148 @@
+/*
+   GCTA: a tool for Genome-wide Complex Trait Analysis
+
+   Memory mapped reader of the binary GRM.
+
+   This file is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   A copy of the GNU General Public License is attached along with this program.
+   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "GRMReader.h"
+#include "Logger.h"
+#include "mem.hpp"
+#include <cstring>
+#include <cstdio>
+
+GRMReader::GRMReader(string grm_file, uint32_t num_sample){
+    if(num_sample == 0){
+        LOGGER.e(0, "no sample in the GRM [" + grm_file + "].");
+    }
+    this->grm_file = grm_file;
+    this->num_sample = num_sample;
+    this->num_byte = (uint64_t)num_sample * (num_sample + 1) / 2 * sizeof(float);
+    grm = map_file(grm_file + ".grm.bin", num_byte);
+}
+
+GRMReader::~GRMReader(){
+    unmap_file((void *)grm, num_byte);
+    unmap_file((void *)N, num_byte);
+}
+
+const float *GRMReader::map_file(string file_name, uint64_t num_byte){
+    uint64_t file_byte;
+    void *addr = map_file_read(file_name.c_str(), file_byte);
+    if(!addr){
+        LOGGER.e(0, "cannot open the file [" + file_name + "] to read.");
+    }
+    if(file_byte != num_byte){
+        unmap_file(addr, file_byte);
+        LOGGER.e(0, "the size of the [" + file_name + "] file is incorrect, expected " + std::to_string(num_byte)
+                + " bytes. Are the *.grm.id and the binary file mismatched?");
+    }
+    return (const float *)addr;
+}
+
+bool GRMReader::hasN() const{
+    if(N) return true;
+    FILE *in = fopen((grm_file + ".grm.N.bin").c_str(), "rb");
+    if(in) fclose(in);
+    return in != NULL;
+}
+
+const float *GRMReader::mapN(){
+    if(!N){
+        N = map_file(grm_file + ".grm.N.bin", num_byte);
+    }
+    return N;
+}
+
+void GRMReader::prefetch(uint32_t row_from, uint32_t row_to, bool isN){
+    if(row_to >= num_sample) row_to = num_sample - 1;
+    if(row_from > row_to) return;
+    const float *base = isN ? mapN() : grm;
+    uint64_t start = (uint64_t)row_from * (row_from + 1) / 2 * sizeof(float);
+    uint64_t end = ((uint64_t)row_to + 1) * (row_to + 2) / 2 * sizeof(float);
+    advise_sequential((const char *)base + start, end - start);
+}
+
+GRMSparseReader::GRMSparseReader(string file_name){
+    this->file_name = file_name;
+    void *addr = map_file_read(file_name.c_str(), num_byte);
+    if(!addr){
+        LOGGER.e(0, "cannot open the file [" + file_name + "] to read.");
+    }
+    if(num_byte < sizeof(GRMSparseHeader)){
+        LOGGER.e(0, "[" + file_name + "] is not a valid binary sparse GRM.");
+    }
+    header = (const GRMSparseHeader *)addr;
+    if(memcmp(header->magic, "GSPB", 4) != 0 || header->version != 0){
+        LOGGER.e(0, "[" + file_name + "] is not a valid binary sparse GRM.");
+    }
+    uint64_t expect_byte = sizeof(GRMSparseHeader) + (header->numSample + 1) * sizeof(long long)
+        + header->nnz * (sizeof(long long) + sizeof(double));
+    if(expect_byte != num_byte){
+        LOGGER.e(0, "the size of the [" + file_name + "] file is incorrect, the file may be truncated.");
+    }
+    outer_index = (const long long *)(header + 1);
+    inner_index = outer_index + header->numSample + 1;
+    value = (const double *)(inner_index + header->nnz);
+    if(outer_index[header->numSample] != (long long)header->nnz){
+        LOGGER.e(0, "[" + file_name + "] is not a valid binary sparse GRM.");
+    }
+}
+
+GRMSparseReader::~GRMSparseReader(){
+    unmap_file((void *)header, num_byte);
+}
+
+void GRMSparseReader::write(string file_name, uint32_t num_sample, const vector<int> &id1,
+        const vector<int> &id2, const vector<float> &val){
+    // each off diagonal element goes to both column id2 and column id1;
+    // as the elements come in row order of the lower triangle the rows of each column stay sorted
+    vector<long long> outer(num_sample + 1, 0);
+    for(uint64_t i = 0; i < id1.size(); i++){
+        outer[id2[i] + 1]++;
+        if(id1[i] != id2[i]) outer[id1[i] + 1]++;
+    }
+    for(uint32_t i = 0; i < num_sample; i++){
+        outer[i + 1] += outer[i];
+    }
+    uint64_t nnz = outer[num_sample];
+    vector<long long> inner(nnz);
+    vector<double> value(nnz);
+    vector<long long> pos(outer.begin(), outer.end() - 1);
+    for(uint64_t i = 0; i < id1.size(); i++){
+        long long cur_pos = pos[id2[i]]++;
+        inner[cur_pos] = id1[i];
+        value[cur_pos] = val[i];
+        if(id1[i] != id2[i]){
+            cur_pos = pos[id1[i]]++;
+            inner[cur_pos] = id2[i];
+            value[cur_pos] = val[i];
+        }
+    }
+
+    GRMSparseHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "GSPB", 4);
+    header.version = 0;
+    header.numSample = num_sample;
+    header.nnz = nnz;
+
+    FILE *out = fopen(file_name.c_str(), "wb");
+    if(!out){
+        LOGGER.e(0, "can't open [" + file_name + "] to write.");
+    }
+    if(fwrite(&header, sizeof(header), 1, out) != 1 ||
+            fwrite(outer.data(), sizeof(long long), outer.size(), out) != outer.size() ||
+            fwrite(inner.data(), sizeof(long long), nnz, out) != nnz ||
+            fwrite(value.data(), sizeof(double), nnz, out) != nnz){
+        LOGGER.e(0, "failed to write [" + file_name + "].");
+    }
+    fclose(out);
+}
@@ -43,6 +43,9 @@
 #include <algorithm>
 #include "submods/Pgenlib/PgenReader.h"
 #include <numeric>
+#include "mem.hpp"
+#include "GenoIO.h"
+#include <memory>
 
 #ifdef _WIN64
   #include <intrin.h>
@@ -271,6 +274,7 @@ Geno::~Geno(){
     if(asyncBuffer)delete asyncBuffer;
     if(keep_mask)delete[] keep_mask;
     if(keep_male_mask) delete[] keep_male_mask;
+    freeGenoSlabs();
 }
 
 void Geno::init_keep(){
@@ -605,9 +609,25 @@ void Geno::preGenoDouble(int numMarkerBuf, bool bMakeGeno, bool bGenoCenter, boo
     this->bGenoStd = bGenoStd;
     this->bMakeMiss = bMakeMiss;
 
-    numMarkersReadBlocks.resize(3);
-    isMarkersSexXYs.resize(3);
-    fileIndexBuf.resize(3);
+    numBufSlots = options_d.find("read_ahead") != options_d.end() ? (int)options_d["read_ahead"] : 3;
+    // each reader needs a free slot to fill while the callbacks work on another, so by default
+    // the readers fit in --read-ahead; an explicit --read-threads enlarges the ring instead
+    if(options_d.find("read_threads") != options_d.end()){
+        numReadThreads = (int)options_d["read_threads"];
+        if(numBufSlots < numReadThreads + 1){
+            LOGGER.i(0, "The read-ahead is raised from " + to_string(numBufSlots) + " to " + to_string(numReadThreads + 1)
+                    + " blocks to hold the blocks of " + to_string(numReadThreads) + " reader threads.");
+            numBufSlots = numReadThreads + 1;
+        }
+    }else{
+        numReadThreads = std::min(std::min((int)geno_files.size(), 4), numBufSlots - 1);
+        if(numReadThreads < 1) numReadThreads = 1;
+    }
+    bDirectIO = options.find("direct_io") != options.end();
+    ioDepth = options_d.find("io_depth") != options_d.end() ? (int)options_d["io_depth"] : 32;
+    numMarkersReadBlocks.resize(numBufSlots);
+    isMarkersSexXYs.resize(numBufSlots);
+    fileIndexBuf.resize(numBufSlots);
  
     (this->*preGenoDoubleFuncs[genoFormat])();
     
@@ -621,6 +641,61 @@ void Geno::preGenoDouble(int numMarkerBuf, bool bMakeGeno, bool bGenoCenter, boo
     }
 
     missPtrSize = PgenReader::GetSubsetMaskSize(keepSampleCT);
+    getGenoDoubleFunc = getGenoDoubleFuncs[genoFormat];
+    initGenoSlabs();
+}
+
+void Geno::initGenoSlabs(){
+    freeGenoSlabs();
+    if(!bMakeGeno && !bMakeMiss) return;
+    int num_thread = omp_get_max_threads();
+    genoSlabs.resize(num_thread, NULL);
+    missSlabs.resize(num_thread, NULL);
+    uint64_t genoByte = ((uint64_t)keepSampleCT * sizeof(double) + 63) / 64 * 64;
+    uint64_t missByte = ((uint64_t)missPtrSize * sizeof(uintptr_t) + 63) / 64 * 64;
+    bool bFailed = false;
+    #pragma omp parallel num_threads(num_thread) reduction(||:bFailed)
+    {
+        int tid = omp_get_thread_num();
+        if(bMakeGeno){
+            if(posix_memalign((void **)&genoSlabs[tid], 64, genoByte)){
+                genoSlabs[tid] = NULL;
+                bFailed = true;
+            }else{
+                memset(genoSlabs[tid], 0, genoByte);
+            }
+        }
+        if(bMakeMiss){
+            if(posix_memalign((void **)&missSlabs[tid], 64, missByte)){
+                missSlabs[tid] = NULL;
+                bFailed = true;
+            }else{
+                memset(missSlabs[tid], 0, missByte);
+            }
+        }
+    }
+    if(bFailed){
+        LOGGER.e(0, "can't allocate enough memory to read genotype.");
+    }
+}
+
+void Geno::freeGenoSlabs(){
+    for(auto slab : genoSlabs){
+        if(slab) posix_mem_free(slab);
+    }
+    for(auto slab : missSlabs){
+        if(slab) posix_mem_free(slab);
+    }
+    genoSlabs.clear();
+    missSlabs.clear();
+}
+
+double *Geno::getGenoSlab(){
+    return genoSlabs[omp_get_thread_num()];
+}
+
+uintptr_t *Geno::getMissSlab(){
+    return missSlabs[omp_get_thread_num()];
 }
 
 //void Geno::loopDouble(const vector<uint32_t> &extractIndex, )
@@ -644,7 +719,7 @@ void Geno::preGenoDouble_pgen(){
     pgenDosagePresentPtrSize = (PgenReader::GetDosagePresentSize(keepSampleCT) + 63)/64 * 64;
 
     pgenGenoBuf1PtrSize = (pgenGenoPtrSize + pgenDosageMainPtrSize + pgenDosagePresentPtrSize + 1 + 63) /64 * 64;
-    asyncBuf64 = new AsyncBuffer<uintptr_t>(pgenGenoBuf1PtrSize * numMarkerBlock);
+    asyncBuf64 = new AsyncBuffer<uintptr_t>(pgenGenoBuf1PtrSize * numMarkerBlock, numBufSlots);
     if(!asyncBuf64->init_status()){
         LOGGER.e(0, "can't allocate enough memory to read genotype.");
     }
@@ -669,7 +744,7 @@ void Geno::preGenoDouble_bed(){
     // raw genotype buffer size
     uint32_t raw_sample_ct = rawSampleCT;
     bedRawGenoBuf1PtrSize = PgenReader::GetGenoBufPtrSize(raw_sample_ct);
-    asyncBuf64 = new AsyncBuffer<uintptr_t>(bedRawGenoBuf1PtrSize * numMarkerBlock);
+    asyncBuf64 = new AsyncBuffer<uintptr_t>(bedRawGenoBuf1PtrSize * numMarkerBlock, numBufSlots);
     if(!asyncBuf64->init_status()){
         LOGGER.e(0, "can't allocate enough memory to read genotype.");
     }
@@ -709,7 +784,7 @@ void Geno::preGenoDouble_bgen(){
 
 
     bgenRawGenoBuf1PtrSize = marker->getMaxGenoMarkerUptrSize();
-    asyncBuf64 = new AsyncBuffer<uintptr_t>(bgenRawGenoBuf1PtrSize * numMarkerBlock);
+    asyncBuf64 = new AsyncBuffer<uintptr_t>(bgenRawGenoBuf1PtrSize * numMarkerBlock, numBufSlots);
     if(!asyncBuf64->init_status()){
         LOGGER.e(0, "can't allocate enough memory to read genotype.");
     }
@@ -717,109 +792,104 @@ void Geno::preGenoDouble_bgen(){
 
 }
 
-int nextBufIndex(int curIndex){
-    return (curIndex + 1) % 3;
+int Geno::nextBufIndex(int curIndex){
+    return (curIndex + 1) % numBufSlots;
 }
 
 
-void Geno::readGeno(const vector<uint32_t> &extractIndex){
-    (this->*readGenoFuncs[genoFormat])(extractIndex);
+void Geno::readGeno(int readerIndex, int numReader){
+    (this->*readGenoFuncs[genoFormat])(readerIndex, numReader);
 }
 
-void Geno::readGeno_bed(const vector<uint32_t> &extractIndex){
-    const vector<uint32_t> raw_marker_index = marker->get_extract_index();
-    vector<uint32_t> rawIndices(extractIndex.size());
-    std::transform(extractIndex.begin(), extractIndex.end(), rawIndices.begin(), 
+// split the markers into the blocks of the ring before reading, so that the readers
+//   can take the blocks independently
+void Geno::initReadBlocks(const vector<uint32_t> &extractIndex){
+    const vector<uint32_t> &raw_marker_index = marker->get_extract_index();
+    readRawIndices.resize(extractIndex.size());
+    std::transform(extractIndex.begin(), extractIndex.end(), readRawIndices.begin(), 
             [&raw_marker_index](size_t pos){return raw_marker_index[pos];});
 
-    uintptr_t *g_buf = NULL;
+    readBlocks.clear();
     uint32_t numMarker = extractIndex.size();
     uint32_t finishedMarker = 0;
     uint32_t nextSize;
-    int preFileIndex = -1;
     int fileIndex = 0;
-    int base_index = baseIndexLookup[fileIndex];
-    PgenReader reader;
     bool chr_ends;
     uint8_t isSexXY;
-    int curWriteBufIndex = 0;
-    //std::ofstream oidx("rawidx.snplist");
-    while(finishedMarker != numMarker && (nextSize = marker->getNextSize(rawIndices, finishedMarker, numMarkerBlock,fileIndex, chr_ends, isSexXY)) != 0){
-        g_buf = asyncBuf64->start_write();
-        for(int i = 0; i < nextSize; i++){
-            int processIndex = finishedMarker + i;
-            int rawIndex = rawIndices[processIndex];
-            //oidx << rawIndex << "\n";
-            int curExtractIndex = extractIndex[processIndex];
-            if(preFileIndex != fileIndex){
-                //LOGGER << "reading " << fileIndex << ", sample: " << rawCountSamples[fileIndex] << ", marker: " << rawCountSNPs[fileIndex] << std::endl;
-                reader.Load(geno_files[fileIndex], &rawCountSamples[fileIndex], &rawCountSNPs[fileIndex], sampleKeepIndex);
-                base_index = baseIndexLookup[fileIndex];
-                preFileIndex = fileIndex;
-            }
-            int lag_index = rawIndex - base_index;
-            //int al_idx = marker->isEffecRevRaw(rawIndex) ? 0 : 1;
-            reader.ReadRawFullHard(g_buf, lag_index);
+    while(finishedMarker != numMarker && (nextSize = marker->getNextSize(readRawIndices, finishedMarker, numMarkerBlock, fileIndex, chr_ends, isSexXY)) != 0){
+        ReadBlock block;
+        block.start = finishedMarker;
+        block.size = nextSize;
+        block.fileIndex = fileIndex;
+        block.isSexXY = isSexXY;
+        readBlocks.push_back(block);
+        finishedMarker += nextSize;
+    }
+}
 
+// each reader owns the slot of its block, no lock needed for the slot information
+void Geno::endReadBlock(uint64_t blockIndex){
+    const ReadBlock &block = readBlocks[blockIndex];
+    int slot = blockIndex % numBufSlots;
+    numMarkersReadBlocks[slot] = block.size;
+    isMarkersSexXYs[slot] = block.isSexXY;
+    fileIndexBuf[slot] = block.fileIndex;
+    asyncBuf64->end_write(blockIndex);
+}
+
+void Geno::readGeno_bed(int readerIndex, int numReader){
+    int preFileIndex = -1;
+    int base_index = 0;
+    PgenReader reader;
+    for(uint64_t blockIndex = readerIndex; blockIndex < readBlocks.size(); blockIndex += numReader){
+        const ReadBlock &block = readBlocks[blockIndex];
+        uintptr_t *g_buf = asyncBuf64->start_write(blockIndex);
+        if(preFileIndex != block.fileIndex){
+            reader.Load(geno_files[block.fileIndex], &rawCountSamples[block.fileIndex], &rawCountSNPs[block.fileIndex], sampleKeepIndex);
+            base_index = baseIndexLookup[block.fileIndex];
+            preFileIndex = block.fileIndex;
+        }
+        for(int i = 0; i < block.size; i++){
+            int lag_index = readRawIndices[block.start + i] - base_index;
+            reader.ReadRawFullHard(g_buf, lag_index);
             g_buf += bedRawGenoBuf1PtrSize;
         }
-
-        finishedMarker += nextSize;
-        numMarkersReadBlocks[curWriteBufIndex] = nextSize;
-        isMarkersSexXYs[curWriteBufIndex] = isSexXY;
-        fileIndexBuf[curWriteBufIndex] = fileIndex;
-        asyncBuf64->end_write();
-        curWriteBufIndex = nextBufIndex(curWriteBufIndex);
+        endReadBlock(blockIndex);
     }
-    //oidx.close();
 }
 
-void Geno::readGeno_pgen(const vector<uint32_t> &extractIndex){
-    const vector<uint32_t> raw_marker_index = marker->get_extract_index();
-    vector<uint32_t> rawIndices(extractIndex.size());
-    std::transform(extractIndex.begin(), extractIndex.end(), rawIndices.begin(), 
-            [&raw_marker_index](size_t pos){return raw_marker_index[pos];});
-
-    uintptr_t *g_buf = NULL;
-    uint32_t numMarker = extractIndex.size();
-    uint32_t finishedMarker = 0;
-    uint32_t nextSize;
+void Geno::readGeno_pgen(int readerIndex, int numReader){
     int preFileIndex = -1;
-    int fileIndex = 0;
-    int base_index = baseIndexLookup[fileIndex];
+    int base_index = 0;
     PgenReader reader;
-    bool chr_ends;
-    uint8_t isSexXY;
-    int curWriteBufIndex = 0;
-    while((finishedMarker != numMarker) && (nextSize = marker->getNextSize(rawIndices, finishedMarker, numMarkerBlock,fileIndex, chr_ends, isSexXY)) != 0){
-        g_buf = asyncBuf64->start_write();
-        //LOGGER << "before: " << (void*)g_buf << std::endl;
-        for(int i = 0; i < nextSize; i++){
-            int processIndex = finishedMarker + i;
-            int rawIndex = rawIndices[processIndex];
-            int curExtractIndex = extractIndex[processIndex];
-            if(preFileIndex != fileIndex){
-                reader.Load(geno_files[fileIndex], &rawCountSamples[fileIndex], &rawCountSNPs[fileIndex], sampleKeepIndex);
-                base_index = baseIndexLookup[fileIndex];
-                preFileIndex = fileIndex;
-            }
+    for(uint64_t blockIndex = readerIndex; blockIndex < readBlocks.size(); blockIndex += numReader){
+        const ReadBlock &block = readBlocks[blockIndex];
+        uintptr_t *g_buf = asyncBuf64->start_write(blockIndex);
+        if(preFileIndex != block.fileIndex){
+            reader.Load(geno_files[block.fileIndex], &rawCountSamples[block.fileIndex], &rawCountSNPs[block.fileIndex], sampleKeepIndex);
+            base_index = baseIndexLookup[block.fileIndex];
+            preFileIndex = block.fileIndex;
+        }
+        for(int i = 0; i < block.size; i++){
+            int rawIndex = readRawIndices[block.start + i];
             int lag_index = rawIndex - base_index;
             int al_idx = marker->isEffecRevRaw(rawIndex) ? 0 : 1;
             reader.ReadDosage(g_buf, lag_index, al_idx);
             g_buf += pgenGenoBuf1PtrSize;
         }
-
-        finishedMarker += nextSize;
-        numMarkersReadBlocks[curWriteBufIndex] = nextSize;
-        isMarkersSexXYs[curWriteBufIndex] = isSexXY;
-        fileIndexBuf[curWriteBufIndex] = fileIndex;
-        asyncBuf64->end_write();
-        curWriteBufIndex = nextBufIndex(curWriteBufIndex);
+        endReadBlock(blockIndex);
     }
 }
 
 void Geno::getGenoDouble(uintptr_t *buf, int bufIndex, GenoBufItem* gbuf){
-    (this->*getGenoDoubleFuncs[genoFormat])(buf, bufIndex, gbuf);
+    // resize is free once the item is reused
+    if(bMakeGeno) gbuf->geno.resize(keepSampleCT);
+    if(bMakeMiss) gbuf->missing.resize(missPtrSize);
+    (this->*getGenoDoubleFunc)(buf, bufIndex, gbuf, gbuf->geno.data(), gbuf->missing.data());
+}
+
+void Geno::getGenoDouble(uintptr_t *buf, int bufIndex, GenoBufItem* gbuf, double *geno, uintptr_t *missing){
+    (this->*getGenoDoubleFunc)(buf, bufIndex, gbuf, geno, missing);
 }
 
 void Geno::setGenoItemSize(uint32_t &genoSize, uint32_t &missSize){
@@ -827,7 +897,7 @@ void Geno::setGenoItemSize(uint32_t &genoSize, uint32_t &missSize){
     missSize = missPtrSize;
 }
 
-void Geno::getGenoDouble_pgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
+void Geno::getGenoDouble_pgen(uintptr_t *buf, int idx, GenoBufItem* gbuf, double *geno, uintptr_t *missing){
     SNPInfo snpinfo;
     uintptr_t *cur_buf = buf + idx * pgenGenoBuf1PtrSize;
     uintptr_t *geno_buf = cur_buf;
@@ -870,19 +940,19 @@ void Geno::getGenoDouble_pgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
                 setMaleWeight(weight, needWeight);
                 if(needWeight){
                     for(int i = 0 ; i < keepMaleSampleCT; i++){
-                        gbuf->geno[keepMaleExtractIndex[i]] *= weight;
+                        geno[keepMaleExtractIndex[i]] *= weight;
                     }
                 }
             }
         }
         if(bMakeMiss){
-            gbuf->missing.resize(missPtrSize, 0);
+            memset(missing, 0, sizeof(uintptr_t) * missPtrSize);
         }
 
     }
 }
 
-void Geno::getGenoDouble_bed(uintptr_t *buf, int idx, GenoBufItem* gbuf){
+void Geno::getGenoDouble_bed(uintptr_t *buf, int idx, GenoBufItem* gbuf, double *geno, uintptr_t *missing){
     SNPInfo snpinfo;
     uintptr_t *cur_buf = buf + idx * bedRawGenoBuf1PtrSize;
     uint8_t isSexXY = isMarkersSexXYs[curBufferIndex];
@@ -974,21 +1044,16 @@ void Geno::getGenoDouble_bed(uintptr_t *buf, int idx, GenoBufItem* gbuf){
                 }
 
                 const double lookup[32] __attribute__ ((aligned (16))) = GET_TABLE16(a0, a1, a2, na);
-                gbuf->geno.resize(keepSampleCT);
-                uintptr_t * pmiss = NULL;
-                if(bMakeMiss){
-                    gbuf->missing.resize(missPtrSize); 
-                    pmiss = gbuf->missing.data();
-                }
-                PgenReader::ExtractDoubleExt(cur_buf, keepMaskPtr, rawSampleCT, keepSampleCT, lookup, gbuf->geno.data(), pmiss); 
+                uintptr_t * pmiss = bMakeMiss ? missing : NULL;
+                PgenReader::ExtractDoubleExt(cur_buf, keepMaskPtr, rawSampleCT, keepSampleCT, lookup, geno, pmiss); 
                 // adjust for chr X;
                 if(isSexXY == 1){
                     /* don't set to missing
                     if(!hasNoHET){
                         for(int i = 0 ; i < keepMaleSampleCT; i++){
                             uint32_t curMaleIndex = keepMaleExtractIndex[i];
-                            if(gbuf->geno[curMaleIndex] == a1){
-                                gbuf->geno[curMaleIndex] = na;
+                            if(geno[curMaleIndex] == a1){
+                                geno[curMaleIndex] = na;
                             }
                         }
                     }
@@ -999,14 +1064,14 @@ void Geno::getGenoDouble_bed(uintptr_t *buf, int idx, GenoBufItem* gbuf){
                     if(needWeight){
                         if(bGRM){
                             for(int i = 0 ; i < keepMaleSampleCT; i++){
-                                gbuf->geno[keepMaleExtractIndex[i]] *= weight;
+                                geno[keepMaleExtractIndex[i]] *= weight;
                             }
                         }else{
                             double correctWeight = (weight - 1) * rdev * center_value;
                             for(int i = 0 ; i < keepMaleSampleCT; i++){
                                 uint32_t curIndex = keepMaleExtractIndex[i];
-                                gbuf->geno[curIndex] *= weight;
-                                gbuf->geno[curIndex] += correctWeight;
+                                geno[curIndex] *= weight;
+                                geno[curIndex] += correctWeight;
                             }
                         }
                     }
@@ -1020,45 +1085,115 @@ void Geno::getGenoDouble_bed(uintptr_t *buf, int idx, GenoBufItem* gbuf){
     gbuf->valid = false;
 }
 
-void Geno::readGeno_bgen(const vector<uint32_t> &extractIndex){
-    const vector<uint32_t> raw_marker_index = marker->get_extract_index();
-    vector<uint32_t> rawIndices(extractIndex.size());
-    std::transform(extractIndex.begin(), extractIndex.end(), rawIndices.begin(), 
-            [&raw_marker_index](size_t pos){return raw_marker_index[pos];});
-
-    openGFiles();
-
-    uintptr_t *g_buf = NULL;
-    uint32_t numMarker = extractIndex.size();
-    uint32_t finishedMarker = 0;
-    uint32_t nextSize;
-    int fileIndex = 0;
-    bool chr_ends;
-    uint8_t isSexXY;
-    int curWriteBufIndex = 0;
-    while(finishedMarker != numMarker && (nextSize = marker->getNextSize(rawIndices, finishedMarker, numMarkerBlock,fileIndex, chr_ends, isSexXY)) != 0){
-        g_buf = asyncBuf64->start_write();
-        FILE *bgenFile = gFiles[fileIndex];
-        for(int i = 0; i < nextSize; i++){
-            int processIndex = finishedMarker + i;
-            int rawIndex = rawIndices[processIndex];
+void Geno::readGeno_bgen(int readerIndex, int numReader){
+    // own file handles, the readers seek independently
+    vector<FILE *> bgenFiles(geno_files.size(), NULL);
+#ifdef GCTA_DIRECT_IO
+    vector<std::unique_ptr<GenoDirectReader>> directReaders(geno_files.size());
+#endif
+    // variants [first, last) stored next to each other, read in one piece
+    struct ReadRun{
+        int first;
+        int last;
+        uint64_t pos;
+        uint64_t size;
+        uint64_t bufOffset;
+    };
+    vector<ReadRun> runs;
+    vector<uint8_t> runBuf;
+    int preFileIndex = -1;
+    uint64_t filePos = 0;
+    for(uint64_t blockIndex = readerIndex; blockIndex < readBlocks.size(); blockIndex += numReader){
+        const ReadBlock &block = readBlocks[blockIndex];
+        int fileIndex = block.fileIndex;
+#ifdef GCTA_DIRECT_IO
+        if(bDirectIO){
+            if(!directReaders[fileIndex]){
+                directReaders[fileIndex].reset(new GenoDirectReader(geno_files[fileIndex], ioDepth));
+            }
+        }else
+#endif
+        if(!bgenFiles[fileIndex]){
+            bgenFiles[fileIndex] = fopen(geno_files[fileIndex].c_str(), "rb");
+            if(!bgenFiles[fileIndex]){
+                LOGGER.e(0, "failed to open genotype [" + geno_files[fileIndex] + "], " + string(strerror(errno)));
+            }
+        }
+        if(fileIndex != preFileIndex){
+            // unknown position, seek at the first read
+            filePos = UINT64_MAX;
+            preFileIndex = fileIndex;
+        }
 
+        // merge the variants stored next to each other (small gaps of skipped variants included)
+        //   into one sequential read, then spread them to their slots
+        const uint32_t *rawIndices = readRawIndices.data() + block.start;
+        int nextSize = block.size;
+        uint64_t runBufSize = 0;
+        runs.clear();
+        for(int i = 0; i < nextSize; ){
             uint64_t pos, size;
-            marker->getStartPosSize(rawIndex, pos, size);
-            fseek(bgenFile, pos, SEEK_SET);
-            if(fread(g_buf, sizeof(char), size, bgenFile) != size){
-                int lag_index = rawIndex - baseIndexLookup[fileIndex];
-                LOGGER.e(0, "can't read " + to_string(lag_index) + "th SNP in [" + geno_files[fileIndex] + "].");
+            marker->getStartPosSize(rawIndices[i], pos, size);
+            uint64_t run_end = pos + size;
+            int j = i + 1;
+            for(; j < nextSize; j++){
+                uint64_t next_pos, next_size;
+                marker->getStartPosSize(rawIndices[j], next_pos, next_size);
+                if(next_pos < run_end || next_pos - run_end > maxBgenReadGap || 
+                        next_pos + next_size - pos > maxBgenReadRun){
+                    break;
+                }
+                run_end = next_pos + next_size;
+            }
+            ReadRun run = {i, j, pos, run_end - pos, runBufSize};
+            if(j - i > 1) runBufSize += run.size;
+            runs.push_back(run);
+            i = j;
+        }
+        if(runBuf.size() < runBufSize) runBuf.resize(runBufSize);
+
+        uint8_t *g_buf = (uint8_t *)asyncBuf64->start_write(blockIndex);
+        uint64_t slotSize = bgenRawGenoBuf1PtrSize * sizeof(uintptr_t);
+#ifdef GCTA_DIRECT_IO
+        if(bDirectIO){
+            // all the runs of the block are queued together
+            GenoDirectReader *reader = directReaders[fileIndex].get();
+            for(auto &run : runs){
+                uint8_t *run_buf = (run.last - run.first > 1) ? runBuf.data() + run.bufOffset : g_buf + run.first * slotSize;
+                reader->add(run.pos, run.size, run_buf);
+            }
+            if(!reader->submit_wait()){
+                LOGGER.e(0, "can't read the variants of block " + to_string(blockIndex) + " in [" + geno_files[fileIndex] + "].");
+            }
+        }else
+#endif
+        {
+            FILE *bgenFile = bgenFiles[fileIndex];
+            for(auto &run : runs){
+                uint8_t *run_buf = (run.last - run.first > 1) ? runBuf.data() + run.bufOffset : g_buf + run.first * slotSize;
+                if(run.pos != filePos){
+                    fseek(bgenFile, run.pos, SEEK_SET);
+                }
+                if(fread(run_buf, sizeof(char), run.size, bgenFile) != run.size){
+                    int lag_index = rawIndices[run.first] - baseIndexLookup[fileIndex];
+                    LOGGER.e(0, "can't read " + to_string(lag_index) + "th SNP in [" + geno_files[fileIndex] + "].");
+                }
+                filePos = run.pos + run.size;
             }
-            g_buf += bgenRawGenoBuf1PtrSize;
         }
 
-        finishedMarker += nextSize;
-        numMarkersReadBlocks[curWriteBufIndex] = nextSize;
-        isMarkersSexXYs[curWriteBufIndex] = isSexXY;
-        fileIndexBuf[curWriteBufIndex] = fileIndex;
-        asyncBuf64->end_write();
-        curWriteBufIndex = nextBufIndex(curWriteBufIndex);
+        for(auto &run : runs){
+            if(run.last - run.first == 1) continue;
+            for(int k = run.first; k < run.last; k++){
+                uint64_t cur_pos, cur_size;
+                marker->getStartPosSize(rawIndices[k], cur_pos, cur_size);
+                memcpy(g_buf + k * slotSize, runBuf.data() + run.bufOffset + (cur_pos - run.pos), cur_size);
+            }
+        }
+        endReadBlock(blockIndex);
+    }
+    for(auto bgenFile : bgenFiles){
+        if(bgenFile) fclose(bgenFile);
     }
 }
 
@@ -1094,6 +1229,38 @@ void Geno::setMaleWeight(double &weight, bool &needWeight){
     }
 }
 
+// decompression contexts of a thread, kept for all the variants it decodes
+struct BgenDecoder{
+    ZSTD_DCtx *zstd = NULL;
+    z_stream zlib;
+    bool bZlib = false;
+
+    ~BgenDecoder(){
+        if(zstd) ZSTD_freeDCtx(zstd);
+        if(bZlib) inflateEnd(&zlib);
+    }
+
+    bool inflateZlib(uint8_t *dest, uint32_t dest_size, uint8_t *src, uint32_t src_size){
+        if(!bZlib){
+            memset(&zlib, 0, sizeof(zlib));
+            if(inflateInit(&zlib) != Z_OK) return false;
+            bZlib = true;
+        }else if(inflateReset(&zlib) != Z_OK){
+            return false;
+        }
+        zlib.next_in = (Bytef *)src;
+        zlib.avail_in = src_size;
+        zlib.next_out = (Bytef *)dest;
+        zlib.avail_out = dest_size;
+        return inflate(&zlib, Z_FINISH) == Z_STREAM_END && zlib.total_out == dest_size;
+    }
+
+    size_t decompressZstd(uint8_t *dest, uint32_t dest_size, uint8_t *src, uint32_t src_size){
+        if(!zstd) zstd = ZSTD_createDCtx();
+        return ZSTD_decompressDCtx(zstd, dest, dest_size, src, src_size);
+    }
+};
+
 void calDosage_bgen(uint32_t prob1, uint32_t prob2, uint64_t &dosage, uint32_t &prob1d){
     prob1d = prob1 * 2;
     dosage = prob1d + prob2;
@@ -1105,7 +1272,72 @@ void calDosagePhase_bgen(uint32_t prob1, uint32_t prob2, uint64_t &dosage, uint3
 }
 
 
-void Geno::getGenoDouble_bgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
+// getGenoPacked reads the raw BED rows (stride, keep mask and sample count of preGenoDouble_bed);
+// the PGEN buffers are subset already and may carry dosages, so they take the double path
+bool Geno::isHardCall(){
+    return genoFormat == "BED";
+}
+
+// number of uintptr_t to hold the 2-bit genotypes of the kept samples, padded to 512 bit vectors
+uint32_t Geno::getGenoPackedPtrSize(){
+    return (pheno->count_keep() + 255) / 256 * 8;
+}
+
+// extract the 2-bit genotypes (0, 1, 2: count of effect allele; 3: missing) of the kept samples
+// return false if the marker has to be decoded by getGenoDouble:
+//   missing genotypes in kept samples, chrX, reversed effect allele or dominance GRM.
+// if true is returned, gbuf holds the frequency and the validity of the marker
+bool Geno::getGenoPacked(uintptr_t *buf, int idx, GenoBufItem* gbuf, uintptr_t *packed){
+    uintptr_t *cur_buf = buf + idx * bedRawGenoBuf1PtrSize;
+    uint32_t curExtractIndex = gbuf->extractedMarkerIndex;
+    if(bGRMDom || isMarkersSexXYs[curBufferIndex] == 1 || marker->isEffecRev(curExtractIndex)){
+        return false;
+    }
+
+    SNPInfo snpinfo;
+    PgenReader::CountHardFreqMissExt(cur_buf, keepMaskInterPtr, rawSampleCT, keepSampleCT, &snpinfo, f_std);
+    if(snpinfo.N != keepSampleCT){
+        return false;
+    }
+
+    gbuf->valid = false;
+    double af = snpinfo.af;
+    if(bHasPreAF){
+        af = AFA1[curExtractIndex];
+        snpinfo.mean = 2 * af;
+        snpinfo.std = 2 * af * (1.0 - af); 
+    }
+    double maf = std::min(af, 1.0 - af);
+    if(maf >= min_maf && maf <= max_maf && snpinfo.nMissRate >= dFilterMiss){
+        gbuf->af = af;
+        gbuf->nValidN = snpinfo.N;
+        gbuf->nValidAllele = snpinfo.AlCount;
+        gbuf->mean = bGRM ? 2.0 * af : snpinfo.mean;
+        gbuf->sd = f_std ? snpinfo.std : gbuf->mean * (1.0 - af);
+        if(gbuf->sd < 1.0e-50){
+            return true;
+        }
+        gbuf->valid = true;
+
+        uint32_t numPtr = (keepSampleCT + 31) / 32;
+        if(rawSampleCT == keepSampleCT){
+            memcpy(packed, cur_buf, sizeof(uintptr_t) * numPtr);
+        }else{
+            PgenReader::ExtractGenoExt(cur_buf, keepMaskPtr, rawSampleCT, keepSampleCT, packed);
+        }
+        uint32_t remain = keepSampleCT % 32;
+        if(remain){
+            packed[numPtr - 1] &= (((uintptr_t)1) << (2 * remain)) - 1;
+        }
+        uint32_t padSize = (keepSampleCT + 63) / 64 * 2;
+        for(uint32_t i = numPtr; i < padSize; i++){
+            packed[i] = 0;
+        }
+    }
+    return true;
+}
+
+void Geno::getGenoDouble_bgen(uintptr_t *buf, int idx, GenoBufItem* gbuf, double *geno, uintptr_t *missing){
     SNPInfo snpinfo;
     uintptr_t *cur_buf = buf + idx * bgenRawGenoBuf1PtrSize;
     // skip the header
@@ -1152,14 +1384,19 @@ void Geno::getGenoDouble_bgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
     }
 
     string error_promp = to_string(gbuf->extractedMarkerIndex) + "th SNP of [" + geno_files[fileIndex] + "]."; 
+    // scratch of the thread, grows to the largest variant and is kept for the later calls
+    static thread_local vector<uint8_t> dec_buf;
+    static thread_local vector<uint32_t> dosages;
+    static thread_local vector<uint32_t> miss_index;
+    static thread_local vector<double> dos_lookup;
+    static thread_local BgenDecoder decoder;
     uint8_t *dec_data;
     if(compressFormat != 0){
-        dec_data = new uint8_t[len_decomp + 8];
+        if(dec_buf.size() < len_decomp + 8) dec_buf.resize(len_decomp + 8);
+        dec_data = dec_buf.data();
         uint32_t curCompSize = len_comp;
         if(compressFormat == 1){
-            uint32_t Ldecomp = len_decomp;
-            int z_result = uncompress((Bytef*)dec_data, (uLongf*)&Ldecomp, (Bytef*)curbuf, curCompSize);
-            if(z_result != Z_OK || len_decomp != Ldecomp){
+            if(!decoder.inflateZlib(dec_data, len_decomp, curbuf, curCompSize)){
                 LOGGER.e(0, "decompressing genotype data error in " + error_promp); 
             }
         }else if(compressFormat == 2){
@@ -1176,7 +1413,7 @@ void Geno::getGenoDouble_bgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
             if(rSize != len_decomp){
                 LOGGER.e(0, "size stated in the compressed file is different from " + error_promp);
             }
-            size_t const dSize = ZSTD_decompress((void *)dec_data, len_decomp, (void*)curbuf, curCompSize); 
+            size_t const dSize = decoder.decompressZstd(dec_data, len_decomp, curbuf, curCompSize); 
 
             if(ZSTD_isError(dSize)){
                 LOGGER.e(0, "decompressing genotype error: " + string(ZSTD_getErrorName(dSize)) + " in " + error_promp);
@@ -1218,7 +1455,7 @@ void Geno::getGenoDouble_bgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
     }
 
     uint8_t double_bits_prob = bits_prob * 2;
-    vector<uint32_t> miss_index;
+    miss_index.clear();
 
     uint8_t isSexXY = isMarkersSexXYs[curBufferIndex];
 
@@ -1226,7 +1463,7 @@ void Geno::getGenoDouble_bgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
     uint64_t dosage_sum = 0, fij_sum = 0, dosage2_sum = 0;
     uint32_t validN = 0;
     uint32_t validAllele = 0;
-    vector<uint32_t> dosages(keepSampleCT);
+    dosages.resize(keepSampleCT);
     uint32_t max_dos = mask * 2 + 1;
     bool has_miss = false;
 
@@ -1243,7 +1480,8 @@ void Geno::getGenoDouble_bgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
         uint32_t sindex = (*curSampleIndexPtr)[j];
         uint8_t item_ploidy = sample_ploidy[sindex];
         if(item_ploidy > 128){
-            miss_index.push_back(sindex);
+            // bit position in the kept samples
+            miss_index.push_back(j);
             has_miss = true;
             dosages[j] = max_dos;
         }else if(item_ploidy == 2){
@@ -1310,11 +1548,6 @@ void Geno::getGenoDouble_bgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
     }
 
 
-    if(compressFormat != 0){
-        delete[] dec_data;
-    }
-
-
     double maskd = (double)mask;
     double af = (double)dosage_sum_half / maskd / validAllele;
     double mean;
@@ -1371,7 +1604,7 @@ void Geno::getGenoDouble_bgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
                     return;
                 }
 
-                double* dos_lookup = new double[max_dos + 2];
+                dos_lookup.resize(max_dos + 2);
                 double center_value = 0.0;
                 double rdev = 1.0;
                 if(!bGRMDom){
@@ -1419,11 +1652,9 @@ void Geno::getGenoDouble_bgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
                     dos_lookup[max_dos] = (dosna - center_value) * rdev;
                 }
 
-                gbuf->geno.resize(curSampleCT);
                 for(int j = 0; j < curSampleCT; j++){
-                    gbuf->geno[j] = dos_lookup[dosages[j]];
+                    geno[j] = dos_lookup[dosages[j]];
                 }
-                delete[] dos_lookup;
                 // adjust for chr X;
                 if(isSexXY == 1){
                     double weight;
@@ -1432,14 +1663,14 @@ void Geno::getGenoDouble_bgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
                     if(needWeight){
                         if(bGRM){
                             for(int i = 0 ; i < keepMaleSampleCT; i++){
-                                gbuf->geno[keepMaleExtractIndex[i]] *= weight;
+                                geno[keepMaleExtractIndex[i]] *= weight;
                             }
                         }else{
                             double correctWeight = (weight - 1) * rdev * center_value;
                             for(int i = 0 ; i < keepMaleSampleCT; i++){
                                 uint32_t curIndex = keepMaleExtractIndex[i];
-                                gbuf->geno[curIndex] *= weight;
-                                gbuf->geno[curIndex] += correctWeight;
+                                geno[curIndex] *= weight;
+                                geno[curIndex] += correctWeight;
                             }
  
                         }
@@ -1447,11 +1678,11 @@ void Geno::getGenoDouble_bgen(uintptr_t *buf, int idx, GenoBufItem* gbuf){
                 }
             }
             if(bMakeMiss){
-                gbuf->missing.resize(missPtrSize, 0); 
+                memset(missing, 0, sizeof(uintptr_t) * missPtrSize);
                 const int ptrsize = sizeof(uintptr_t) * CHAR_BIT;
                 for(int j = 0; j < miss_index.size(); j++){
                     int cur_index = miss_index[j];
-                    gbuf->missing[cur_index / ptrsize] |= (1UL << (cur_index % ptrsize));
+                    missing[cur_index / ptrsize] |= (1UL << (cur_index % ptrsize));
                 }
             }
             return;
@@ -1479,6 +1710,7 @@ void Geno::endGenoDouble_bed(){
 
 void Geno::endGenoDouble(){
     (this->*endGenoDoubleFuncs[genoFormat])();
+    freeGenoSlabs();
 }
 
 
@@ -1497,8 +1729,14 @@ bool Geno::getGenoHasInfo(){
 void Geno::loopDouble(const vector<uint32_t> &extractIndex, int numMarkerBuf, bool bMakeGeno, bool bGenoCenter, bool bGenoStd, bool bMakeMiss, vector<function<void (uintptr_t *buf, const vector<uint32_t> &exIndex)>> callbacks, bool showLog){
    
     preGenoDouble(numMarkerBuf, bMakeGeno, bGenoCenter, bGenoStd, bMakeMiss);
-    thread read_thread([this, &extractIndex](){this->readGeno(extractIndex);});
-    read_thread.detach();
+    // the blocks are dealt round robin to the readers, so several files or several parts of one file
+    //   are read at the same time; the ring still hands them to the callbacks in extract order
+    initReadBlocks(extractIndex);
+    int numReader = std::min((uint64_t)numReadThreads, (uint64_t)readBlocks.size());
+    vector<thread> read_threads;
+    for(int i = 0; i < numReader; i++){
+        read_threads.emplace_back([this, i, numReader](){this->readGeno(i, numReader);});
+    }
     // main loop
     
     LOGGER.ts("LOOP_GENO_PRE");
@@ -1557,6 +1795,16 @@ void Geno::loopDouble(const vector<uint32_t> &extractIndex, int numMarkerBuf, bo
         ss << std::fixed << std::setprecision(1) << "100% finished in " << LOGGER.tp("LOOP_GENO_TOT") << " sec";
         LOGGER.i(1, ss.str());
         LOGGER << nFinishedMarker << " SNPs have been processed." << std::endl;
+        // reader waits mean the genotype reading can't keep up, more --read-ahead or faster storage helps
+        std::ostringstream ss_wait;
+        ss_wait << std::fixed << std::setprecision(1) << "Read-ahead of " << numBufSlots << " blocks: the reading waited "
+            << asyncBuf64->producer_waits() << " times (" << asyncBuf64->producer_wait_us() / 1e6 << " sec) for the computing, "
+            << "the computing waited " << asyncBuf64->consumer_waits() << " times (" << asyncBuf64->consumer_wait_us() / 1e6
+            << " sec) for the reading.";
+        LOGGER.i(1, ss_wait.str());
+    }
+    for(auto &read_thread : read_threads){
+        read_thread.join();
     }
     endGenoDouble();
 }
@@ -3551,6 +3799,21 @@ int Geno::registerOption(map<string, vector<string>>& options_in) {
     }
 
     addOneValOption<double>("info_score", "--info", options_in, options_d, 0.0, 0.0, 1.0);
+    // number of genotype blocks held in the read-ahead ring
+    addOneValOption<double>("read_ahead", "--read-ahead", options_in, options_d, 3.0, 2.0, 1024.0);
+    // number of threads reading the genotype blocks
+    if(options_in.find("--read-threads") != options_in.end()){
+        addOneValOption<double>("read_threads", "--read-threads", options_in, options_d, 1.0, 1.0, 64.0);
+    }
+    // O_DIRECT reads by io_uring, the queue depth of each reader thread
+    if(options_in.find("--direct-io") != options_in.end()){
+#ifdef GCTA_DIRECT_IO
+        options["direct_io"] = "yes";
+#else
+        LOGGER.w(0, "--direct-io is only supported on Linux, the genotypes are read through the page cache.");
+#endif
+    }
+    addOneValOption<double>("io_depth", "--io-depth", options_in, options_d, 32.0, 1.0, 4096.0);
     addOneValOption<double>("dos_dc", "--dc", options_in, options_d, -1.0, -1.0, 1.0);
 
 
@@ -3932,8 +4195,10 @@ void Geno::recode_func(uintptr_t* genobuf, const vector<uint32_t> &markerIndex){
         uint32_t cur_marker = markerIndex[i];
         GenoBufItem item;
         item.extractedMarkerIndex = cur_marker;
+        double *geno_slab = getGenoSlab();
+        uintptr_t *miss_slab = getMissSlab();
 
-        getGenoDouble(genobuf, i, &item);
+        getGenoDouble(genobuf, i, &item, geno_slab, miss_slab);
 
         #pragma omp ordered
         {
@@ -3944,10 +4209,10 @@ void Geno::recode_func(uintptr_t* genobuf, const vector<uint32_t> &markerIndex){
                 if(hasInfo) osOut << "\t" << item.info;
                 for(int j = 0; j < keepSampleCT; j++){
                     osOut << "\t";
-                    if(bRecodeSaveMiss && (item.missing[j/64] & (1UL << (j %64)))){
+                    if(bRecodeSaveMiss && (miss_slab[j/64] & (1UL << (j %64)))){
                         osOut << "NA";
                     }else{
-                        osOut << item.geno[j];
+                        osOut << geno_slab[j];
                     }
                 }
                 osOut << "\n";
@@ -0,0 +1,259 @@
+/*
+   GCTA: a tool for Genome-wide Complex Trait Analysis
+
+   Direct reader of the genotype files: reads around the page cache (O_DIRECT),
+   submitted in batches by io_uring.
+
+   This file is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   A copy of the GNU General Public License is attached along with this program.
+   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "GenoIO.h"
+
+#ifdef GCTA_DIRECT_IO
+#include "Logger.h"
+#include "mem.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// io_uring by the raw system calls, no liburing needed; IORING_OP_READ came with the 5.6 headers,
+// which are told by IORING_FEAT_RW_CUR_POS (the 5.1 - 5.5 headers have the system calls only)
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#include <linux/io_uring.h>
+#ifdef IORING_FEAT_RW_CUR_POS
+#define GCTA_IO_URING
+#endif
+#endif
+
+GenoDirectReader::GenoDirectReader(const string &file_name, int queueDepth){
+    this->file_name = file_name;
+    this->queueDepth = queueDepth < 1 ? 1 : queueDepth;
+#ifdef O_DIRECT
+    fd = open(file_name.c_str(), O_RDONLY | O_DIRECT);
+    if(fd != -1){
+        bDirect = true;
+    }else if(errno != EINVAL){
+        LOGGER.e(0, "failed to open genotype [" + file_name + "], " + string(strerror(errno)));
+    }
+#endif
+    if(fd == -1){
+        // tmpfs and some network file systems don't take O_DIRECT
+        fd = open(file_name.c_str(), O_RDONLY);
+        if(fd == -1){
+            LOGGER.e(0, "failed to open genotype [" + file_name + "], " + string(strerror(errno)));
+        }
+    }
+    initUring();
+}
+
+GenoDirectReader::~GenoDirectReader(){
+    closeUring();
+    if(fd != -1) close(fd);
+    for(auto buf : bounceBufs){
+        if(buf) posix_mem_free(buf);
+    }
+}
+
+void GenoDirectReader::add(uint64_t pos, uint64_t size, uint8_t *dest){
+    Request req;
+    req.pos = pos;
+    req.size = size;
+    req.dest = dest;
+    req.done = false;
+    if(bDirect){
+        req.readPos = pos / alignSize * alignSize;
+        req.readSize = (pos + size - req.readPos + alignSize - 1) / alignSize * alignSize;
+        size_t index = requests.size();
+        if(index >= bounceBufs.size()){
+            bounceBufs.resize(index + 1, NULL);
+            bounceSizes.resize(index + 1, 0);
+        }
+        if(bounceSizes[index] < req.readSize){
+            if(bounceBufs[index]) posix_mem_free(bounceBufs[index]);
+            if(posix_memalign((void **)&bounceBufs[index], alignSize, req.readSize) != 0){
+                bounceBufs[index] = NULL;
+                bounceSizes[index] = 0;
+                LOGGER.e(0, "can't allocate enough memory to read genotype.");
+            }
+            bounceSizes[index] = req.readSize;
+        }
+        req.buf = bounceBufs[index];
+    }else{
+        req.readPos = pos;
+        req.readSize = size;
+        req.buf = dest;
+    }
+    requests.push_back(req);
+}
+
+bool GenoDirectReader::submit_wait(){
+    bool status = true;
+    if(is_uring() && !readUring()){
+        closeUring();
+    }
+    for(auto &req : requests){
+        if(!req.done && !readSync(req)){
+            status = false;
+            break;
+        }
+        if(req.buf != req.dest){
+            memcpy(req.dest, req.buf + (req.pos - req.readPos), req.size);
+        }
+    }
+    requests.clear();
+    return status;
+}
+
+// the rest of a request, also the short reads left by io_uring
+bool GenoDirectReader::readSync(Request &req){
+    uint64_t need = req.pos + req.size - req.readPos;
+    uint64_t finished = 0;
+    while(finished < need){
+        ssize_t ret = pread(fd, req.buf + finished, req.readSize - finished, req.readPos + finished);
+        if(ret < 0 && errno == EINTR) continue;
+        if(ret <= 0) return false;
+        finished += ret;
+        // O_DIRECT reads have to continue from an aligned offset
+        if(bDirect && finished < need && finished % alignSize != 0){
+            finished = finished / alignSize * alignSize;
+        }
+    }
+    req.done = true;
+    return true;
+}
+
+#ifdef GCTA_IO_URING
+
+void GenoDirectReader::initUring(){
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ret = syscall(__NR_io_uring_setup, queueDepth, &params);
+    if(ret < 0) return;
+    ring_fd = ret;
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if(sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED){
+        closeUring();
+        return;
+    }
+    // the kernel may round the depth up
+    queueDepth = params.sq_entries;
+
+    uint8_t *sq = (uint8_t *)sq_ring;
+    sq_head = (unsigned *)(sq + params.sq_off.head);
+    sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    sq_array = (unsigned *)(sq + params.sq_off.array);
+    uint8_t *cq = (uint8_t *)cq_ring;
+    cq_head = (unsigned *)(cq + params.cq_off.head);
+    cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    cqes = cq + params.cq_off.cqes;
+}
+
+void GenoDirectReader::closeUring(){
+    if(sq_ring && sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+    if(cq_ring && cq_ring != MAP_FAILED) munmap(cq_ring, cq_ring_size);
+    if(sqes && sqes != MAP_FAILED) munmap(sqes, sqes_size);
+    sq_ring = cq_ring = sqes = NULL;
+    if(ring_fd >= 0) close(ring_fd);
+    ring_fd = -1;
+}
+
+// keeps queueDepth reads in flight; the requests failed or read short are left to readSync
+bool GenoDirectReader::readUring(){
+    struct io_uring_sqe *sqe_array = (struct io_uring_sqe *)sqes;
+    struct io_uring_cqe *cqe_array = (struct io_uring_cqe *)cqes;
+    uint64_t numRequest = requests.size();
+    uint64_t submitted = 0, completed = 0;
+    bool unsupported = false;
+    while(completed < numRequest){
+        unsigned tail = *sq_tail;
+        while(submitted < numRequest && submitted - completed < (uint64_t)queueDepth){
+            Request &req = requests[submitted];
+            unsigned index = tail & *sq_mask;
+            struct io_uring_sqe *sqe = &sqe_array[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = fd;
+            sqe->off = req.readPos;
+            sqe->addr = (uint64_t)(uintptr_t)req.buf;
+            sqe->len = req.readSize;
+            sqe->user_data = submitted;
+            sq_array[index] = index;
+            tail++;
+            submitted++;
+        }
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+        unsigned to_submit = tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        int ret = syscall(__NR_io_uring_enter, ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY){
+            drainUring(submitted - (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE)) - completed);
+            return false;
+        }
+
+        unsigned head = *cq_head;
+        while(head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)){
+            struct io_uring_cqe *cqe = &cqe_array[head & *cq_mask];
+            Request &req = requests[cqe->user_data];
+            if(cqe->res >= 0 && (uint64_t)cqe->res >= req.pos + req.size - req.readPos){
+                req.done = true;
+            }else if(cqe->res == -EINVAL){
+                // IORING_OP_READ needs kernel 5.6
+                unsupported = true;
+            }
+            head++;
+            completed++;
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+    return !unsupported;
+}
+
+// wait for the reads taken by the kernel to complete, before readSync reuses their buffers
+void GenoDirectReader::drainUring(uint64_t numInflight){
+    unsigned head = *cq_head;
+    while(numInflight > 0){
+        while(numInflight > 0 && head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)){
+            head++;
+            numInflight--;
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        if(numInflight == 0) break;
+        int ret = syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY){
+            LOGGER.e(0, "failed to wait for the reads of genotype [" + file_name + "], " + string(strerror(errno)));
+        }
+    }
+}
+
+#else
+
+void GenoDirectReader::initUring(){}
+
+void GenoDirectReader::drainUring(uint64_t numInflight){}
+
+void GenoDirectReader::closeUring(){}
+
+bool GenoDirectReader::readUring(){
+    return false;
+}
+
+#endif
+
+#endif //GCTA_DIRECT_IO
@@ -9,10 +9,17 @@
 #include <omp.h>
 #include "cpu_f77blas.h"
 #include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <cmath>
 #include <algorithm>
+#include "mem.hpp"
+#include "zlib.h"
+#include "zstd.h"
 
 map<string, string> LD::options;
 map<string, int> LD::options_i;
+map<string, double> LD::options_d;
 vector<string> LD::processFunctions;
 bool LD::chr_ends = false;
 unique_ptr<double[]> LD::geno_buffer[2];
@@ -20,6 +27,23 @@ int LD::cur_buffer = 0;
 uint64_t LD::cur_buffer_offset[2] = {0, 0};
 uint32_t LD::num_indi = 0;
 
+// markers of each block in the .zld file
+static const uint32_t ld_block_marker = 64;
+
+// the 4-byte words go into 4 byte planes: the high bytes of the LD values are much alike,
+// so zstd compresses the planes far better than the interleaved words
+static void shuffle_words(const char *in, char *out, uint64_t num_word){
+    for(uint64_t i = 0; i < num_word; i++){
+        for(int k = 0; k < 4; k++) out[k * num_word + i] = in[i * 4 + k];
+    }
+}
+
+static void unshuffle_words(const char *in, char *out, uint64_t num_word){
+    for(uint64_t i = 0; i < num_word; i++){
+        for(int k = 0; k < 4; k++) out[i * 4 + k] = in[k * num_word + i];
+    }
+}
+
 LD::LD(Geno * geno){
     this->geno = geno;
     num_indi = geno->pheno->count_keep();
@@ -30,13 +54,58 @@ LD::LD(Geno * geno){
         is_r2 = true;
     }
 
-    h_ld = fopen(options["out"].c_str(), "wb");
-    if(!h_ld){
-        LOGGER.e(0, "can't open " + options["out"] + " for writing.");
+    uint32_t num_marker = geno->marker->count_extract();
+    vector<string> marker_info(num_marker);
+    for(uint32_t i = 0; i < num_marker; i++){
+        marker_info[i] = geno->marker->getMarkerStrExtract(i);
     }
+    writer.reset(new LDWriter(options["out"], marker_info, is_r2, ld_window, options_d["error_bound"]));
 }
 
 LD::~LD(){
+}
+
+LDWriter::LDWriter(const string &file, const vector<string> &marker_info, bool is_r2, uint32_t window, double error_bound){
+    this->file = file;
+    h_ld = fopen(file.c_str(), "wb");
+    if(!h_ld){
+        LOGGER.e(0, "can't open " + file + " for writing.");
+    }
+
+    uint32_t num_marker = marker_info.size();
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "ZLD", 3);
+    header.version = 1;
+    header.valueType = is_r2 ? 1 : 0;
+    header.matrixType = 0;
+    header.numMarker = num_marker;
+    header.compressType = error_bound > 0 ? 1 : 0;
+    header.order = 1;
+    header.window = window;
+    header.markerInfoStart = 256;
+    header.blockMarker = ld_block_marker;
+    header.numBlock = (num_marker + ld_block_marker - 1) / ld_block_marker;
+    header.errorBound = error_bound;
+
+    string info;
+    for(uint32_t i = 0; i < num_marker; i++){
+        info += marker_info[i] + "\n";
+    }
+    marker_info_crc = crc32(0, (const Bytef *)info.data(), info.size());
+    header.LDInfoStart = header.markerInfoStart + info.size();
+    cur_byte = header.LDInfoStart + (uint64_t)header.numBlock * sizeof(LDInfoStart);
+    data_crc = crc32(0, Z_NULL, 0);
+
+    // the header and the block index are written by finish
+    char zeros[256] = {0};
+    if(fwrite(zeros, 1, 256, h_ld) != 256 || 
+            fwrite(info.data(), 1, info.size(), h_ld) != info.size() ||
+            fseeko(h_ld, cur_byte, SEEK_SET) != 0){
+        LOGGER.e(0, "can't write to " + file + ".");
+    }
+}
+
+LDWriter::~LDWriter(){
     fclose(h_ld);
 }
 
@@ -101,13 +170,7 @@ void LD::calcLD(){
             double* temp_ptr = res1 + i + i * nc1;
             std::transform(temp_ptr, temp_ptr + cur_size, buffer, static_cast_func<float>());
         }
-        // write to file
-        if(fwrite(&cur_size, sizeof(uint32_t), 1, h_ld) != 1){
-            LOGGER.e(0, "can't write to " + options["out"] + ".");
-        }
-        if(fwrite(buffer, sizeof(float), cur_size, h_ld) != cur_size){
-            LOGGER.e(0, "can't write to " + options["out"] + ".");
-        }
+        writer->writeRow(buffer, cur_size);
         delete[] buffer;
         cur_process_marker_index++;
     }
@@ -119,7 +182,87 @@ void LD::calcLD(){
         delete[] res2;
     }
     geno_buffer[cacl_index_buffer].reset(nullptr);
-    fflush(h_ld);
+}
+
+void LDWriter::writeRow(const float *values, uint32_t size){
+    num_row++;
+    block_rel.push_back(size);
+    block_values.insert(block_values.end(), values, values + size);
+    if(block_rel.size() == header.blockMarker){
+        writeBlock();
+    }
+}
+
+void LDWriter::writeBlock(){
+    if(block_rel.empty()) return;
+    uint64_t num_rel = block_rel.size();
+    uint64_t num_value = block_values.size();
+    uint64_t num_word = num_rel + num_value;
+    vector<char> raw(num_word * 4), shuffled(num_word * 4);
+    memcpy(raw.data(), block_rel.data(), num_rel * 4);
+    if(header.compressType == 1){
+        // the nearest multiple of 2 * errorBound, INT32_MIN for NaN
+        double step = 2.0 * header.errorBound;
+        int32_t *quant = (int32_t *)(raw.data() + num_rel * 4);
+        for(uint64_t i = 0; i < num_value; i++){
+            float value = block_values[i];
+            quant[i] = std::isfinite(value) ? (int32_t)std::lround(value / step) : INT32_MIN;
+        }
+    }else{
+        memcpy(raw.data() + num_rel * 4, block_values.data(), num_value * 4);
+    }
+    shuffle_words(raw.data(), shuffled.data(), num_word);
+
+    size_t bound = ZSTD_compressBound(shuffled.size());
+    vector<char> comp(bound);
+    size_t comp_size = ZSTD_compress(comp.data(), bound, shuffled.data(), shuffled.size(), 3);
+    if(ZSTD_isError(comp_size)){
+        LOGGER.e(0, "failed to compress the LD matrix: " + string(ZSTD_getErrorName(comp_size)) + ".");
+    }
+
+    LDInfoStart info;
+    memset(&info, 0, sizeof(info));
+    info.startIndex = block_index.size() * header.blockMarker;
+    info.numMarker = num_rel;
+    info.startByte = cur_byte;
+    info.compressSize = comp_size;
+    info.decompressSize = shuffled.size();
+    info.blockCRC = crc32(0, (const Bytef *)comp.data(), comp_size);
+    if(fwrite(comp.data(), 1, comp_size, h_ld) != comp_size){
+        LOGGER.e(0, "can't write to " + file + ".");
+    }
+    data_crc = crc32_combine(data_crc, info.blockCRC, comp_size);
+    cur_byte += comp_size;
+    block_index.push_back(info);
+
+    block_rel.clear();
+    block_values.clear();
+}
+
+void LD::finishLD(){
+    writer->finish();
+}
+
+void LDWriter::finish(){
+    writeBlock();
+    if(num_row != header.numMarker){
+        LOGGER.e(0, "the LD matrix of " + to_string(num_row) + " markers is generated, "
+                + to_string(header.numMarker) + " markers expected.");
+    }
+    header.fileSize = cur_byte;
+    uint64_t index_bytes = block_index.size() * sizeof(LDInfoStart);
+    uint32_t index_crc = crc32(0, (const Bytef *)block_index.data(), index_bytes);
+    uint32_t crc = crc32_combine(marker_info_crc, index_crc, index_bytes);
+    header.resourceCRC = crc32_combine(crc, data_crc, cur_byte - header.LDInfoStart - index_bytes);
+    header.headerCRC = crc32(0, (const Bytef *)&header, offsetof(LDHeader, headerCRC));
+
+    if(fseeko(h_ld, header.LDInfoStart, SEEK_SET) != 0 ||
+            fwrite(block_index.data(), 1, index_bytes, h_ld) != index_bytes ||
+            fseeko(h_ld, 0, SEEK_SET) != 0 ||
+            fwrite(&header, sizeof(header), 1, h_ld) != 1 ||
+            fflush(h_ld) != 0){
+        LOGGER.e(0, "can't write to " + file + ".");
+    }
 }
 
 void LD::readGeno(uint64_t *buf, int num_marker){
@@ -174,6 +317,24 @@ int LD::registerOption(map<string, vector<string>>& options_in){
         options_in.erase(curFlag);
     }
 
+    // lossy compression of the LD values to a maximum absolute error, lossless by default
+    options_d["error_bound"] = 0;
+    curFlag = "--ld-error-bound";
+    if(options_in.find(curFlag) != options_in.end()){
+        if(options_in[curFlag].size() == 1){
+            try{
+                options_d["error_bound"] = std::stod(options_in[curFlag][0]);
+            }catch(std::invalid_argument&){
+                LOGGER.e(0, "LD error bound is not a number.");
+            }
+            if(options_d["error_bound"] < 1e-7 || options_d["error_bound"] > 0.5){
+                LOGGER.e(0, "LD error bound should be within 1e-7 to 0.5, omit " + curFlag + " for the lossless compression.");
+            }
+        }else{
+            LOGGER.e(0, curFlag + " takes one value.");
+        }
+        options_in.erase(curFlag);
+    }
 
     return ret_val;
 }
@@ -219,7 +380,150 @@ void LD::processMain(){
             if(geno_buffer[cur_buffer]){
                 ld.calcLD();
             }
+            ld.finishLD();
+            LOGGER.i(0, "The LD matrix has been saved in [" + options["out"] + "].");
+        }
+    }
+}
+
+
+LDReader::LDReader(const string &file){
+    this->file = file;
+    data = (const char *)map_file_read(file.c_str(), data_bytes);
+    if(!data){
+        LOGGER.e(0, "can't open " + file + " for reading.");
+    }
+    if(data_bytes < sizeof(header) || memcmp(data, "ZLD", 3) != 0){
+        LOGGER.e(0, file + " is not an LD matrix generated by --ld-matrix.");
+    }
+    memcpy(&header, data, sizeof(header));
+    if(header.version != 1){
+        LOGGER.e(0, file + " is in an old LD matrix format, please generate it again by --ld-matrix.");
+    }
+    if(crc32(0, (const Bytef *)&header, offsetof(LDHeader, headerCRC)) != header.headerCRC){
+        LOGGER.e(0, "the header of " + file + " is corrupted.");
+    }
+    if(data_bytes != header.fileSize){
+        LOGGER.e(0, file + " is truncated.");
+    }
+
+    uint64_t index_bytes = (uint64_t)header.numBlock * sizeof(LDInfoStart);
+    if(header.markerInfoStart > header.LDInfoStart || header.LDInfoStart + index_bytes > data_bytes){
+        LOGGER.e(0, "can't read " + file + ".");
+    }
+    string info(data + header.markerInfoStart, header.LDInfoStart - header.markerInfoStart);
+    blocks.resize(header.numBlock);
+    memcpy(blocks.data(), data + header.LDInfoStart, index_bytes);
+
+    marker_info.reserve(header.numMarker);
+    marker_name.reserve(header.numMarker);
+    size_t pos = 0;
+    while(pos < info.size()){
+        size_t end = info.find('\n', pos);
+        if(end == string::npos) end = info.size();
+        marker_info.push_back(info.substr(pos, end - pos));
+        size_t name_start = info.find('\t', pos) + 1;
+        size_t name_end = info.find('\t', name_start);
+        if(name_start == 0 || name_end == string::npos || name_end > end){
+            LOGGER.e(0, "the marker information in " + file + " is corrupted.");
+        }
+        marker_name.push_back(info.substr(name_start, name_end - name_start));
+        pos = end + 1;
+    }
+    if(marker_info.size() != header.numMarker){
+        LOGGER.e(0, "the marker information in " + file + " is corrupted.");
+    }
+    marker_index.build(marker_name);
+}
+
+LDReader::~LDReader(){
+    unmap_file((void *)data, data_bytes);
+}
+
+uint32_t LDReader::count() const{
+    return header.numMarker;
+}
+
+bool LDReader::isR2() const{
+    return header.valueType == 1;
+}
+
+uint32_t LDReader::getWindow() const{
+    return header.window;
+}
+
+const string& LDReader::getMarkerInfo(uint32_t index) const{
+    return marker_info[index];
+}
+
+const string& LDReader::getMarkerName(uint32_t index) const{
+    return marker_name[index];
+}
+
+int64_t LDReader::findMarker(const string &name) const{
+    return marker_index.find(name);
+}
+
+uint32_t LDReader::getRow(uint32_t index, vector<float> &values){
+    if(index >= header.numMarker){
+        LOGGER.e(0, "marker " + to_string(index) + " is out of the LD matrix " + file + ".");
+    }
+    uint32_t block = index / header.blockMarker;
+    if(block != cur_block){
+        readBlock(block);
+    }
+    uint32_t row = index - block * header.blockMarker;
+    values.assign(cur_values.begin() + cur_row_start[row], cur_values.begin() + cur_row_start[row + 1]);
+    return values.size();
+}
+
+void LDReader::readBlock(uint32_t block){
+    const LDInfoStart &info = blocks[block];
+    vector<char> shuffled(info.decompressSize), raw(info.decompressSize);
+    if(info.startByte + info.compressSize > data_bytes){
+        LOGGER.e(0, "can't read " + file + ".");
+    }
+    const char *comp = data + info.startByte;
+    if(crc32(0, (const Bytef *)comp, info.compressSize) != info.blockCRC){
+        LOGGER.e(0, "block " + to_string(block) + " of " + file + " is corrupted.");
+    }
+    size_t size = ZSTD_decompress(shuffled.data(), shuffled.size(), comp, info.compressSize);
+    if(ZSTD_isError(size) || size != info.decompressSize || size % 4 != 0 || size / 4 < info.numMarker){
+        LOGGER.e(0, "block " + to_string(block) + " of " + file + " is corrupted.");
+    }
+    uint64_t num_word = size / 4;
+    unshuffle_words(shuffled.data(), raw.data(), num_word);
+
+    const uint32_t *rel = (const uint32_t *)raw.data();
+    cur_row_start.resize(info.numMarker + 1);
+    cur_row_start[0] = 0;
+    for(uint32_t i = 0; i < info.numMarker; i++){
+        cur_row_start[i + 1] = cur_row_start[i] + rel[i];
+    }
+    uint64_t num_value = num_word - info.numMarker;
+    if(cur_row_start[info.numMarker] != num_value){
+        LOGGER.e(0, "block " + to_string(block) + " of " + file + " is corrupted.");
+    }
+    cur_values.resize(num_value);
+    if(header.compressType == 1){
+        double step = 2.0 * header.errorBound;
+        const int32_t *quant = (const int32_t *)(raw.data() + info.numMarker * 4);
+        for(uint64_t i = 0; i < num_value; i++){
+            cur_values[i] = quant[i] == INT32_MIN ? nanf("") : (float)(quant[i] * step);
         }
+    }else{
+        memcpy(cur_values.data(), raw.data() + info.numMarker * 4, num_value * 4);
     }
+    cur_block = block;
 }
 
+bool LDReader::verify(){
+    // crc32 takes the length in uInt
+    uint64_t chunk = 64 * 1024 * 1024;
+    uLong crc = crc32(0, Z_NULL, 0);
+    for(uint64_t pos = header.markerInfoStart; pos < header.fileSize; pos += chunk){
+        uint64_t size = std::min(chunk, header.fileSize - pos);
+        crc = crc32(crc, (const Bytef *)data + pos, size);
+    }
+    return crc == header.resourceCRC;
+}
@@ -93,8 +93,14 @@ Pheno::Pheno() {
             LOGGER.e(0, " duplicated IDs found in the phenotype data.");
         }
 
+        if(options.find("mpheno_all") != options.end() || options.find("pheno_list") != options.end()){
+            read_mpheno(pheno_subjects, phenos);
+        }
+
         int cur_pheno = 1;
-        if(options.find("mpheno") != options.end()){
+        if(mpheno_cols.size() != 0){
+            cur_pheno = mpheno_cols[0] + 1;
+        }else if(options.find("mpheno") != options.end()){
             try{
                 cur_pheno = std::stoi(options["mpheno"]);
             }catch(std::invalid_argument&){
@@ -145,6 +151,72 @@ Pheno::Pheno() {
 
 }
 
+// columns of the traits tested together, only the individuals with all the traits are kept
+void Pheno::read_mpheno(vector<string>& pheno_subjects, vector<vector<double>>& phenos){
+    if(options.find("pheno_list") != options.end()){
+        std::ifstream list(options["pheno_list"].c_str());
+        if(!list){
+            LOGGER.e(0, "can't read [" + options["pheno_list"] + "].");
+        }
+        string item;
+        while(list >> item){
+            int cur_pheno = 0;
+            try{
+                cur_pheno = std::stoi(item);
+            }catch(std::invalid_argument&){
+                LOGGER.e(0, "non-numberic value [" + item + "] in [" + options["pheno_list"] + "].");
+            }
+            if(cur_pheno <= 0 || cur_pheno > phenos.size()){
+                LOGGER.e(0, "the value " + item + " in [" + options["pheno_list"] + "] can't be less than 0 or larger than the total number of columns in .pheno file.");
+            }
+            mpheno_cols.push_back(cur_pheno - 1);
+        }
+        list.close();
+        removeDuplicateSort(mpheno_cols);
+    }else{
+        mpheno_cols.resize(phenos.size());
+        std::iota(mpheno_cols.begin(), mpheno_cols.end(), 0);
+    }
+    if(mpheno_cols.size() == 0){
+        LOGGER.e(0, "no phenotype to be tested.");
+    }
+
+    for(int i = 0; i < mpheno_cols.size(); i++){
+        update_pheno(pheno_subjects, phenos[mpheno_cols[i]]);
+    }
+    // keep the values of the remaining individuals only, index_keep is not changed in the 2nd pass
+    mpheno_index = index_keep;
+    std::sort(mpheno_index.begin(), mpheno_index.end());
+    mphenos.resize(mpheno_cols.size());
+    for(int i = 0; i < mpheno_cols.size(); i++){
+        update_pheno(pheno_subjects, phenos[mpheno_cols[i]]);
+        mphenos[i].resize(mpheno_index.size());
+        for(int j = 0; j < mpheno_index.size(); j++){
+            mphenos[i][j] = pheno[mpheno_index[j]];
+        }
+    }
+    LOGGER.i(0, to_string(mpheno_cols.size()) + " phenotypes to be tested, " + to_string(index_keep.size()) 
+            + " individuals have non-missing values for all of them.");
+}
+
+int Pheno::count_mpheno(){
+    return mpheno_cols.size();
+}
+
+string Pheno::get_mpheno_name(int index){
+    return "pheno" + to_string(mpheno_cols[index] + 1);
+}
+
+void Pheno::get_mpheno(int index, vector<double>& pheno){
+    pheno.clear();
+    pheno.reserve(index_keep.size());
+    // index_keep might be filtered or reordered after reading, mpheno_index is sorted
+    for(auto& cur_index : index_keep){
+        auto pos = std::lower_bound(mpheno_index.begin(), mpheno_index.end(), cur_index);
+        pheno.push_back(mphenos[index][pos - mpheno_index.begin()]);
+    }
+}
+
 void Pheno::filter_keep_index(vector<uint32_t>& k_index){
     if(k_index.size() == index_keep.size()){return;}
     vector<uint32_t> index_keep2(k_index.size(), 0);
@@ -969,6 +1041,30 @@ int Pheno::registerOption(map<string, vector<string>>& options_in){
         options_in.erase("--mpheno");
     }
 
+    if(options_in.find("--mpheno-all") != options_in.end()){
+        if(options.find("qpheno_file") == options.end()){
+            LOGGER.e(0, "--mpheno-all only works with --pheno");
+        }
+        options["mpheno_all"] = "yes";
+        options_in.erase("--mpheno-all");
+    }
+
+    if(options_in.find("--pheno-list") != options_in.end()){
+        if(options.find("qpheno_file") == options.end()){
+            LOGGER.e(0, "--pheno-list only works with --pheno");
+        }
+        if(options_in["--pheno-list"].size() != 1){
+            LOGGER.e(0, "--pheno-list takes one file listing the phenotype columns.");
+        }
+        options["pheno_list"] = options_in["--pheno-list"][0];
+        options_in.erase("--pheno-list");
+    }
+
+    if((options.find("mpheno_all") != options.end() || options.find("pheno_list") != options.end())
+            && options.find("mpheno") != options.end()){
+        LOGGER.e(0, "--mpheno can't be used together with --mpheno-all or --pheno-list.");
+    }
+
     if(options_in.find("--filter-sex") != options_in.end()){
         options["filter_sex"] = "yes";
     }
@@ -19,6 +19,14 @@
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 int parseLine(char* line){
     // This assumes that a digit will be found and the line ends in " Kb".
@@ -91,8 +99,66 @@ int getVMPeakKB(){
     return result;
 }
 
+#ifdef _WIN32
+void *map_file_read(const char *file_name, uint64_t &num_byte){
+    num_byte = 0;
+    HANDLE file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE) return NULL;
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file, &size) || size.QuadPart == 0){
+        CloseHandle(file);
+        return NULL;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if(mapping == NULL) return NULL;
+    void *addr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    // the view keeps its own reference to the mapping
+    CloseHandle(mapping);
+    if(addr) num_byte = size.QuadPart;
+    return addr;
+}
 
+void unmap_file(void *addr, uint64_t num_byte){
+    if(addr) UnmapViewOfFile(addr);
+}
 
+void advise_sequential(const void *addr, uint64_t num_byte){
+}
 
+int replace_file(const char *from, const char *to){
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+}
+#else
+void *map_file_read(const char *file_name, uint64_t &num_byte){
+    num_byte = 0;
+    int fd = open(file_name, O_RDONLY);
+    if(fd == -1) return NULL;
+    struct stat st;
+    if(fstat(fd, &st) == -1 || st.st_size == 0){
+        close(fd);
+        return NULL;
+    }
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping keeps its own reference to the file
+    close(fd);
+    if(addr == MAP_FAILED) return NULL;
+    num_byte = st.st_size;
+    return addr;
+}
 
+void unmap_file(void *addr, uint64_t num_byte){
+    if(addr) munmap(addr, num_byte);
+}
 
+void advise_sequential(const void *addr, uint64_t num_byte){
+    static const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)addr / page_size * page_size;
+    uintptr_t end = (uintptr_t)addr + num_byte;
+    madvise((void *)start, end - start, MADV_SEQUENTIAL);
+    madvise((void *)start, end - start, MADV_WILLNEED);
+}
+int replace_file(const char *from, const char *to){
+    return rename(from, to);
+}
+#endif
@@ -22,6 +22,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <chrono>
+#include <cmath>
+#include <cstring>
 
 #if defined(__unix__) || defined(__APPLE__)
 #include <unistd.h>
@@ -129,3 +131,88 @@ uint64_t getFileByteSize(FILE * file) {
 }
 
 
+
+char *formatUInt(uint64_t value, char *buf){
+    char temp[20];
+    int n = 0;
+    do{
+        temp[n++] = '0' + value % 10;
+        value /= 10;
+    }while(value);
+    while(n) *buf++ = temp[--n];
+    return buf;
+}
+
+// exact powers of 10 in double
+static const double pow10Table[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static inline double scalePow10(double value, int k){
+    return k >= 0 ? value * pow10Table[k] : value / pow10Table[-k];
+}
+
+char *formatDouble(double value, char *buf){
+    double a = std::fabs(value);
+    // 10^22 is the largest exact power, so |5 - e| <= 22 including the adjustments of e below
+    if(!std::isfinite(value) || a == 0.0 || a < 1e-16 || a >= 1e27){
+        return buf + snprintf(buf, 32, "%g", value);
+    }
+    // 6 significant digits of a * 10^(5 - e), one correctly rounded multiply or divide by an exact power
+    int e = (int)std::floor(std::log10(a));
+    double scaled = scalePow10(a, 5 - e);
+    if(scaled < 100000.0){
+        e--;
+        scaled = scalePow10(a, 5 - e);
+    }
+    // the rounding error of scaled is far below 1e-9, leave the near ties to printf
+    if(std::fabs(scaled - std::floor(scaled) - 0.5) < 1e-9 || std::fabs(scaled - 100000.0) < 1e-9){
+        return buf + snprintf(buf, 32, "%g", value);
+    }
+    if(std::nearbyint(scaled) >= 1000000.0){
+        e++;
+        scaled = scalePow10(a, 5 - e);
+    }
+    uint32_t digits = (uint32_t)std::nearbyint(scaled);
+    char d[6];
+    for(int i = 5; i >= 0; i--){
+        d[i] = '0' + digits % 10;
+        digits /= 10;
+    }
+    int num_digit = 6;
+    char *p = buf;
+    if(value < 0) *p++ = '-';
+    if(e < -4 || e >= 6){
+        while(num_digit > 1 && d[num_digit - 1] == '0') num_digit--;
+        *p++ = d[0];
+        if(num_digit > 1){
+            *p++ = '.';
+            memcpy(p, d + 1, num_digit - 1);
+            p += num_digit - 1;
+        }
+        *p++ = 'e';
+        *p++ = e < 0 ? '-' : '+';
+        int ae = e < 0 ? -e : e;
+        if(ae < 10) *p++ = '0';
+        p = formatUInt(ae, p);
+    }else{
+        // digits after the decimal point
+        int num_int = e + 1;
+        while(num_digit > num_int && num_digit > 0 && d[num_digit - 1] == '0') num_digit--;
+        if(num_int <= 0){
+            *p++ = '0';
+            *p++ = '.';
+            for(int i = 0; i < -num_int; i++) *p++ = '0';
+            memcpy(p, d, num_digit);
+            p += num_digit;
+        }else{
+            memcpy(p, d, num_int);
+            p += num_int;
+            if(num_digit > num_int){
+                *p++ = '.';
+                memcpy(p, d + num_int, num_digit - num_int);
+                p += num_digit - num_int;
+            }
+        }
+    }
+    return p;
+}
@@ -0,0 +1,140 @@
+#include "gtest/gtest.h"
+#include "Logger.h"
+#include "test_config.h"
+#include "LD.h"
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+// 150 markers: two full blocks and a partial one; each row holds the marker itself and up to
+// 20 markers after it, with a NaN in every 17th value
+static vector<vector<float>> ld_rows(uint32_t num_marker){
+    std::mt19937 rng(2024);
+    std::uniform_real_distribution<float> unif(-1.0, 1.0);
+    vector<vector<float>> rows(num_marker);
+    uint64_t k = 0;
+    for(uint32_t i = 0; i < num_marker; i++){
+        uint32_t size = std::min(num_marker - i, (uint32_t)21);
+        rows[i].push_back(1.0);
+        for(uint32_t j = 1; j < size; j++){
+            rows[i].push_back(++k % 17 == 0 ? nanf("") : unif(rng));
+        }
+    }
+    return rows;
+}
+
+static vector<string> ld_markers(uint32_t num_marker){
+    vector<string> info;
+    for(uint32_t i = 0; i < num_marker; i++){
+        info.push_back("1\trs" + std::to_string(i) + "\t" + std::to_string(1000 + i * 10) + "\tA\tG");
+    }
+    return info;
+}
+
+static void write_ld(const string &file, const vector<vector<float>> &rows, double error_bound){
+    LDWriter writer(file, ld_markers(rows.size()), false, 1000000, error_bound);
+    for(auto &row : rows){
+        writer.writeRow(row.data(), row.size());
+    }
+    writer.finish();
+}
+
+// flip one byte of a copy of the file
+static void corrupt_copy(const string &from, const string &to, uint64_t pos){
+    std::ifstream in(from, std::ios::binary);
+    string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    bytes[pos] ^= 0x5a;
+    std::ofstream out(to, std::ios::binary);
+    out.write(bytes.data(), bytes.size());
+}
+
+TEST(test_ld, round_trip_lossless){
+    LOGGER.open(CUR_OUT_DIR + "/test_ld.log");
+    string file = CUR_OUT_DIR + "/test_ld_lossless.zld";
+    auto rows = ld_rows(150);
+    write_ld(file, rows, 0);
+
+    LDReader reader(file);
+    ASSERT_EQ(reader.count(), 150);
+    EXPECT_TRUE(reader.verify());
+    EXPECT_EQ(reader.findMarker("rs77"), 77);
+    EXPECT_EQ(reader.getMarkerName(149), "rs149");
+    vector<float> values;
+    // out of order to cross the blocks both ways
+    for(uint32_t i : {149u, 0u, 64u, 63u, 128u, 100u}){
+        ASSERT_EQ(reader.getRow(i, values), rows[i].size());
+        for(uint32_t j = 0; j < values.size(); j++){
+            if(std::isnan(rows[i][j])) EXPECT_TRUE(std::isnan(values[j]));
+            else EXPECT_EQ(values[j], rows[i][j]);
+        }
+    }
+}
+
+TEST(test_ld, round_trip_error_bound){
+    string file = CUR_OUT_DIR + "/test_ld_bound.zld";
+    const double error_bound = 1e-3;
+    auto rows = ld_rows(150);
+    write_ld(file, rows, error_bound);
+
+    LDReader reader(file);
+    EXPECT_TRUE(reader.verify());
+    vector<float> values;
+    double max_error = 0;
+    for(uint32_t i = 0; i < reader.count(); i++){
+        ASSERT_EQ(reader.getRow(i, values), rows[i].size());
+        for(uint32_t j = 0; j < values.size(); j++){
+            if(std::isnan(rows[i][j])){
+                EXPECT_TRUE(std::isnan(values[j]));
+            }else{
+                max_error = std::max(max_error, std::fabs((double)values[j] - rows[i][j]));
+            }
+        }
+    }
+    // the bound plus the float rounding of the restored value
+    EXPECT_LE(max_error, error_bound + 1e-6);
+    EXPECT_GT(max_error, error_bound / 2);
+}
+
+TEST(test_ld, crc){
+    string file = CUR_OUT_DIR + "/test_ld_crc.zld";
+    write_ld(file, ld_rows(150), 1e-3);
+
+    LDHeader header;
+    vector<LDInfoStart> blocks(3);
+    {
+        std::ifstream in(file, std::ios::binary);
+        in.read((char *)&header, sizeof(header));
+        in.seekg(header.LDInfoStart);
+        in.read((char *)blocks.data(), blocks.size() * sizeof(LDInfoStart));
+    }
+    ASSERT_EQ(header.numBlock, 3);
+
+    // a corrupted block index entry: caught by verify()
+    string bad_index = CUR_OUT_DIR + "/test_ld_bad_index.zld";
+    corrupt_copy(file, bad_index, header.LDInfoStart + sizeof(LDInfoStart) + offsetof(LDInfoStart, blockCRC));
+    {
+        LDReader reader(bad_index);
+        EXPECT_FALSE(reader.verify());
+    }
+
+    // a corrupted byte in the second block: verify() fails, and so does the block CRC on reading
+    string bad_block = CUR_OUT_DIR + "/test_ld_bad_block.zld";
+    corrupt_copy(file, bad_block, blocks[1].startByte + blocks[1].compressSize / 2);
+    {
+        LDReader reader(bad_block);
+        EXPECT_FALSE(reader.verify());
+        vector<float> values;
+        EXPECT_EQ(reader.getRow(0, values), 21);
+        EXPECT_EXIT(reader.getRow(64, values), ::testing::ExitedWithCode(EXIT_FAILURE), "");
+    }
+
+    // a corrupted header
+    string bad_header = CUR_OUT_DIR + "/test_ld_bad_header.zld";
+    corrupt_copy(file, bad_header, offsetof(LDHeader, errorBound));
+    EXPECT_EXIT(LDReader reader(bad_header), ::testing::ExitedWithCode(EXIT_FAILURE), "");
+}
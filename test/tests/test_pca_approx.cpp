@@ -0,0 +1,107 @@
+#include "gtest/gtest.h"
+#include "Logger.h"
+#include "test_config.h"
+#include "gcta.h"
+#include "Pheno.h"
+#include "Marker.h"
+#include "Geno.h"
+#include "GRM.h"
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+using std::map;
+using std::string;
+using std::vector;
+
+// --pca-approx against the eigendecomposition of the full GRM (--pca) on the 600 individuals of
+// data/reml_fixture.keep and the 1000 SNPs of data/test.bed. --pca-approx takes Z Z' / m with the
+// missing genotypes at the mean, while --make-grm has the 1 + F diagonal and divides each pair by
+// its own SNP count, which moves the leading eigenvalues of this fixture by up to 3%.
+// For each of the leading PCs:
+//   eigenvalue: 5% relative
+//   eigenvector: |cos| with the --pca eigenvector >= 0.99
+static const int num_pc = 2;
+static const double tol_eval = 0.05, min_cos = 0.99;
+
+static vector<double> read_eigenval(const string &file){
+    vector<double> eval;
+    std::ifstream in(file);
+    double value;
+    while(in >> value) eval.push_back(value);
+    return eval;
+}
+
+// the columns of the .eigenvec file, without the FID and IID
+static vector<vector<double>> read_eigenvec(const string &file){
+    vector<vector<double>> evec;
+    std::ifstream in(file);
+    string line;
+    while(std::getline(in, line)){
+        std::istringstream ss(line);
+        string fid, iid;
+        if(!(ss >> fid >> iid)) continue;
+        double value;
+        for(int j = 0; ss >> value; j++){
+            if(evec.size() <= j) evec.resize(j + 1);
+            evec[j].push_back(value);
+        }
+    }
+    return evec;
+}
+
+TEST(test_pca_approx, agrees_with_pca){
+    LOGGER.open(CUR_OUT_DIR + "/test_pca_approx.log");
+    string bfile = CUR_SRC_DIR + "/data/test";
+    string keep_file = CUR_SRC_DIR + "/data/reml_fixture.keep";
+    string out_pca = CUR_OUT_DIR + "/pca_fixture";
+    string out_approx = CUR_OUT_DIR + "/pca_fixture_approx";
+    {
+        gcta data(22, -1.0, out_pca);
+        data.read_famfile(bfile + ".fam");
+        data.keep_indi(keep_file);
+        data.read_bimfile(bfile + ".bim");
+        data.read_bedfile(bfile + ".bed");
+        data.make_grm(false, false, false, true, 0, false);
+    }
+    {
+        gcta pca(22, -1.0, out_pca);
+        pca.enable_grm_bin_flag();
+        pca.pca(out_pca, "", "", -2.0, false, num_pc);
+    }
+
+    map<string, vector<string>> options;
+    options["--bfile"] = {bfile};
+    options["--keep"] = {keep_file};
+    options["--pca-approx"] = {std::to_string(num_pc)};
+    options["--seed"] = {"2024"};
+    options["--out"] = {out_approx};
+    options["out"] = {out_approx};
+    Pheno::registerOption(options);
+    Marker::registerOption(options);
+    Geno::registerOption(options);
+    ASSERT_EQ(GRM::registerOption(options), 1);
+    GRM::processMain();
+
+    auto eval = read_eigenval(out_pca + ".eigenval");
+    auto eval_approx = read_eigenval(out_approx + ".eigenval");
+    auto evec = read_eigenvec(out_pca + ".eigenvec");
+    auto evec_approx = read_eigenvec(out_approx + ".eigenvec");
+    ASSERT_GE(eval.size(), num_pc);
+    ASSERT_EQ(eval_approx.size(), num_pc);
+    ASSERT_EQ(evec.size(), num_pc);
+    ASSERT_EQ(evec_approx.size(), num_pc);
+    for(int j = 0; j < num_pc; j++){
+        EXPECT_NEAR(eval_approx[j], eval[j], tol_eval * eval[j]) << "PC" << j + 1;
+        ASSERT_EQ(evec_approx[j].size(), evec[j].size());
+        double dot = 0, norm = 0, norm_approx = 0;
+        for(int i = 0; i < evec[j].size(); i++){
+            dot += evec[j][i] * evec_approx[j][i];
+            norm += evec[j][i] * evec[j][i];
+            norm_approx += evec_approx[j][i] * evec_approx[j][i];
+        }
+        EXPECT_GE(std::fabs(dot) / std::sqrt(norm * norm_approx), min_cos) << "PC" << j + 1;
+    }
+}
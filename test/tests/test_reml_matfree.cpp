@@ -0,0 +1,136 @@
+#include "gtest/gtest.h"
+#include "Logger.h"
+#include "test_config.h"
+#include "gcta.h"
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+using std::map;
+using std::string;
+using std::vector;
+
+// Fixture: the GRM of the 600 individuals in data/reml_fixture.keep from the 1000 SNPs of
+// data/test.bed, and data/reml_fixture.phen simulated from 200 of these SNPs with h2 = 0.5
+// (an unrelated phenotype would leave V(G) on the boundary). Each engine has to agree with the
+// dense --reml on the same GRM to within its tolerances:
+//   --reml-matfree, 100 probes: variance components and Vp 2% of Vp, V(G)/Vp 0.02, SEs 10% relative, logL 0.5
+//   --reml-spectral: exact, 1e-4 of Vp, 1e-4, 0.1% relative, 1e-3
+//   --reml-wfam (sparse): on a copy of the GRM with the off-diagonals below 0.05 set to 0, exact as above
+struct RemlEngineCase {
+    const char *name;
+    bool thresholded;   // the GRM with the small off-diagonals set to 0
+    int num_probes;     // --reml-matfree
+    bool spectral;      // --reml-spectral
+    bool within_family; // --reml-wfam
+    double tol_var, tol_hsq, tol_se, tol_logL;
+};
+
+static const RemlEngineCase reml_engine_cases[] = {
+    {"matfree", false, 100, false, false, 0.02, 0.02, 0.1, 0.5},
+    {"spectral", false, 0, true, false, 1e-4, 1e-4, 1e-3, 1e-3},
+    {"wfam", true, 0, false, true, 1e-4, 1e-4, 1e-3, 1e-3},
+};
+
+// "Source Variance SE" lines of a .hsq file, the SE of logL is set to 0
+static map<string, vector<double>> read_hsq(const string &file){
+    map<string, vector<double>> hsq;
+    std::ifstream in(file);
+    string line;
+    while(std::getline(in, line)){
+        std::istringstream ss(line);
+        string name;
+        double value = 0, se = 0;
+        if(!(ss >> name >> value)) continue;
+        ss >> se;
+        hsq[name] = {value, se};
+    }
+    return hsq;
+}
+
+static void copy_file(const string &from, const string &to){
+    std::ifstream in(from, std::ios::binary);
+    std::ofstream out(to, std::ios::binary);
+    out << in.rdbuf();
+}
+
+static void fit(const string &grm, const string &out, const RemlEngineCase *engine){
+    gcta reml(22, -1.0, out);
+    reml.enable_grm_bin_flag();
+    reml.set_cv_blup(false);
+    bool within_family = false;
+    if(engine){
+        if(engine->num_probes > 0) reml.set_reml_matfree(engine->num_probes);
+        if(engine->spectral) reml.set_reml_spectral();
+        within_family = engine->within_family;
+    }
+    reml.fit_reml(grm, CUR_SRC_DIR + "/data/reml_fixture.phen", "", "", "", "", CUR_SRC_DIR + "/data/reml_fixture.keep",
+            "", "", 1, -2.0, -2.0, -2, false, false, false, 0, 100, vector<double>(), vector<double>(),
+            vector<int>(), true, -2.0, false, false, within_family);
+}
+
+class test_reml_engine : public ::testing::TestWithParam<RemlEngineCase> {
+protected:
+    static string grm, grm_thresh;
+
+    // the GRMs and the dense fits on them, shared by all the engines
+    static void SetUpTestSuite(){
+        LOGGER.open(CUR_OUT_DIR + "/test_reml_engine.log");
+        grm = CUR_OUT_DIR + "/reml_fixture";
+        grm_thresh = CUR_OUT_DIR + "/reml_fixture_thresh";
+        {
+            gcta data(22, -1.0, grm);
+            data.read_famfile(CUR_SRC_DIR + "/data/test.fam");
+            data.keep_indi(CUR_SRC_DIR + "/data/reml_fixture.keep");
+            data.read_bimfile(CUR_SRC_DIR + "/data/test.bim");
+            data.read_bedfile(CUR_SRC_DIR + "/data/test.bed");
+            data.make_grm(false, false, false, true, 0, false);
+        }
+
+        std::ifstream in(grm + ".grm.bin", std::ios::binary | std::ios::ate);
+        vector<float> values(in.tellg() / sizeof(float));
+        in.seekg(0);
+        in.read((char *)values.data(), values.size() * sizeof(float));
+        uint64_t k = 0;
+        for(uint64_t i = 0; k < values.size(); i++){
+            for(uint64_t j = 0; j <= i; j++, k++){
+                if(j != i && std::fabs(values[k]) < 0.05) values[k] = 0;
+            }
+        }
+        std::ofstream out(grm_thresh + ".grm.bin", std::ios::binary);
+        out.write((const char *)values.data(), values.size() * sizeof(float));
+        out.close();
+        copy_file(grm + ".grm.id", grm_thresh + ".grm.id");
+        copy_file(grm + ".grm.N.bin", grm_thresh + ".grm.N.bin");
+
+        fit(grm, grm + "_dense", NULL);
+        fit(grm_thresh, grm_thresh + "_dense", NULL);
+    }
+};
+
+string test_reml_engine::grm, test_reml_engine::grm_thresh;
+
+TEST_P(test_reml_engine, agrees_with_reml){
+    const RemlEngineCase &engine = GetParam();
+    string cur_grm = engine.thresholded ? grm_thresh : grm;
+    fit(cur_grm, cur_grm + "_" + engine.name, &engine);
+
+    auto dense = read_hsq(cur_grm + "_dense.hsq");
+    auto result = read_hsq(cur_grm + "_" + engine.name + ".hsq");
+    for(string name : {"V(G)", "V(e)", "Vp", "V(G)/Vp", "logL"}){
+        ASSERT_TRUE(dense.count(name) && result.count(name)) << name;
+    }
+    double Vp = dense["Vp"][0];
+    for(string name : {"V(G)", "V(e)", "Vp"}){
+        EXPECT_NEAR(result[name][0], dense[name][0], engine.tol_var * Vp) << name;
+        EXPECT_NEAR(result[name][1], dense[name][1], engine.tol_se * dense[name][1]) << "SE of " << name;
+    }
+    EXPECT_NEAR(result["V(G)/Vp"][0], dense["V(G)/Vp"][0], engine.tol_hsq);
+    EXPECT_NEAR(result["V(G)/Vp"][1], dense["V(G)/Vp"][1], engine.tol_se * dense["V(G)/Vp"][1]);
+    EXPECT_NEAR(result["logL"][0], dense["logL"][0], engine.tol_logL);
+}
+
+INSTANTIATE_TEST_SUITE_P(engines, test_reml_engine, ::testing::ValuesIn(reml_engine_cases),
+        [](const ::testing::TestParamInfo<RemlEngineCase> &info){ return string(info.param.name); });